@@ -4,35 +4,40 @@
 ALU::ALU() : zero_flag(false) 
 {}
 
+typedef int32_t (*Operation)(int32_t operand1, int32_t operand2);
+
+static int32_t op_and(int32_t a, int32_t b) { return a & b; }
+static int32_t op_or(int32_t a, int32_t b) { return a | b; }
+static int32_t op_add(int32_t a, int32_t b) { return a + b; }
+static int32_t op_sltu(int32_t a, int32_t b) { return ((uint32_t)a < (uint32_t)b) ? 1 : 0; }
+static int32_t op_sub(int32_t a, int32_t b) { return a - b; }
+static int32_t op_sra(int32_t a, int32_t b) { return a >> (b & 0x1F); }
+static int32_t op_invalid(int32_t, int32_t) {
+    assert(false); // Should not happen
+    return 0;
+}
+
+// 4-bit ALU operation -> function
+static const Operation OPERATIONS[16] = {
+    op_and,     // 0000 AND
+    op_or,      // 0001 OR
+    op_add,     // 0010 ADD
+    op_sltu,    // 0011 SLTU
+    op_invalid, op_invalid,
+    op_sub,     // 0110 SUB
+    op_sra,     // 0111 SRA
+    op_invalid, op_invalid, op_invalid, op_invalid,
+    op_invalid, op_invalid, op_invalid, op_invalid
+};
+
 /**
-Performs an ALU operation based on the control signal.
+Performs an ALU operation based on the control signal, through the
+operation table instead of a switch.
 It also sets the internal zero flag, which is used by branch instructions.
 */
 int32_t ALU::execute(uint8_t alu_operation, int32_t operand1, int32_t operand2) {
-    int32_t result = 0;
-    switch (alu_operation) {
-        case 0b0000: 
-            result = operand1 & operand2; 
-            break;  // AND
-        case 0b0001: 
-            result = operand1 | operand2; 
-            break;  // OR
-        case 0b0010: 
-            result = operand1 + operand2; 
-            break;  // ADD
-        case 0b0011: 
-            result = ((uint32_t)operand1 < (uint32_t)operand2) ? 1 : 0; 
-            break; // SLTU
-        case 0b0110: 
-            result = operand1 - operand2; 
-            break;  // SUB
-        case 0b0111: 
-            result = operand1 >> (operand2 & 0x1F); 
-            break; // SRA
-        default: 
-            assert(false); // Should not happen
-    }
-    
+    int32_t result = OPERATIONS[alu_operation & 0xF](operand1, operand2);
+
     // The zero flag for BNE is based on subtraction, not the main result.
     zero_flag = ((operand1 - operand2) == 0);
 
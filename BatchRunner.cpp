@@ -0,0 +1,223 @@
+#include "BatchRunner.h"
+#include "Program.h"
+#include "CoSimulator.h"
+#include "ResultCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+BatchRunner::BatchRunner(const EngineOptions &options, unsigned jobs)
+    : options(options), workerCount(jobs), cosimInterval(0), cache(NULL), paths(NULL)
+{
+    if (workerCount == 0)
+        workerCount = std::max(1u, std::thread::hardware_concurrency());
+}
+
+unsigned BatchRunner::jobs() const {
+    return workerCount;
+}
+
+void BatchRunner::setCoSimulation(uint64_t interval) {
+    cosimInterval = interval;
+}
+
+void BatchRunner::setResultCache(const ResultCache *resultCache) {
+    cache = resultCache;
+}
+
+// Next task for a worker: front of its own queue, else the back of another's
+bool BatchRunner::take(unsigned worker, size_t &task) {
+    {
+        WorkQueue &own = queues[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    for (unsigned i = 1; i < workerCount; i++) {
+        WorkQueue &victim = queues[(worker + i) % workerCount];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void BatchRunner::work(unsigned worker) {
+    // per-worker state, reused for every program this worker runs
+    std::unique_ptr<Program> program(new Program());
+    std::unique_ptr<CPU> cpu;
+
+    size_t task;
+    while (take(worker, task)) {
+        Result r;
+        r.done = true;
+        r.halted = false;
+        r.diverged = false;
+        r.cached = false;
+        r.divergedAt = 0;
+        r.divergedPC = 0;
+        r.a0 = r.a1 = 0;
+        r.instructions = 0;
+        r.seconds = 0;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        r.loaded = load_program((*paths)[task], *program, FORMAT_AUTO, r.error);
+        if (r.loaded && cosimInterval != 0) {
+            CoSimulator checker(*program, options, cosimInterval);
+            r.diverged = !checker.run();
+            r.halted = checker.halted();
+            r.instructions = checker.instructions();
+            r.divergedAt = checker.instructions();
+            r.divergedPC = checker.divergencePC();
+            r.a0 = checker.reference().getA0();
+            r.a1 = checker.reference().getA1();
+        } else if (r.loaded) {
+            if (!cpu)
+                cpu.reset(new CPU(program->instMem));
+            reset_cpu(*cpu, *program);
+            cpu->setMemoryLimit(options.memoryLimit);
+            ResultKey key;
+            CachedRun hit;
+            if (cache != NULL) {
+                key = ResultCache::key(*cpu, program->pcLimit(), options);
+                r.cached = cache->lookup(key, hit);
+            }
+            if (r.cached) {
+                r.halted = hit.halted;
+                r.instructions = hit.instructions;
+                r.a0 = hit.a0;
+                r.a1 = hit.a1;
+            } else {
+                RunResult run = run_program(*cpu, program->pcLimit(), options);
+                r.halted = run.halted;
+                r.instructions = run.instructions;
+                r.a0 = cpu->getA0();
+                r.a1 = cpu->getA1();
+                if (cache != NULL) {
+                    CachedRun done = { r.a0, r.a1, r.halted, r.instructions, ResultCache::digest(*cpu) };
+                    cache->store(key, done);
+                }
+            }
+        }
+        r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> guard(doneLock);
+        results[task] = r;
+        doneSignal.notify_one();
+    }
+}
+
+size_t BatchRunner::run(const std::vector<std::string> &inputs, std::ostream &out) {
+    paths = &inputs;
+    results.assign(inputs.size(), Result());
+    for (size_t i = 0; i < results.size(); i++)
+        results[i].done = false;
+
+    if (inputs.empty())
+        return 0;
+
+    // deal contiguous chunks so neighbouring programs share a worker
+    queues = std::vector<WorkQueue>(workerCount);
+    for (size_t i = 0; i < inputs.size(); i++)
+        queues[i * workerCount / inputs.size()].tasks.push_back(i);
+
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < workerCount; w++)
+        workers.push_back(std::thread(&BatchRunner::work, this, w));
+
+    // write results in input order while the workers run
+    size_t failures = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        Result r;
+        {
+            std::unique_lock<std::mutex> guard(doneLock);
+            while (!results[i].done)
+                doneSignal.wait(guard);
+            r = results[i];
+        }
+        out << inputs[i];
+        if (!r.loaded) {
+            out << " error: " << r.error << "\n";
+            failures++;
+            continue;
+        }
+        out << " (" << r.a0 << "," << r.a1 << ")"
+            << " instructions=" << r.instructions
+            << " wall_us=" << (uint64_t)(r.seconds * 1e6);
+        if (cache != NULL && cosimInterval == 0)
+            out << (r.cached ? " cache=hit" : " cache=miss");
+        if (r.diverged) {
+            out << " status=diverged at=" << r.divergedAt << " pc=0x" << std::hex << r.divergedPC << std::dec;
+            failures++;
+        } else if (!r.halted) {
+            out << " status=limit";
+        }
+        out << "\n";
+    }
+    out.flush();
+
+    for (size_t w = 0; w < workers.size(); w++)
+        workers[w].join();
+    paths = NULL;
+    return failures;
+}
+
+static std::string directory_of(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return (slash == std::string::npos) ? std::string() : path.substr(0, slash + 1);
+}
+
+bool collect_batch_inputs(const std::string &source, std::vector<std::string> &paths) {
+    struct stat info;
+    if (stat(source.c_str(), &info) != 0)
+        return false;
+
+    if (S_ISDIR(info.st_mode)) {
+        DIR *dir = opendir(source.c_str());
+        if (dir == NULL)
+            return false;
+        std::string prefix = source;
+        if (prefix.empty() || prefix[prefix.size() - 1] != '/')
+            prefix += '/';
+        std::vector<std::string> found;
+        while (struct dirent *entry = readdir(dir)) {
+            std::string path = prefix + entry->d_name;
+            struct stat entryInfo;
+            if (stat(path.c_str(), &entryInfo) == 0 && S_ISREG(entryInfo.st_mode))
+                found.push_back(path);
+        }
+        closedir(dir);
+        std::sort(found.begin(), found.end());
+        paths.insert(paths.end(), found.begin(), found.end());
+        return true;
+    }
+
+    std::ifstream manifest(source.c_str());
+    if (!manifest.is_open())
+        return false;
+    std::string base = directory_of(source);
+    std::string line;
+    while (std::getline(manifest, line)) {
+        // trim surrounding whitespace
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+        size_t last = line.find_last_not_of(" \t\r");
+        std::string path = line.substr(first, last - first + 1);
+        paths.push_back(path[0] == '/' ? path : base + path);
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include <cstdint>
+#include <deque>
+#include <iosfwd>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+#include "Engine.h"
+
+class ResultCache;
+
+// Runs many programs across a pool of worker threads.
+// Every worker owns one CPU that is reset for each program it runs. Tasks
+// are dealt out to per-worker queues up front; a worker that drains its own
+// queue steals from the back of the others. Results are written in input
+// order as soon as each next one is available.
+class BatchRunner {
+public:
+    // jobs == 0 uses every hardware thread
+    BatchRunner(const EngineOptions &options, unsigned jobs);
+
+    // Runs every program in paths and writes one line per program to out.
+    // Returns the number of programs that could not be loaded (or diverged).
+    size_t run(const std::vector<std::string> &paths, std::ostream &out);
+
+    unsigned jobs() const;
+
+    // Checks every program against the stage engine with a CoSimulator
+    // comparing every interval instructions (0 = off, the default); a
+    // divergence counts as a failure
+    void setCoSimulation(uint64_t interval);
+    // Answers programs from cache when it has their result and stores the
+    // results of the others (NULL = off, the default; not with co-simulation)
+    void setResultCache(const ResultCache *cache);
+
+private:
+    struct Result {
+        bool done;
+        bool loaded;
+        bool halted;
+        bool diverged;
+        bool cached;
+        uint64_t divergedAt;    // instruction index
+        unsigned long divergedPC;
+        int32_t a0, a1;
+        uint64_t instructions;
+        double seconds;
+        std::string error;      // why the program could not be loaded
+    };
+
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    EngineOptions options;
+    unsigned workerCount;
+    uint64_t cosimInterval;
+    const ResultCache *cache;
+
+    const std::vector<std::string> *paths;
+    std::vector<Result> results;
+    std::vector<WorkQueue> queues;
+
+    // guards Result::done and wakes the writer
+    std::mutex doneLock;
+    std::condition_variable doneSignal;
+
+    bool take(unsigned worker, size_t &task);
+    void work(unsigned worker);
+};
+
+// Expands a batch source into program paths: a directory yields its regular
+// files in name order, anything else is read as a manifest with one path
+// per line (relative paths are taken relative to the manifest's directory;
+// blank lines and lines starting with '#' are skipped).
+bool collect_batch_inputs(const std::string &source, std::vector<std::string> &paths);
+
+#endif // BATCH_RUNNER_H
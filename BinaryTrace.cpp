@@ -0,0 +1,257 @@
+#include "BinaryTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+static const char MAGIC[7] = { 'R', 'V', 'T', 'R', 'A', 'C', 'E' };
+static const uint8_t VERSION = 1;
+
+// Header, block framing and records are all in host byte order
+struct TraceHeader {
+    char magic[7];
+    uint8_t version;
+    uint32_t flags;
+    uint32_t recordSize;
+};
+
+// std::min binds it to a reference
+const size_t TraceWriter::BLOCK_RECORDS;
+
+static_assert(sizeof(TraceRecord) == 24, "trace records are 24 bytes on disk");
+static_assert(sizeof(TraceRecord) % 8 == 0, "packing works on 8-byte groups");
+
+// Zero-byte elision: a mask byte per 8 input bytes, then the non-zero ones
+static void pack(const uint8_t *in, size_t size, std::vector<uint8_t> &out) {
+    out.resize(size + size / 8);
+    uint8_t *o = &out[0];
+    for (size_t group = 0; group < size; group += 8) {
+        uint64_t bytes;
+        memcpy(&bytes, in + group, 8);
+        uint8_t *mask = o++;
+        *mask = 0;
+        if (bytes == 0)
+            continue;
+        for (unsigned i = 0; i < 8; i++) {
+            uint8_t byte = (uint8_t)(bytes >> (8 * i));
+            *o = byte;
+            // always store, advance only past non-zero bytes
+            o += byte != 0;
+            *mask |= (byte != 0) << i;
+        }
+    }
+    out.resize(o - &out[0]);
+}
+
+static bool unpack(const uint8_t *in, size_t size, uint8_t *out, size_t outSize) {
+    size_t at = 0;
+    for (size_t group = 0; group < outSize; group += 8) {
+        if (at >= size)
+            return false;
+        uint8_t mask = in[at++];
+        for (unsigned i = 0; i < 8; i++) {
+            if (mask & (1 << i)) {
+                if (at >= size)
+                    return false;
+                out[group + i] = in[at++];
+            } else {
+                out[group + i] = 0;
+            }
+        }
+    }
+    return at == size;
+}
+
+// Constructor - not tracing until open()
+TraceWriter::TraceWriter()
+    : expectedPC(0), lastAddress(0), tailSeen(0), head(0), tail(0), closing(false),
+      file(NULL), packed(false), failed(false), written(0)
+{
+}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const char *path, bool packed, std::string &error) {
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        error = std::string("cannot create trace ") + path;
+        return false;
+    }
+    TraceHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.flags = packed ? TRACE_PACKED : 0;
+    header.recordSize = sizeof(TraceRecord);
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        file = NULL;
+        error = std::string("cannot write trace ") + path;
+        return false;
+    }
+    written = sizeof(header);
+
+    this->packed = packed;
+    ring.resize(RING_RECORDS);
+    expectedPC = 0;
+    lastAddress = 0;
+    tailSeen = 0;
+    head.store(0);
+    tail.store(0);
+    closing.store(false);
+    failed = false;
+    writer = std::thread(&TraceWriter::drain, this);
+    return true;
+}
+
+bool TraceWriter::close() {
+    if (file == NULL)
+        return !failed;
+    closing.store(true, std::memory_order_release);
+    writer.join();
+    if (fclose(file) != 0)
+        failed = true;
+    file = NULL;
+    return !failed;
+}
+
+uint64_t TraceWriter::records() const {
+    return head.load(std::memory_order_relaxed);
+}
+
+uint64_t TraceWriter::bytesWritten() const {
+    return written;
+}
+
+/**
+ * Writer thread: moves whatever the simulator has published into blocks.
+ * It polls rather than waits on a condition so the producer never has to
+ * take a lock; while the simulator runs there is almost always a full
+ * block ready.
+ */
+void TraceWriter::drain() {
+    std::vector<TraceRecord> block(BLOCK_RECORDS);
+    std::vector<uint8_t> buffer;
+    for (;;) {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+        if (h == t) {
+            // closing is set after the last push, so head is final once it is seen
+            if (closing.load(std::memory_order_acquire) && head.load(std::memory_order_acquire) == t)
+                break;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        size_t count = (size_t)std::min<uint64_t>(h - t, BLOCK_RECORDS);
+        for (size_t i = 0; i < count; i++)
+            block[i] = ring[(t + i) & (RING_RECORDS - 1)];
+        tail.store(t + count, std::memory_order_release);
+        write_block(&block[0], count, buffer);
+    }
+}
+
+void TraceWriter::write_block(const TraceRecord *records, size_t count, std::vector<uint8_t> &buffer) {
+    if (failed)
+        return;
+    const uint8_t *payload = (const uint8_t *)records;
+    uint32_t frame[2];
+    frame[0] = (uint32_t)count;
+    frame[1] = (uint32_t)(count * sizeof(TraceRecord));
+    if (packed) {
+        pack(payload, frame[1], buffer);
+        payload = &buffer[0];
+        frame[1] = (uint32_t)buffer.size();
+    }
+    if (fwrite(frame, sizeof(frame), 1, file) != 1 || fwrite(payload, 1, frame[1], file) != frame[1])
+        failed = true;
+    written += sizeof(frame) + frame[1];
+}
+
+// Constructor - no file yet
+TraceReader::TraceReader()
+    : file(NULL), flags(0), position(0), cycle(0), expectedPC(0), lastAddress(0)
+{
+}
+
+TraceReader::~TraceReader() {
+    if (file != NULL)
+        fclose(file);
+}
+
+bool TraceReader::open(const char *path, std::string &error) {
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        error = std::string("cannot open trace ") + path;
+        return false;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        error = std::string(path) + " is not a trace file";
+        return false;
+    }
+    if (header.version != VERSION || header.recordSize != sizeof(TraceRecord)) {
+        error = std::string(path) + ": unsupported trace version";
+        return false;
+    }
+    flags = header.flags;
+    return true;
+}
+
+const std::string &TraceReader::error() const {
+    return failure;
+}
+
+bool TraceReader::packed() const {
+    return (flags & TRACE_PACKED) != 0;
+}
+
+bool TraceReader::read_block() {
+    uint32_t frame[2];
+    size_t got = fread(frame, 1, sizeof(frame), file);
+    if (got == 0)
+        return false; // clean end
+    if (got != sizeof(frame) || frame[0] == 0 || frame[0] > (1u << 24)) {
+        failure = "damaged block header";
+        return false;
+    }
+    size_t size = (size_t)frame[0] * sizeof(TraceRecord);
+    block.resize(frame[0]);
+    uint8_t *records = (uint8_t *)&block[0];
+    if (packed()) {
+        buffer.resize(frame[1]);
+        if (fread(&buffer[0], 1, frame[1], file) != frame[1] ||
+            !unpack(&buffer[0], frame[1], records, size)) {
+            failure = "damaged packed block";
+            return false;
+        }
+    } else if (frame[1] != size || fread(records, 1, size, file) != size) {
+        failure = "truncated block";
+        return false;
+    }
+    position = 0;
+    return true;
+}
+
+bool TraceReader::next(TraceEntry &entry) {
+    if (file == NULL)
+        return false;
+    if (position == block.size() && !read_block())
+        return false;
+    const TraceRecord &r = block[position++];
+    entry.cycle = cycle++;
+    entry.pc = expectedPC + r.pcDelta;
+    expectedPC = entry.pc + 4;
+    entry.instruction = r.instruction;
+    entry.flags = r.flags;
+    entry.rd = r.rd;
+    entry.wbData = r.wbData;
+    entry.address = 0;
+    entry.memValue = r.memValue;
+    if (r.flags & (TRACE_MEM_READ | TRACE_MEM_WRITE)) {
+        lastAddress += r.addrDelta;
+        entry.address = lastAddress;
+    }
+    return true;
+}
@@ -0,0 +1,165 @@
+#ifndef BINARY_TRACE_H
+#define BINARY_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CPU.h"
+
+// Binary execution trace. A trace file is a header followed by blocks of
+// fixed-size records, one per executed instruction in order (the record
+// index is the cycle). PCs and memory addresses are stored as deltas, so
+// straight-line code and sequential data turn into zero bytes; packed
+// files then drop the zero bytes of every block.
+//
+//   header: "RVTRACE" version(1) flags(4) recordSize(4)
+//   block:  records(4) bytes(4) payload(bytes)
+//
+// Packed payloads hold one mask byte per 8 record bytes, bit i set if
+// byte i is non-zero, followed by the non-zero bytes.
+
+enum TraceRecordFlags {
+    TRACE_MEM_READ = 1,   // MemRead: addr/value are the load
+    TRACE_MEM_WRITE = 2,  // MemWrite: addr/value are the store
+    TRACE_REG_WRITE = 4   // rd != x0 was written with wbData
+};
+
+enum TraceFileFlags {
+    TRACE_PACKED = 1
+};
+
+struct TraceRecord {
+    uint32_t pcDelta;     // pc - (previous pc + 4)
+    uint32_t instruction;
+    uint32_t wbData;
+    uint32_t addrDelta;   // address - previous memory address
+    uint32_t memValue;
+    uint8_t rd;
+    uint8_t flags;
+    uint16_t unused;
+};
+
+// One decoded trace record
+struct TraceEntry {
+    uint64_t cycle;
+    uint32_t pc;
+    uint32_t instruction;
+    uint8_t flags;
+    uint8_t rd;
+    uint32_t wbData;
+    uint32_t address;
+    uint32_t memValue;
+};
+
+// Instrumentation policy (see Instrumentation.h) that streams a binary
+// trace to a file. retire() only fills a record into a single-producer,
+// single-consumer ring; a writer thread drains the ring, packs blocks and
+// writes them out. A full ring makes the simulator wait, so nothing is
+// ever dropped.
+class TraceWriter {
+public:
+    static const size_t RING_RECORDS = 1 << 16;
+    static const size_t BLOCK_RECORDS = 4096;
+
+    TraceWriter();
+    ~TraceWriter();
+
+    // Creates path and starts the writer thread
+    bool open(const char *path, bool packed, std::string &error);
+    // Drains the ring, stops the thread and closes the file; false if any
+    // write failed
+    bool close();
+
+    uint64_t records() const;
+    uint64_t bytesWritten() const;
+
+    void retire(const CPU &cpu, unsigned long pc, uint32_t instruction, uint64_t) {
+        const DecodedInstruction &d = *cpu.decoded;
+        TraceRecord r;
+        r.pcDelta = (uint32_t)pc - expectedPC;
+        expectedPC = (uint32_t)pc + 4;
+        r.instruction = instruction;
+        r.rd = 0;
+        r.wbData = 0;
+        r.flags = 0;
+        r.unused = 0;
+        if (d.control.RegWrite && d.rd_idx != 0) {
+            r.flags = TRACE_REG_WRITE;
+            r.rd = d.rd_idx;
+            r.wbData = (uint32_t)cpu.wb_data;
+        }
+        r.addrDelta = 0;
+        r.memValue = 0;
+        if (d.control.MemRead || d.control.MemWrite) {
+            r.flags |= d.control.MemRead ? TRACE_MEM_READ : TRACE_MEM_WRITE;
+            r.addrDelta = (uint32_t)cpu.alu_result - lastAddress;
+            lastAddress = (uint32_t)cpu.alu_result;
+            r.memValue = (uint32_t)(d.control.MemRead ? cpu.mem_read_data : cpu.rs2_val);
+        }
+        push(r);
+    }
+
+private:
+    // producer side, touched only by the simulating thread
+    uint32_t expectedPC;
+    uint32_t lastAddress;
+    uint64_t tailSeen;  // cached copy of tail
+
+    std::vector<TraceRecord> ring;
+    // ring indices grow forever; slot = index % RING_RECORDS
+    alignas(64) std::atomic<uint64_t> head; // next record to fill
+    alignas(64) std::atomic<uint64_t> tail; // next record to write out
+    std::atomic<bool> closing;
+
+    FILE *file;
+    bool packed;
+    bool failed;
+    uint64_t written;
+    std::thread writer;
+
+    void push(const TraceRecord &r) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        while (h - tailSeen == RING_RECORDS) {
+            tailSeen = tail.load(std::memory_order_acquire);
+            if (h - tailSeen == RING_RECORDS)
+                std::this_thread::yield();
+        }
+        ring[h & (RING_RECORDS - 1)] = r;
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    void drain();
+    void write_block(const TraceRecord *records, size_t count, std::vector<uint8_t> &buffer);
+};
+
+// Reads a trace file back into absolute values
+class TraceReader {
+public:
+    TraceReader();
+    ~TraceReader();
+
+    bool open(const char *path, std::string &error);
+    // Next record; false at the end or on a damaged file (see error())
+    bool next(TraceEntry &entry);
+    const std::string &error() const;
+    bool packed() const;
+
+private:
+    FILE *file;
+    uint32_t flags;
+    std::vector<TraceRecord> block;
+    size_t position;
+    std::vector<uint8_t> buffer;
+    uint64_t cycle;
+    uint32_t expectedPC;
+    uint32_t lastAddress;
+    std::string failure;
+
+    bool read_block();
+};
+
+#endif // BINARY_TRACE_H
@@ -0,0 +1,387 @@
+#include "BlockEngine.h"
+
+#include <cstring>
+
+// Longest body a single block may hold
+static const size_t MAX_BLOCK_LENGTH = 256;
+
+// Constructor - blocks are translated lazily as execution reaches them
+BlockEngine::BlockEngine(CPU &cpu, unsigned long pcLimit, bool foldLoops)
+    : cpu(cpu), pcLimit(pcLimit), translatedVersion(cpu.codeVersion), isHalted(false),
+      blockAt((pcLimit >> 2) + 1, (Block *)NULL), blocksUsed(0), foldLoops(foldLoops),
+      loopsUsed(0), folded(0)
+{}
+
+bool BlockEngine::halted() const {
+    return isHalted;
+}
+
+uint64_t BlockEngine::foldedInstructions() const {
+    return folded;
+}
+
+void BlockEngine::flush() {
+    blocksUsed = 0;
+    loopsUsed = 0;
+    std::fill(blockAt.begin(), blockAt.end(), (Block *)NULL);
+    translatedVersion = cpu.codeVersion;
+}
+
+void BlockEngine::restart(unsigned long pcLimit) {
+    this->pcLimit = pcLimit;
+    isHalted = false;
+    blockAt.resize((pcLimit >> 2) + 1);
+    flush();
+}
+
+// Block starting at an aligned pc <= pcLimit, translating it on first use
+BlockEngine::Block *BlockEngine::lookup(unsigned long pc) {
+    Block *b = blockAt[pc >> 2];
+    if (b == NULL) {
+        b = translate(pc);
+        blockAt[pc >> 2] = b;
+    }
+    return b;
+}
+
+/**
+ * Translates the straight-line run starting at pc. The body stops before the
+ * first instruction that ends the block (bne, jalr, a zero word, or one only
+ * the CPU stages handle), or once the next PC would leave [0, pcLimit].
+ */
+BlockEngine::Block *BlockEngine::translate(unsigned long pc) {
+    if (blocksUsed == blocks.size())
+        blocks.push_back(Block());
+    Block *b = &blocks[blocksUsed++];
+    b->body.clear();
+    b->offsets.clear();
+    b->startPC = pc;
+    b->next[0] = b->next[1] = NULL;
+    b->jalrPC = 0;
+    b->jalrNext = NULL;
+    b->loop = NULL;
+
+    unsigned long q = pc;
+    for (;;) {
+        TranslatedOp op = Translator::translate(cpu, q);
+        if (op.kind == OP_HALT) {
+            b->exitKind = EXIT_HALT;
+            break;
+        }
+        if (op.kind == OP_GENERIC) {
+            b->exitKind = EXIT_GENERIC;
+            break;
+        }
+        if (op.kind == OP_BNE || op.kind == OP_JALR) {
+            b->exit = op;
+            b->exitKind = (op.kind == OP_BNE) ? EXIT_BNE : EXIT_JALR;
+            break;
+        }
+        if (op.kind != OP_NOP) {
+            b->body.push_back(op);
+            b->offsets.push_back((uint16_t)((q - pc) / 4));
+        }
+        q += 4;
+        if (q > pcLimit) {
+            b->exitKind = EXIT_LIMIT;
+            break;
+        }
+        if ((q - pc) / 4 >= MAX_BLOCK_LENGTH) {
+            b->exitKind = EXIT_FALLTHROUGH;
+            break;
+        }
+    }
+    b->endPC = q;
+    b->length = (q - pc) / 4 + ((b->exitKind == EXIT_BNE || b->exitKind == EXIT_JALR) ? 1 : 0);
+    if (foldLoops && b->exitKind == EXIT_BNE) {
+        if (loopsUsed == loops.size())
+            loops.push_back(CountedLoop());
+        if (loops[loopsUsed].analyze(pc, q, b->body, b->offsets, b->exit))
+            b->loop = &loops[loopsUsed++];
+    }
+    return b;
+}
+
+#if defined(__GNUC__)
+#define BODY_OP(name) L_##name:
+#define BODY_NEXT() do { if (++op == end) return NULL; goto *labels[op->kind]; } while (0)
+#else
+#define BODY_OP(name) case name:
+#define BODY_NEXT() do { ++op; goto next; } while (0)
+#endif
+
+// After a store: stop at it if it overwrote translated code
+#define BODY_STORE_NEXT() do { if (*codeVersion != version) return op; BODY_NEXT(); } while (0)
+
+/**
+ * Executes a block body. Everything a body op touches is a local or the
+ * CPU's memory, and consecutive ops are dispatched directly to one another
+ * without returning to the block loop. Returns NULL once the body is done,
+ * or the store that changed translated code (the rest of the body is stale).
+ */
+static const TranslatedOp *run_body(const TranslatedOp *op, const TranslatedOp *end,
+                                    int32_t *r, Memory &mem, int32_t &mrd,
+                                    const unsigned long *codeVersion, unsigned long version) {
+    if (op == end)
+        return NULL;
+
+#if defined(__GNUC__)
+    static void *const labels[OP_COUNT] = {
+        &&L_OP_HALT, &&L_OP_GENERIC, &&L_OP_NOP,
+        &&L_OP_ADD, &&L_OP_SUB, &&L_OP_AND, &&L_OP_OR, &&L_OP_SLTU, &&L_OP_SRA,
+        &&L_OP_ADDI, &&L_OP_SUBI, &&L_OP_ANDI, &&L_OP_ORI, &&L_OP_SLTIU, &&L_OP_SRAI,
+        &&L_OP_LUI,
+        &&L_OP_LB, &&L_OP_LBU, &&L_OP_LW,
+        &&L_OP_SH, &&L_OP_SW,
+        &&L_OP_BNE,
+        &&L_OP_JALR,
+    };
+    goto *labels[op->kind];
+#else
+next:
+    if (op == end)
+        return NULL;
+    switch (op->kind) {
+#endif
+
+    // never part of a body
+    BODY_OP(OP_HALT)
+    BODY_OP(OP_GENERIC)
+    BODY_OP(OP_BNE)
+    BODY_OP(OP_JALR)
+    BODY_OP(OP_NOP)
+        BODY_NEXT();
+
+    BODY_OP(OP_ADD)   r[op->rd] = (int32_t)((uint32_t)r[op->rs1] + (uint32_t)r[op->rs2]); BODY_NEXT();
+    BODY_OP(OP_SUB)   r[op->rd] = (int32_t)((uint32_t)r[op->rs1] - (uint32_t)r[op->rs2]); BODY_NEXT();
+    BODY_OP(OP_AND)   r[op->rd] = r[op->rs1] & r[op->rs2]; BODY_NEXT();
+    BODY_OP(OP_OR)    r[op->rd] = r[op->rs1] | r[op->rs2]; BODY_NEXT();
+    BODY_OP(OP_SLTU)  r[op->rd] = ((uint32_t)r[op->rs1] < (uint32_t)r[op->rs2]) ? 1 : 0; BODY_NEXT();
+    BODY_OP(OP_SRA)   r[op->rd] = r[op->rs1] >> (r[op->rs2] & 0x1F); BODY_NEXT();
+    BODY_OP(OP_ADDI)  r[op->rd] = (int32_t)((uint32_t)r[op->rs1] + (uint32_t)op->imm); BODY_NEXT();
+    BODY_OP(OP_SUBI)  r[op->rd] = (int32_t)((uint32_t)r[op->rs1] - (uint32_t)op->imm); BODY_NEXT();
+    BODY_OP(OP_ANDI)  r[op->rd] = r[op->rs1] & op->imm; BODY_NEXT();
+    BODY_OP(OP_ORI)   r[op->rd] = r[op->rs1] | op->imm; BODY_NEXT();
+    BODY_OP(OP_SLTIU) r[op->rd] = ((uint32_t)r[op->rs1] < (uint32_t)op->imm) ? 1 : 0; BODY_NEXT();
+    BODY_OP(OP_SRAI)  r[op->rd] = r[op->rs1] >> (op->imm & 0x1F); BODY_NEXT();
+    BODY_OP(OP_LUI)   r[op->rd] = op->imm; BODY_NEXT();
+
+    BODY_OP(OP_LB)
+        mrd = (int8_t)mem.read8(op_address(r, *op));
+        r[op->rd] = mrd;
+        r[0] = 0;
+        BODY_NEXT();
+    BODY_OP(OP_LBU)
+        mrd = mem.read8(op_address(r, *op));
+        r[op->rd] = mrd;
+        r[0] = 0;
+        BODY_NEXT();
+    BODY_OP(OP_LW)
+        mrd = (int32_t)mem.read32(op_address(r, *op));
+        r[op->rd] = mrd;
+        r[0] = 0;
+        BODY_NEXT();
+    BODY_OP(OP_SH)
+        mem.write16(op_address(r, *op), r[op->rs2]);
+        BODY_STORE_NEXT();
+    BODY_OP(OP_SW)
+        mem.write32(op_address(r, *op), r[op->rs2]);
+        BODY_STORE_NEXT();
+
+#if !defined(__GNUC__)
+    }
+#endif
+    return NULL;
+}
+
+/**
+ * Runs one instruction through the CPU stages, syncing the local register
+ * file around it. Returns false if the fetched word was zero (halt).
+ */
+bool BlockEngine::step(int32_t *r, int32_t &mrd, unsigned long &pc) {
+    memcpy(cpu.regs, r, sizeof(cpu.regs));
+    cpu.PC = pc;
+    cpu.mem_read_data = mrd;
+
+    uint32_t instruction = cpu.fetch();
+    if (instruction == 0)
+        return false;
+    cpu.decode(instruction);
+    cpu.execute();
+    cpu.mem();
+    cpu.wb();
+    cpu.updatePC();
+
+    memcpy(r, cpu.regs, sizeof(cpu.regs));
+    pc = cpu.PC;
+    mrd = cpu.mem_read_data;
+    return true;
+}
+
+/**
+ * Executes blocks until a halt condition or the instruction budget is
+ * reached. The halt conditions are exactly those of the stage loop in
+ * cpusim.cpp: a zero instruction word, or PC > pcLimit after an instruction
+ * completes. When the remaining budget is shorter than a block, execution
+ * finishes one instruction at a time so the count stays exact.
+ */
+uint64_t BlockEngine::run(uint64_t max_instructions) {
+    if (isHalted || max_instructions == 0)
+        return 0;
+    if (translatedVersion != cpu.codeVersion)
+        flush();
+
+    int32_t r[32];
+    memcpy(r, cpu.regs, sizeof(r));
+    int32_t mrd = cpu.mem_read_data;
+    Memory &mem = cpu.memory;
+    unsigned long pc = cpu.PC;
+    uint64_t executed = 0;
+    Block *b = NULL;
+
+    while (executed < max_instructions) {
+        if (translatedVersion != cpu.codeVersion) {
+            // the last instruction wrote over translated code
+            flush();
+            b = NULL;
+        }
+        if (b == NULL) {
+            if (pc > pcLimit || (pc & 3)) {
+                // outside translated code: single step
+                if (!step(r, mrd, pc)) {
+                    isHalted = true;
+                    break;
+                }
+                executed++;
+                if (pc > pcLimit) {
+                    isHalted = true;
+                    break;
+                }
+                continue;
+            }
+            b = lookup(pc);
+        }
+
+        if (b->loop != NULL) {
+            // a copy, so pc itself stays in a register
+            unsigned long next = pc;
+            uint64_t done = b->loop->run(r, mem, &cpu.codeVersion, translatedVersion,
+                                         max_instructions - executed, next, folded);
+            if (done != 0) {
+                executed += done;
+                pc = next;
+                // still at the loop's start unless it exited or stopped at a store
+                if (pc != b->startPC) {
+                    b = NULL;
+                    if (pc > pcLimit) {
+                        isHalted = true;
+                        break;
+                    }
+                }
+                continue;
+            }
+        }
+
+        if (max_instructions - executed < b->length) {
+            // budget ends inside this block
+            b = NULL;
+            if (!step(r, mrd, pc)) {
+                isHalted = true;
+                break;
+            }
+            executed++;
+            if (pc > pcLimit) {
+                isHalted = true;
+                break;
+            }
+            continue;
+        }
+
+        const TranslatedOp *stop = run_body(b->body.data(), b->body.data() + b->body.size(),
+                                            r, mem, mrd, &cpu.codeVersion, translatedVersion);
+        if (stop != NULL) {
+            // retire up to the store; the loop retranslates from there
+            uint64_t done = b->offsets[stop - b->body.data()] + 1;
+            executed += done;
+            pc = b->startPC + 4 * done;
+            b = NULL;
+            if (pc > pcLimit) {
+                isHalted = true;
+                break;
+            }
+            continue;
+        }
+        executed += b->length;
+        pc = b->endPC;
+
+        Block **link = NULL;
+        switch (b->exitKind) {
+            case EXIT_FALLTHROUGH:
+                link = &b->next[0];
+                break;
+            case EXIT_LIMIT:
+                break;
+            case EXIT_HALT:
+                if (mem.read32((uint32_t)pc) == 0) {
+                    isHalted = true;
+                    break;
+                }
+                // a store filled the zero word since it was translated;
+                // the loop retranslates from there
+                flush();
+                break;
+            case EXIT_GENERIC:
+                // not counted in length: the budget may end right before it
+                if (executed == max_instructions)
+                    break;
+                if (!step(r, mrd, pc)) {
+                    isHalted = true;
+                    break;
+                }
+                executed++;
+                break;
+            case EXIT_BNE: {
+                const TranslatedOp &op = b->exit;
+                bool taken = r[op.rs1] != r[op.rs2];
+                pc = pc_from_mux((uint32_t)pc + (taken ? (uint32_t)op.imm : 4u));
+                link = &b->next[taken ? 1 : 0];
+                break;
+            }
+            case EXIT_JALR: {
+                const TranslatedOp &op = b->exit;
+                uint32_t target = ((uint32_t)r[op.rs1] + (uint32_t)op.imm) & ~1u;
+                if (op.rd != 0)
+                    r[op.rd] = (int32_t)(pc + 4);
+                pc = pc_from_mux(target);
+                if (b->jalrNext != NULL && b->jalrPC == pc) {
+                    link = &b->jalrNext;
+                } else if (pc <= pcLimit && (pc & 3) == 0) {
+                    b->jalrPC = pc;
+                    link = &b->jalrNext;
+                    *link = NULL;
+                }
+                break;
+            }
+        }
+        if (isHalted)
+            break;
+        if (pc > pcLimit) {
+            isHalted = true;
+            break;
+        }
+
+        // follow the chain, filling it in on first use
+        if (link != NULL && (pc & 3) == 0) {
+            if (*link == NULL)
+                *link = lookup(pc);
+            b = *link;
+        } else {
+            b = NULL;
+        }
+    }
+
+    memcpy(cpu.regs, r, sizeof(r));
+    cpu.PC = pc;
+    cpu.mem_read_data = mrd;
+    return executed;
+}
@@ -0,0 +1,98 @@
+#ifndef BLOCK_ENGINE_H
+#define BLOCK_ENGINE_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "CPU.h"
+#include "CountedLoop.h"
+#include "Translator.h"
+
+// Basic-block execution engine.
+// Discovers straight-line runs of instructions ending at a bne/jalr and
+// translates each into a Block that executes its whole body in one call with
+// the register file held in locals. Blocks are chained to their successors
+// on first use, so a hot loop jumps from block to block without going back
+// through the PC lookup. Anything without a translated form is executed
+// through the regular CPU stages. A store over translated code ends its
+// block right after the store and drops every translation.
+//
+// A block that branches back to its own start is also offered to
+// CountedLoop, which skips to the iteration where the bne falls through
+// when the body allows it (see CountedLoop.h).
+class BlockEngine {
+public:
+    // pcLimit is the stage loop's exit bound: execution stops once PC > pcLimit.
+    // foldLoops: skip counted loops' iterations, cleared by --no-fold-loops
+    BlockEngine(CPU &cpu, unsigned long pcLimit, bool foldLoops = true);
+
+    // Runs until the program halts or max_instructions have executed.
+    // Returns the number of instructions executed.
+    uint64_t run(uint64_t max_instructions);
+
+    // True once the program fetched a zero word or left [0, pcLimit]
+    bool halted() const;
+
+    // Drops every translated block; used when instruction memory changes
+    void flush();
+
+    // Forgets the halt and starts over at the CPU's PC with a new exit
+    // bound, e.g. after CPU::reset loaded another program. Reuses the
+    // engine's buffers, so it does not allocate unless pcLimit grew.
+    void restart(unsigned long pcLimit);
+
+    // Instructions counted loops skipped rather than executed
+    uint64_t foldedInstructions() const;
+
+private:
+    // How control leaves a block once its body has run
+    enum ExitKind {
+        EXIT_FALLTHROUGH, // body hit the length cap; continue at endPC
+        EXIT_LIMIT,       // next PC is past pcLimit: the program is done
+        EXIT_HALT,        // zero instruction word at endPC
+        EXIT_GENERIC,     // instruction at endPC needs the CPU stages
+        EXIT_BNE,         // conditional branch at endPC
+        EXIT_JALR         // indirect jump at endPC
+    };
+
+    struct Block {
+        unsigned long startPC;
+        unsigned long endPC;  // PC following the body
+        uint64_t length;      // instructions retired by body + bne/jalr
+        std::vector<TranslatedOp> body;
+        std::vector<uint16_t> offsets; // instruction index of each body op
+        TranslatedOp exit;    // terminating bne/jalr
+        uint8_t exitKind;
+        // chained successors: [0] fall-through / not taken, [1] taken
+        Block *next[2];
+        // last JALR target and its block
+        unsigned long jalrPC;
+        Block *jalrNext;
+        CountedLoop *loop;    // if the block is a counted loop, else NULL
+    };
+
+    CPU &cpu;
+    unsigned long pcLimit;
+    unsigned long translatedVersion;
+    bool isHalted;
+    // block starting at each aligned PC <= pcLimit, NULL until translated
+    std::vector<Block *> blockAt;
+    // owns every Block; deque keeps chained pointers stable. Blocks past
+    // the first blocksUsed are left over from before a flush and are
+    // reused, body capacity included, by later translations.
+    std::deque<Block> blocks;
+    size_t blocksUsed;
+    bool foldLoops;
+    // analyses of the blocks that are counted loops, reused after a flush
+    // like blocks
+    std::deque<CountedLoop> loops;
+    size_t loopsUsed;
+    uint64_t folded;
+
+    Block *lookup(unsigned long pc);
+    Block *translate(unsigned long pc);
+    bool step(int32_t *r, int32_t &mrd, unsigned long &pc);
+};
+
+#endif // BLOCK_ENGINE_H
@@ -0,0 +1,177 @@
+#include "BranchPredictor.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// std::fill binds it to a reference
+const uint32_t BranchPredictor::NO_BRANCH;
+
+const char *predictor_name(PredictorKind kind) {
+    switch (kind) {
+        case PREDICT_BIMODAL: return "bimodal";
+        case PREDICT_GSHARE: return "gshare";
+        default: return "not-taken";
+    }
+}
+
+bool parse_predictor(const char *text, PredictorConfig &config, std::string &error) {
+    static const PredictorKind kinds[] = { PREDICT_NOT_TAKEN, PREDICT_BIMODAL, PREDICT_GSHARE };
+    size_t length = strcspn(text, ":");
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        const char *name = predictor_name(kinds[i]);
+        if (strlen(name) != length || strncmp(text, name, length) != 0)
+            continue;
+        unsigned bits = config.tableBits;
+        if (text[length] == ':') {
+            char *end;
+            bits = strtoul(text + length + 1, &end, 10);
+            if (end == text + length + 1 || *end != '\0' || bits < 1 || bits > 24) {
+                error = "table bits must be 1 to 24";
+                return false;
+            }
+        }
+        config.kind = kinds[i];
+        config.tableBits = bits;
+        return true;
+    }
+    error = "unknown predictor " + std::string(text, length);
+    return false;
+}
+
+// Constructor - cold predictor; btbEntries must be 0 or a power of two
+BranchPredictor::BranchPredictor(const PredictorConfig &config)
+    : config(config)
+{
+    if (config.kind != PREDICT_NOT_TAKEN)
+        counters.resize((size_t)1 << config.tableBits);
+    btbTags.resize(config.btbEntries);
+    btbTargets.resize(config.btbEntries);
+    ras.resize(config.rasDepth);
+    reset();
+}
+
+void BranchPredictor::reset() {
+    // weakly not-taken
+    std::fill(counters.begin(), counters.end(), 1);
+    history = 0;
+    std::fill(btbTags.begin(), btbTags.end(), NO_BRANCH);
+    std::fill(btbTargets.begin(), btbTargets.end(), 0);
+    rasTop = 0;
+    rasCount = 0;
+    memset(&totals, 0, sizeof(totals));
+    sites.clear();
+}
+
+const PredictorConfig &BranchPredictor::configuration() const {
+    return config;
+}
+
+PredictorStats BranchPredictor::stats() const {
+    return totals;
+}
+
+static bool more_mispredicted(const std::pair<uint32_t, BranchSite> &a,
+                              const std::pair<uint32_t, BranchSite> &b) {
+    if (a.second.mispredicted != b.second.mispredicted)
+        return a.second.mispredicted > b.second.mispredicted;
+    return a.first < b.first;
+}
+
+std::vector<std::pair<uint32_t, BranchSite> > BranchPredictor::worstSites(size_t count) const {
+    std::vector<std::pair<uint32_t, BranchSite> > all(sites.begin(), sites.end());
+    count = std::min(count, all.size());
+    std::partial_sort(all.begin(), all.begin() + count, all.end(), more_mispredicted);
+    all.resize(count);
+    return all;
+}
+
+uint32_t BranchPredictor::counter_index(uint32_t pc) const {
+    uint32_t index = pc >> 2;
+    if (config.kind == PREDICT_GSHARE)
+        index ^= history;
+    return index & ((1u << config.tableBits) - 1);
+}
+
+bool BranchPredictor::btb_lookup(uint32_t pc, uint32_t &target) const {
+    if (btbTags.empty())
+        return false;
+    size_t entry = (pc >> 2) & (btbTags.size() - 1);
+    if (btbTags[entry] != pc)
+        return false;
+    target = btbTargets[entry];
+    return true;
+}
+
+void BranchPredictor::btb_update(uint32_t pc, uint32_t target) {
+    if (btbTags.empty())
+        return;
+    size_t entry = (pc >> 2) & (btbTags.size() - 1);
+    btbTags[entry] = pc;
+    btbTargets[entry] = target;
+}
+
+/**
+ * Works out what fetch would have predicted for the instruction at pc,
+ * compares it with where the CPU went, then trains every structure on the
+ * real outcome. Counters and history only track bne; the BTB learns the
+ * targets of taken bne and of every jalr.
+ */
+bool BranchPredictor::retire(const CPU &cpu, unsigned long pc) {
+    const DecodedInstruction &d = *cpu.decoded;
+    if (d.opcode != BNE && d.opcode != JALR)
+        return false;
+
+    uint32_t from = (uint32_t)pc;
+    uint32_t actual = (uint32_t)cpu.PC;
+    uint32_t fallThrough = from + 4;
+    uint32_t predicted = fallThrough;
+    uint32_t target;
+    bool missed;
+
+    if (d.opcode == BNE) {
+        bool taken = actual != fallThrough;
+        if (config.kind != PREDICT_NOT_TAKEN) {
+            uint8_t &counter = counters[counter_index(from)];
+            if (counter >= 2 && btb_lookup(from, target))
+                predicted = target;
+            if (taken && counter < 3)
+                counter++;
+            else if (!taken && counter > 0)
+                counter--;
+            history = (history << 1) | (taken ? 1 : 0);
+        }
+        if (taken)
+            btb_update(from, actual);
+        missed = predicted != actual;
+        totals.branches++;
+        totals.branchMisses += missed;
+    } else {
+        bool link = d.rd_idx == 1 || d.rd_idx == 5;
+        bool ret = d.rd_idx == 0 && (d.rs1_idx == 1 || d.rs1_idx == 5);
+        if (ret && rasCount != 0) {
+            rasTop = (rasTop + config.rasDepth - 1) % config.rasDepth;
+            rasCount--;
+            predicted = ras[rasTop];
+            totals.returns++;
+            totals.returnMisses += predicted != actual;
+        } else if (btb_lookup(from, target)) {
+            predicted = target;
+        }
+        if (link && config.rasDepth != 0) {
+            ras[rasTop] = fallThrough;
+            rasTop = (rasTop + 1) % config.rasDepth;
+            if (rasCount < config.rasDepth)
+                rasCount++;
+        }
+        btb_update(from, actual);
+        missed = predicted != actual;
+        totals.jumps++;
+        totals.jumpMisses += missed;
+    }
+
+    BranchSite &site = sites[from];
+    site.executed++;
+    site.mispredicted += missed;
+    return missed;
+}
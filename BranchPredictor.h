@@ -0,0 +1,88 @@
+#ifndef BRANCH_PREDICTOR_H
+#define BRANCH_PREDICTOR_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "CPU.h"
+
+// Direction predictors for bne
+enum PredictorKind {
+    PREDICT_NOT_TAKEN, // static: always fall through
+    PREDICT_BIMODAL,   // 2-bit counters indexed by PC
+    PREDICT_GSHARE     // 2-bit counters indexed by PC xor global history
+};
+
+struct PredictorConfig {
+    PredictorKind kind;
+    unsigned tableBits;  // log2 of the counter table size (and history length)
+    unsigned btbEntries; // direct-mapped branch target buffer, 0 = none
+    unsigned rasDepth;   // return address stack, 0 = none
+
+    PredictorConfig()
+        : kind(PREDICT_NOT_TAKEN), tableBits(12), btbEntries(64), rasDepth(8) {}
+};
+
+const char *predictor_name(PredictorKind kind);
+// Parses KIND[:BITS] with KIND "not-taken", "bimodal" or "gshare"
+bool parse_predictor(const char *text, PredictorConfig &config, std::string &error);
+
+struct PredictorStats {
+    uint64_t branches, branchMisses; // bne
+    uint64_t jumps, jumpMisses;      // jalr
+    uint64_t returns, returnMisses;  // jalr predicted from the return stack
+};
+
+// Outcome of one static branch or jump
+struct BranchSite {
+    uint64_t executed;
+    uint64_t mispredicted;
+};
+
+// Fetch-stage next-PC predictor for bne and jalr.
+// At fetch it guesses the next PC from what it has seen: the direction
+// table says whether a bne is taken, and the BTB supplies the target of a
+// taken bne or a jalr, so fetch can only leave the fall-through path on a
+// BTB hit. jalr that looks like a return (rd = x0, rs1 = ra or t0) is
+// predicted from the return stack, which jalr that looks like a call
+// (rd = ra or t0) pushes. A prediction is wrong if it differs from the PC
+// the CPU actually went to.
+class BranchPredictor {
+public:
+    explicit BranchPredictor(const PredictorConfig &config);
+
+    // Forgets all history and counters
+    void reset();
+
+    // Predicts and trains on the instruction the CPU just executed at pc
+    // (cpu's PC is already the next one). Returns true if fetch would have
+    // gone down the wrong path; always false for other instructions.
+    bool retire(const CPU &cpu, unsigned long pc);
+
+    const PredictorConfig &configuration() const;
+    PredictorStats stats() const;
+    // Up to count branch PCs with the most mispredictions, most first
+    std::vector<std::pair<uint32_t, BranchSite> > worstSites(size_t count) const;
+
+private:
+    static const uint32_t NO_BRANCH = 0xFFFFFFFFu;
+
+    PredictorConfig config;
+    std::vector<uint8_t> counters;  // 2-bit saturating, >= 2 predicts taken
+    uint32_t history;               // gshare: recent outcomes, newest in bit 0
+    std::vector<uint32_t> btbTags;  // branch PC per entry, NO_BRANCH if empty
+    std::vector<uint32_t> btbTargets;
+    std::vector<uint32_t> ras;      // circular; overflow drops the oldest
+    unsigned rasTop, rasCount;
+    PredictorStats totals;
+    std::unordered_map<uint32_t, BranchSite> sites;
+
+    uint32_t counter_index(uint32_t pc) const;
+    bool btb_lookup(uint32_t pc, uint32_t &target) const;
+    void btb_update(uint32_t pc, uint32_t target);
+};
+
+#endif // BRANCH_PREDICTOR_H
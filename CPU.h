@@ -1,84 +1,172 @@
-#include <iostream>
-#include <bitset>
-#include <stdio.h>
-#include<stdlib.h>
-#include <string>
-#include <sstream>
-#include <iomanip>
-
-#include "Controller.h"
-#include "ALU.h"
-#include "ImmediateGenerator.h"
-
-using namespace std;
-
-
-class CPU {
-private:
-	// store actual values
-	// Data Memory
-	uint8_t dmemory[4096]; //data memory byte addressable in little endian fashion;
-	
-	// Instruction Memory
-	uint8_t iMem[4096];
-	unsigned long PC; //pc 
-	int32_t regs[32]; // registers
-
-	//Components
-	// Controller
-	Controller controller;
-	// ALU
-	ALU alu;
-	// Immediate Generator
-	ImmediateGenerator immGen;
-	// Control Signals
-	ControlSignals control;
-
-	// Data
-	int32_t immediate;
-    int32_t rs1_val, rs2_val;
-
-	// Instruction Fields
-    uint8_t rd_idx, rs1_idx, rs2_idx;
-    uint8_t funct3, funct7;
-    uint8_t opcode;
-
-	// ALU Result
-    int32_t alu_result;
-    bool alu_zero_flag;
-
-	// Memory Read Data	(MEM)
-    int32_t mem_read_data;
-	// Write Back Data	(WB)
-	int32_t wb_data; 
-	
-	// Debugger
-    std::string disassemble_instruction();
-
-public:
-	// Constructor
-	CPU(const char instructionMemory[4096]);
-	// Getters 
-	unsigned long readPC();
-	// Update PC
-	void updatePC();
-	// Getters for A0 and A1
-	int32_t getA0();
-	int32_t getA1();
-	
-	// Fetch
-	uint32_t fetch();
-	// Decode
-	void decode(uint32_t instruction);
-	// Execute
-    void execute();
-	// Memory
-    void mem();
-	// Write Back
-    void wb();
-	// Debugging	
-	void print_debug_state(uint32_t instruction, int cycle);
-	
-};
-
-// add other functions and objects here
+#ifndef CPU_H
+#define CPU_H
+
+#include <iostream>
+#include <bitset>
+#include <stdio.h>
+#include<stdlib.h>
+#include <string>
+#include <sstream>
+#include <iomanip>
+
+#include "Controller.h"
+#include "ALU.h"
+#include "ImmediateGenerator.h"
+#include "Memory.h"
+
+class CacheModel;
+
+using namespace std;
+
+// Pre-decoded instruction. Everything decode() and execute() derive from the
+// raw instruction bits alone, computed once per PC instead of once per cycle.
+struct DecodedInstruction {
+	uint32_t instruction;
+	int32_t immediate;
+	ControlSignals control;
+	uint8_t opcode;
+	uint8_t rd_idx, rs1_idx, rs2_idx;
+	uint8_t funct3, funct7;
+	uint8_t alu_op; // resolved 4-bit ALU operation
+};
+
+// Architectural state at one point of a run (see CPU::snapshot). Memory
+// pages are shared copy-on-write with the CPU, so taking one is cheap.
+// mem_read_data is state too: a load of an unsupported width leaves it
+// alone and writes the previous load's value back.
+struct CPUSnapshot {
+	unsigned long PC;
+	int32_t regs[32];
+	int32_t mem_read_data;
+	MemorySnapshot memory;
+};
+
+class CPU {
+	// fast execution engines work directly on the architectural state
+	friend class Translator;
+	friend class ThreadedEngine;
+	friend class BlockEngine;
+	friend class JitEngine;
+	friend class LockstepEngine;
+	// the library API exposes registers and memory
+	friend class Simulator;
+	// harts of a HartGroup get their id in tp and merge memories at barriers
+	friend class HartGroup;
+	// the co-simulator compares two CPUs' state
+	friend class CoSimulator;
+	// the result cache hashes the state in place
+	friend class ResultCache;
+	// the time-travel debugger steps the stages itself and undoes their writes
+	friend class TimeTravel;
+	// the timing model, branch predictor and counters read the decoded instruction
+	friend class PipelineModel;
+	friend class BranchPredictor;
+	friend class ExecutionCounters;
+	friend class Profiler;
+	friend class TraceWriter;
+
+private:
+	// store actual values
+	// Unified instruction and data memory, byte addressable in little endian fashion
+	Memory memory;
+	unsigned long PC; //pc 
+	int32_t regs[32]; // registers
+
+	//Components
+	// Controller
+	Controller controller;
+	// ALU
+	ALU alu;
+	// Immediate Generator
+	ImmediateGenerator immGen;
+
+	// Decoded Instruction Cache, direct mapped by (PC >> 2) % 1024; decodeTag
+	// holds the PC each entry was decoded from (NO_DECODE if empty)
+	static const unsigned long NO_DECODE = ~0ul;
+	DecodedInstruction decodeCache[1024];
+	unsigned long decodeTag[1024];
+	// Bumped on every write to code so translated code can detect staleness
+	unsigned long codeVersion;
+	// Scratch entry for PCs the cache does not cover (misaligned JALR targets)
+	DecodedInstruction decodeScratch;
+	// Instruction currently in flight
+	const DecodedInstruction *decoded;
+	// Cache models fetch() and mem() report to (NULL if not simulated)
+	CacheModel *instructionCache;
+	CacheModel *dataCache;
+
+	// Data
+    int32_t rs1_val, rs2_val;
+
+	// ALU Result
+    int32_t alu_result;
+    bool alu_zero_flag;
+
+	// Memory Read Data	(MEM)
+    int32_t mem_read_data;
+	// Write Back Data	(WB)
+	int32_t wb_data; 
+	
+	// Fills a cache entry from the raw instruction bits
+	void decode_fields(uint32_t instruction, DecodedInstruction &d);
+	// Drops decoded entries for the words written (Memory code-write hook)
+	static void code_written(void *cpu, uint32_t addr, unsigned size);
+	void invalidate_decoded();
+
+	// Debugger
+    std::string disassemble_instruction(const DecodedInstruction &d);
+
+public:
+	// Constructor
+	CPU(const char instructionMemory[4096]);
+	// Reload instruction memory and clear all other state
+	void reset(const char instructionMemory[4096]);
+	// Same with an image of any size loaded at address 0
+	void reset(const uint8_t *image, size_t size);
+	// Captures PC, registers, the last load and memory into snapshot
+	void snapshot(CPUSnapshot &snapshot);
+	// Continues from snapshot: PC, registers, the last load and memory as
+	// they were, nothing decoded. Restore between runs, not while an engine is running.
+	void restore(const CPUSnapshot &snapshot);
+	// Getters 
+	unsigned long readPC();
+	// Update PC
+	void updatePC();
+	// Getters for A0 and A1
+	int32_t getA0();
+	int32_t getA1();
+	// Writes a byte of memory, invalidating its decoded entry
+	void writeInstructionMemory(uint32_t addr, uint8_t value);
+	// Copies size bytes to memory at addr (program loading), same invalidation
+	void loadMemory(uint32_t addr, const uint8_t *data, size_t size);
+	// Moves the PC, e.g. to a program's entry point after reset
+	void setPC(unsigned long pc);
+	// Caps resident memory (0 = unlimited); see Memory::setLimit
+	void setMemoryLimit(uint64_t bytes);
+	uint64_t residentMemory() const;
+	// Stores dropped because of the memory limit
+	uint64_t droppedWrites() const;
+	// Has fetch() and mem() report each access to these cache models;
+	// NULL detaches. They only count hits and misses, never change results
+	void attachCaches(CacheModel *instruction, CacheModel *data);
+	
+	// Fetch
+	uint32_t fetch();
+	// Decode
+	void decode(uint32_t instruction);
+	// Execute
+    void execute();
+	// Memory
+    void mem();
+	// Write Back
+    void wb();
+	// Debugging	
+	void print_debug_state(uint32_t instruction, int cycle);
+	// Assembly text of any instruction word, as print_debug_state shows it
+	std::string disassemble(uint32_t instruction);
+	
+};
+
+// add other functions and objects here
+
+#endif // CPU_H
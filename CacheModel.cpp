@@ -0,0 +1,250 @@
+#include "CacheModel.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// std::fill binds it to a reference
+const uint32_t CacheModel::INVALID;
+
+const char *replacement_name(Replacement replacement) {
+    switch (replacement) {
+        case REPLACE_PLRU: return "plru";
+        case REPLACE_RANDOM: return "random";
+        default: return "lru";
+    }
+}
+
+static bool is_power_of_two(uint64_t n) {
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+// Number with an optional K/M suffix, ending at ':' or the end of text
+static bool parse_number(const char *&text, uint64_t &n) {
+    char *end;
+    n = strtoull(text, &end, 10);
+    if (end == text)
+        return false;
+    switch (*end) {
+        case 'K': case 'k': n <<= 10; end++; break;
+        case 'M': case 'm': n <<= 20; end++; break;
+    }
+    text = end;
+    return *text == ':' || *text == '\0';
+}
+
+bool parse_cache_config(const char *text, CacheConfig &config, std::string &error) {
+    CacheConfig c;
+    uint64_t size, ways = c.ways, line = c.lineBytes;
+    const char *p = text;
+    if (!parse_number(p, size)) {
+        error = "bad cache size";
+        return false;
+    }
+    if (*p == ':' && !parse_number(++p, ways)) {
+        error = "bad associativity";
+        return false;
+    }
+    if (*p == ':' && !parse_number(++p, line)) {
+        error = "bad line size";
+        return false;
+    }
+    while (*p == ':') {
+        const char *field = ++p;
+        size_t length = strcspn(field, ":");
+        std::string word(field, length);
+        p += length;
+        if (word == "lru")
+            c.replacement = REPLACE_LRU;
+        else if (word == "plru")
+            c.replacement = REPLACE_PLRU;
+        else if (word == "random")
+            c.replacement = REPLACE_RANDOM;
+        else if (word == "wb")
+            c.writeBack = true;
+        else if (word == "wt")
+            c.writeBack = false;
+        else {
+            error = "unknown cache option " + word;
+            return false;
+        }
+    }
+
+    if (!is_power_of_two(size) || !is_power_of_two(ways) || !is_power_of_two(line)) {
+        error = "size, ways and line size must be powers of two";
+        return false;
+    }
+    if (line < 4 || size > (1u << 30) || size < ways * line) {
+        error = "cache must hold at least one set of lines of 4 bytes or more";
+        return false;
+    }
+    if (c.replacement == REPLACE_PLRU && ways > 64) {
+        error = "plru supports at most 64 ways";
+        return false;
+    }
+    c.sizeBytes = (uint32_t)size;
+    c.ways = (uint32_t)ways;
+    c.lineBytes = (uint32_t)line;
+    config = c;
+    return true;
+}
+
+// Constructor - empty cache; config must have passed parse_cache_config's checks
+CacheModel::CacheModel(const CacheConfig &config)
+    : config(config)
+{
+    lineBits = 0;
+    while ((1u << lineBits) < config.lineBytes)
+        lineBits++;
+    uint32_t sets = config.sizeBytes / (config.lineBytes * config.ways);
+    setMask = sets - 1;
+    tags.resize((size_t)sets * config.ways);
+    dirty.resize(tags.size());
+    if (config.replacement == REPLACE_LRU)
+        stamps.resize(tags.size());
+    else if (config.replacement == REPLACE_PLRU)
+        plru.resize(sets);
+    reset();
+}
+
+void CacheModel::reset() {
+    std::fill(tags.begin(), tags.end(), INVALID);
+    std::fill(dirty.begin(), dirty.end(), 0);
+    std::fill(stamps.begin(), stamps.end(), 0);
+    std::fill(plru.begin(), plru.end(), 0);
+    clock = 0;
+    random = 0x9E3779B9u; // fixed seed keeps runs reproducible
+    lastLine = INVALID;
+    lastSlot = 0;
+    memset(&counters, 0, sizeof(counters));
+    missesByPC.clear();
+}
+
+const CacheConfig &CacheModel::configuration() const {
+    return config;
+}
+
+CacheStats CacheModel::stats() const {
+    return counters;
+}
+
+static bool more_misses(const std::pair<uint32_t, uint64_t> &a,
+                        const std::pair<uint32_t, uint64_t> &b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+}
+
+std::vector<std::pair<uint32_t, uint64_t> > CacheModel::topMisses(size_t count) const {
+    std::vector<std::pair<uint32_t, uint64_t> > all(missesByPC.begin(), missesByPC.end());
+    count = std::min(count, all.size());
+    std::partial_sort(all.begin(), all.begin() + count, all.end(), more_misses);
+    all.resize(count);
+    return all;
+}
+
+/**
+ * Records a use of way in set for the replacement policy. LRU stamps the
+ * slot with a running clock; PLRU points every tree node on the path from
+ * the root to the way at the other half.
+ */
+void CacheModel::touch(uint32_t set, uint32_t way) {
+    if (config.replacement == REPLACE_LRU) {
+        stamps[(size_t)set * config.ways + way] = ++clock;
+    } else if (config.replacement == REPLACE_PLRU) {
+        uint64_t &bits = plru[set];
+        // leaves are nodes ways .. 2 * ways - 1; node n's children are 2n and 2n + 1
+        for (uint32_t node = way + config.ways; node > 1; node >>= 1) {
+            uint64_t bit = 1ull << (node >> 1);
+            if (node & 1)
+                bits &= ~bit; // came from the right: next victim on the left
+            else
+                bits |= bit;
+        }
+    }
+}
+
+// Way to replace in set: an empty one if any, else per policy
+uint32_t CacheModel::victim(uint32_t set) {
+    size_t base = (size_t)set * config.ways;
+    for (uint32_t w = 0; w < config.ways; w++) {
+        if (tags[base + w] == INVALID)
+            return w;
+    }
+    switch (config.replacement) {
+        case REPLACE_PLRU: {
+            uint32_t node = 1;
+            while (node < config.ways)
+                node = 2 * node + ((plru[set] >> node) & 1);
+            return node - config.ways;
+        }
+        case REPLACE_RANDOM:
+            // xorshift32
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            return random & (config.ways - 1);
+        default: {
+            uint32_t oldest = 0;
+            for (uint32_t w = 1; w < config.ways; w++) {
+                if (stamps[base + w] < stamps[base + oldest])
+                    oldest = w;
+            }
+            return oldest;
+        }
+    }
+}
+
+/**
+ * Looks up one line. A miss allocates the line unless it is a write to a
+ * write-through cache, which goes straight to memory without allocating.
+ */
+bool CacheModel::access_line(uint32_t line, bool write, uint32_t pc) {
+    uint32_t set = line & setMask;
+    size_t base = (size_t)set * config.ways;
+    if (write)
+        counters.writes++;
+    else
+        counters.reads++;
+    if (write && !config.writeBack)
+        counters.memoryWrites++;
+
+    for (uint32_t w = 0; w < config.ways; w++) {
+        if (tags[base + w] != line)
+            continue;
+        touch(set, w);
+        if (write && config.writeBack)
+            dirty[base + w] = 1;
+        lastLine = line;
+        lastSlot = base + w;
+        counters.hits++;
+        return true;
+    }
+
+    counters.misses++;
+    missesByPC[pc]++;
+    if (write && !config.writeBack)
+        return false;
+
+    uint32_t w = victim(set);
+    size_t slot = base + w;
+    if (tags[slot] != INVALID) {
+        counters.evictions++;
+        if (dirty[slot])
+            counters.writebacks++;
+    }
+    tags[slot] = line;
+    dirty[slot] = (write && config.writeBack) ? 1 : 0;
+    touch(set, w);
+    lastLine = line;
+    lastSlot = slot;
+    return false;
+}
+
+// Accesses the fast path in access() could not settle
+bool CacheModel::access_slow(uint32_t addr, unsigned size, bool write, uint32_t pc) {
+    uint32_t first = addr >> lineBits;
+    uint32_t second = (uint32_t)(addr + size - 1) >> lineBits;
+    bool hit = access_line(first, write, pc);
+    if (second != first)
+        hit &= access_line(second, write, pc);
+    return hit;
+}
@@ -0,0 +1,105 @@
+#ifndef CACHE_MODEL_H
+#define CACHE_MODEL_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+enum Replacement {
+    REPLACE_LRU,
+    REPLACE_PLRU,  // tree pseudo-LRU
+    REPLACE_RANDOM
+};
+
+struct CacheConfig {
+    uint32_t sizeBytes;
+    uint32_t ways;
+    uint32_t lineBytes;
+    Replacement replacement;
+    bool writeBack;  // write-back + write-allocate; else write-through, no allocate
+
+    CacheConfig()
+        : sizeBytes(32 * 1024), ways(4), lineBytes(64),
+          replacement(REPLACE_LRU), writeBack(true) {}
+};
+
+// Parses SIZE[:WAYS[:LINE[:lru|plru|random[:wb|wt]]]], e.g. "32K:8:64:plru:wt".
+// Sizes take K/M suffixes; all three numbers must be powers of two, lines
+// at least 4 bytes, and PLRU at most 64 ways.
+bool parse_cache_config(const char *text, CacheConfig &config, std::string &error);
+const char *replacement_name(Replacement replacement);
+
+struct CacheStats {
+    uint64_t reads, writes;
+    uint64_t hits, misses;
+    uint64_t evictions;     // valid lines replaced
+    uint64_t writebacks;    // dirty lines written back (write-back)
+    uint64_t memoryWrites;  // stores passed to memory (write-through)
+};
+
+// Set-associative cache model. It tracks only tags, never data: the CPU
+// still reads and writes Memory directly and calls access() alongside to
+// find out whether the access would have hit. Tags, replacement state and
+// dirty bits live in flat arrays indexed by set * ways + way, so a lookup
+// touches one or two host cache lines. A fast path remembers the last
+// line accessed, which catches straight-line instruction fetch and
+// sequential data.
+class CacheModel {
+public:
+    explicit CacheModel(const CacheConfig &config);
+
+    // Forgets all lines and counters
+    void reset();
+
+    // One access of size bytes at addr by the instruction at pc. Returns
+    // true on a hit. Accesses spanning two lines count once per line.
+    bool access(uint32_t addr, unsigned size, bool write, uint32_t pc) {
+        uint32_t line = addr >> lineBits;
+        if (line == lastLine && ((addr + size - 1) >> lineBits) == line) {
+            // still the most recently used line: replacement state is current
+            if (write) {
+                counters.writes++;
+                if (config.writeBack)
+                    dirty[lastSlot] = 1;
+                else
+                    counters.memoryWrites++;
+            } else {
+                counters.reads++;
+            }
+            counters.hits++;
+            return true;
+        }
+        return access_slow(addr, size, write, pc);
+    }
+
+    const CacheConfig &configuration() const;
+    CacheStats stats() const;
+    // Up to count PCs with the most misses, most first
+    std::vector<std::pair<uint32_t, uint64_t> > topMisses(size_t count) const;
+
+private:
+    static const uint32_t INVALID = 0xFFFFFFFFu;
+
+    CacheConfig config;
+    unsigned lineBits;
+    uint32_t setMask;
+    std::vector<uint32_t> tags;    // line address per slot, INVALID if empty
+    std::vector<uint64_t> stamps;  // LRU: last use time per slot
+    std::vector<uint64_t> plru;    // PLRU: tree bits per set
+    std::vector<uint8_t> dirty;
+    uint64_t clock;
+    uint32_t random;
+    uint32_t lastLine;             // line of the previous access
+    size_t lastSlot;
+    CacheStats counters;
+    std::unordered_map<uint32_t, uint64_t> missesByPC;
+
+    bool access_slow(uint32_t addr, unsigned size, bool write, uint32_t pc);
+    bool access_line(uint32_t line, bool write, uint32_t pc);
+    void touch(uint32_t set, uint32_t way);
+    uint32_t victim(uint32_t set);
+};
+
+#endif // CACHE_MODEL_H
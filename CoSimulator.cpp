@@ -0,0 +1,212 @@
+#include "CoSimulator.h"
+#include "Program.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+
+// Byte differences listed per divergence; the rest are only counted
+static const unsigned MAX_BYTE_DIFFERENCES = 16;
+
+CoSimulator::CoSimulator(const Program &program, const EngineOptions &options, uint64_t interval)
+    : kind(options.kind), pcLimit(program.pcLimit()), interval(std::max<uint64_t>(interval, 1)),
+      maxInstructions(options.maxInstructions), executed(0), checkCount(0), divergence(false),
+      bothHalted(false), badPC(0), badWord(0)
+{
+    ref.reset(new CPU(program.instMem));
+    fast.reset(new CPU(program.instMem));
+    reset_cpu(*ref, program);
+    reset_cpu(*fast, program);
+    ref->setMemoryLimit(options.memoryLimit);
+    fast->setMemoryLimit(options.memoryLimit);
+    session.reset(new EngineSession(*fast, pcLimit, options));
+}
+
+bool CoSimulator::diverged() const {
+    return divergence;
+}
+
+bool CoSimulator::halted() const {
+    return bothHalted;
+}
+
+uint64_t CoSimulator::instructions() const {
+    return executed;
+}
+
+unsigned long CoSimulator::divergencePC() const {
+    return badPC;
+}
+
+uint64_t CoSimulator::checks() const {
+    return checkCount;
+}
+
+CPU &CoSimulator::reference() {
+    return *ref;
+}
+
+RunResult CoSimulator::run_reference(uint64_t n) {
+    EngineOptions stage;
+    stage.maxInstructions = n;
+    return run_program(*ref, pcLimit, stage);
+}
+
+/**
+ * An engine that used up its budget right before a halting word may report
+ * the halt at once, where the other reports it on the next run. Running
+ * the side that did not halt once more tells that apart from a real
+ * difference (which then shows as an instruction count mismatch).
+ */
+void CoSimulator::settle(RunResult &r, RunResult &f, uint64_t n) {
+    if (r.halted == f.halted || r.instructions != n || f.instructions != n)
+        return;
+    RunResult &late = r.halted ? f : r;
+    RunResult extra = r.halted ? session->run(1) : run_reference(1);
+    late.instructions += extra.instructions;
+    late.halted = extra.halted;
+}
+
+static std::string hex_value(uint64_t value) {
+    std::ostringstream s;
+    s << "0x" << std::hex << value;
+    return s.str();
+}
+
+bool CoSimulator::compare(const RunResult &r, const RunResult &f, bool record) {
+    checkCount++;
+    bool same = true;
+    if (r.instructions != f.instructions) {
+        if (!record)
+            return false;
+        same = false;
+        std::ostringstream s;
+        s << "instructions: reference " << r.instructions << " " << engine_name(kind) << " " << f.instructions;
+        differences.push_back(s.str());
+    }
+    if (r.halted != f.halted) {
+        if (!record)
+            return false;
+        same = false;
+        differences.push_back(std::string("halted: reference ") + (r.halted ? "yes" : "no") + " " +
+                              engine_name(kind) + " " + (f.halted ? "yes" : "no"));
+    }
+    if (ref->PC != fast->PC) {
+        if (!record)
+            return false;
+        same = false;
+        differences.push_back("pc: reference " + hex_value(ref->PC) + " " + engine_name(kind) + " " +
+                              hex_value(fast->PC));
+    }
+    for (int i = 0; i < 32; i++) {
+        if (ref->regs[i] == fast->regs[i])
+            continue;
+        if (!record)
+            return false;
+        same = false;
+        std::ostringstream s;
+        s << "x" << i << ": reference " << ref->regs[i] << " " << engine_name(kind) << " " << fast->regs[i];
+        differences.push_back(s.str());
+    }
+
+    // both memories matched at the snapshots; only pages either wrote can differ
+    ref->memory.changedPages(refStart.memory, refPages);
+    fast->memory.changedPages(fastStart.memory, fastPages);
+    pages.clear();
+    std::set_union(refPages.begin(), refPages.end(), fastPages.begin(), fastPages.end(),
+                   std::back_inserter(pages));
+    uint64_t bytes = 0;
+    for (size_t p = 0; p < pages.size(); p++) {
+        const uint8_t *a = ref->memory.pageData(pages[p]);
+        const uint8_t *b = fast->memory.pageData(pages[p]);
+        if (memcmp(a, b, Memory::PAGE_SIZE) == 0)
+            continue;
+        if (!record)
+            return false;
+        same = false;
+        for (uint32_t i = 0; i < Memory::PAGE_SIZE; i++) {
+            if (a[i] == b[i])
+                continue;
+            if (bytes++ < MAX_BYTE_DIFFERENCES) {
+                std::ostringstream s;
+                s << "mem[" << hex_value(((uint64_t)pages[p] << Memory::PAGE_BITS) | i)
+                  << "]: reference " << hex_value(a[i]) << " " << engine_name(kind) << " " << hex_value(b[i]);
+                differences.push_back(s.str());
+            }
+        }
+    }
+    if (bytes > MAX_BYTE_DIFFERENCES) {
+        std::ostringstream s;
+        s << "... and " << bytes - MAX_BYTE_DIFFERENCES << " more bytes";
+        differences.push_back(s.str());
+    }
+    return same;
+}
+
+/**
+ * Redoes the last interval of n instructions one at a time from the
+ * snapshots, stopping at the first instruction after which the two CPUs
+ * differ.
+ */
+void CoSimulator::locate(uint64_t n) {
+    divergence = true;
+    ref->restore(refStart);
+    fast->restore(fastStart);
+    session->restart(pcLimit);
+    for (uint64_t i = 0; i < n; i++) {
+        badPC = ref->PC;
+        badWord = ref->memory.read32((uint32_t)ref->PC);
+        ref->snapshot(refStart);
+        fast->snapshot(fastStart);
+        RunResult r = run_reference(1);
+        RunResult f = session->run(1);
+        settle(r, f, 1);
+        if (!compare(r, f, true))
+            return;
+        executed += r.instructions;
+        if (r.halted)
+            break;
+    }
+    // The replay matched all the way: only the interval as a whole differed
+    // (an engine that depends on how far it may run at once)
+    differences.push_back("no single instruction differs when stepping; the " + std::string(engine_name(kind)) +
+                          " engine diverged only over the whole interval");
+}
+
+bool CoSimulator::run() {
+    while (executed < maxInstructions) {
+        uint64_t n = std::min(interval, maxInstructions - executed);
+        ref->snapshot(refStart);
+        fast->snapshot(fastStart);
+        RunResult r = run_reference(n);
+        RunResult f = session->run(n);
+        settle(r, f, n);
+        if (!compare(r, f, false)) {
+            locate(n);
+            return false;
+        }
+        executed += r.instructions;
+        if (r.halted) {
+            bothHalted = true;
+            break;
+        }
+    }
+    // the snapshots share pages with both memories; let them go
+    refStart.memory.clear();
+    fastStart.memory.clear();
+    return true;
+}
+
+void CoSimulator::report(std::ostream &out) const {
+    if (!divergence) {
+        out << "cosim: " << engine_name(kind) << " matched the stage engine over "
+            << executed << " instructions (" << checkCount << " checks)" << std::endl;
+        return;
+    }
+    out << "cosim: " << engine_name(kind) << " diverged from the stage engine at instruction "
+        << executed << ", pc " << hex_value(badPC) << ": " << hex_value(badWord)
+        << " [" << ref->disassemble(badWord) << "]" << std::endl;
+    for (size_t i = 0; i < differences.size(); i++)
+        out << "  " << differences[i] << std::endl;
+}
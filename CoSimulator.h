@@ -0,0 +1,78 @@
+#ifndef CO_SIMULATOR_H
+#define CO_SIMULATOR_H
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Engine.h"
+
+struct Program;
+
+// Differential co-simulation. Two CPUs load the same program: the
+// reference runs the stage engine (fetch/decode/execute/mem/wb/updatePC)
+// and the other runs a fast engine. They advance in intervals of the same
+// number of instructions, and after each one the checker compares the
+// instruction counts, halt states, PCs, registers and every memory page
+// either side wrote (found through copy-on-write snapshots taken at the
+// start of the interval). When something differs, both CPUs go back to the
+// start of the interval and redo it one instruction at a time, so the
+// report names the first instruction whose results differ, whatever the
+// interval. Long intervals make the check nearly free; an interval of 1
+// compares after every instruction.
+class CoSimulator {
+public:
+    // options.kind is the engine checked; models and instrumentation are ignored
+    CoSimulator(const Program &program, const EngineOptions &options, uint64_t interval);
+
+    // Runs both until they halt, diverge or options.maxInstructions have
+    // executed; false if they diverged
+    bool run();
+
+    bool diverged() const;
+    // Both halted (rather than reaching options.maxInstructions)
+    bool halted() const;
+    // Instructions executed before the first diverging one (all of them
+    // if there was no divergence)
+    uint64_t instructions() const;
+    unsigned long divergencePC() const;
+    uint64_t checks() const;
+    CPU &reference();
+
+    // The first diverging instruction and every difference it left
+    void report(std::ostream &out) const;
+
+private:
+    std::unique_ptr<CPU> ref;
+    std::unique_ptr<CPU> fast;
+    std::unique_ptr<EngineSession> session;
+    EngineKind kind;
+    unsigned long pcLimit;
+    uint64_t interval;
+    uint64_t maxInstructions;
+
+    CPUSnapshot refStart, fastStart;
+    std::vector<uint32_t> refPages, fastPages, pages;
+
+    uint64_t executed;
+    uint64_t checkCount;
+    bool divergence;
+    bool bothHalted;
+    unsigned long badPC;
+    uint32_t badWord;
+    std::vector<std::string> differences;
+
+    RunResult run_reference(uint64_t n);
+    void settle(RunResult &r, RunResult &f, uint64_t n);
+    // Compares the states reached since the snapshots, recording what
+    // differs if record is set; true if they match
+    bool compare(const RunResult &r, const RunResult &f, bool record);
+    void locate(uint64_t n);
+
+    CoSimulator(const CoSimulator &);
+    CoSimulator &operator=(const CoSimulator &);
+};
+
+#endif // CO_SIMULATOR_H
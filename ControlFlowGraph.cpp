@@ -0,0 +1,777 @@
+#include "ControlFlowGraph.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+
+#include "ALU.h"
+#include "Controller.h"
+#include "ImmediateGenerator.h"
+
+// Loop levels past this all count the same in the hotness estimate
+static const unsigned MAX_WEIGHT_DEPTH = 6;
+// Graph and jump target passes before build() settles for what it has
+static const unsigned MAX_PASSES = 16;
+
+// The byte at address after the program is loaded (see reset_cpu)
+static uint8_t image_byte(const Program &program, uint32_t address) {
+    if (program.segments.empty())
+        return address < sizeof(program.instMem) ? (uint8_t)program.instMem[address] : 0;
+    uint8_t value = 0;
+    // later segments load over earlier ones
+    for (size_t i = 0; i < program.segments.size(); i++) {
+        const ProgramSegment &s = program.segments[i];
+        uint32_t offset = address - s.address;
+        if (address >= s.address && offset < s.fileSize)
+            value = s.data[offset];
+    }
+    return value;
+}
+
+static uint32_t image_word(const Program &program, uint32_t address) {
+    uint32_t word = 0;
+    for (unsigned i = 0; i < 4; i++)
+        word |= (uint32_t)image_byte(program, address + i) << (8 * i);
+    return word;
+}
+
+// The fields CPU::decode_fields fills in, from the same decoders
+static void decode(Controller &controller, ImmediateGenerator &immGen, uint32_t instruction,
+                   DecodedInstruction &d) {
+    d.instruction = instruction;
+    d.opcode = instruction & 0x7F;
+    d.rd_idx = (instruction >> 7) & 0x1F;
+    d.funct3 = (instruction >> 12) & 0x7;
+    d.rs1_idx = (instruction >> 15) & 0x1F;
+    d.rs2_idx = (instruction >> 20) & 0x1F;
+    d.funct7 = (instruction >> 25) & 0x7F;
+    d.control = controller.generate_signals(d.opcode);
+    d.immediate = immGen.generate(instruction, d.opcode);
+    d.alu_op = controller.aluOperation(d.opcode, d.funct3, d.funct7);
+}
+
+static bool is_link(unsigned index) {
+    return index == 1 || index == 5;
+}
+
+// Returns go back to the return site their call made an edge to, so their
+// targets are never resolved (the constant in the link register would name
+// one caller only)
+static bool is_return(const DecodedInstruction &d) {
+    return is_link(d.rs1_idx) && !is_link(d.rd_idx);
+}
+
+// Registers an instruction reads for its result (x0 left out)
+static uint32_t reads_of(const DecodedInstruction &d) {
+    uint32_t mask = 0;
+    switch (d.opcode) {
+    case RTYPE:
+    case SW:
+    case BNE:
+        mask |= 1u << d.rs2_idx;
+        // fall through
+    case ITYPE:
+    case LW:
+    case JALR:
+        mask |= 1u << d.rs1_idx;
+        break;
+    }
+    return mask & ~1u;
+}
+
+static uint32_t writes_of(const DecodedInstruction &d) {
+    return d.control.RegWrite && d.rd_idx != 0 ? 1u << d.rd_idx : 0;
+}
+
+// What constant propagation knows about the registers at one point
+struct Constants {
+    uint32_t known;  // bit per register; x0 always
+    int32_t value[32];
+
+    Constants() : known(1) { value[0] = 0; }
+
+    bool has(unsigned index) const { return (known >> index & 1) != 0; }
+
+    // The state after d, whose writes it computes when its inputs are known
+    void step(ALU &alu, const DecodedInstruction &d, uint32_t pc) {
+        const ControlSignals &c = d.control;
+        if (!c.RegWrite || d.rd_idx == 0)
+            return;
+        uint32_t bit = 1u << d.rd_idx;
+        if (c.JALRSel) {
+            value[d.rd_idx] = (int32_t)(pc + 4);
+        } else if (c.LUISel) {
+            value[d.rd_idx] = d.immediate;
+        } else if (!c.MemRead && has(d.rs1_idx) && (c.ALUSrc || has(d.rs2_idx))) {
+            value[d.rd_idx] = alu.execute(d.alu_op, value[d.rs1_idx], c.ALUSrc ? d.immediate : value[d.rs2_idx]);
+        } else {
+            known &= ~bit;
+            return;
+        }
+        known |= bit;
+    }
+
+    // Keeps what both states agree on; true if anything was lost
+    bool meet(const Constants &other) {
+        uint32_t agreed = known & other.known;
+        for (unsigned r = 1; r < 32; r++) {
+            if ((agreed >> r & 1) && value[r] != other.value[r])
+                agreed &= ~(1u << r);
+        }
+        bool lost = agreed != known;
+        known = agreed;
+        return lost;
+    }
+};
+
+// The run halts at a PC past the limit or holding the word 0
+static bool runs(const Program &program, unsigned long pcLimit, int64_t pc) {
+    return pc >= 0 && (uint64_t)pc <= pcLimit && pc <= 0xFFFFFFFFLL && image_word(program, (uint32_t)pc) != 0;
+}
+
+// Constructor - analyzes program from its entry point
+ControlFlowGraph::ControlFlowGraph(const Program &program)
+    : pcLimit(program.pcLimit()), entryPC(program.entry), entryBlock(0)
+{
+    build(program);
+    find_dominators();
+    find_loops();
+}
+
+/**
+ * jalr targets need the graph (constants flow along its edges) and the
+ * graph needs the targets, so the two are built in passes until the
+ * targets stop changing. Code a pass reaches through a target that a later
+ * pass no longer resolves is dropped by the final cut.
+ */
+void ControlFlowGraph::build(const Program &program) {
+    std::map<uint32_t, uint32_t> targets;  // jalr PC -> target resolved on the last pass
+    std::set<uint32_t> seen;               // every target any pass resolved
+    for (unsigned pass = 0; pass < MAX_PASSES; pass++) {
+        cut(program, seen);
+        link(targets);
+        size_t before = seen.size();
+        std::map<uint32_t, uint32_t> resolved;
+        propagate(resolved, seen);
+        if (resolved == targets && seen.size() == before)
+            break;
+        targets.swap(resolved);
+    }
+    std::set<uint32_t> kept;
+    for (std::map<uint32_t, uint32_t>::const_iterator it = targets.begin(); it != targets.end(); ++it)
+        kept.insert(it->second);
+    cut(program, kept);
+    link(targets);
+    entryBlock = (uint32_t)std::max(block_at(entryPC), 0);
+}
+
+/**
+ * Finds every instruction reachable from the entry point and the given
+ * jump targets without going through a jalr, and cuts them into blocks at
+ * the leaders: those starting points, branch targets, and the instructions
+ * after branches and calls.
+ */
+void ControlFlowGraph::cut(const Program &program, const std::set<uint32_t> &jumpTargets) {
+    Controller controller;
+    ImmediateGenerator immGen;
+    std::map<uint32_t, DecodedInstruction> reachable;
+    std::set<uint32_t> leaders;
+    std::vector<uint32_t> work;
+    auto lead = [&](int64_t pc) {
+        if (runs(program, pcLimit, pc) && leaders.insert((uint32_t)pc).second)
+            work.push_back((uint32_t)pc);
+    };
+
+    lead(entryPC);
+    // a negative target sign-extends past the PC limit, as in updatePC
+    for (std::set<uint32_t>::const_iterator it = jumpTargets.begin(); it != jumpTargets.end(); ++it)
+        lead((int32_t)*it);
+    while (!work.empty()) {
+        uint32_t pc = work.back();
+        work.pop_back();
+        while (reachable.count(pc) == 0) {
+            DecodedInstruction &d = reachable[pc];
+            decode(controller, immGen, image_word(program, pc), d);
+            if (d.control.Branch) {
+                lead((int64_t)pc + d.immediate);
+                lead((int64_t)pc + 4);
+                break;
+            }
+            if (d.control.PCSrc == 2) {
+                if (is_link(d.rd_idx))
+                    lead((int64_t)pc + 4);
+                break;
+            }
+            if (!runs(program, pcLimit, (int64_t)pc + 4))
+                break;
+            pc += 4;
+        }
+    }
+
+    blockList.clear();
+    decoded.clear();
+    pcs.clear();
+    for (std::set<uint32_t>::const_iterator it = leaders.begin(); it != leaders.end(); ++it) {
+        Block b;
+        b.start = *it;
+        b.first = (uint32_t)decoded.size();
+        b.exit = EXIT_FALLTHROUGH;
+        b.targetKnown = false;
+        b.target = 0;
+        b.idom = 0;
+        b.loop = -1;
+        b.reads = b.writes = 0;
+        uint32_t pc = *it;
+        for (;;) {
+            const DecodedInstruction &d = reachable[pc];
+            decoded.push_back(d);
+            pcs.push_back(pc);
+            b.reads |= reads_of(d);
+            b.writes |= writes_of(d);
+            if (d.control.Branch) {
+                b.exit = EXIT_BRANCH;
+                break;
+            }
+            if (d.control.PCSrc == 2) {
+                b.exit = EXIT_INDIRECT;  // link() sorts jalr out
+                break;
+            }
+            if (!runs(program, pcLimit, (int64_t)pc + 4)) {
+                b.exit = EXIT_HALT;
+                break;
+            }
+            if (leaders.count(pc + 4))
+                break;
+            pc += 4;
+        }
+        b.end = pc + 4;
+        b.count = (uint32_t)decoded.size() - b.first;
+        blockList.push_back(b);
+    }
+
+    // blocks starting at the same offset within a word never overlap, so
+    // block_at() searches among those of the PC's offset
+    byOffset.resize(blockList.size());
+    for (size_t i = 0; i < blockList.size(); i++)
+        byOffset[i] = (uint32_t)i;
+    std::stable_sort(byOffset.begin(), byOffset.end(), [&](uint32_t a, uint32_t b) {
+        return (blockList[a].start & 3) < (blockList[b].start & 3);
+    });
+}
+
+// Classifies each jalr with the targets resolved so far and adds the edges
+void ControlFlowGraph::link(const std::map<uint32_t, uint32_t> &targets) {
+    for (size_t i = 0; i < blockList.size(); i++) {
+        blockList[i].successors.clear();
+        blockList[i].predecessors.clear();
+    }
+    for (size_t i = 0; i < blockList.size(); i++) {
+        Block &b = blockList[i];
+        uint32_t last = b.end - 4;
+        const DecodedInstruction &d = decoded[b.first + b.count - 1];
+        if (d.control.PCSrc == 2) {
+            std::map<uint32_t, uint32_t>::const_iterator it = targets.find(last);
+            b.targetKnown = it != targets.end();
+            b.target = b.targetKnown ? it->second : 0;
+            if (is_link(d.rd_idx))
+                b.exit = EXIT_CALL;
+            else if (is_return(d))
+                b.exit = EXIT_RETURN;
+            else
+                b.exit = b.targetKnown ? EXIT_JUMP : EXIT_INDIRECT;
+        }
+        auto edge = [&](int64_t pc, EdgeKind kind) {
+            int target = pc >= 0 && pc <= 0xFFFFFFFFLL ? block_at((uint32_t)pc) : -1;
+            if (target < 0)
+                return;
+            Edge e = { (uint32_t)target, kind };
+            b.successors.push_back(e);
+            Edge back = { (uint32_t)i, kind };
+            blockList[target].predecessors.push_back(back);
+        };
+        switch (b.exit) {
+        case EXIT_FALLTHROUGH:
+            edge(b.end, EDGE_FALLTHROUGH);
+            break;
+        case EXIT_BRANCH:
+            edge((int64_t)last + d.immediate, EDGE_TAKEN);
+            if ((int64_t)last + d.immediate != (int64_t)b.end)
+                edge(b.end, EDGE_FALLTHROUGH);
+            break;
+        case EXIT_CALL:
+            if (b.targetKnown)
+                edge((int32_t)b.target, EDGE_CALL);
+            edge(b.end, EDGE_RETURN_SITE);
+            break;
+        case EXIT_JUMP:
+            edge((int32_t)b.target, EDGE_JUMP);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * Forward constant propagation from the entry block, which starts knowing
+ * nothing (a snapshot or lane input may set any register). Values flow
+ * along every edge but return sites: the state after a call is the state
+ * before it less every register the code at the call's target (as these
+ * states compute it) can write, or less all of them if that code is not
+ * known yet. Fills resolved with the jalr targets the
+ * final states give and adds every target seen on the way to seen.
+ */
+void ControlFlowGraph::propagate(std::map<uint32_t, uint32_t> &resolved, std::set<uint32_t> &seen) const {
+    ALU alu;
+    size_t n = blockList.size();
+    std::vector<Constants> in(n);
+    std::vector<char> reached(n, 0), queued(n, 0);
+    std::map<uint32_t, uint32_t> clobbers;  // callee block -> registers it can write
+    std::vector<uint32_t> work;
+    if (n == 0 || block_at(entryPC) < 0)
+        return;
+    uint32_t start = (uint32_t)block_at(entryPC);
+    reached[start] = queued[start] = 1;
+    work.push_back(start);
+
+    // registers the code at target can write before it returns
+    auto callee_writes = [&](bool known, uint32_t target) -> uint32_t {
+        if (!known || (int32_t)target < 0 || block_at(target) < 0)
+            return ~0u;
+        uint32_t callee = (uint32_t)block_at(target);
+        std::map<uint32_t, uint32_t>::const_iterator cached = clobbers.find(callee);
+        if (cached != clobbers.end())
+            return cached->second;
+        uint32_t mask = 0;
+        std::vector<char> visited(n, 0);
+        std::vector<uint32_t> stack(1, callee);
+        visited[callee] = 1;
+        while (!stack.empty() && mask != ~0u) {
+            const Block &c = blockList[stack.back()];
+            stack.pop_back();
+            mask |= c.writes;
+            if (c.exit == EXIT_INDIRECT || (c.exit == EXIT_CALL && !c.targetKnown))
+                mask = ~0u;
+            for (size_t k = 0; k < c.successors.size(); k++) {
+                if (!visited[c.successors[k].block]) {
+                    visited[c.successors[k].block] = 1;
+                    stack.push_back(c.successors[k].block);
+                }
+            }
+        }
+        clobbers[callee] = mask;
+        return mask;
+    };
+
+    while (!work.empty()) {
+        uint32_t i = work.back();
+        work.pop_back();
+        queued[i] = 0;
+        const Block &b = blockList[i];
+        Constants state = in[i];
+        bool targetKnown = false;
+        uint32_t target = 0;
+        for (uint32_t k = b.first; k < b.first + b.count; k++) {
+            const DecodedInstruction &d = decoded[k];
+            if (d.control.PCSrc == 2 && !is_return(d) && state.has(d.rs1_idx)) {
+                targetKnown = true;
+                target = ((uint32_t)state.value[d.rs1_idx] + (uint32_t)d.immediate) & ~1u;
+                seen.insert(target);
+            }
+            state.step(alu, d, pcs[k]);
+        }
+        for (size_t k = 0; k < b.successors.size(); k++) {
+            const Edge &e = b.successors[k];
+            Constants out = state;
+            if (e.kind == EDGE_RETURN_SITE)
+                out.known &= ~callee_writes(targetKnown, target) | 1u;
+            bool changed;
+            if (!reached[e.block]) {
+                reached[e.block] = 1;
+                in[e.block] = out;
+                changed = true;
+            } else {
+                changed = in[e.block].meet(out);
+            }
+            if (changed && !queued[e.block]) {
+                queued[e.block] = 1;
+                work.push_back(e.block);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        const Block &b = blockList[i];
+        const DecodedInstruction &d = decoded[b.first + b.count - 1];
+        if (!reached[i] || d.control.PCSrc != 2 || is_return(d))
+            continue;
+        Constants state = in[i];
+        for (uint32_t k = b.first; k + 1 < b.first + b.count; k++)
+            state.step(alu, decoded[k], pcs[k]);
+        if (state.has(d.rs1_idx))
+            resolved[b.end - 4] = ((uint32_t)state.value[d.rs1_idx] + (uint32_t)d.immediate) & ~1u;
+    }
+}
+
+/**
+ * Immediate dominators by the iterative method of Cooper, Harvey and
+ * Kennedy, over the blocks in reverse postorder.
+ */
+void ControlFlowGraph::find_dominators() {
+    size_t n = blockList.size();
+    if (n == 0)
+        return;
+    std::vector<uint32_t> order;           // reverse postorder
+    std::vector<uint32_t> rank(n, 0);      // position in order
+    std::vector<char> seen(n, 0);
+    std::vector<std::pair<uint32_t, size_t> > stack;
+    stack.push_back(std::make_pair(entryBlock, (size_t)0));
+    seen[entryBlock] = 1;
+    while (!stack.empty()) {
+        uint32_t b = stack.back().first;
+        size_t &next = stack.back().second;
+        if (next < blockList[b].successors.size()) {
+            uint32_t s = blockList[b].successors[next++].block;
+            if (!seen[s]) {
+                seen[s] = 1;
+                stack.push_back(std::make_pair(s, (size_t)0));
+            }
+        } else {
+            order.push_back(b);
+            stack.pop_back();
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); i++)
+        rank[order[i]] = (uint32_t)i;
+
+    const uint32_t UNDEFINED = 0xFFFFFFFFu;
+    std::vector<uint32_t> idom(n, UNDEFINED);
+    idom[entryBlock] = entryBlock;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); i++) {
+            uint32_t b = order[i];
+            uint32_t dom = UNDEFINED;
+            const std::vector<Edge> &preds = blockList[b].predecessors;
+            for (size_t k = 0; k < preds.size(); k++) {
+                uint32_t p = preds[k].block;
+                if (idom[p] == UNDEFINED)
+                    continue;
+                if (dom == UNDEFINED) {
+                    dom = p;
+                    continue;
+                }
+                // walk both up to their common dominator
+                uint32_t x = p, y = dom;
+                while (x != y) {
+                    while (rank[x] > rank[y])
+                        x = idom[x];
+                    while (rank[y] > rank[x])
+                        y = idom[y];
+                }
+                dom = x;
+            }
+            if (dom != idom[b]) {
+                idom[b] = dom;
+                changed = true;
+            }
+        }
+    }
+    for (size_t b = 0; b < n; b++)
+        blockList[b].idom = idom[b] == UNDEFINED ? (uint32_t)b : idom[b];
+}
+
+/**
+ * Natural loops of the back edges, one per header. Calls are left out on
+ * both ends: a call edge never closes a loop (recursion is not a loop),
+ * and a loop's body is gathered without walking into the functions it
+ * calls, since their returns have no edges back.
+ */
+void ControlFlowGraph::find_loops() {
+    std::map<uint32_t, std::vector<uint32_t> > latchesByHeader;
+    for (size_t b = 0; b < blockList.size(); b++) {
+        const std::vector<Edge> &succs = blockList[b].successors;
+        for (size_t k = 0; k < succs.size(); k++) {
+            if (succs[k].kind != EDGE_CALL && dominates(succs[k].block, (uint32_t)b))
+                latchesByHeader[succs[k].block].push_back((uint32_t)b);
+        }
+    }
+
+    std::vector<char> inLoop(blockList.size(), 0);
+    for (std::map<uint32_t, std::vector<uint32_t> >::const_iterator it = latchesByHeader.begin();
+         it != latchesByHeader.end(); ++it) {
+        Loop loop;
+        loop.header = it->first;
+        loop.latches = it->second;
+        std::fill(inLoop.begin(), inLoop.end(), 0);
+        inLoop[loop.header] = 1;
+        std::vector<uint32_t> work(loop.latches);
+        while (!work.empty()) {
+            uint32_t b = work.back();
+            work.pop_back();
+            if (inLoop[b])
+                continue;
+            inLoop[b] = 1;
+            const std::vector<Edge> &preds = blockList[b].predecessors;
+            for (size_t k = 0; k < preds.size(); k++) {
+                if (preds[k].kind != EDGE_CALL)
+                    work.push_back(preds[k].block);
+            }
+        }
+        loop.blocks.push_back(loop.header);
+        for (size_t b = 0; b < blockList.size(); b++) {
+            if (inLoop[b] && b != loop.header)
+                loop.blocks.push_back((uint32_t)b);
+        }
+
+        loop.reads = loop.writes = 0;
+        loop.loads = loop.stores = loop.calls = loop.indirect = false;
+        loop.instructions = 0;
+        for (size_t k = 0; k < loop.blocks.size(); k++) {
+            const Block &b = blockList[loop.blocks[k]];
+            loop.reads |= b.reads;
+            loop.writes |= b.writes;
+            loop.calls |= b.exit == EXIT_CALL;
+            loop.indirect |= b.exit == EXIT_RETURN || b.exit == EXIT_INDIRECT;
+            loop.instructions += b.count;
+            for (uint32_t i = b.first; i < b.first + b.count; i++) {
+                loop.loads |= decoded[i].control.MemRead;
+                loop.stores |= decoded[i].control.MemWrite;
+            }
+            for (size_t s = 0; s < b.successors.size(); s++) {
+                const Edge &e = b.successors[s];
+                if (e.kind != EDGE_CALL && !inLoop[e.block] &&
+                    std::find(loop.exits.begin(), loop.exits.end(), e.block) == loop.exits.end())
+                    loop.exits.push_back(e.block);
+            }
+        }
+        std::sort(loop.exits.begin(), loop.exits.end());
+        loop.parent = -1;
+        loop.depth = 1;
+        loop.weight = 0;
+        loopList.push_back(loop);
+    }
+
+    // a loop holds more blocks than any loop inside it
+    std::stable_sort(loopList.begin(), loopList.end(),
+                     [](const Loop &a, const Loop &b) { return a.blocks.size() > b.blocks.size(); });
+    for (size_t l = 0; l < loopList.size(); l++) {
+        Loop &loop = loopList[l];
+        // the innermost loop marked so far around the header encloses this one
+        loop.parent = blockList[loop.header].loop;
+        loop.depth = loop.parent < 0 ? 1 : loopList[loop.parent].depth + 1;
+        for (size_t k = 0; k < loop.blocks.size(); k++)
+            blockList[loop.blocks[k]].loop = (int)l;
+    }
+
+    for (size_t l = 0; l < loopList.size(); l++) {
+        Loop &loop = loopList[l];
+        for (size_t k = 0; k < loop.blocks.size(); k++) {
+            const Block &b = blockList[loop.blocks[k]];
+            uint64_t scale = 1;
+            for (unsigned d = std::min(loopList[b.loop].depth, MAX_WEIGHT_DEPTH); d > 0; d--)
+                scale *= 10;
+            loop.weight += b.count * scale;
+        }
+    }
+}
+
+uint32_t ControlFlowGraph::entry() const {
+    return entryPC;
+}
+
+const std::vector<DecodedInstruction> &ControlFlowGraph::instructions() const {
+    return decoded;
+}
+
+const std::vector<uint32_t> &ControlFlowGraph::addresses() const {
+    return pcs;
+}
+
+const std::vector<ControlFlowGraph::Block> &ControlFlowGraph::blocks() const {
+    return blockList;
+}
+
+const std::vector<ControlFlowGraph::Loop> &ControlFlowGraph::loops() const {
+    return loopList;
+}
+
+int ControlFlowGraph::block_at(uint32_t pc) const {
+    // last block at or before pc, ordering by (start % 4, start)
+    size_t low = 0, high = byOffset.size();
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        uint32_t start = blockList[byOffset[middle]].start;
+        if ((start & 3) < (pc & 3) || ((start & 3) == (pc & 3) && start <= pc))
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low == 0)
+        return -1;
+    uint32_t id = byOffset[low - 1];
+    const Block &b = blockList[id];
+    return (b.start & 3) == (pc & 3) && pc >= b.start && pc < b.end ? (int)id : -1;
+}
+
+uint32_t ControlFlowGraph::entry_block() const {
+    return entryBlock;
+}
+
+bool ControlFlowGraph::dominates(uint32_t a, uint32_t b) const {
+    for (;;) {
+        if (a == b)
+            return true;
+        if (blockList[b].idom == b)
+            return false;
+        b = blockList[b].idom;
+    }
+}
+
+std::vector<uint32_t> ControlFlowGraph::hot_loops() const {
+    std::vector<uint32_t> order;
+    for (size_t l = 0; l < loopList.size(); l++)
+        order.push_back((uint32_t)l);
+    std::stable_sort(order.begin(), order.end(),
+                     [this](uint32_t a, uint32_t b) { return loopList[a].weight > loopList[b].weight; });
+    return order;
+}
+
+static const char *exit_name(ControlFlowGraph::Exit exit) {
+    static const char *const NAMES[] = { "fallthrough", "branch", "call", "return", "jump", "indirect", "halt" };
+    return NAMES[exit];
+}
+
+static const char *edge_name(ControlFlowGraph::EdgeKind kind) {
+    static const char *const NAMES[] = { "fallthrough", "taken", "call", "return-site", "jump" };
+    return NAMES[kind];
+}
+
+static std::string address(uint32_t value) {
+    char text[16];
+    snprintf(text, sizeof(text), "0x%08x", value);
+    return text;
+}
+
+// Register names of a mask, for the JSON dump
+static std::string register_list(uint32_t mask) {
+    std::string text = "[";
+    for (unsigned r = 0; r < 32; r++) {
+        if (!(mask >> r & 1))
+            continue;
+        if (text.size() > 1)
+            text += ", ";
+        text += "\"x" + std::to_string(r) + "\"";
+    }
+    return text + "]";
+}
+
+static std::string dot_escape(const std::string &text) {
+    std::string escaped;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '"' || text[i] == '\\')
+            escaped += '\\';
+        escaped += text[i];
+    }
+    return escaped;
+}
+
+// Loop clusters nest the way the loops do
+static void write_cluster(std::ostream &out, const ControlFlowGraph &graph, int loop, unsigned indent) {
+    const std::vector<ControlFlowGraph::Block> &blocks = graph.blocks();
+    const std::vector<ControlFlowGraph::Loop> &loops = graph.loops();
+    std::string pad(indent, ' ');
+    for (size_t b = 0; b < blocks.size(); b++) {
+        if (blocks[b].loop == loop)
+            out << pad << "b" << b << ";\n";
+    }
+    for (size_t l = 0; l < loops.size(); l++) {
+        if (loops[l].parent != loop)
+            continue;
+        const ControlFlowGraph::Loop &inner = loops[l];
+        out << pad << "subgraph cluster_loop" << l << " {\n"
+            << pad << "  label=\"loop " << l << " (depth " << inner.depth << ", weight " << inner.weight << ")\";\n"
+            << pad << "  style=dashed;\n";
+        write_cluster(out, graph, (int)l, indent + 2);
+        out << pad << "}\n";
+    }
+}
+
+void ControlFlowGraph::write_dot(std::ostream &out, CPU &disassembler) const {
+    out << "digraph cfg {\n  node [shape=box, fontname=\"monospace\"];\n";
+    for (size_t i = 0; i < blockList.size(); i++) {
+        const Block &b = blockList[i];
+        out << "  b" << i << " [label=\"" << address(b.start) << "\\l";
+        for (uint32_t k = b.first; k < b.first + b.count; k++)
+            out << "  " << dot_escape(disassembler.disassemble(decoded[k].instruction)) << "\\l";
+        if (b.exit != EXIT_FALLTHROUGH && b.exit != EXIT_BRANCH) {
+            out << "-> " << exit_name(b.exit);
+            if (b.targetKnown)
+                out << " " << address(b.target);
+            out << "\\l";
+        }
+        out << "\"";
+        if (i == entryBlock)
+            out << ", penwidth=2";
+        out << "];\n";
+    }
+    write_cluster(out, *this, -1, 2);
+    for (size_t i = 0; i < blockList.size(); i++) {
+        const std::vector<Edge> &succs = blockList[i].successors;
+        for (size_t k = 0; k < succs.size(); k++) {
+            out << "  b" << i << " -> b" << succs[k].block << " [label=\"" << edge_name(succs[k].kind) << "\"";
+            if (succs[k].kind == EDGE_CALL || succs[k].kind == EDGE_RETURN_SITE)
+                out << ", style=dashed";
+            else if (dominates(succs[k].block, (uint32_t)i))
+                out << ", color=red";
+            out << "];\n";
+        }
+    }
+    out << "}\n";
+}
+
+void ControlFlowGraph::write_json(std::ostream &out) const {
+    out << "{\n  \"entry\": " << entryPC << ",\n  \"entry_block\": " << entryBlock
+        << ",\n  \"instructions\": " << decoded.size() << ",\n  \"blocks\": [";
+    for (size_t i = 0; i < blockList.size(); i++) {
+        const Block &b = blockList[i];
+        out << (i ? "," : "") << "\n    {\"id\": " << i << ", \"start\": " << b.start << ", \"end\": " << b.end
+            << ", \"instructions\": " << b.count << ", \"exit\": \"" << exit_name(b.exit) << "\"";
+        if (b.targetKnown)
+            out << ", \"target\": " << b.target;
+        out << ", \"successors\": [";
+        for (size_t k = 0; k < b.successors.size(); k++)
+            out << (k ? ", " : "") << "{\"block\": " << b.successors[k].block << ", \"kind\": \""
+                << edge_name(b.successors[k].kind) << "\"}";
+        out << "], \"idom\": " << b.idom << ", \"loop\": " << b.loop << ", \"reads\": " << register_list(b.reads)
+            << ", \"writes\": " << register_list(b.writes) << "}";
+    }
+    out << "\n  ],\n  \"loops\": [";
+    for (size_t l = 0; l < loopList.size(); l++) {
+        const Loop &loop = loopList[l];
+        out << (l ? "," : "") << "\n    {\"id\": " << l << ", \"header\": " << loop.header
+            << ", \"header_pc\": " << blockList[loop.header].start << ", \"blocks\": [";
+        for (size_t k = 0; k < loop.blocks.size(); k++)
+            out << (k ? ", " : "") << loop.blocks[k];
+        out << "], \"latches\": [";
+        for (size_t k = 0; k < loop.latches.size(); k++)
+            out << (k ? ", " : "") << loop.latches[k];
+        out << "], \"exits\": [";
+        for (size_t k = 0; k < loop.exits.size(); k++)
+            out << (k ? ", " : "") << loop.exits[k];
+        out << "], \"parent\": " << loop.parent << ", \"depth\": " << loop.depth
+            << ", \"instructions\": " << loop.instructions << ", \"reads\": " << register_list(loop.reads)
+            << ", \"writes\": " << register_list(loop.writes) << ", \"loads\": " << (loop.loads ? "true" : "false")
+            << ", \"stores\": " << (loop.stores ? "true" : "false") << ", \"calls\": " << (loop.calls ? "true" : "false")
+            << ", \"indirect\": " << (loop.indirect ? "true" : "false") << ", \"weight\": " << loop.weight << "}";
+    }
+    out << "\n  ],\n  \"hot_loops\": [";
+    std::vector<uint32_t> hot = hot_loops();
+    for (size_t k = 0; k < hot.size(); k++)
+        out << (k ? ", " : "") << hot[k];
+    out << "]\n}\n";
+}
@@ -0,0 +1,118 @@
+#ifndef CONTROL_FLOW_GRAPH_H
+#define CONTROL_FLOW_GRAPH_H
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <set>
+#include <vector>
+
+#include "CPU.h"
+#include "Program.h"
+
+// Static control-flow graph of a program image, built before it runs.
+// Every instruction reachable from the entry point is decoded with the
+// same Controller and ImmediateGenerator the CPU uses, and split into
+// basic blocks at bne targets, after bne and jalr, and at the halt word.
+//
+// jalr targets are resolved where the base register holds a constant:
+// lui, addi and the like folded with the ALU and propagated along the
+// graph's edges. jalr to a link register (x1 or x5) is a call, assumed to
+// come back to the next instruction, and jalr through one is a return.
+// Other targets stay unknown and the block's exit says so.
+//
+// Loops are natural loops: a back edge is an edge to a block that
+// dominates its source, and back edges to the same header make one loop.
+// Loops found this way nest, and each one records the registers its blocks
+// read and write and whether it touches memory or calls out. Hotness is
+// estimated from nesting alone: each level counts ten times the one
+// around it.
+class ControlFlowGraph {
+public:
+    // How control leaves a block
+    enum Exit {
+        EXIT_FALLTHROUGH,  // into the next block, which other edges also enter
+        EXIT_BRANCH,       // bne: taken target and fall-through
+        EXIT_CALL,         // jalr writing a link register
+        EXIT_RETURN,       // jalr through a link register
+        EXIT_JUMP,         // other jalr with a known target
+        EXIT_INDIRECT,     // other jalr with an unknown target
+        EXIT_HALT          // next PC holds 0 or is past the PC limit
+    };
+
+    enum EdgeKind { EDGE_FALLTHROUGH, EDGE_TAKEN, EDGE_CALL, EDGE_RETURN_SITE, EDGE_JUMP };
+
+    struct Edge {
+        uint32_t block;
+        EdgeKind kind;
+    };
+
+    struct Block {
+        uint32_t start;           // first PC
+        uint32_t end;             // PC after the last instruction
+        uint32_t first, count;    // range in instructions()
+        Exit exit;
+        bool targetKnown;         // EXIT_CALL, EXIT_JUMP: the target resolved
+        uint32_t target;
+        std::vector<Edge> successors;
+        std::vector<Edge> predecessors;   // edge.block is the source
+        uint32_t idom;            // immediate dominator (the entry block: itself)
+        int loop;                 // innermost loop, -1 if none
+        uint32_t reads, writes;   // registers, bit per register
+    };
+
+    struct Loop {
+        uint32_t header;
+        std::vector<uint32_t> blocks;   // header first, then by address
+        std::vector<uint32_t> latches;  // sources of the back edges
+        std::vector<uint32_t> exits;    // blocks outside entered from inside
+        int parent;                     // enclosing loop, -1 if outermost
+        unsigned depth;                 // 1 for outermost loops
+        uint32_t reads, writes;         // registers, bit per register
+        bool loads, stores, calls, indirect;
+        unsigned instructions;
+        uint64_t weight;                // estimated hotness (see hot_loops)
+    };
+
+    // Constructor - analyzes program from its entry point
+    explicit ControlFlowGraph(const Program &program);
+
+    uint32_t entry() const;
+    const std::vector<DecodedInstruction> &instructions() const;
+    const std::vector<uint32_t> &addresses() const;  // PC of each instruction
+    // By address; the entry's may not be first. A block entered at a
+    // halfword (jalr or bne to pc % 4 == 2) decodes its own instructions and
+    // may overlap the word-aligned blocks around it.
+    const std::vector<Block> &blocks() const;
+    const std::vector<Loop> &loops() const;          // outer loops before the loops they hold
+
+    // Block holding the instruction at pc, -1 if unreachable
+    int block_at(uint32_t pc) const;
+    uint32_t entry_block() const;
+    bool dominates(uint32_t a, uint32_t b) const;
+    // Loops by estimated hotness: instructions in the loop's blocks, each
+    // block scaled by 10 per loop level around it
+    std::vector<uint32_t> hot_loops() const;
+
+    void write_dot(std::ostream &out, CPU &disassembler) const;
+    void write_json(std::ostream &out) const;
+
+private:
+    unsigned long pcLimit;
+    uint32_t entryPC;
+    uint32_t entryBlock;
+    std::vector<DecodedInstruction> decoded;
+    std::vector<uint32_t> pcs;
+    std::vector<Block> blockList;
+    std::vector<uint32_t> byOffset;   // block ids by start % 4, then start
+    std::vector<Loop> loopList;
+
+    void build(const Program &program);
+    void cut(const Program &program, const std::set<uint32_t> &jumpTargets);
+    void link(const std::map<uint32_t, uint32_t> &targets);
+    void propagate(std::map<uint32_t, uint32_t> &resolved, std::set<uint32_t> &seen) const;
+    void find_dominators();
+    void find_loops();
+};
+
+#endif // CONTROL_FLOW_GRAPH_H
@@ -1,73 +1,201 @@
 #include "Controller.h"
 
+// Decode tables. The rule lists below are the editable part: the flat
+// tables the decoder indexes are expanded from them at compile time, and
+// static_asserts check every entry against the reference functions.
+// tests/controller_test.cpp checks the result against the original
+// switch-based control logic for every opcode, funct3, funct7 and ALUOp.
+// Adding an instruction means adding a rule (and teaching the reference
+// functions and the original logic in the test about it).
+
+namespace {
+
+constexpr ControlSignals signals(bool RegWrite, bool MemRead, bool MemWrite, bool Branch,
+                                 bool ALUSrc, bool MemtoReg, uint8_t ALUOp, bool LUISel,
+                                 bool JALRSel, uint8_t PCSrc) {
+    return ControlSignals{ RegWrite, MemRead, MemWrite, Branch, ALUSrc, MemtoReg,
+                           ALUOp, LUISel, JALRSel, PCSrc };
+}
+
+// All signals false and 0: unknown opcodes
+constexpr ControlSignals NO_SIGNALS = signals(false, false, false, false, false, false, 0, false, false, 0);
+
+struct ControlRule {
+    uint8_t opcode;
+    ControlSignals signals;
+};
+
+// Mapping according to the controls table.
+//            RegWrite MemRead MemWrite Branch ALUSrc MemtoReg ALUOp LUISel JALRSel PCSrc
+constexpr ControlRule CONTROL_RULES[] = {
+    { RTYPE, signals(true,  false, false, false, false, false, 0b10, false, false, 0) },
+    { ITYPE, signals(true,  false, false, false, true,  false, 0b00, false, false, 0) },
+    // LUI selector - use the immediate instead of the ALU result
+    { LUI,   signals(true,  false, false, false, true,  false, 0b00, true,  false, 0) },
+    { LW,    signals(true,  true,  false, false, true,  true,  0b00, false, false, 0) },
+    { SW,    signals(false, false, true,  false, true,  true,  0b00, false, false, 0) },
+    // PC + immediate if the branch is taken
+    { BNE,   signals(false, false, false, true,  false, true,  0b01, false, false, 1) },
+    // write PC+4 to rd, jump to rs1 + immediate
+    { JALR,  signals(true,  false, false, false, true,  false, 0b00, false, true,  2) },
+};
+constexpr unsigned CONTROL_RULE_COUNT = sizeof(CONTROL_RULES) / sizeof(CONTROL_RULES[0]);
+
+constexpr ControlSignals find_control(unsigned opcode, unsigned rule) {
+    return rule == CONTROL_RULE_COUNT ? NO_SIGNALS
+         : CONTROL_RULES[rule].opcode == opcode ? CONTROL_RULES[rule].signals
+         : find_control(opcode, rule + 1);
+}
+
+// 4-bit ALU operations (see ALU::execute)
+enum {
+    ALU_AND = 0b0000, ALU_OR = 0b0001, ALU_ADD = 0b0010, ALU_SLTU = 0b0011,
+    ALU_SUB = 0b0110, ALU_SRA = 0b0111
+};
+
+const uint8_t ANY = 0xFF;
+
+// First matching rule wins; anything unmatched adds (loads, stores,
+// I-type, LUI and JALR all use ALUOp 00)
+struct AluRule {
+    uint8_t opcode, funct3, funct7;
+    uint8_t operation;
+};
+
+constexpr AluRule ALU_RULES[] = {
+    { RTYPE, 0b000, 0b0000000, ALU_ADD },
+    { RTYPE, 0b000, 0b0100000, ALU_SUB },
+    { RTYPE, 0b101, 0b0100000, ALU_SRA },
+    { RTYPE, 0b111, 0b0000000, ALU_AND },
+    { BNE,   ANY,   ANY,       ALU_SUB },
+};
+constexpr unsigned ALU_RULE_COUNT = sizeof(ALU_RULES) / sizeof(ALU_RULES[0]);
+
+// The ALU table is indexed by opcode, funct3 and the only three funct7
+// cases the rules tell apart: 0000000, 0100000 and anything else
+constexpr unsigned funct7_class(unsigned funct7) {
+    return funct7 == 0b0000000 ? 0 : funct7 == 0b0100000 ? 1 : 2;
+}
+
+constexpr unsigned alu_index(unsigned opcode, unsigned funct3, unsigned funct7) {
+    return ((opcode & 0x7F) << 5) | ((funct3 & 0b111) << 2) | funct7_class(funct7);
+}
+
+// A funct7 value of each class (class 3 is unused and repeats class 2)
+constexpr uint8_t class_funct7(unsigned cls) {
+    return cls == 0 ? 0b0000000 : cls == 1 ? 0b0100000 : 0b0000001;
+}
+
+constexpr bool rule_matches(const AluRule &rule, unsigned index) {
+    return rule.opcode == (index >> 5) &&
+           (rule.funct3 == ANY || rule.funct3 == ((index >> 2) & 0b111)) &&
+           (rule.funct7 == ANY || funct7_class(rule.funct7) == funct7_class(class_funct7(index & 3)));
+}
+
+constexpr uint8_t find_alu(unsigned index, unsigned rule) {
+    return rule == ALU_RULE_COUNT ? (uint8_t)ALU_ADD
+         : rule_matches(ALU_RULES[rule], index) ? ALU_RULES[rule].operation
+         : find_alu(index, rule + 1);
+}
+
+#define EXPAND4(f, i) f(i), f((i) + 1), f((i) + 2), f((i) + 3)
+#define EXPAND16(f, i) EXPAND4(f, i), EXPAND4(f, (i) + 4), EXPAND4(f, (i) + 8), EXPAND4(f, (i) + 12)
+#define EXPAND64(f, i) EXPAND16(f, i), EXPAND16(f, (i) + 16), EXPAND16(f, (i) + 32), EXPAND16(f, (i) + 48)
+#define EXPAND256(f, i) EXPAND64(f, i), EXPAND64(f, (i) + 64), EXPAND64(f, (i) + 128), EXPAND64(f, (i) + 192)
+#define EXPAND1024(f, i) EXPAND256(f, i), EXPAND256(f, (i) + 256), EXPAND256(f, (i) + 512), EXPAND256(f, (i) + 768)
+
+#define CONTROL_ENTRY(i) find_control(i, 0)
+#define ALU_ENTRY(i) find_alu(i, 0)
+
+// opcode -> control signals
+constexpr ControlSignals CONTROL_TABLE[128] = {
+    EXPAND64(CONTROL_ENTRY, 0), EXPAND64(CONTROL_ENTRY, 64)
+};
+
+// alu_index(opcode, funct3, funct7) -> ALU operation
+constexpr uint8_t ALU_TABLE[4096] = {
+    EXPAND1024(ALU_ENTRY, 0), EXPAND1024(ALU_ENTRY, 1024),
+    EXPAND1024(ALU_ENTRY, 2048), EXPAND1024(ALU_ENTRY, 3072)
+};
+
+#undef ALU_ENTRY
+#undef CONTROL_ENTRY
+#undef EXPAND1024
+#undef EXPAND256
+#undef EXPAND64
+#undef EXPAND16
+#undef EXPAND4
+
 /**
- * Generates control signals based *only on the opcode.
- * This function is direct implementation of the control logic table.
+ * Reference control logic: the signals generated *only* from the opcode,
+ * as the original switch over the control table did.
  */
-ControlSignals Controller::generate_signals(uint8_t opcode) {
-    
-    ControlSignals signals;
+constexpr ControlSignals reference_signals(unsigned opcode) {
+    return opcode == RTYPE ? signals(true, false, false, false, false, false, 0b10, false, false, 0)
+         : opcode == ITYPE ? signals(true, false, false, false, true, false, 0, false, false, 0)
+         : opcode == LUI ? signals(true, false, false, false, true, false, 0, true, false, 0)
+         : opcode == LW ? signals(true, true, false, false, true, true, 0, false, false, 0)
+         : opcode == SW ? signals(false, false, true, false, true, true, 0, false, false, 0)
+         : opcode == BNE ? signals(false, false, false, true, false, true, 0b01, false, false, 1)
+         : opcode == JALR ? signals(true, false, false, false, true, false, 0, false, true, 2)
+         : NO_SIGNALS;
+}
+
+/**
+ * Reference ALU control: the 2-bit ALUOp, funct3, funct7 and opcode to
+ * the 4-bit ALU operation. ALUOp 00 (load/store/ADDI) adds and 01 (BNE)
+ * subtracts; R-type (10) decodes funct3/funct7. The I-type arm is only
+ * reached with an ALUOp other than the 00 the control table gives I-type,
+ * so every I-type instruction adds.
+ */
+constexpr uint8_t reference_alu(unsigned opcode, unsigned funct3, unsigned funct7, unsigned alu_op) {
+    return alu_op == 0b00 ? ALU_ADD
+         : alu_op == 0b01 ? ALU_SUB
+         : alu_op == 0b10 && funct3 == 0b000 && funct7 == 0b0000000 ? ALU_ADD
+         : alu_op == 0b10 && funct3 == 0b000 && funct7 == 0b0100000 ? ALU_SUB
+         : alu_op == 0b10 && funct3 == 0b101 && funct7 == 0b0100000 ? ALU_SRA
+         : alu_op == 0b10 && funct3 == 0b111 && funct7 == 0b0000000 ? ALU_AND
+         : opcode == ITYPE && funct3 == 0b110 ? ALU_OR
+         : opcode == ITYPE && funct3 == 0b011 ? ALU_SLTU
+         : ALU_ADD;
+}
+
+constexpr bool same_signals(const ControlSignals &a, const ControlSignals &b) {
+    return a.RegWrite == b.RegWrite && a.MemRead == b.MemRead && a.MemWrite == b.MemWrite &&
+           a.Branch == b.Branch && a.ALUSrc == b.ALUSrc && a.MemtoReg == b.MemtoReg &&
+           a.ALUOp == b.ALUOp && a.LUISel == b.LUISel && a.JALRSel == b.JALRSel &&
+           a.PCSrc == b.PCSrc;
+}
+
+// Halving recursion keeps the constexpr depth at log2 of the table size
+constexpr bool control_table_matches(unsigned first, unsigned count) {
+    return count == 1 ? same_signals(CONTROL_TABLE[first], reference_signals(first))
+         : control_table_matches(first, count / 2) &&
+           control_table_matches(first + count / 2, count - count / 2);
+}
 
-    // Initialize all signals to false and 0
-    signals.RegWrite = false;
-    signals.MemRead = false;
-    signals.MemWrite = false;
-    signals.Branch = false;
-    signals.ALUSrc = false;
-    signals.MemtoReg = false;
-    signals.ALUOp = 0;
-    signals.LUISel = false;
-    signals.JALRSel = false;
-    signals.PCSrc = 0;
-    
-    // Mapping according to the controls table
-    switch (opcode) {
-        case RTYPE: 
-			signals.RegWrite = true; 
-			signals.ALUOp = 0b10; 
-			signals.PCSrc = 0; // PC+4
-			break; // R-type
-        case ITYPE: 
-			signals.RegWrite = true; 
-			signals.ALUSrc = true; 
-			signals.PCSrc = 0; // PC+4
-			break; // I-type
-        case LUI: 
-			signals.RegWrite = true; 
-			signals.ALUSrc = true; 
-			signals.LUISel = true; // LUI selector - Use immediate instead of ALU result
-			signals.PCSrc = 0; // PC+4
-			break; // LUI
-        case LW: 
-			signals.RegWrite = true; 
-			signals.MemRead = true; 
-			signals.ALUSrc = true; 
-			signals.MemtoReg = true; 
-			signals.PCSrc = 0; // PC+4
-			break; // Load
-        case SW: 
-			signals.MemWrite = true; 
-			signals.ALUSrc = true; 
-            signals.MemtoReg = true;
-			signals.PCSrc = 0; // PC+4
-			break; // Store
-        case BNE: 
-			signals.Branch = true; 
-			signals.ALUOp = 0b01; 
-            signals.MemtoReg = true;
-			signals.PCSrc = 1; // PC + immediate (if branch taken)
-			break; // BNE
-        case JALR: 
-			signals.RegWrite = true; 
-			signals.ALUSrc = true; 
-			signals.JALRSel = true; // Write PC+4 to register
-			signals.PCSrc = 2; 
-			break; // JALR
-        default:
-            break;
-    }
-
-    return signals;
+constexpr bool alu_entry_matches(unsigned index) {
+    return ALU_TABLE[index] == reference_alu(index >> 5, (index >> 2) & 0b111, class_funct7(index & 3),
+                                             reference_signals(index >> 5).ALUOp);
+}
+
+constexpr bool alu_table_matches(unsigned first, unsigned count) {
+    return count == 1 ? alu_entry_matches(first)
+         : alu_table_matches(first, count / 2) &&
+           alu_table_matches(first + count / 2, count - count / 2);
+}
+
+static_assert(control_table_matches(0, 128), "CONTROL_RULES disagree with reference_signals");
+static_assert(alu_table_matches(0, 4096), "ALU_RULES disagree with reference_alu");
+
+} // namespace
+
+/**
+ * Generates control signals based *only on the opcode: one load from the
+ * control table.
+ */
+ControlSignals Controller::generate_signals(uint8_t opcode) {
+    return CONTROL_TABLE[opcode & 0x7F];
 }
 
 /**
@@ -75,32 +203,13 @@ ControlSignals Controller::generate_signals(uint8_t opcode) {
  * Takes the 2-bit ALUOp, funct3, funct7 and opcode to generate the 4-bit ALU operation signal.
  */
 uint8_t Controller::aluController(uint8_t opcode, uint8_t funct3, uint8_t funct7, uint8_t alu_op) {
-    if (alu_op == 0b00) 
-        return 0b0010; // ADD (for Load/Store/ADDI)
-    if (alu_op == 0b01) 
-        return 0b0110; // SUB (for BNE)
-    
-    // For R-type instructions (ALUOp = 10), decode funct3/funct7
-    if (alu_op == 0b10) {
-        if (funct3 == 0b000 && funct7 == 0b0000000) 
-            return 0b0010; // ADD
-        if (funct3 == 0b000 && funct7 == 0b0100000) 
-            return 0b0110; // SUB
-        if (funct3 == 0b101 && funct7 == 0b0100000) 
-            return 0b0111; // SRA
-        if (funct3 == 0b111 && funct7 == 0b0000000) 
-            return 0b0000; // AND
-    }
-
-    // For I-type ALU instructions (opcode 0010011), decode funct3
-    if(opcode == 0b0010011) {
-        if (funct3 == 0b110) 
-            return 0b0001; // ORI
-        if (funct3 == 0b011) 
-            return 0b0011; // SLTIU
-        if (funct3 == 0b000) 
-            return 0b0010; // ADDI
-    }
-
-    return 0b0010; // Default : ADD
+    return reference_alu(opcode, funct3, funct7, alu_op);
+}
+
+/**
+ * The ALU operation of an instruction straight from its fields, i.e.
+ * aluController with the ALUOp generate_signals gives the opcode.
+ */
+uint8_t Controller::aluOperation(uint8_t opcode, uint8_t funct3, uint8_t funct7) {
+    return ALU_TABLE[alu_index(opcode, funct3, funct7)];
 }
@@ -28,6 +28,9 @@ enum opCodes
     JALR = 0b1100111,
 };
 
+// Decoding is done with flat tables generated at compile time from rule
+// lists (see Controller.cpp), so the decoder does a load instead of a
+// chain of compares.
 class Controller {
 public:
     // Control logic.
@@ -35,6 +38,10 @@ public:
 
     // ALU Control logic.
     uint8_t aluController(uint8_t opcode, uint8_t funct3, uint8_t funct7, uint8_t alu_op);
+
+    // ALU operation straight from the instruction fields: aluController
+    // with the ALUOp that generate_signals(opcode) gives.
+    uint8_t aluOperation(uint8_t opcode, uint8_t funct3, uint8_t funct7);
 };
 
 #endif // CONTROLLER_H
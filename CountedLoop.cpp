@@ -0,0 +1,478 @@
+#include "CountedLoop.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Fewest iterations worth skipping; shorter runs just execute
+static const uint64_t MIN_SKIPPED = 16;
+// Entries in a row that skipped nothing before they stop being sampled at
+// all, for 2^misses - 1 calls (and the calls before the current one exits)
+static const unsigned MAX_MISSES = 10;
+
+// A value as a function of the registers at the start of an iteration:
+// sum of coef[i] * start[i], plus a constant that does not matter here
+// (opaque: some other function of the registers in deps)
+struct Form {
+    uint32_t coef[32];
+    uint32_t deps;   // registers it may depend on, bit per register
+    bool opaque;
+};
+
+static void form_register(Form &f, unsigned index) {
+    memset(f.coef, 0, sizeof(f.coef));
+    f.deps = 0;
+    f.opaque = false;
+    if (index != 0) {
+        f.coef[index] = 1;
+        f.deps = 1u << index;
+    }
+}
+
+static void form_combine(Form &f, const Form &a, const Form &b, uint32_t sign) {
+    for (unsigned i = 0; i < 32; i++)
+        f.coef[i] = a.coef[i] + sign * b.coef[i];
+    f.deps = a.deps | b.deps;
+    f.opaque = a.opaque || b.opaque;
+}
+
+// True if the value changes from one iteration to the next
+static bool form_variant(const Form &f, uint32_t written) {
+    if (f.opaque)
+        return true;
+    for (unsigned i = 1; i < 32; i++) {
+        if (f.coef[i] != 0 && (written >> i & 1))
+            return true;
+    }
+    return false;
+}
+
+static bool is_store(const TranslatedOp &op) {
+    return op.kind == OP_SH || op.kind == OP_SW;
+}
+
+// Register effect of a body op, as run_body in BlockEngine.cpp has it
+static void execute(int32_t *r, const TranslatedOp &op) {
+    switch (op.kind) {
+        case OP_ADD:   r[op.rd] = (int32_t)((uint32_t)r[op.rs1] + (uint32_t)r[op.rs2]); break;
+        case OP_SUB:   r[op.rd] = (int32_t)((uint32_t)r[op.rs1] - (uint32_t)r[op.rs2]); break;
+        case OP_AND:   r[op.rd] = r[op.rs1] & r[op.rs2]; break;
+        case OP_OR:    r[op.rd] = r[op.rs1] | r[op.rs2]; break;
+        case OP_SLTU:  r[op.rd] = ((uint32_t)r[op.rs1] < (uint32_t)r[op.rs2]) ? 1 : 0; break;
+        case OP_SRA:   r[op.rd] = r[op.rs1] >> (r[op.rs2] & 0x1F); break;
+        case OP_ADDI:  r[op.rd] = (int32_t)((uint32_t)r[op.rs1] + (uint32_t)op.imm); break;
+        case OP_SUBI:  r[op.rd] = (int32_t)((uint32_t)r[op.rs1] - (uint32_t)op.imm); break;
+        case OP_ANDI:  r[op.rd] = r[op.rs1] & op.imm; break;
+        case OP_ORI:   r[op.rd] = r[op.rs1] | op.imm; break;
+        case OP_SLTIU: r[op.rd] = ((uint32_t)r[op.rs1] < (uint32_t)op.imm) ? 1 : 0; break;
+        case OP_SRAI:  r[op.rd] = r[op.rs1] >> (op.imm & 0x1F); break;
+        case OP_LUI:   r[op.rd] = op.imm; break;
+        default:       break;
+    }
+}
+
+/**
+ * Binomial coefficient C(n, k) modulo 2^32, for k <= MAX_DEGREE. The k
+ * consecutive factors of n!/(n-k)! hold every prime factor of k! (only 2
+ * and 3 for k <= 4), which are divided out before multiplying.
+ */
+static uint32_t binomial(uint64_t n, unsigned k) {
+    if (n < k)
+        return 0;
+    uint64_t factors[CountedLoop::MAX_DEGREE];
+    for (unsigned i = 0; i < k; i++)
+        factors[i] = n - i;
+    static const unsigned primes[] = { 2, 3 };
+    for (unsigned p = 0; p < 2; p++) {
+        // exponent of the prime in k!
+        unsigned count = 0;
+        for (unsigned m = 2; m <= k; m++) {
+            for (unsigned v = m; v % primes[p] == 0; v /= primes[p])
+                count++;
+        }
+        for (unsigned i = 0; i < k && count > 0; i++) {
+            while (count > 0 && factors[i] % primes[p] == 0) {
+                factors[i] /= primes[p];
+                count--;
+            }
+        }
+    }
+    uint32_t result = 1;
+    for (unsigned i = 0; i < k; i++)
+        result *= (uint32_t)factors[i];
+    return result;
+}
+
+// Inverse of an odd number modulo 2^32 (Newton's iteration)
+static uint32_t inverse(uint32_t a) {
+    uint32_t x = a;
+    for (int i = 0; i < 4; i++)
+        x *= 2 - a * x;
+    return x;
+}
+
+// Turns rows 0..degree of samples (row stride width) into forward differences
+static void differentiate(uint32_t *table, unsigned degree, size_t width) {
+    for (unsigned level = 1; level <= degree; level++) {
+        for (unsigned row = degree; row >= level; row--) {
+            for (size_t i = 0; i < width; i++)
+                table[row * width + i] -= table[(row - 1) * width + i];
+        }
+    }
+}
+
+// Moves a column of forward differences one iteration on
+static void advance(uint32_t *table, unsigned degree, size_t width) {
+    for (unsigned row = 0; row < degree; row++)
+        table[row * width] += table[(row + 1) * width];
+}
+
+// Constructor - empty until analyze accepts a loop
+CountedLoop::CountedLoop()
+    : startPC(0), endPC(0), length(0), base(0), degree(0), samples(0), misses(0), idle(0)
+{
+    branch.kind = OP_NOP;
+    difference[0] = difference[1] = 0;
+}
+
+// Applies a body op other than a store to the forms of the registers
+static void form_op(Form *forms, const TranslatedOp &op, uint32_t written) {
+    Form f;
+    switch (op.kind) {
+        case OP_ADD:
+            form_combine(f, forms[op.rs1], forms[op.rs2], 1);
+            break;
+        case OP_SUB:
+            form_combine(f, forms[op.rs1], forms[op.rs2], (uint32_t)-1);
+            break;
+        case OP_ADDI:
+        case OP_SUBI:
+            f = forms[op.rs1];
+            break;
+        case OP_LUI:
+            form_register(f, 0);
+            break;
+        default: {
+            // and/or/sltu/sra: a constant if the operands are (x0 is never
+            // written, so forms[0] stays zero)
+            const Form &a = forms[op.rs1];
+            const Form &b = op.kind <= OP_SRA ? forms[op.rs2] : forms[0];
+            form_register(f, 0);
+            f.deps = a.deps | b.deps;
+            f.opaque = form_variant(a, written) || form_variant(b, written);
+            break;
+        }
+    }
+    forms[op.rd] = f;
+}
+
+// Degree of a form of the linear registers, raising settle to the first
+// iteration it holds from
+static unsigned form_degree(const Form &f, uint32_t linear, const unsigned *degrees, const unsigned *settles,
+                            unsigned &settle) {
+    unsigned d = 0;
+    for (unsigned k = 1; k < 32; k++) {
+        if (f.coef[k] != 0 && (linear >> k & 1)) {
+            d = std::max(d, degrees[k]);
+            settle = std::max(settle, settles[k]);
+        }
+    }
+    return d;
+}
+
+/**
+ * Runs the body over forms of the start-of-iteration registers, then works
+ * out from the forms the loop leaves behind which registers follow
+ * polynomials, their degrees, and the first iteration from which each
+ * does: a register that is not carried over (coefficient 0 on itself)
+ * starts following one an iteration after what it is computed from. A
+ * second pass checks the stores against that.
+ */
+bool CountedLoop::analyze(unsigned long startPC, unsigned long endPC, const std::vector<TranslatedOp> &body,
+                          const std::vector<uint16_t> &offsets, const TranslatedOp &branch) {
+    if (branch.kind != OP_BNE || pc_from_mux((uint32_t)endPC + (uint32_t)branch.imm) != startPC)
+        return false;
+
+    uint32_t written = 0;
+    for (size_t i = 0; i < body.size(); i++) {
+        const TranslatedOp &op = body[i];
+        if (op.kind < OP_ADD || op.kind > OP_SW || op.kind == OP_LB || op.kind == OP_LBU || op.kind == OP_LW)
+            return false;
+        if (!is_store(op))
+            written |= 1u << op.rd;
+    }
+
+    Form forms[32];
+    for (unsigned i = 0; i < 32; i++)
+        form_register(forms[i], i);
+    for (size_t i = 0; i < body.size(); i++) {
+        if (!is_store(body[i]))
+            form_op(forms, body[i], written);
+    }
+    Form diff;
+    form_combine(diff, forms[branch.rs1], forms[branch.rs2], (uint32_t)-1);
+    if (diff.opaque)
+        return false;
+
+    // nothing may read the start value of an opaque register (stores are
+    // checked below)
+    uint32_t opaque = 0, reads = diff.deps;
+    for (unsigned i = 1; i < 32; i++) {
+        if (written >> i & 1) {
+            reads |= forms[i].deps;
+            if (forms[i].opaque)
+                opaque |= 1u << i;
+        }
+    }
+    if ((reads & opaque) != 0)
+        return false;
+
+    // the rest, in an order where each comes after what it depends on
+    uint32_t linear = written & ~opaque;
+    uint8_t order[32];
+    unsigned ordered = 0;
+    uint32_t placed = 0;
+    while (placed != linear) {
+        bool progress = false;
+        for (unsigned i = 1; i < 32; i++) {
+            if (!(linear >> i & 1) || (placed >> i & 1))
+                continue;
+            const Form &f = forms[i];
+            if (f.coef[i] > 1)
+                return false;
+            bool ready = true;
+            for (unsigned k = 1; k < 32 && ready; k++) {
+                if (k != i && f.coef[k] != 0 && (linear >> k & 1) && !(placed >> k & 1))
+                    ready = false;
+            }
+            if (ready) {
+                order[ordered++] = (uint8_t)i;
+                placed |= 1u << i;
+                progress = true;
+            }
+        }
+        if (!progress)
+            return false;   // dependence cycle
+    }
+
+    unsigned degrees[32] = { 0 }, settles[32] = { 0 };
+    unsigned maxDegree = 1, maxSettle = 0;
+    for (unsigned n = 0; n < ordered; n++) {
+        unsigned i = order[n];
+        unsigned d = 0, s = 0;
+        for (unsigned k = 1; k < 32; k++) {
+            if (k != i && forms[i].coef[k] != 0 && (linear >> k & 1)) {
+                d = std::max(d, degrees[k]);
+                s = std::max(s, settles[k]);
+            }
+        }
+        if (forms[i].coef[i] == 1) {
+            degrees[i] = d + 1;
+            settles[i] = s;
+        } else {
+            degrees[i] = d;
+            settles[i] = s + 1;
+        }
+        maxDegree = std::max(maxDegree, degrees[i]);
+        maxSettle = std::max(maxSettle, settles[i]);
+    }
+
+    // the bne difference and store addresses must be affine, store values
+    // polynomials
+    if (form_degree(diff, linear, degrees, settles, maxSettle) > 1)
+        return false;
+    for (unsigned i = 0; i < 32; i++)
+        form_register(forms[i], i);
+    for (size_t i = 0; i < body.size(); i++) {
+        const TranslatedOp &op = body[i];
+        if (!is_store(op)) {
+            form_op(forms, op, written);
+            continue;
+        }
+        const Form &address = forms[op.rs1], &value = forms[op.rs2];
+        if (address.opaque || value.opaque || ((address.deps | value.deps) & opaque) != 0)
+            return false;
+        if (form_degree(address, linear, degrees, settles, maxSettle) > 1)
+            return false;
+        maxDegree = std::max(maxDegree, form_degree(value, linear, degrees, settles, maxSettle));
+    }
+    if (maxDegree > MAX_DEGREE)
+        return false;
+
+    this->startPC = startPC;
+    this->endPC = endPC;
+    length = (endPC - startPC) / 4 + 1;
+    this->body = body;
+    this->offsets = offsets;
+    this->branch = branch;
+    extrapolated.assign(order, order + ordered);
+    stores.clear();
+    for (size_t i = 0; i < body.size(); i++) {
+        if (is_store(body[i]))
+            stores.push_back((uint32_t)i);
+    }
+    base = maxSettle;
+    degree = maxDegree;
+    samples = base + degree + 1;
+    misses = 0;
+    idle = 0;
+    registerTable.assign((degree + 1) * extrapolated.size(), 0);
+    addressTable.assign((degree + 1) * stores.size(), 0);
+    valueTable.assign((degree + 1) * stores.size(), 0);
+    return true;
+}
+
+// An entry that skipped nothing: the loop runs remaining more iterations
+void CountedLoop::miss(uint64_t remaining) {
+    if (misses < MAX_MISSES)
+        misses++;
+    idle = remaining + (1u << misses) - 1;
+}
+
+// Extrapolated registers at the start of an iteration at or after base
+void CountedLoop::registers_at(int32_t *r, uint64_t iteration) const {
+    size_t width = extrapolated.size();
+    uint32_t coefficients[MAX_DEGREE + 1];
+    for (unsigned k = 0; k <= degree; k++)
+        coefficients[k] = binomial(iteration - base, k);
+    for (size_t i = 0; i < width; i++) {
+        uint32_t value = 0;
+        for (unsigned k = 0; k <= degree; k++)
+            value += coefficients[k] * registerTable[k * width + i];
+        r[extrapolated[i]] = (int32_t)value;
+    }
+}
+
+// Register effects of body ops before end; the stores are already done
+void CountedLoop::run_registers(int32_t *r, size_t end) const {
+    for (size_t i = 0; i < end; i++)
+        execute(r, body[i]);
+}
+
+/**
+ * State right after the store at body index of the given iteration, which
+ * changed code: the registers come from the iteration before and a replay
+ * of the register ops since. Returns the instructions retired.
+ */
+uint64_t CountedLoop::stop_at_store(int32_t *r, uint64_t iteration, size_t index, unsigned long &pc) const {
+    registers_at(r, iteration - 1);
+    run_registers(r, body.size());
+    run_registers(r, index);
+    pc = startPC + 4 * (offsets[index] + 1);
+    return iteration * length + offsets[index] + 1;
+}
+
+/**
+ * Runs the sampled iterations, then skips to the iteration where the bne
+ * falls through or the budget runs out, whichever is first. Only the last
+ * skipped iteration's registers are computed (from the polynomials), and
+ * that iteration's register ops run again to bring the output-only
+ * registers up to date.
+ */
+uint64_t CountedLoop::run_slow(int32_t *r, Memory &mem, const unsigned long *codeVersion, unsigned long version,
+                               uint64_t budget, unsigned long &pc, uint64_t &folded) {
+    uint64_t iterations = budget / length;
+    if (iterations < samples)
+        return 0;
+
+    size_t width = extrapolated.size();
+    size_t storeCount = stores.size();
+    for (unsigned j = 0; j < samples; j++) {
+        bool sampled = j >= base && j <= base + degree;
+        unsigned row = j - base;
+        if (sampled) {
+            for (size_t i = 0; i < width; i++)
+                registerTable[row * width + i] = (uint32_t)r[extrapolated[i]];
+        }
+        size_t s = 0;
+        for (size_t i = 0; i < body.size(); i++) {
+            const TranslatedOp &op = body[i];
+            if (!is_store(op)) {
+                execute(r, op);
+                continue;
+            }
+            uint32_t address = op_address(r, op);
+            if (op.kind == OP_SH)
+                mem.write16(address, r[op.rs2]);
+            else
+                mem.write32(address, r[op.rs2]);
+            if (sampled) {
+                addressTable[row * storeCount + s] = address;
+                valueTable[row * storeCount + s] = (uint32_t)r[op.rs2];
+            }
+            s++;
+            if (*codeVersion != version) {
+                pc = startPC + 4 * (offsets[i] + 1);
+                return j * length + offsets[i] + 1;
+            }
+        }
+        uint32_t d = (uint32_t)r[branch.rs1] - (uint32_t)r[branch.rs2];
+        if (j == base || j == base + 1)
+            difference[j - base] = d;
+        if (d == 0) {
+            miss(0);
+            pc = pc_from_mux((uint32_t)endPC + 4);
+            return (j + 1) * length;
+        }
+    }
+    pc = startPC;
+
+    // the bne falls through after iteration base + t where
+    // difference[0] + t * step == 0 (mod 2^32), if ever
+    uint32_t step = difference[1] - difference[0];
+    uint32_t target = -difference[0];
+    uint64_t exits = UINT64_MAX;
+    if (step != 0) {
+        unsigned shift = 0;
+        while (!(step >> shift & 1))
+            shift++;
+        if ((target & ((1u << shift) - 1)) == 0) {
+            // unique modulo 2^(32 - shift)
+            uint32_t t = ((target >> shift) * inverse(step >> shift)) & (0xFFFFFFFFu >> shift);
+            exits = base + (uint64_t)t + 1;
+        }
+    }
+    uint64_t end = std::min(exits, iterations);
+    if (end < samples + MIN_SKIPPED) {
+        // the rest of this run of the loop goes to the engine
+        if (end == exits)
+            miss(end - samples);
+        return samples * length;
+    }
+    misses = 0;
+
+    // replay the stores of iterations samples .. end-1
+    differentiate(registerTable.data(), degree, width);
+    if (storeCount != 0) {
+        differentiate(addressTable.data(), degree, storeCount);
+        differentiate(valueTable.data(), degree, storeCount);
+        for (unsigned j = base; j < samples; j++) {
+            for (size_t s = 0; s < storeCount; s++) {
+                advance(&addressTable[s], degree, storeCount);
+                advance(&valueTable[s], degree, storeCount);
+            }
+        }
+        for (uint64_t j = samples; j < end; j++) {
+            for (size_t s = 0; s < storeCount; s++) {
+                const TranslatedOp &op = body[stores[s]];
+                if (op.kind == OP_SH)
+                    mem.write16(addressTable[s], valueTable[s]);
+                else
+                    mem.write32(addressTable[s], valueTable[s]);
+                if (*codeVersion != version) {
+                    uint64_t retired = stop_at_store(r, j, stores[s], pc);
+                    folded += retired - samples * length;
+                    return retired;
+                }
+                advance(&addressTable[s], degree, storeCount);
+                advance(&valueTable[s], degree, storeCount);
+            }
+        }
+    }
+
+    registers_at(r, end - 1);
+    run_registers(r, body.size());
+    if (r[branch.rs1] == r[branch.rs2])
+        pc = pc_from_mux((uint32_t)endPC + 4);
+    folded += (end - samples) * length;
+    return end * length;
+}
@@ -0,0 +1,96 @@
+#ifndef COUNTED_LOOP_H
+#define COUNTED_LOOP_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Memory.h"
+#include "Translator.h"
+
+// A single-block loop (straight-line body, then a bne back to its first
+// instruction) whose iterations can be skipped instead of executed.
+//
+// analyze() runs the body symbolically over the registers it starts
+// with. It accepts the loop when the body has no loads and:
+//  - every register it writes is a linear combination of the registers at
+//    the start of the iteration plus a constant, and the recurrences this
+//    gives have polynomial solutions: a register depends on itself with
+//    coefficient 0 or 1 and otherwise only on registers that do not depend
+//    on it. Anything else written is only an output: its old value is
+//    never read;
+//  - and/or/sltu/sra results depend on nothing the loop changes (or are
+//    outputs);
+//  - stores have affine addresses and polynomial values;
+//  - the difference of the bne operands is affine in the iteration number.
+// Such registers hold polynomials of the iteration number (of degree at
+// most MAX_DEGREE), modulo 2^32, once the first few iterations are past.
+//
+// run() executes the first iterations for real, recording the register
+// values, store addresses and values, and bne operands. It solves the
+// affine difference for the iteration that exits, then jumps there:
+// Newton's forward differences give the registers at any later iteration
+// exactly, and a kernel replays only the loop's stores, with addresses and
+// values stepped by differences. The last iteration before the target runs
+// for real again, which also fills in the output-only registers. Results,
+// memory contents (including writes dropped by the memory limit) and
+// instruction counts are those of executing every iteration; a store over
+// translated code stops the loop right after that store, as the engines do.
+class CountedLoop {
+public:
+    static const unsigned MAX_DEGREE = 4;
+
+    CountedLoop();
+
+    // The block at startPC: body ops with the instruction offset of each,
+    // then the bne at endPC. False if it is not a loop run() can skip.
+    bool analyze(unsigned long startPC, unsigned long endPC, const std::vector<TranslatedOp> &body,
+                 const std::vector<uint16_t> &offsets, const TranslatedOp &branch);
+
+    // Runs iterations starting with PC at the loop's first instruction and
+    // the registers in r, executing at most budget instructions. Returns
+    // the instructions retired, 0 if it declines (the budget is too small,
+    // or recent runs of the loop were too short to skip anything), and
+    // leaves pc at the next one: the loop start, the instruction after the
+    // bne, or the one after a store that changed code (codeVersion no
+    // longer version). Adds the instructions skipped to folded.
+    uint64_t run(int32_t *r, Memory &mem, const unsigned long *codeVersion, unsigned long version,
+                 uint64_t budget, unsigned long &pc, uint64_t &folded) {
+        // inline, as the engine asks on every pass through the loop
+        if (idle != 0) {
+            idle--;
+            return 0;
+        }
+        return run_slow(r, mem, codeVersion, version, budget, pc, folded);
+    }
+
+private:
+    unsigned long startPC, endPC;
+    uint64_t length;               // instructions per iteration, bne included
+    std::vector<TranslatedOp> body;
+    std::vector<uint16_t> offsets;
+    TranslatedOp branch;
+    std::vector<uint8_t> extrapolated;  // registers given by polynomials
+    std::vector<uint32_t> stores;       // body index of each store
+    unsigned base;      // first iteration every polynomial holds from
+    unsigned degree;
+    unsigned samples;   // iterations run before skipping
+
+    // per sampled iteration base..base+degree: extrapolated registers at its
+    // start, then address and value of each store; turned into differences
+    std::vector<uint32_t> registerTable, addressTable, valueTable;
+    uint32_t difference[2];  // bne operand difference after iterations base, base+1
+    // entries in a row that skipped nothing, and calls left to decline
+    // because of them (short loops run faster in the engine)
+    unsigned misses;
+    uint64_t idle;
+
+    uint64_t run_slow(int32_t *r, Memory &mem, const unsigned long *codeVersion, unsigned long version,
+                      uint64_t budget, unsigned long &pc, uint64_t &folded);
+    void miss(uint64_t remaining);
+
+    void registers_at(int32_t *r, uint64_t iteration) const;
+    void run_registers(int32_t *r, size_t end) const;
+    uint64_t stop_at_store(int32_t *r, uint64_t iteration, size_t index, unsigned long &pc) const;
+};
+
+#endif // COUNTED_LOOP_H
@@ -0,0 +1,190 @@
+#include "Engine.h"
+#include "ThreadedEngine.h"
+#include "BlockEngine.h"
+#include "JitEngine.h"
+#include "PipelineModel.h"
+#include "BranchPredictor.h"
+#include "Instrumentation.h"
+#include "BinaryTrace.h"
+#include "Profiler.h"
+
+#include <cstring>
+
+const char *engine_name(EngineKind engine) {
+	switch (engine) {
+		case ENGINE_THREADED: return "threaded";
+		case ENGINE_BLOCK: return "block";
+		case ENGINE_JIT: return "jit";
+		default: return "stage";
+	}
+}
+
+bool parse_engine(const char *name, EngineKind &engine) {
+	static const EngineKind kinds[] = { ENGINE_STAGE, ENGINE_THREADED, ENGINE_BLOCK, ENGINE_JIT };
+	for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+		if (strcmp(name, engine_name(kinds[i])) == 0) {
+			engine = kinds[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+// The reference engine: every instruction through the five stages.
+// Instrumentation is a template parameter so the plain loop pays nothing
+// for it; see Instrumentation.h.
+template <class Instrumentation>
+static RunResult run_stages(CPU &cpu, unsigned long pcLimit, const EngineOptions &options,
+							Instrumentation &instrumentation)
+{
+	RunResult result;
+	result.halted = false;
+	result.compiledBlocks = 0;
+	result.codeFlushes = 0;
+	result.foldedInstructions = 0;
+
+	cpu.attachCaches(options.instructionCache, options.dataCache);
+
+	uint64_t cycle = 0;
+	while (cycle < options.maxInstructions) // main loop. Each iteration is equal to one clock cycle.  
+	{
+		unsigned long pc = cpu.readPC();
+
+		//fetch
+		uint32_t instruction = cpu.fetch();
+
+		if(instruction == 0){
+			result.halted = true;
+			break;
+		}
+		
+		// decode
+		cpu.decode(instruction);
+
+		// execute
+		cpu.execute();
+        
+		// Mem
+		cpu.mem();
+
+		// Write Back
+        cpu.wb();
+
+		instrumentation.retire(cpu, pc, instruction, cycle);
+
+		cpu.updatePC(); // Update PC
+
+		// Pipeline timing or branch prediction, if enabled
+		if (options.timing != NULL) {
+			options.timing->retire(cpu, pc);
+		} else if (options.predictor != NULL) {
+			options.predictor->retire(cpu, pc);
+		}
+
+		cycle++;
+
+		if (cpu.readPC() > pcLimit) {
+			result.halted = true;
+			break;
+		}
+	}
+	result.instructions = cycle;
+	cpu.attachCaches(NULL, NULL);
+	return result;
+}
+
+// Instantiates the stage loop for the instrumentation options ask for
+static RunResult run_stages(CPU &cpu, unsigned long pcLimit, const EngineOptions &options)
+{
+	if (options.debug) {
+		TraceInstrumentation trace;
+		return run_stages(cpu, pcLimit, options, trace);
+	}
+	if (options.traceWriter != NULL)
+		return run_stages(cpu, pcLimit, options, *options.traceWriter);
+	if (options.counters != NULL)
+		return run_stages(cpu, pcLimit, options, *options.counters);
+	if (options.profiler != NULL)
+		return run_stages(cpu, pcLimit, options, *options.profiler);
+	NoInstrumentation none;
+	return run_stages(cpu, pcLimit, options, none);
+}
+
+RunResult run_program(CPU &cpu, unsigned long pcLimit, const EngineOptions &options)
+{
+	if (options.timing != NULL || options.instructionCache != NULL || options.dataCache != NULL ||
+		options.predictor != NULL || options.counters != NULL || options.traceWriter != NULL ||
+		options.profiler != NULL || options.debug)
+		return run_stages(cpu, pcLimit, options);
+
+	EngineSession session(cpu, pcLimit, options);
+	return session.run(options.maxInstructions);
+}
+
+EngineSession::EngineSession(CPU &cpu, unsigned long pcLimit, const EngineOptions &options)
+	: cpu(cpu), pcLimit(pcLimit), kind(options.kind), threaded(NULL), blocks(NULL), jit(NULL)
+{
+	switch (kind) {
+		case ENGINE_THREADED:
+			threaded = new ThreadedEngine(cpu, pcLimit);
+			break;
+		case ENGINE_BLOCK:
+			blocks = new BlockEngine(cpu, pcLimit, options.foldLoops);
+			break;
+		case ENGINE_JIT:
+			jit = new JitEngine(cpu, pcLimit, options.jitThreshold, options.jitEnabled);
+			break;
+		default:
+			break;
+	}
+}
+
+EngineSession::~EngineSession()
+{
+	delete threaded;
+	delete blocks;
+	delete jit;
+}
+
+void EngineSession::restart(unsigned long pcLimit)
+{
+	this->pcLimit = pcLimit;
+	if (threaded != NULL)
+		threaded->restart(pcLimit);
+	if (blocks != NULL)
+		blocks->restart(pcLimit);
+	if (jit != NULL)
+		jit->restart(pcLimit);
+}
+
+RunResult EngineSession::run(uint64_t maxInstructions)
+{
+	RunResult result;
+	result.compiledBlocks = 0;
+	result.codeFlushes = 0;
+	result.foldedInstructions = 0;
+	switch (kind) {
+		case ENGINE_THREADED:
+			result.instructions = threaded->run(maxInstructions);
+			result.halted = threaded->halted();
+			break;
+		case ENGINE_BLOCK:
+			result.instructions = blocks->run(maxInstructions);
+			result.halted = blocks->halted();
+			result.foldedInstructions = blocks->foldedInstructions();
+			break;
+		case ENGINE_JIT:
+			result.instructions = jit->run(maxInstructions);
+			result.halted = jit->halted();
+			result.compiledBlocks = jit->compiledBlocks();
+			result.codeFlushes = jit->codeFlushes();
+			break;
+		default: {
+			EngineOptions plain;
+			plain.maxInstructions = maxInstructions;
+			result = run_stages(cpu, pcLimit, plain);
+			break;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,99 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <cstdint>
+
+#include "CPU.h"
+
+class PipelineModel;
+class CacheModel;
+class BranchPredictor;
+class ExecutionCounters;
+class TraceWriter;
+class Profiler;
+class ThreadedEngine;
+class BlockEngine;
+class JitEngine;
+
+// Execution engines selectable with --engine=
+enum EngineKind {
+	ENGINE_STAGE,    // fetch/decode/execute/mem/wb/updatePC per cycle (reference)
+	ENGINE_THREADED, // pre-translated handlers, see ThreadedEngine.h
+	ENGINE_BLOCK,    // chained basic blocks, see BlockEngine.h
+	ENGINE_JIT,      // stage interpreter + native hot blocks, see JitEngine.h
+};
+
+// How a program should be run
+struct EngineOptions {
+	EngineKind kind;
+	unsigned jitThreshold;     // --jit-threshold
+	bool jitEnabled;           // cleared by --no-jit
+	bool foldLoops;            // block engine: skip counted loops, cleared by --no-fold-loops
+	bool debug;                // --trace: print_debug_state every cycle; forces the stage engine
+	uint64_t maxInstructions;  // stop after this many instructions
+	uint64_t memoryLimit;      // --mem-limit: resident bytes per CPU, 0 = unlimited
+	PipelineModel *timing;     // --timing: fed every instruction; forces the stage engine
+	CacheModel *instructionCache; // --icache: sees every fetch; forces the stage engine
+	CacheModel *dataCache;        // --dcache: sees every load and store; likewise
+	// --predictor: trained on every bne / jalr; forces the stage engine.
+	// Ignored with a timing model, which trains its own predictor
+	BranchPredictor *predictor;
+	ExecutionCounters *counters; // --counters: fed every instruction; forces the stage engine
+	TraceWriter *traceWriter;    // --trace-file: likewise
+	Profiler *profiler;          // --profile: likewise
+
+	EngineOptions()
+		: kind(ENGINE_STAGE), jitThreshold(16), jitEnabled(true), foldLoops(true), debug(false),
+		  maxInstructions(UINT64_MAX), memoryLimit(0), timing(NULL),
+		  instructionCache(NULL), dataCache(NULL), predictor(NULL),
+		  counters(NULL), traceWriter(NULL), profiler(NULL) {}
+};
+
+// Outcome of run_program
+struct RunResult {
+	uint64_t instructions;
+	bool halted;                  // false if maxInstructions stopped the run
+	unsigned long compiledBlocks; // JIT only
+	unsigned long codeFlushes;    // JIT only: times the code buffer filled up
+	uint64_t foldedInstructions;  // block engine: skipped by counted loops
+};
+
+const char *engine_name(EngineKind engine);
+// Parses "stage", "threaded", "block" or "jit"
+bool parse_engine(const char *name, EngineKind &engine);
+
+// Runs the program loaded in cpu until it halts (zero instruction word or
+// PC > pcLimit) or options.maxInstructions have executed. With tracing,
+// counters, or a timing, cache or predictor model the stage engine runs
+// whatever options.kind says.
+RunResult run_program(CPU &cpu, unsigned long pcLimit, const EngineOptions &options);
+
+// A fast engine (options.kind) kept alive over several runs of one CPU, so
+// translated and compiled code survives in between. Something else, such
+// as a detailed stage run, may advance the CPU between calls: every engine
+// resumes from the CPU's PC and retranslates if code changed meanwhile.
+// Models and instrumentation in options are ignored.
+class EngineSession {
+public:
+	EngineSession(CPU &cpu, unsigned long pcLimit, const EngineOptions &options);
+	~EngineSession();
+
+	// Runs at most maxInstructions more (options.maxInstructions is ignored)
+	RunResult run(uint64_t maxInstructions);
+	// Starts over after the CPU was reset, possibly with another program:
+	// clears the halt and adopts pcLimit, keeping the engine's buffers
+	void restart(unsigned long pcLimit);
+
+private:
+	CPU &cpu;
+	unsigned long pcLimit;
+	EngineKind kind;
+	ThreadedEngine *threaded;
+	BlockEngine *blocks;
+	JitEngine *jit;
+
+	EngineSession(const EngineSession &);
+	EngineSession &operator=(const EngineSession &);
+};
+
+#endif // ENGINE_H
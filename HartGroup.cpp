@@ -0,0 +1,202 @@
+#include "HartGroup.h"
+#include "Program.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+HartGroup::HartGroup(const Program &program, unsigned harts, uint64_t quantum,
+                     const EngineOptions &options, unsigned jobs)
+    : quantum(std::max<uint64_t>(quantum, 1)), maxInstructions(options.maxInstructions),
+      workerCount(jobs), quantumCount(0), merged(0), generation(0), running(0),
+      stopping(false), mergeBuffer(Memory::PAGE_SIZE)
+{
+    if (workerCount == 0)
+        workerCount = std::max(1u, std::thread::hardware_concurrency());
+    workerCount = std::max(1u, std::min(workerCount, harts));
+
+    for (unsigned i = 0; i < harts; i++) {
+        std::unique_ptr<Hart> hart(new Hart());
+        hart->cpu.reset(new CPU(program.instMem));
+        reset_cpu(*hart->cpu, program);
+        hart->cpu->setMemoryLimit(options.memoryLimit);
+        hart->cpu->regs[4] = (int32_t)i;  // tp = hart id
+        hart->session.reset(new EngineSession(*hart->cpu, program.pcLimit(), options));
+        hart->instructions = 0;
+        hart->halted = false;
+        hart->ran = false;
+        hartList.push_back(std::move(hart));
+    }
+}
+
+HartGroup::~HartGroup() {
+}
+
+unsigned HartGroup::harts() const {
+    return (unsigned)hartList.size();
+}
+
+unsigned HartGroup::jobs() const {
+    return workerCount;
+}
+
+CPU &HartGroup::hart(unsigned index) {
+    return *hartList[index]->cpu;
+}
+
+uint64_t HartGroup::instructions(unsigned index) const {
+    return hartList[index]->instructions;
+}
+
+bool HartGroup::halted(unsigned index) const {
+    return hartList[index]->halted;
+}
+
+uint64_t HartGroup::quanta() const {
+    return quantumCount;
+}
+
+uint64_t HartGroup::mergedBytes() const {
+    return merged;
+}
+
+bool HartGroup::active(const Hart &hart) const {
+    return !hart.halted && hart.instructions < maxInstructions;
+}
+
+// One quantum of one hart, remembering its memory as it was before
+void HartGroup::run_hart(Hart &hart) {
+    hart.ran = active(hart);
+    if (!hart.ran)
+        return;
+    hart.cpu->memory.snapshot(hart.base);
+    RunResult r = hart.session->run(std::min(quantum, maxInstructions - hart.instructions));
+    hart.instructions += r.instructions;
+    hart.halted = r.halted;
+    hart.cpu->memory.changedPages(hart.base, hart.changed);
+}
+
+// Harts are dealt to workers round-robin, so each always runs on one thread
+void HartGroup::run_share(unsigned worker) {
+    for (size_t h = worker; h < hartList.size(); h += workerCount)
+        run_hart(*hartList[h]);
+}
+
+void HartGroup::work(unsigned worker) {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (generation == seen && !stopping)
+                startSignal.wait(guard);
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        run_share(worker);
+        std::lock_guard<std::mutex> guard(lock);
+        if (--running == 0)
+            doneSignal.notify_one();
+    }
+}
+
+/**
+ * The barrier's merge, run while every worker waits. Each page some hart
+ * wrote starts from its contents before the quantum; the bytes each hart
+ * changed are laid over it in hart order, and every hart whose copy ended
+ * up different gets the result through ordinary stores, so writes over
+ * code are caught like self-modifying code.
+ */
+void HartGroup::merge() {
+    std::vector<uint32_t> pages;
+    for (size_t h = 0; h < hartList.size(); h++) {
+        const Hart &hart = *hartList[h];
+        if (hart.ran)
+            pages.insert(pages.end(), hart.changed.begin(), hart.changed.end());
+    }
+    std::sort(pages.begin(), pages.end());
+    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+    uint8_t *result = &mergeBuffer[0];
+    for (size_t p = 0; p < pages.size(); p++) {
+        uint32_t pageNumber = pages[p];
+        bool started = false;
+        for (size_t h = 0; h < hartList.size(); h++) {
+            Hart &hart = *hartList[h];
+            if (!hart.ran)
+                continue;
+            // every copy held the same bytes when the quantum started
+            const uint8_t *before = hart.base.findPage(pageNumber);
+            if (!started) {
+                if (before != NULL)
+                    memcpy(result, before, Memory::PAGE_SIZE);
+                else
+                    memset(result, 0, Memory::PAGE_SIZE);
+                started = true;
+            }
+            if (!std::binary_search(hart.changed.begin(), hart.changed.end(), pageNumber))
+                continue;
+            const uint8_t *after = hart.cpu->memory.pageData(pageNumber);
+            for (uint32_t i = 0; i < Memory::PAGE_SIZE; i++) {
+                uint8_t old = (before != NULL) ? before[i] : 0;
+                if (after[i] != old)
+                    result[i] = after[i];
+            }
+        }
+
+        uint32_t address = pageNumber << Memory::PAGE_BITS;
+        for (size_t h = 0; h < hartList.size(); h++) {
+            Memory &memory = hartList[h]->cpu->memory;
+            const uint8_t *current = memory.pageData(pageNumber);
+            if (memcmp(current, result, Memory::PAGE_SIZE) == 0)
+                continue;
+            for (uint32_t i = 0; i < Memory::PAGE_SIZE; i++) {
+                if (current[i] != result[i]) {
+                    memory.write8(address + i, result[i]);
+                    merged++;
+                    // the first write allocates or copies the page
+                    current = memory.pageData(pageNumber);
+                }
+            }
+        }
+    }
+    for (size_t h = 0; h < hartList.size(); h++)
+        hartList[h]->base.clear();
+}
+
+void HartGroup::run() {
+    std::vector<std::thread> workers;
+    for (unsigned w = 1; w < workerCount; w++)
+        workers.push_back(std::thread(&HartGroup::work, this, w));
+
+    for (;;) {
+        bool any = false;
+        for (size_t h = 0; h < hartList.size(); h++)
+            any = any || active(*hartList[h]);
+        if (!any)
+            break;
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            generation++;
+            running = workerCount - 1;
+        }
+        startSignal.notify_all();
+        run_share(0);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (running != 0)
+                doneSignal.wait(guard);
+        }
+        merge();
+        quantumCount++;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    startSignal.notify_all();
+    for (size_t w = 0; w < workers.size(); w++)
+        workers[w].join();
+}
@@ -0,0 +1,85 @@
+#ifndef HART_GROUP_H
+#define HART_GROUP_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Engine.h"
+
+struct Program;
+
+// Several harts running one program in one address space. Every hart is a
+// CPU with its own engine, started at the program's entry point with its
+// hart id in tp (x4), which programs use to split up the work (there are no
+// CSRs to hold an mhartid).
+//
+// Harts run in quanta of a fixed number of instructions on a pool of host
+// threads and meet at a barrier after each quantum. Within a quantum every
+// hart works on its own copy of memory; at the barrier the bytes each hart
+// stored are merged, in hart order, into every copy. A store is visible to
+// its own hart at once and to the others from the next quantum on, and if
+// two harts store to the same byte in one quantum the higher hart id wins.
+// Nothing depends on how the host schedules the threads, so a run gives
+// the same results for any number of them; only the quantum matters.
+class HartGroup {
+public:
+    // jobs == 0 uses one thread per hart, up to the hardware threads
+    HartGroup(const Program &program, unsigned harts, uint64_t quantum,
+              const EngineOptions &options, unsigned jobs);
+    ~HartGroup();
+
+    // Runs until every hart has halted or run options.maxInstructions
+    void run();
+
+    unsigned harts() const;
+    unsigned jobs() const;
+    CPU &hart(unsigned index);
+    uint64_t instructions(unsigned index) const;
+    bool halted(unsigned index) const;
+    // Barriers passed so far
+    uint64_t quanta() const;
+    // Bytes copied from one hart's memory into another's at barriers
+    uint64_t mergedBytes() const;
+
+private:
+    struct Hart {
+        std::unique_ptr<CPU> cpu;
+        std::unique_ptr<EngineSession> session;
+        MemorySnapshot base;            // memory at the start of the quantum
+        std::vector<uint32_t> changed;  // pages written during the quantum
+        uint64_t instructions;
+        bool halted;
+        bool ran;                       // took part in the last quantum
+    };
+
+    std::vector<std::unique_ptr<Hart> > hartList;
+    uint64_t quantum;
+    uint64_t maxInstructions;
+    unsigned workerCount;
+    uint64_t quantumCount;
+    uint64_t merged;
+
+    // barrier: the coordinator bumps generation, workers count running down
+    std::mutex lock;
+    std::condition_variable startSignal;
+    std::condition_variable doneSignal;
+    uint64_t generation;
+    unsigned running;
+    bool stopping;
+
+    std::vector<uint8_t> mergeBuffer;
+
+    bool active(const Hart &hart) const;
+    void run_hart(Hart &hart);
+    void run_share(unsigned worker);
+    void work(unsigned worker);
+    void merge();
+
+    HartGroup(const HartGroup &);
+    HartGroup &operator=(const HartGroup &);
+};
+
+#endif // HART_GROUP_H
@@ -0,0 +1,88 @@
+#include "Instrumentation.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+
+const unsigned ExecutionCounters::LOAD_BYTES[8] = { 1, 0, 4, 0, 1, 0, 0, 0 };  // lb, lw, lbu
+const unsigned ExecutionCounters::STORE_BYTES[8] = { 0, 2, 4, 0, 0, 0, 0, 0 }; // sh, sw
+
+// Constructor - all counters zero
+ExecutionCounters::ExecutionCounters(unsigned long pcLimit) : byPC((size_t)(pcLimit >> 1) + 1) {
+    reset();
+}
+
+void ExecutionCounters::reset() {
+    instructions = 0;
+    memset(byOpcode, 0, sizeof(byOpcode));
+    std::fill(byPC.begin(), byPC.end(), 0);
+    elsewhere = 0;
+    loads = stores = 0;
+    bytesRead = bytesWritten = 0;
+}
+
+uint64_t ExecutionCounters::executed() const {
+    return instructions;
+}
+
+// RV32I mnemonic of an opcode bucket; alt is funct7 bit 5 (sub, sra, srai)
+static std::string mnemonic(unsigned opcode, unsigned funct3, bool alt) {
+    static const char *const rtype[8] = { "add", "sll", "slt", "sltu", "xor", "srl", "or", "and" };
+    static const char *const itype[8] = { "addi", "slli", "slti", "sltiu", "xori", "srli", "ori", "andi" };
+    static const char *const loads[8] = { "lb", "lh", "lw", NULL, "lbu", "lhu", NULL, NULL };
+    static const char *const stores[8] = { "sb", "sh", "sw", NULL, NULL, NULL, NULL, NULL };
+    const char *name = NULL;
+    switch (opcode) {
+        case RTYPE:
+            if (alt && funct3 == 0) name = "sub";
+            else if (alt && funct3 == 5) name = "sra";
+            else name = rtype[funct3];
+            break;
+        case ITYPE:
+            name = (alt && funct3 == 5) ? "srai" : itype[funct3];
+            break;
+        case LW: name = loads[funct3]; break;
+        case SW: name = stores[funct3]; break;
+        case LUI: return "lui";
+        case JALR: return "jalr";
+        case BNE: return "bne";
+    }
+    if (name != NULL)
+        return name;
+    char unknown[40];
+    snprintf(unknown, sizeof(unknown), "unknown_%02x_%u", opcode, funct3);
+    return unknown;
+}
+
+/**
+ * Instruction counts are merged by mnemonic (the funct7 bit only splits
+ * buckets for the R-type and shift encodings), and PCs that never ran are
+ * left out, so the object stays small for short programs.
+ */
+void ExecutionCounters::write_json(std::ostream &out) const {
+    std::map<std::string, uint64_t> byName;
+    for (unsigned i = 0; i < sizeof(byOpcode) / sizeof(byOpcode[0]); i++) {
+        if (byOpcode[i] != 0)
+            byName[mnemonic(i >> 4, (i >> 1) & 7, i & 1)] += byOpcode[i];
+    }
+
+    out << "{\n  \"instructions\": " << instructions << ",\n  \"opcodes\": {";
+    const char *separator = "";
+    for (std::map<std::string, uint64_t>::const_iterator it = byName.begin(); it != byName.end(); ++it) {
+        out << separator << "\n    \"" << it->first << "\": " << it->second;
+        separator = ",";
+    }
+    out << "\n  },\n  \"memory\": {\"loads\": " << loads << ", \"stores\": " << stores
+        << ", \"bytes_read\": " << bytesRead << ", \"bytes_written\": " << bytesWritten
+        << "},\n  \"pc\": {";
+    separator = "";
+    for (size_t slot = 0; slot < byPC.size(); slot++) {
+        if (byPC[slot] == 0)
+            continue;
+        out << separator << "\n    \"" << slot * 2 << "\": " << byPC[slot];
+        separator = ",";
+    }
+    out << "\n  },\n  \"pc_outside_program\": " << elsewhere << "\n}\n";
+}
@@ -0,0 +1,74 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "CPU.h"
+
+// Instrumentation policies for the stage engine. run_stages is a template
+// on the policy and calls retire() once per instruction, after wb and
+// before updatePC, with the instruction's PC, raw bits and cycle number;
+// a policy whose retire() is empty compiles away entirely.
+
+// No instrumentation: the run loop carries no per-cycle cost
+struct NoInstrumentation {
+    void retire(const CPU &, unsigned long, uint32_t, uint64_t) {}
+};
+
+// Full trace: the CPU's debug dump of every cycle to stdout
+struct TraceInstrumentation {
+    void retire(CPU &cpu, unsigned long, uint32_t instruction, uint64_t cycle) {
+        cpu.print_debug_state(instruction, (int)cycle);
+    }
+};
+
+// Execution counters in arrays sized once: instructions by
+// opcode/funct3/funct7 bucket, by PC, and the loads and stores that reached
+// memory. Names are only attached when the counters are written out.
+class ExecutionCounters {
+public:
+    // PCs up to pcLimit (Program::pcLimit) are counted per halfword
+    explicit ExecutionCounters(unsigned long pcLimit);
+
+    void reset();
+
+    void retire(const CPU &cpu, unsigned long pc, uint32_t, uint64_t) {
+        const DecodedInstruction &d = *cpu.decoded;
+        instructions++;
+        byOpcode[(d.opcode & 127) << 4 | d.funct3 << 1 | ((d.funct7 >> 5) & 1)]++;
+        if (pc / 2 < byPC.size())
+            byPC[pc / 2]++;
+        else
+            elsewhere++;
+        if (d.control.MemRead) {
+            unsigned size = LOAD_BYTES[d.funct3];
+            loads += size != 0;
+            bytesRead += size;
+        } else if (d.control.MemWrite) {
+            unsigned size = STORE_BYTES[d.funct3];
+            stores += size != 0;
+            bytesWritten += size;
+        }
+    }
+
+    uint64_t executed() const;
+
+    // Writes everything as one JSON object
+    void write_json(std::ostream &out) const;
+
+private:
+    // bytes CPU::mem() accesses for each funct3 (0 = no memory access)
+    static const unsigned LOAD_BYTES[8];
+    static const unsigned STORE_BYTES[8];
+
+    uint64_t instructions;
+    uint64_t byOpcode[128 * 16]; // opcode, funct3, funct7 bit 5
+    std::vector<uint64_t> byPC;   // one slot per halfword up to the PC limit
+    uint64_t elsewhere;           // PCs outside the program image
+    uint64_t loads, stores;
+    uint64_t bytesRead, bytesWritten;
+};
+
+#endif // INSTRUMENTATION_H
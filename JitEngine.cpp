@@ -0,0 +1,552 @@
+#include "JitEngine.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// Executable buffer size and longest block compiled in one piece
+static const size_t CODE_BUFFER_SIZE = 4 << 20;
+static const size_t MAX_BLOCK_LENGTH = 256;
+
+// x86-64 register numbers used by the emitter
+enum HostReg { EAX = 0, ECX = 1, EDX = 2 };
+
+/**
+ * Minimal x86-64 encoder for the instruction forms the JIT needs.
+ * Generated code is called as code(regs, memory, retired) under the
+ * System V calling convention and keeps its arguments where they arrive:
+ *   rdi - base pointer to the CPU's regs[]
+ *   rsi - the CPU's Memory
+ *   rdx - retired, written only when the block exits early
+ *   eax, ecx, r8-r10 - scratch
+ * Other CPU fields are addressed as fixed displacements from rdi. Blocks
+ * need no frame; the memory slow paths save rdi/rsi/rdx around their call.
+ */
+class Emitter {
+public:
+    std::vector<uint8_t> code;
+    // jump8 emits rel32 jumps instead, for a block whose short jumps did
+    // not all reach their targets
+    bool nearJumps;
+    // set by patch8 when a short jump's target is out of rel8 range
+    bool overflow;
+
+    Emitter() : nearJumps(false), overflow(false) {}
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void dword(uint32_t v) {
+        byte(v & 0xFF);
+        byte((v >> 8) & 0xFF);
+        byte((v >> 16) & 0xFF);
+        byte((v >> 24) & 0xFF);
+    }
+    void qword(uint64_t v) {
+        dword((uint32_t)v);
+        dword((uint32_t)(v >> 32));
+    }
+
+    // mov reg, dword [rdi + disp]
+    void load(HostReg reg, int32_t disp) { byte(0x8B); byte(0x87 | (reg << 3)); dword(disp); }
+    // mov dword [rdi + disp], reg
+    void store(HostReg reg, int32_t disp) { byte(0x89); byte(0x87 | (reg << 3)); dword(disp); }
+    // mov dword [rdi + disp], imm32
+    void store_imm(int32_t disp, int32_t imm) { byte(0xC7); byte(0x87); dword(disp); dword(imm); }
+    // <op> eax, ecx
+    void alu_rr(uint8_t opcode) { byte(opcode); byte(0xC8); }
+    // <op> eax, imm32 (short eax forms)
+    void alu_ri(uint8_t opcode, int32_t imm) { byte(opcode); dword(imm); }
+    // cmp eax, dword [rdi + disp]
+    void cmp_mem(int32_t disp) { byte(0x3B); byte(0x87); dword(disp); }
+    // setb al; movzx eax, al
+    void set_below() { byte(0x0F); byte(0x92); byte(0xC0); byte(0x0F); byte(0xB6); byte(0xC0); }
+    // movsxd rax, eax; ret
+    void ret_pc() { byte(0x48); byte(0x63); byte(0xC0); byte(0xC3); }
+    // mov eax, imm32; return it as the next PC
+    void ret_pc_imm(uint32_t pc) { byte(0xB8); dword(pc); ret_pc(); }
+
+    // Short jump with opcode (jcc rel8 / jmp rel8), or its rel32 form with
+    // nearJumps; returns the offset to patch
+    size_t jump8(uint8_t opcode) {
+        if (nearJumps) {
+            if (opcode == 0xEB) {
+                byte(0xE9);                       // jmp rel32
+            } else {
+                byte(0x0F); byte(opcode + 0x10);  // jcc rel32
+            }
+            dword(0);
+            return code.size() - 4;
+        }
+        byte(opcode); byte(0); return code.size() - 1;
+    }
+    // jmp rel32; returns the offset to patch
+    size_t jump32() { byte(0xE9); dword(0); return code.size() - 4; }
+    // Points a jump32 at the current position
+    void patch32(size_t at) {
+        uint32_t rel = (uint32_t)(code.size() - at - 4);
+        for (int i = 0; i < 4; i++)
+            code[at + i] = (rel >> (8 * i)) & 0xFF;
+    }
+    // jmp rel32 back to an earlier position
+    void jump_back(size_t target) { byte(0xE9); dword((uint32_t)(target - (code.size() + 4))); }
+    // Points a jump8 at the current position; sets overflow if a short
+    // jump cannot reach it
+    void patch8(size_t at) {
+        if (nearJumps) {
+            patch32(at);
+            return;
+        }
+        size_t rel = code.size() - at - 1;
+        if (rel > 127) {
+            overflow = true;
+            return;
+        }
+        code[at] = (uint8_t)rel;
+    }
+
+    // eax = regs[rs1] + imm, the address CPU::mem uses
+    void address(const TranslatedOp &op) {
+        load(EAX, op.rs1 * 4);
+        alu_ri(0x05, op.imm);   // add eax, imm32
+    }
+
+    /**
+     * Looks up the page of the address in eax in a Memory TLB, expecting
+     * the entry's tag to be the page number | tagFlag. On a hit that keeps
+     * width bytes inside the page, leaves r8 = page data and ecx = offset
+     * and falls through; otherwise takes one of the jumps added to misses,
+     * with eax intact.
+     */
+    void tlb_lookup(int32_t tagDisp, int32_t pageDisp, uint32_t width, std::vector<size_t> &misses,
+                    uint32_t tagFlag = 0) {
+        byte(0x89); byte(0xC1);                               // mov ecx, eax
+        byte(0xC1); byte(0xE9); byte(Memory::PAGE_BITS);      // shr ecx, PAGE_BITS
+        if (tagFlag != 0) {
+            byte(0x81); byte(0xC9); dword(tagFlag);           // or ecx, tagFlag
+        }
+        byte(0x41); byte(0x89); byte(0xC8);                   // mov r8d, ecx
+        byte(0x41); byte(0x83); byte(0xE0); byte(Memory::TLB_ENTRIES - 1); // and r8d, TLB_ENTRIES - 1
+        byte(0x41); byte(0xC1); byte(0xE0); byte(4);          // shl r8d, 4 (entry size)
+        byte(0x42); byte(0x3B); byte(0x8C); byte(0x06); dword(tagDisp); // cmp ecx, [rsi + r8 + tagDisp]
+        misses.push_back(jump8(0x75));                        // jne miss
+        byte(0x89); byte(0xC1);                               // mov ecx, eax
+        byte(0x81); byte(0xE1); dword(Memory::PAGE_MASK);     // and ecx, PAGE_MASK
+        if (width > 1) {
+            byte(0x81); byte(0xF9); dword(Memory::PAGE_SIZE - width); // cmp ecx, PAGE_SIZE - width
+            misses.push_back(jump8(0x77));                    // ja miss (crosses the page)
+        }
+        byte(0x4E); byte(0x8B); byte(0x84); byte(0x06); dword(pageDisp); // mov r8, [rsi + r8 + pageDisp]
+    }
+
+    /**
+     * After a tlb_lookup hit: takes one of the jumps added to misses if
+     * width bytes at offset ecx touch a word whose bit is set in the
+     * bitmap at r8 + bitmapDisp.
+     */
+    void code_test(int32_t bitmapDisp, uint32_t width, std::vector<size_t> &misses) {
+        byte(0x41); byte(0x89); byte(0xC9);                   // mov r9d, ecx
+        word_test(bitmapDisp, misses);
+        if (width > 1) {
+            byte(0x44); byte(0x8D); byte(0x49); byte(width - 1); // lea r9d, [rcx + width - 1]
+            word_test(bitmapDisp, misses);
+        }
+    }
+
+    // Jumps to a new miss if the bit of word r9d / 4 is set (r9, r10 scratch)
+    void word_test(int32_t bitmapDisp, std::vector<size_t> &misses) {
+        byte(0x41); byte(0xC1); byte(0xE9); byte(2);          // shr r9d, 2
+        byte(0x45); byte(0x89); byte(0xCA);                   // mov r10d, r9d
+        byte(0x41); byte(0xC1); byte(0xEA); byte(5);          // shr r10d, 5
+        byte(0x47); byte(0x8B); byte(0x94); byte(0x90); dword(bitmapDisp); // mov r10d, [r8 + r10*4 + bitmapDisp]
+        byte(0x45); byte(0x0F); byte(0xA3); byte(0xCA);       // bt r10d, r9d
+        misses.push_back(jump8(0x72));                        // jc miss
+    }
+
+    // Calls helper(memory, eax[, regs[valueReg]]); the result is in eax.
+    // The three pushes also restore the 16-byte alignment the call needs.
+    void call_helper(uint64_t helper, bool withValue, uint8_t valueReg) {
+        byte(0x57); byte(0x56); byte(0x52);                   // push rdi; push rsi; push rdx
+        if (withValue)
+            load(EDX, valueReg * 4);                          // mov edx, regs[valueReg]
+        byte(0x48); byte(0x89); byte(0xF7);                   // mov rdi, rsi
+        byte(0x89); byte(0xC6);                               // mov esi, eax
+        byte(0x48); byte(0xB8); qword(helper);                // mov rax, helper
+        byte(0xFF); byte(0xD0);                               // call rax
+        byte(0x5A); byte(0x5E); byte(0x5F);                   // pop rdx; pop rsi; pop rdi
+    }
+};
+
+// Slow paths of the inline memory accesses. Store helpers return nonzero
+// if the store changed code words.
+static uint32_t jit_load_byte(Memory *m, uint32_t addr) { return (uint32_t)(int32_t)(int8_t)m->read8(addr); }
+static uint32_t jit_load_ubyte(Memory *m, uint32_t addr) { return m->read8(addr); }
+static uint32_t jit_load_word(Memory *m, uint32_t addr) { return m->read32(addr); }
+static uint32_t jit_store_half(Memory *m, uint32_t addr, uint32_t value) {
+    uint64_t before = m->codeWrites();
+    m->write16(addr, value);
+    return m->codeWrites() != before;
+}
+static uint32_t jit_store_word(Memory *m, uint32_t addr, uint32_t value) {
+    uint64_t before = m->codeWrites();
+    m->write32(addr, value);
+    return m->codeWrites() != before;
+}
+
+static inline int32_t reg_disp(uint8_t idx) {
+    return idx * 4;
+}
+
+// Where the inline memory accesses find things
+struct MemoryLayout {
+    int32_t mrdDisp;                 // mem_read_data, from rdi
+    int32_t readTag, readPage;       // read TLB fields, from rsi
+    int32_t writeTag, writePage;     // write TLB fields, from rsi
+    int32_t codeBitmap;              // page's code bitmap, from the page data
+    uint32_t codePage;               // write TLB tag flag of pages holding code
+};
+
+/**
+ * Emits a load or store: the TLB hit is handled inline, everything else
+ * (misses, page-crossing accesses) by a helper call. Stores to a page
+ * holding code are also inline as long as they touch only data words;
+ * other stores to code pages go through the helper, and one that changes
+ * code words leaves the block right after itself, reporting retired
+ * instructions and nextPC.
+ */
+static void emit_memory_op(Emitter &e, const TranslatedOp &op, const MemoryLayout &layout,
+                           uint64_t retired, uint32_t nextPC) {
+    bool isStore = (op.kind == OP_SH || op.kind == OP_SW);
+    uint32_t width = (op.kind == OP_LW || op.kind == OP_SW) ? 4 : (op.kind == OP_SH ? 2 : 1);
+    std::vector<size_t> misses;
+    std::vector<size_t> codePage; // write TLB misses that may hit a code page entry
+
+    e.address(op);
+    if (isStore)
+        e.tlb_lookup(layout.writeTag, layout.writePage, width, codePage);
+    else
+        e.tlb_lookup(layout.readTag, layout.readPage, width, misses);
+    size_t access = e.code.size();
+
+    uint64_t helper = 0;
+    switch (op.kind) {
+        case OP_LB:  // movsx eax, byte [r8 + rcx]
+            e.byte(0x41); e.byte(0x0F); e.byte(0xBE); e.byte(0x04); e.byte(0x08);
+            helper = (uint64_t)(uintptr_t)&jit_load_byte;
+            break;
+        case OP_LBU: // movzx eax, byte [r8 + rcx]
+            e.byte(0x41); e.byte(0x0F); e.byte(0xB6); e.byte(0x04); e.byte(0x08);
+            helper = (uint64_t)(uintptr_t)&jit_load_ubyte;
+            break;
+        case OP_LW:  // mov eax, [r8 + rcx]
+            e.byte(0x41); e.byte(0x8B); e.byte(0x04); e.byte(0x08);
+            helper = (uint64_t)(uintptr_t)&jit_load_word;
+            break;
+        case OP_SH:  // mov [r8 + rcx], ax
+            e.load(EAX, reg_disp(op.rs2));
+            e.byte(0x66); e.byte(0x41); e.byte(0x89); e.byte(0x04); e.byte(0x08);
+            helper = (uint64_t)(uintptr_t)&jit_store_half;
+            break;
+        case OP_SW:  // mov [r8 + rcx], eax
+            e.load(EAX, reg_disp(op.rs2));
+            e.byte(0x41); e.byte(0x89); e.byte(0x04); e.byte(0x08);
+            helper = (uint64_t)(uintptr_t)&jit_store_word;
+            break;
+    }
+    size_t done = e.jump32();                                 // jmp done
+
+    if (isStore) {
+        for (size_t i = 0; i < codePage.size(); i++)
+            e.patch8(codePage[i]);
+        e.tlb_lookup(layout.writeTag, layout.writePage, width, misses, layout.codePage);
+        e.code_test(layout.codeBitmap, width, misses);
+        e.jump_back(access);
+    }
+    for (size_t i = 0; i < misses.size(); i++)
+        e.patch8(misses[i]);
+    e.call_helper(helper, isStore, op.rs2);
+    if (isStore) {
+        e.byte(0x85); e.byte(0xC0);                           // test eax, eax
+        size_t unchanged = e.jump8(0x74);                     // jz done
+        e.byte(0x48); e.byte(0xC7); e.byte(0x02); e.dword((uint32_t)retired); // mov qword [rdx], retired
+        e.ret_pc_imm(nextPC);
+        e.patch8(unchanged);
+    }
+
+    e.patch32(done);
+    if (!isStore) {
+        e.store(EAX, layout.mrdDisp);
+        if (op.rd != 0)
+            e.store(EAX, reg_disp(op.rd));
+    }
+}
+
+// Constructor - maps the code buffer unless the JIT is off or unsupported
+JitEngine::JitEngine(CPU &cpu, unsigned long pcLimit, unsigned threshold, bool enableJit)
+    : cpu(cpu), pcLimit(pcLimit), threshold(threshold ? threshold : 1),
+      jitEnabled(enableJit && JIT_SUPPORTED), translatedVersion(cpu.codeVersion),
+      isHalted(false), compiled(0),
+      counters((pcLimit >> 2) + 1, 0), native((pcLimit >> 2) + 1),
+      codeBuffer(NULL), codeSize(0), codeUsed(0), pageSize(4096), bufferFlushes(0)
+{
+    flush();
+#if JIT_SUPPORTED
+    if (jitEnabled) {
+        void *p = mmap(NULL, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            jitEnabled = false;
+        } else {
+            codeBuffer = (uint8_t *)p;
+            codeSize = CODE_BUFFER_SIZE;
+            long page = sysconf(_SC_PAGESIZE);
+            if (page > 0)
+                pageSize = (size_t)page;
+        }
+    }
+#endif
+}
+
+JitEngine::~JitEngine() {
+#if JIT_SUPPORTED
+    if (codeBuffer != NULL)
+        munmap(codeBuffer, codeSize);
+#endif
+}
+
+bool JitEngine::halted() const {
+    return isHalted;
+}
+
+unsigned long JitEngine::compiledBlocks() const {
+    return compiled;
+}
+
+unsigned long JitEngine::codeFlushes() const {
+    return bufferFlushes;
+}
+
+void JitEngine::restart(unsigned long pcLimit) {
+    this->pcLimit = pcLimit;
+    isHalted = false;
+    counters.resize((pcLimit >> 2) + 1);
+    native.resize((pcLimit >> 2) + 1);
+    flush();
+}
+
+// Forgets every compiled block and restarts the hotness counters
+void JitEngine::flush() {
+    for (size_t i = 0; i < native.size(); i++) {
+        native[i].code = NULL;
+        native[i].length = 0;
+        counters[i] = 0;
+    }
+    codeUsed = 0;
+    translatedVersion = cpu.codeVersion;
+}
+
+#if JIT_SUPPORTED
+/**
+ * Emits the basic block starting at pc into e and returns its length in
+ * instructions. The block ends like a BlockEngine block: at a bne/jalr
+ * (included), before a zero word or an instruction only the CPU stages
+ * handle, or once the next PC would leave [0, pcLimit].
+ */
+static uint64_t emit_block(Emitter &e, CPU &cpu, unsigned long pc, unsigned long pcLimit,
+                           const MemoryLayout &layout) {
+    uint64_t length = 0;
+    unsigned long q = pc;
+    bool terminated = false;
+    while (!terminated) {
+        TranslatedOp op = Translator::translate(cpu, q);
+        switch (op.kind) {
+            case OP_HALT:
+            case OP_GENERIC:
+                // leave this instruction to the interpreter
+                e.ret_pc_imm((uint32_t)q);
+                terminated = true;
+                continue;
+            case OP_NOP:
+                break;
+            case OP_ADD:  e.load(EAX, reg_disp(op.rs1)); e.load(ECX, reg_disp(op.rs2)); e.alu_rr(0x01); e.store(EAX, reg_disp(op.rd)); break;
+            case OP_SUB:  e.load(EAX, reg_disp(op.rs1)); e.load(ECX, reg_disp(op.rs2)); e.alu_rr(0x29); e.store(EAX, reg_disp(op.rd)); break;
+            case OP_AND:  e.load(EAX, reg_disp(op.rs1)); e.load(ECX, reg_disp(op.rs2)); e.alu_rr(0x21); e.store(EAX, reg_disp(op.rd)); break;
+            case OP_OR:   e.load(EAX, reg_disp(op.rs1)); e.load(ECX, reg_disp(op.rs2)); e.alu_rr(0x09); e.store(EAX, reg_disp(op.rd)); break;
+            case OP_SLTU: e.load(EAX, reg_disp(op.rs1)); e.cmp_mem(reg_disp(op.rs2)); e.set_below(); e.store(EAX, reg_disp(op.rd)); break;
+            case OP_SRA:
+                e.load(EAX, reg_disp(op.rs1));
+                e.load(ECX, reg_disp(op.rs2));
+                e.byte(0xD3); e.byte(0xF8); // sar eax, cl (count masked to 5 bits)
+                e.store(EAX, reg_disp(op.rd));
+                break;
+            case OP_ADDI:  e.load(EAX, reg_disp(op.rs1)); e.alu_ri(0x05, op.imm); e.store(EAX, reg_disp(op.rd)); break;
+            case OP_SUBI:  e.load(EAX, reg_disp(op.rs1)); e.alu_ri(0x2D, op.imm); e.store(EAX, reg_disp(op.rd)); break;
+            case OP_ANDI:  e.load(EAX, reg_disp(op.rs1)); e.alu_ri(0x25, op.imm); e.store(EAX, reg_disp(op.rd)); break;
+            case OP_ORI:   e.load(EAX, reg_disp(op.rs1)); e.alu_ri(0x0D, op.imm); e.store(EAX, reg_disp(op.rd)); break;
+            case OP_SLTIU: e.load(EAX, reg_disp(op.rs1)); e.alu_ri(0x3D, op.imm); e.set_below(); e.store(EAX, reg_disp(op.rd)); break;
+            case OP_SRAI:
+                e.load(EAX, reg_disp(op.rs1));
+                e.byte(0xC1); e.byte(0xF8); e.byte(op.imm & 0x1F); // sar eax, imm8
+                e.store(EAX, reg_disp(op.rd));
+                break;
+            case OP_LUI:
+                e.store_imm(reg_disp(op.rd), op.imm);
+                break;
+            case OP_LB:
+            case OP_LBU:
+            case OP_LW:
+            case OP_SH:
+            case OP_SW:
+                emit_memory_op(e, op, layout, length + 1, (uint32_t)q + 4);
+                break;
+            case OP_BNE:
+                e.load(EAX, reg_disp(op.rs1));
+                e.cmp_mem(reg_disp(op.rs2));
+                e.byte(0xB8); e.dword((uint32_t)q + 4);                 // mov eax, not-taken PC
+                e.byte(0xB9); e.dword((uint32_t)q + (uint32_t)op.imm);  // mov ecx, taken PC
+                e.byte(0x0F); e.byte(0x45); e.byte(0xC1);               // cmovne eax, ecx
+                e.ret_pc();
+                length++;
+                terminated = true;
+                continue;
+            case OP_JALR:
+                e.load(EAX, reg_disp(op.rs1));
+                e.alu_ri(0x05, op.imm);
+                e.byte(0x83); e.byte(0xE0); e.byte(0xFE);               // and eax, ~1
+                if (op.rd != 0)
+                    e.store_imm(reg_disp(op.rd), (int32_t)(q + 4));
+                e.ret_pc();
+                length++;
+                terminated = true;
+                continue;
+        }
+        length++;
+        q += 4;
+        if (q > pcLimit || length >= MAX_BLOCK_LENGTH) {
+            e.ret_pc_imm((uint32_t)q);
+            terminated = true;
+        }
+    }
+
+    return length;
+}
+#endif
+
+/**
+ * Compiles the basic block starting at pc into the code buffer, flushing
+ * the buffer first if the block does not fit. Returns false if nothing
+ * could be compiled.
+ */
+bool JitEngine::compile(unsigned long pc) {
+#if JIT_SUPPORTED
+    static_assert(sizeof(Memory::TlbEntry) == 16, "tlb_lookup assumes 16-byte TLB entries");
+    const char *memBase = (const char *)&cpu.memory;
+    MemoryLayout layout;
+    layout.mrdDisp = (int32_t)((char *)&cpu.mem_read_data - (char *)cpu.regs);
+    layout.readTag = (int32_t)((const char *)&cpu.memory.readTlb[0].tag - memBase);
+    layout.readPage = (int32_t)((const char *)&cpu.memory.readTlb[0].page - memBase);
+    layout.writeTag = (int32_t)((const char *)&cpu.memory.writeTlb[0].tag - memBase);
+    layout.writePage = (int32_t)((const char *)&cpu.memory.writeTlb[0].page - memBase);
+    layout.codeBitmap = (int32_t)(Memory::PAGE_SIZE + offsetof(Memory::PageInfo, code));
+    layout.codePage = Memory::CODE_PAGE;
+
+    Emitter e;
+    uint64_t length = emit_block(e, cpu, pc, pcLimit, layout);
+    if (e.overflow) {
+        // a short jump did not reach its target: emit again with rel32 jumps
+        e = Emitter();
+        e.nearJumps = true;
+        length = emit_block(e, cpu, pc, pcLimit, layout);
+    }
+    if (length == 0 || e.code.size() > codeSize)
+        return false;
+    if (codeUsed + e.code.size() > codeSize) {
+        // full: drop every compiled block and start over at the beginning
+        flush();
+        bufferFlushes++;
+    }
+
+    // W^X: only the pages the block lands on become writable, and only
+    // while it is copied in
+    uint8_t *dest = codeBuffer + codeUsed;
+    size_t first = codeUsed & ~(pageSize - 1);
+    size_t last = (codeUsed + e.code.size() + pageSize - 1) & ~(pageSize - 1);
+    if (mprotect(codeBuffer + first, last - first, PROT_READ | PROT_WRITE) != 0)
+        return false;
+    memcpy(dest, e.code.data(), e.code.size());
+    mprotect(codeBuffer + first, last - first, PROT_READ | PROT_EXEC);
+    codeUsed += (e.code.size() + 15) & ~(size_t)15;
+
+    native[pc >> 2].code = (NativeCode)(void *)dest;
+    native[pc >> 2].length = length;
+    compiled++;
+    return true;
+#else
+    (void)pc;
+    return false;
+#endif
+}
+
+// One instruction through the CPU stages; false on a zero instruction word
+bool JitEngine::interpret() {
+    uint32_t instruction = cpu.fetch();
+    if (instruction == 0)
+        return false;
+    cpu.decode(instruction);
+    cpu.execute();
+    cpu.mem();
+    cpu.wb();
+    cpu.updatePC();
+    return true;
+}
+
+/**
+ * Runs compiled blocks where they exist and interprets everything else,
+ * counting interpreted PCs to decide what to compile next. The halt
+ * conditions are exactly those of the stage loop in cpusim.cpp.
+ */
+uint64_t JitEngine::run(uint64_t max_instructions) {
+    if (isHalted)
+        return 0;
+    if (translatedVersion != cpu.codeVersion)
+        flush();
+
+    uint64_t executed = 0;
+    while (executed < max_instructions) {
+        if (translatedVersion != cpu.codeVersion)
+            flush(); // the last instruction wrote over compiled code
+        unsigned long pc = cpu.PC;
+        if (pc <= pcLimit && (pc & 3) == 0) {
+            NativeBlock &nb = native[pc >> 2];
+            if (nb.code != NULL && nb.length <= max_instructions - executed) {
+                uint64_t retired = nb.length;
+                cpu.PC = nb.code(cpu.regs, &cpu.memory, &retired);
+                executed += retired;
+                if (cpu.PC > pcLimit) {
+                    isHalted = true;
+                    break;
+                }
+                continue;
+            }
+            if (jitEnabled && nb.code == NULL && ++counters[pc >> 2] == threshold) {
+                if (compile(pc))
+                    continue;
+            }
+        }
+
+        if (!interpret()) {
+            isHalted = true;
+            break;
+        }
+        executed++;
+        if (cpu.PC > pcLimit) {
+            isHalted = true;
+            break;
+        }
+    }
+    return executed;
+}
@@ -0,0 +1,79 @@
+#ifndef JIT_ENGINE_H
+#define JIT_ENGINE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "CPU.h"
+#include "Translator.h"
+
+// Tiered execution engine with an x86-64 native code backend.
+// Instructions are interpreted through the regular CPU stages while a
+// per-PC counter tracks how often each one is reached. Once a PC becomes
+// hot, the basic block starting there is compiled to native code in an
+// executable buffer and later visits run it directly. The native code works
+// on the CPU's own register file and memory (with the TLB lookup inlined),
+// so switching between the tiers needs no state copies. On hosts other than
+// x86-64, or when the JIT is disabled, everything is interpreted.
+class JitEngine {
+public:
+    // pcLimit is the stage loop's exit bound: execution stops once PC > pcLimit.
+    // A block is compiled after its first PC has been interpreted threshold
+    // times; enableJit = false keeps every instruction in the interpreter.
+    JitEngine(CPU &cpu, unsigned long pcLimit, unsigned threshold, bool enableJit);
+    ~JitEngine();
+
+    // Runs until the program halts or max_instructions have executed.
+    // Returns the number of instructions executed.
+    uint64_t run(uint64_t max_instructions);
+
+    // True once the program fetched a zero word or left [0, pcLimit]
+    bool halted() const;
+
+    // Number of blocks compiled so far
+    unsigned long compiledBlocks() const;
+
+    // Number of times the code buffer filled up and every compiled block
+    // was dropped to make room
+    unsigned long codeFlushes() const;
+
+    // Forgets the halt and starts over at the CPU's PC with a new exit
+    // bound, e.g. after CPU::reset loaded another program. Reuses the
+    // engine's buffers; compiling blocks again still allocates.
+    void restart(unsigned long pcLimit);
+
+private:
+    // Native block: returns the next PC; retires length instructions unless
+    // a store over code ends it early, in which case *retired says how many
+    typedef uint64_t (*NativeCode)(int32_t *regs, Memory *memory, uint64_t *retired);
+
+    struct NativeBlock {
+        NativeCode code;
+        uint64_t length;
+    };
+
+    CPU &cpu;
+    unsigned long pcLimit;
+    unsigned threshold;
+    bool jitEnabled;
+    unsigned long translatedVersion;
+    bool isHalted;
+    unsigned long compiled;
+
+    // per aligned PC <= pcLimit: interpretation count and compiled block
+    std::vector<uint32_t> counters;
+    std::vector<NativeBlock> native;
+
+    // executable code buffer, made writable a host page at a time
+    uint8_t *codeBuffer;
+    size_t codeSize;
+    size_t codeUsed;
+    size_t pageSize;
+    unsigned long bufferFlushes;
+
+    void flush();
+    bool compile(unsigned long pc);
+    bool interpret();
+};
+
+#endif // JIT_ENGINE_H
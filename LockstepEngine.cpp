@@ -0,0 +1,620 @@
+#include "LockstepEngine.h"
+#include "Engine.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VEC_LANES 8
+typedef __m256i VecI;
+static inline VecI vload(const int32_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline void vstore(int32_t *p, VecI v) { _mm256_storeu_si256((__m256i *)p, v); }
+static inline VecI vset1(int32_t x) { return _mm256_set1_epi32(x); }
+static inline VecI vadd(VecI a, VecI b) { return _mm256_add_epi32(a, b); }
+static inline VecI vsub(VecI a, VecI b) { return _mm256_sub_epi32(a, b); }
+static inline VecI vand(VecI a, VecI b) { return _mm256_and_si256(a, b); }
+static inline VecI vandnot(VecI a, VecI b) { return _mm256_andnot_si256(a, b); }
+static inline VecI vor(VecI a, VecI b) { return _mm256_or_si256(a, b); }
+static inline VecI vxor(VecI a, VecI b) { return _mm256_xor_si256(a, b); }
+static inline VecI vcmpgt(VecI a, VecI b) { return _mm256_cmpgt_epi32(a, b); }
+static inline VecI vcmpeq(VecI a, VecI b) { return _mm256_cmpeq_epi32(a, b); }
+static inline VecI vsra(VecI a, VecI b) { return _mm256_srav_epi32(a, vand(b, vset1(0x1F))); }
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VEC_LANES 4
+typedef __m128i VecI;
+static inline VecI vload(const int32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void vstore(int32_t *p, VecI v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline VecI vset1(int32_t x) { return _mm_set1_epi32(x); }
+static inline VecI vadd(VecI a, VecI b) { return _mm_add_epi32(a, b); }
+static inline VecI vsub(VecI a, VecI b) { return _mm_sub_epi32(a, b); }
+static inline VecI vand(VecI a, VecI b) { return _mm_and_si128(a, b); }
+static inline VecI vandnot(VecI a, VecI b) { return _mm_andnot_si128(a, b); }
+static inline VecI vor(VecI a, VecI b) { return _mm_or_si128(a, b); }
+static inline VecI vxor(VecI a, VecI b) { return _mm_xor_si128(a, b); }
+static inline VecI vcmpgt(VecI a, VecI b) { return _mm_cmpgt_epi32(a, b); }
+static inline VecI vcmpeq(VecI a, VecI b) { return _mm_cmpeq_epi32(a, b); }
+// SSE2 has no per-element variable shift
+static inline VecI vsra(VecI a, VecI b) {
+    int32_t x[4], s[4];
+    vstore(x, a);
+    vstore(s, b);
+    for (int i = 0; i < 4; i++)
+        x[i] >>= (s[i] & 0x1F);
+    return vload(x);
+}
+#else
+#define VEC_LANES 1
+#endif
+
+// Lane arrays are padded to this many entries so vector loops need no tail
+static const size_t LANE_ALIGN = 8;
+
+// ALU operations, one per ALU::execute operation the translator emits
+struct AddOp {
+    static int32_t scalar(int32_t a, int32_t b) { return (int32_t)((uint32_t)a + (uint32_t)b); }
+#if VEC_LANES > 1
+    static VecI vector(VecI a, VecI b) { return vadd(a, b); }
+#endif
+};
+
+struct SubOp {
+    static int32_t scalar(int32_t a, int32_t b) { return (int32_t)((uint32_t)a - (uint32_t)b); }
+#if VEC_LANES > 1
+    static VecI vector(VecI a, VecI b) { return vsub(a, b); }
+#endif
+};
+
+struct AndOp {
+    static int32_t scalar(int32_t a, int32_t b) { return a & b; }
+#if VEC_LANES > 1
+    static VecI vector(VecI a, VecI b) { return vand(a, b); }
+#endif
+};
+
+struct OrOp {
+    static int32_t scalar(int32_t a, int32_t b) { return a | b; }
+#if VEC_LANES > 1
+    static VecI vector(VecI a, VecI b) { return vor(a, b); }
+#endif
+};
+
+struct SltuOp {
+    static int32_t scalar(int32_t a, int32_t b) { return ((uint32_t)a < (uint32_t)b) ? 1 : 0; }
+#if VEC_LANES > 1
+    // unsigned compare: flip the sign bits and compare signed
+    static VecI vector(VecI a, VecI b) {
+        VecI sign = vset1((int32_t)0x80000000u);
+        return vand(vcmpgt(vxor(b, sign), vxor(a, sign)), vset1(1));
+    }
+#endif
+};
+
+struct SraOp {
+    static int32_t scalar(int32_t a, int32_t b) { return a >> (b & 0x1F); }
+#if VEC_LANES > 1
+    static VecI vector(VecI a, VecI b) { return vsra(a, b); }
+#endif
+};
+
+struct LuiOp {
+    static int32_t scalar(int32_t, int32_t b) { return b; }
+#if VEC_LANES > 1
+    static VecI vector(VecI, VecI b) { return b; }
+#endif
+};
+
+/**
+ * dst[i] = op(a[i], b ? b[i] : imm) for every lane whose mask is set.
+ * Inactive lanes keep their value; dst may alias a or b.
+ */
+template <class Op>
+static void alu_kernel(int32_t *dst, const int32_t *a, const int32_t *b, int32_t imm,
+                       const int32_t *mask, size_t n) {
+    size_t i = 0;
+#if VEC_LANES > 1
+    VecI bImm = vset1(imm);
+    for (; i + VEC_LANES <= n; i += VEC_LANES) {
+        VecI m = vload(mask + i);
+        VecI result = Op::vector(vload(a + i), b ? vload(b + i) : bImm);
+        vstore(dst + i, vor(vand(m, result), vandnot(m, vload(dst + i))));
+    }
+#endif
+    for (; i < n; i++) {
+        if (mask[i])
+            dst[i] = Op::scalar(a[i], b ? b[i] : imm);
+    }
+}
+
+// taken[i] = mask[i] & (a[i] != b[i]); returns the number of taken lanes
+static size_t ne_kernel(int32_t *taken, const int32_t *a, const int32_t *b,
+                        const int32_t *mask, size_t n) {
+    size_t i = 0;
+#if VEC_LANES > 1
+    for (; i + VEC_LANES <= n; i += VEC_LANES)
+        vstore(taken + i, vandnot(vcmpeq(vload(a + i), vload(b + i)), vload(mask + i)));
+#endif
+    for (; i < n; i++)
+        taken[i] = (a[i] != b[i]) ? mask[i] : 0;
+    size_t count = 0;
+    for (i = 0; i < n; i++)
+        count += taken[i] & 1;
+    return count;
+}
+
+// Constructor - every lane starts from reset state plus its own inputs
+LockstepEngine::LockstepEngine(const char instructionMemory[4096], unsigned long pcLimit,
+                               const std::vector<LaneInput> &inputs, uint64_t memoryLimit)
+    : laneCount(inputs.size()),
+      stride((inputs.size() + LANE_ALIGN - 1) / LANE_ALIGN * LANE_ALIGN),
+      pcLimit(pcLimit),
+      regs(32 * stride, 0),
+      laneMemory(new Memory[inputs.size()]),
+      codeWritten(inputs.size(), 0),
+      loadData(inputs.size(), 0),
+      counts(inputs.size(), 0),
+      status(inputs.size(), LANE_RUNNING),
+      scalar(new CPU(instructionMemory))
+{
+    for (size_t lane = 0; lane < laneCount; lane++) {
+        Memory &mem = laneMemory[lane];
+        mem.setLimit(memoryLimit);
+        mem.load(0, (const uint8_t *)instructionMemory, 4096);
+        // every lane runs the shared translation of [0, pcLimit]
+        for (unsigned long pc = 0; pc <= pcLimit; pc += 4)
+            mem.markCode((uint32_t)pc);
+        mem.setCodeWriteHook(&LockstepEngine::code_written, &codeWritten[lane]);
+
+        const LaneInput &in = inputs[lane];
+        for (size_t i = 0; i < in.regs.size(); i++)
+            regs[in.regs[i].first * stride + lane] = in.regs[i].second;
+        for (size_t i = 0; i < in.words.size(); i++)
+            mem.write32(in.words[i].first, in.words[i].second);
+    }
+
+    unsigned long words = (pcLimit >> 2) + 1;
+    ops.resize(words);
+    for (unsigned long i = 0; i < words; i++)
+        ops[i] = Translator::translate(*scalar, i << 2);
+}
+
+LockstepEngine::~LockstepEngine() {
+    delete scalar;
+    delete[] laneMemory;
+}
+
+// Lane memory hook: flags the lane for ejection
+void LockstepEngine::code_written(void *flag, uint32_t, unsigned) {
+    *(uint8_t *)flag = 1;
+}
+
+size_t LockstepEngine::lanes() const {
+    return laneCount;
+}
+
+int32_t LockstepEngine::reg(size_t lane, int idx) const {
+    return regs[idx * stride + lane];
+}
+
+uint64_t LockstepEngine::instructions(size_t lane) const {
+    return counts[lane];
+}
+
+bool LockstepEngine::halted(size_t lane) const {
+    return status[lane] == LANE_HALTED;
+}
+
+// Queues lanes to continue at pc, merging with a group already there
+void LockstepEngine::add_group(unsigned long pc, const std::vector<int32_t> &mask) {
+    for (size_t g = 0; g < groups.size(); g++) {
+        if (groups[g].pc == pc) {
+            for (size_t i = 0; i < stride; i++)
+                groups[g].mask[i] |= mask[i];
+            return;
+        }
+    }
+    Group group;
+    group.pc = pc;
+    group.mask = mask;
+    groups.push_back(group);
+}
+
+void LockstepEngine::halt_lanes(const int32_t *mask) {
+    for (size_t lane = 0; lane < laneCount; lane++) {
+        if (mask[lane])
+            status[lane] = LANE_HALTED;
+    }
+}
+
+// Lanes in mask move on to pc, or halt if it is past the limit
+void LockstepEngine::continue_group(unsigned long pc, const std::vector<int32_t> &mask) {
+    if (pc > pcLimit)
+        halt_lanes(&mask[0]);
+    else
+        add_group(pc, mask);
+}
+
+// Lanes move on to per-lane next PCs: halt the ones past the limit and
+// regroup the rest by target
+void LockstepEngine::scatter(std::vector<std::pair<unsigned long, size_t> > &targets) {
+    std::sort(targets.begin(), targets.end());
+    std::vector<int32_t> mask(stride, 0);
+    for (size_t i = 0; i < targets.size(); i++) {
+        unsigned long pc = targets[i].first;
+        size_t lane = targets[i].second;
+        if (pc > pcLimit) {
+            status[lane] = LANE_HALTED;
+            continue;
+        }
+        mask[lane] = -1;
+        if (i + 1 == targets.size() || targets[i + 1].first != pc) {
+            add_group(pc, mask);
+            std::fill(mask.begin(), mask.end(), 0);
+        }
+    }
+}
+
+/**
+ * Runs one instruction of one lane through the regular CPU stages. Used for
+ * the rare cases the lane kernels do not cover (misaligned PCs and generic
+ * instructions). Returns false if the lane fetched a zero word; sets
+ * changedCode if the instruction stored over code.
+ */
+bool LockstepEngine::step_lane(size_t lane, unsigned long pc, unsigned long &next, bool &changedCode) {
+    CPU &cpu = *scalar;
+    for (int i = 0; i < 32; i++)
+        cpu.regs[i] = regs[i * stride + lane];
+    cpu.memory.swap(laneMemory[lane]);
+    cpu.mem_read_data = loadData[lane];
+    cpu.PC = pc;
+    unsigned long version = cpu.codeVersion;
+
+    bool stepped = false;
+    uint32_t instruction = cpu.fetch();
+    if (instruction != 0) {
+        cpu.decode(instruction);
+        cpu.execute();
+        cpu.mem();
+        cpu.wb();
+        cpu.updatePC();
+        stepped = true;
+    }
+
+    for (int i = 0; i < 32; i++)
+        regs[i * stride + lane] = cpu.regs[i];
+    cpu.memory.swap(laneMemory[lane]);
+    loadData[lane] = cpu.mem_read_data;
+    next = cpu.PC;
+    changedCode = (cpu.codeVersion != version);
+    return stepped;
+}
+
+/**
+ * Takes a lane whose code no longer matches the shared translation out of
+ * the lockstep and runs it to completion on the scalar CPU, starting at pc.
+ */
+void LockstepEngine::eject(size_t lane, unsigned long pc, uint64_t max_instructions) {
+    if (pc > pcLimit) {
+        status[lane] = LANE_HALTED;
+        return;
+    }
+    if (counts[lane] == max_instructions) {
+        status[lane] = LANE_LIMIT;
+        return;
+    }
+
+    CPU &cpu = *scalar;
+    for (int i = 0; i < 32; i++)
+        cpu.regs[i] = regs[i * stride + lane];
+    cpu.memory.swap(laneMemory[lane]);
+    cpu.invalidate_decoded();
+    cpu.mem_read_data = loadData[lane];
+    cpu.PC = pc;
+
+    EngineOptions options;
+    options.kind = ENGINE_BLOCK;
+    options.maxInstructions = max_instructions - counts[lane];
+    RunResult result = run_program(cpu, pcLimit, options);
+    counts[lane] += result.instructions;
+    status[lane] = result.halted ? LANE_HALTED : LANE_LIMIT;
+
+    for (int i = 0; i < 32; i++)
+        regs[i * stride + lane] = cpu.regs[i];
+    cpu.memory.swap(laneMemory[lane]);
+    cpu.invalidate_decoded();
+    loadData[lane] = cpu.mem_read_data;
+}
+
+/**
+ * Runs a group from its PC to the end of its basic block (or a halt, or the
+ * instruction budget of its most advanced lane), then hands its lanes on to
+ * the successor groups.
+ */
+void LockstepEngine::run_group(Group &g, uint64_t max_instructions) {
+    const int32_t *m = &g.mask[0];
+
+    uint64_t budget = max_instructions;
+    for (size_t lane = 0; lane < laneCount; lane++) {
+        if (m[lane])
+            budget = std::min(budget, max_instructions - counts[lane]);
+    }
+
+    unsigned long pc = g.pc;
+    uint64_t executed = 0;
+    std::vector<std::pair<unsigned long, size_t> > targets;
+
+    for (;;) {
+        if (executed == budget) {
+            // lanes out of budget stop; the others carry on from here
+            std::vector<int32_t> rest(stride, 0);
+            bool any = false;
+            for (size_t lane = 0; lane < laneCount; lane++) {
+                if (!m[lane])
+                    continue;
+                counts[lane] += executed;
+                if (counts[lane] == max_instructions) {
+                    status[lane] = LANE_LIMIT;
+                } else {
+                    rest[lane] = -1;
+                    any = true;
+                }
+            }
+            if (any)
+                add_group(pc, rest);
+            return;
+        }
+
+        const TranslatedOp *op = ((pc & 3) == 0) ? &ops[pc >> 2] : NULL;
+        if (op == NULL || op->kind == OP_GENERIC) {
+            for (size_t lane = 0; lane < laneCount; lane++) {
+                if (!m[lane])
+                    continue;
+                counts[lane] += executed;
+                unsigned long next;
+                bool changedCode;
+                if (!step_lane(lane, pc, next, changedCode)) {
+                    status[lane] = LANE_HALTED;
+                    continue;
+                }
+                counts[lane]++;
+                if (changedCode)
+                    eject(lane, next, max_instructions);
+                else
+                    targets.push_back(std::make_pair(next, lane));
+            }
+            scatter(targets);
+            return;
+        }
+
+        switch (op->kind) {
+        case OP_HALT:
+            for (size_t lane = 0; lane < laneCount; lane++) {
+                if (m[lane])
+                    counts[lane] += executed;
+            }
+            halt_lanes(m);
+            return;
+
+        case OP_NOP:
+            break;
+
+        case OP_ADD:   alu_kernel<AddOp>(r(op->rd), r(op->rs1), r(op->rs2), 0, m, stride); break;
+        case OP_SUB:   alu_kernel<SubOp>(r(op->rd), r(op->rs1), r(op->rs2), 0, m, stride); break;
+        case OP_AND:   alu_kernel<AndOp>(r(op->rd), r(op->rs1), r(op->rs2), 0, m, stride); break;
+        case OP_OR:    alu_kernel<OrOp>(r(op->rd), r(op->rs1), r(op->rs2), 0, m, stride); break;
+        case OP_SLTU:  alu_kernel<SltuOp>(r(op->rd), r(op->rs1), r(op->rs2), 0, m, stride); break;
+        case OP_SRA:   alu_kernel<SraOp>(r(op->rd), r(op->rs1), r(op->rs2), 0, m, stride); break;
+        case OP_ADDI:  alu_kernel<AddOp>(r(op->rd), r(op->rs1), NULL, op->imm, m, stride); break;
+        case OP_SUBI:  alu_kernel<SubOp>(r(op->rd), r(op->rs1), NULL, op->imm, m, stride); break;
+        case OP_ANDI:  alu_kernel<AndOp>(r(op->rd), r(op->rs1), NULL, op->imm, m, stride); break;
+        case OP_ORI:   alu_kernel<OrOp>(r(op->rd), r(op->rs1), NULL, op->imm, m, stride); break;
+        case OP_SLTIU: alu_kernel<SltuOp>(r(op->rd), r(op->rs1), NULL, op->imm, m, stride); break;
+        case OP_SRAI:  alu_kernel<SraOp>(r(op->rd), r(op->rs1), NULL, op->imm, m, stride); break;
+        case OP_LUI:   alu_kernel<LuiOp>(r(op->rd), r(0), NULL, op->imm, m, stride); break;
+
+        case OP_LB:
+        case OP_LBU:
+        case OP_LW: {
+            int32_t *base = r(op->rs1);
+            int32_t *dst = r(op->rd);
+            for (size_t lane = 0; lane < laneCount; lane++) {
+                if (!m[lane])
+                    continue;
+                Memory &mem = laneMemory[lane];
+                uint32_t addr = (uint32_t)base[lane] + (uint32_t)op->imm;
+                int32_t value;
+                if (op->kind == OP_LB)
+                    value = (int8_t)mem.read8(addr);
+                else if (op->kind == OP_LBU)
+                    value = mem.read8(addr);
+                else
+                    value = (int32_t)mem.read32(addr);
+                loadData[lane] = value;
+                if (op->rd != 0)
+                    dst[lane] = value;
+            }
+            break;
+        }
+
+        case OP_SH:
+        case OP_SW: {
+            int32_t *base = r(op->rs1);
+            int32_t *src = r(op->rs2);
+            for (size_t lane = 0; lane < laneCount; lane++) {
+                if (!m[lane])
+                    continue;
+                uint32_t addr = (uint32_t)base[lane] + (uint32_t)op->imm;
+                if (op->kind == OP_SH)
+                    laneMemory[lane].write16(addr, src[lane]);
+                else
+                    laneMemory[lane].write32(addr, src[lane]);
+                if (codeWritten[lane]) {
+                    // this lane's code now differs from the others
+                    g.mask[lane] = 0;
+                    counts[lane] += executed + 1;
+                    eject(lane, pc + 4, max_instructions);
+                }
+            }
+            break;
+        }
+
+        case OP_BNE: {
+            executed++;
+            std::vector<int32_t> taken(stride, 0);
+            size_t takenCount = ne_kernel(&taken[0], r(op->rs1), r(op->rs2), m, stride);
+            size_t active = 0;
+            for (size_t lane = 0; lane < laneCount; lane++) {
+                if (m[lane]) {
+                    counts[lane] += executed;
+                    active++;
+                }
+            }
+            if (active == 0)
+                return; // every lane was ejected by a store in this block
+            unsigned long takenPC = pc_from_mux((uint32_t)pc + (uint32_t)op->imm);
+            unsigned long nextPC = pc_from_mux((uint32_t)pc + 4);
+            if (takenCount == 0 || takenCount == active) {
+                // uniform: the whole group moves on together
+                continue_group(takenCount ? takenPC : nextPC, g.mask);
+            } else {
+                // divergent: split the group into its two sides
+                std::vector<int32_t> fall(stride, 0);
+                for (size_t lane = 0; lane < laneCount; lane++)
+                    fall[lane] = m[lane] & ~taken[lane];
+                continue_group(takenPC, taken);
+                continue_group(nextPC, fall);
+            }
+            return;
+        }
+
+        case OP_JALR: {
+            executed++;
+            int32_t *base = r(op->rs1);
+            for (size_t lane = 0; lane < laneCount; lane++) {
+                if (!m[lane])
+                    continue;
+                counts[lane] += executed;
+                uint32_t target = ((uint32_t)base[lane] + (uint32_t)op->imm) & ~1u;
+                targets.push_back(std::make_pair(pc_from_mux(target), lane));
+            }
+            if (op->rd != 0) {
+                int32_t *link = r(op->rd);
+                for (size_t lane = 0; lane < laneCount; lane++)
+                    if (m[lane]) link[lane] = (int32_t)(pc + 4);
+            }
+            scatter(targets);
+            return;
+        }
+        }
+
+        executed++;
+        pc += 4;
+        if (pc > pcLimit) {
+            for (size_t lane = 0; lane < laneCount; lane++) {
+                if (m[lane])
+                    counts[lane] += executed;
+            }
+            halt_lanes(m);
+            return;
+        }
+    }
+}
+
+/**
+ * Runs every lane to completion. The group with the lowest PC runs next, so
+ * lanes that split at a forward branch meet again at the join point before
+ * either side runs ahead.
+ */
+void LockstepEngine::run(uint64_t max_instructions) {
+    groups.clear();
+    std::vector<int32_t> all(stride, 0);
+    bool any = false;
+    for (size_t lane = 0; lane < laneCount; lane++) {
+        if (status[lane] != LANE_RUNNING)
+            continue;
+        if (max_instructions == 0) {
+            status[lane] = LANE_LIMIT;
+            continue;
+        }
+        if (codeWritten[lane]) {
+            // the lane's inputs overwrote part of the program
+            eject(lane, 0, max_instructions);
+            continue;
+        }
+        all[lane] = -1;
+        any = true;
+    }
+    if (any)
+        add_group(0, all);
+
+    while (!groups.empty()) {
+        size_t next = 0;
+        for (size_t g = 1; g < groups.size(); g++) {
+            if (groups[g].pc < groups[next].pc)
+                next = g;
+        }
+        Group group;
+        group.pc = groups[next].pc;
+        group.mask.swap(groups[next].mask);
+        groups.erase(groups.begin() + next);
+        run_group(group, max_instructions);
+    }
+}
+
+// Parses one integer token (decimal, 0x hex, or negative)
+static bool parse_value(const std::string &text, long long &value) {
+    if (text.empty())
+        return false;
+    char *end;
+    value = strtoll(text.c_str(), &end, 0);
+    return *end == '\0';
+}
+
+bool load_lane_inputs(const std::string &path, std::vector<LaneInput> &lanes, std::string &error) {
+    std::ifstream file(path.c_str());
+    if (!file.is_open()) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(file, line)) {
+        lineNo++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+        std::istringstream tokens(line);
+        std::string token;
+        LaneInput lane;
+        bool empty = true;
+        while (tokens >> token) {
+            empty = false;
+            size_t eq = token.find('=');
+            long long target, value;
+            std::ostringstream where;
+            where << path << ":" << lineNo << ": ";
+            if (eq == std::string::npos || !parse_value(token.substr(eq + 1), value)) {
+                error = where.str() + "bad assignment '" + token + "'";
+                return false;
+            }
+            std::string lhs = token.substr(0, eq);
+            if (lhs.size() > 1 && lhs[0] == 'x' && parse_value(lhs.substr(1), target) &&
+                target >= 1 && target < 32) {
+                lane.regs.push_back(std::make_pair((uint8_t)target, (int32_t)value));
+            } else if (lhs.size() > 5 && lhs.compare(0, 4, "mem[") == 0 && lhs[lhs.size() - 1] == ']' &&
+                       parse_value(lhs.substr(4, lhs.size() - 5), target)) {
+                lane.words.push_back(std::make_pair((uint32_t)target, (int32_t)value));
+            } else {
+                error = where.str() + "bad target '" + lhs + "' (expected x1..x31 or mem[addr])";
+                return false;
+            }
+        }
+        if (!empty)
+            lanes.push_back(lane);
+    }
+    return true;
+}
@@ -0,0 +1,84 @@
+#ifndef LOCKSTEP_ENGINE_H
+#define LOCKSTEP_ENGINE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CPU.h"
+#include "Memory.h"
+#include "Translator.h"
+
+// Initial state for one lane of a lockstep run
+struct LaneInput {
+    std::vector<std::pair<uint8_t, int32_t> > regs;   // xN = value
+    std::vector<std::pair<uint32_t, int32_t> > words; // memory word at address
+};
+
+// Reads lane inputs, one lane per non-empty line: "x10=5 x11=-3 mem[0x20]=0x1234".
+// '#' starts a comment. Returns false (with a message in error) on bad input.
+bool load_lane_inputs(const std::string &path, std::vector<LaneInput> &lanes, std::string &error);
+
+// Lockstep engine: one program, many input vectors.
+// Every lane is an independent copy of the CPU state; the register file is
+// stored as a struct of arrays (regs[32][lanes]) so ALU instructions run as
+// vector kernels across all lanes at once (AVX2 or SSE2 where available,
+// scalar otherwise). Lanes that share a PC form a group with an active-lane
+// mask; a bne or jalr that sends lanes different ways splits the group, and
+// groups merge again whenever they reach the same PC. The group with the
+// lowest PC always runs first so diverged lanes reconverge early. Each lane
+// has its own Memory; a lane that stores over the shared code leaves the
+// lockstep and finishes on its own.
+class LockstepEngine {
+public:
+    // program holds the instruction memory every lane runs; memoryLimit caps
+    // each lane's resident memory (0 = unlimited)
+    LockstepEngine(const char instructionMemory[4096], unsigned long pcLimit,
+                   const std::vector<LaneInput> &inputs, uint64_t memoryLimit);
+    ~LockstepEngine();
+
+    // Runs every lane until it halts or executes max_instructions
+    void run(uint64_t max_instructions);
+
+    size_t lanes() const;
+    int32_t reg(size_t lane, int idx) const;
+    uint64_t instructions(size_t lane) const;
+    bool halted(size_t lane) const;
+
+private:
+    enum LaneStatus { LANE_RUNNING, LANE_HALTED, LANE_LIMIT };
+
+    struct Group {
+        unsigned long pc;
+        std::vector<int32_t> mask; // -1 for active lanes, 0 otherwise
+    };
+
+    size_t laneCount;
+    size_t stride;                 // laneCount rounded up to the vector width
+    unsigned long pcLimit;
+
+    std::vector<int32_t> regs;     // regs[r * stride + lane]
+    Memory *laneMemory;            // one Memory per lane
+    std::vector<uint8_t> codeWritten; // lane stored over the shared code
+    std::vector<int32_t> loadData; // per-lane mem_read_data
+    std::vector<uint64_t> counts;  // per-lane instructions executed
+    std::vector<uint8_t> status;   // per-lane LaneStatus
+
+    std::vector<TranslatedOp> ops; // indexed by PC >> 2
+    std::vector<Group> groups;
+
+    // reference CPU: translation source and scalar fallback for single lanes
+    CPU *scalar;
+
+    int32_t *r(int idx) { return &regs[idx * stride]; }
+    void add_group(unsigned long pc, const std::vector<int32_t> &mask);
+    void continue_group(unsigned long pc, const std::vector<int32_t> &mask);
+    void scatter(std::vector<std::pair<unsigned long, size_t> > &targets);
+    void halt_lanes(const int32_t *mask);
+    static void code_written(void *flag, uint32_t addr, unsigned size);
+    bool step_lane(size_t lane, unsigned long pc, unsigned long &next, bool &changedCode);
+    void eject(size_t lane, unsigned long pc, uint64_t max_instructions);
+    void run_group(Group &g, uint64_t max_instructions);
+};
+
+#endif // LOCKSTEP_ENGINE_H
@@ -0,0 +1,418 @@
+#include "Memory.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Unallocated pages read through this page
+static uint8_t zeroPage[Memory::PAGE_SIZE];
+
+// Freed pages and page tables kept for reuse after clear(), so a memory
+// that is cleared and refilled again and again stops allocating
+static const size_t MAX_FREE_PAGES = 64;
+static const size_t MAX_FREE_TABLES = 16;
+
+// Constructor - empty address space, no limit
+Memory::Memory()
+    : pageCount(0), pageLimit(0), dropped(0), codeWriteCount(0),
+      hook(NULL), hookContext(NULL)
+{
+    for (unsigned i = 0; i < (1u << TABLE_BITS); i++)
+        directory[i] = NULL;
+    flush_tlbs();
+}
+
+Memory::~Memory() {
+    clear();
+    for (size_t i = 0; i < freePages.size(); i++)
+        delete[] freePages[i];
+    for (size_t i = 0; i < freeTables.size(); i++)
+        delete[] freeTables[i];
+}
+
+void Memory::flush_tlbs() {
+    for (unsigned i = 0; i < TLB_ENTRIES; i++) {
+        readTlb[i].tag = NO_PAGE;
+        readTlb[i].page = NULL;
+        writeTlb[i].tag = NO_PAGE;
+        writeTlb[i].page = NULL;
+    }
+}
+
+void Memory::clear() {
+    for (unsigned d = 0; d < (1u << TABLE_BITS); d++) {
+        uint8_t **table = directory[d];
+        if (table == NULL)
+            continue;
+        for (unsigned t = 0; t < (1u << TABLE_BITS); t++) {
+            if (table[t] == NULL)
+                continue;
+            if (--info(table[t])->references != 0)
+                continue; // still held by a snapshot
+            if (freePages.size() < MAX_FREE_PAGES)
+                freePages.push_back(table[t]);
+            else
+                delete[] table[t];
+        }
+        if (freeTables.size() < MAX_FREE_TABLES)
+            freeTables.push_back(table);
+        else
+            delete[] table;
+        directory[d] = NULL;
+    }
+    pageCount = 0;
+    dropped = 0;
+    codeWriteCount = 0;
+    flush_tlbs();
+}
+
+void Memory::swap(Memory &other) {
+    for (unsigned d = 0; d < (1u << TABLE_BITS); d++)
+        std::swap(directory[d], other.directory[d]);
+    freePages.swap(other.freePages);
+    freeTables.swap(other.freeTables);
+    std::swap(pageCount, other.pageCount);
+    std::swap(pageLimit, other.pageLimit);
+    std::swap(dropped, other.dropped);
+    std::swap(codeWriteCount, other.codeWriteCount);
+    flush_tlbs();
+    other.flush_tlbs();
+}
+
+void Memory::load(uint32_t addr, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        write8(addr + (uint32_t)i, data[i]);
+}
+
+void Memory::snapshot(MemorySnapshot &snapshot) {
+    snapshot.clear();
+    for (unsigned d = 0; d < (1u << TABLE_BITS); d++) {
+        uint8_t **table = directory[d];
+        if (table == NULL)
+            continue;
+        for (unsigned t = 0; t < (1u << TABLE_BITS); t++) {
+            if (table[t] == NULL)
+                continue;
+            info(table[t])->references++;
+            MemorySnapshot::Entry e = { (d << TABLE_BITS) | t, table[t] };
+            snapshot.entries.push_back(e);
+        }
+    }
+    // every page is shared now, so every write must reach write_slow
+    for (unsigned i = 0; i < TLB_ENTRIES; i++) {
+        writeTlb[i].tag = NO_PAGE;
+        writeTlb[i].page = NULL;
+    }
+}
+
+void Memory::restore(const MemorySnapshot &snapshot) {
+    clear();
+    for (size_t i = 0; i < snapshot.entries.size(); i++) {
+        const MemorySnapshot::Entry &e = snapshot.entries[i];
+        uint8_t **&table = directory[e.pageNumber >> TABLE_BITS];
+        if (table == NULL)
+            table = new_table();
+        table[e.pageNumber & ((1u << TABLE_BITS) - 1)] = e.page;
+        info(e.page)->references++;
+        pageCount++;
+    }
+}
+
+void Memory::changedPages(const MemorySnapshot &snapshot, std::vector<uint32_t> &pages) const {
+    pages.clear();
+    // both sides are walked in increasing page order
+    size_t next = 0;
+    const std::vector<MemorySnapshot::Entry> &entries = snapshot.entries;
+    for (unsigned d = 0; d < (1u << TABLE_BITS); d++) {
+        uint8_t **table = directory[d];
+        if (table == NULL)
+            continue;
+        for (unsigned t = 0; t < (1u << TABLE_BITS); t++) {
+            if (table[t] == NULL)
+                continue;
+            uint32_t pageNumber = (d << TABLE_BITS) | t;
+            while (next < entries.size() && entries[next].pageNumber < pageNumber)
+                next++;
+            bool shared = next < entries.size() && entries[next].pageNumber == pageNumber &&
+                          entries[next].page == table[t];
+            if (!shared)
+                pages.push_back(pageNumber);
+        }
+    }
+}
+
+const uint8_t *Memory::pageData(uint32_t pageNumber) const {
+    const uint8_t *page = find(pageNumber);
+    return (page != NULL) ? page : zeroPage;
+}
+
+void Memory::residentPages(std::vector<uint32_t> &pages) const {
+    pages.clear();
+    for (unsigned d = 0; d < (1u << TABLE_BITS); d++) {
+        uint8_t **table = directory[d];
+        if (table == NULL)
+            continue;
+        for (unsigned t = 0; t < (1u << TABLE_BITS); t++) {
+            if (table[t] != NULL)
+                pages.push_back((d << TABLE_BITS) | t);
+        }
+    }
+}
+
+void Memory::setLimit(uint64_t bytes) {
+    pageLimit = (size_t)((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+uint64_t Memory::residentBytes() const {
+    return (uint64_t)pageCount * PAGE_SIZE;
+}
+
+uint64_t Memory::droppedWrites() const {
+    return dropped;
+}
+
+void Memory::setCodeWriteHook(CodeWriteHook hook, void *context) {
+    this->hook = hook;
+    hookContext = context;
+}
+
+uint64_t Memory::codeWrites() const {
+    return codeWriteCount;
+}
+
+uint8_t *Memory::find(uint32_t pageNumber) const {
+    uint8_t **table = directory[pageNumber >> TABLE_BITS];
+    return (table == NULL) ? NULL : table[pageNumber & ((1u << TABLE_BITS) - 1)];
+}
+
+// An empty second-level page table
+uint8_t **Memory::new_table() {
+    uint8_t **table;
+    if (!freeTables.empty()) {
+        table = freeTables.back();
+        freeTables.pop_back();
+    } else {
+        table = new uint8_t *[1u << TABLE_BITS];
+    }
+    memset(table, 0, sizeof(uint8_t *) << TABLE_BITS);
+    return table;
+}
+
+// Page for pageNumber, allocating it if needed; NULL if over the limit
+uint8_t *Memory::allocate(uint32_t pageNumber) {
+    uint8_t **&table = directory[pageNumber >> TABLE_BITS];
+    if (table == NULL)
+        table = new_table();
+    uint8_t *&page = table[pageNumber & ((1u << TABLE_BITS) - 1)];
+    if (page != NULL)
+        return page;
+    if (pageLimit != 0 && pageCount >= pageLimit)
+        return NULL;
+
+    if (!freePages.empty()) {
+        page = freePages.back();
+        freePages.pop_back();
+    } else {
+        page = new uint8_t[PAGE_SIZE + sizeof(PageInfo)];
+    }
+    memset(page, 0, PAGE_SIZE + sizeof(PageInfo));
+    info(page)->references = 1;
+    pageCount++;
+
+    // the read TLB may still point at the zero page
+    TlbEntry &t = readTlb[pageNumber & (TLB_ENTRIES - 1)];
+    if (t.tag == pageNumber)
+        t.page = page;
+    return page;
+}
+
+// Gives this memory its own copy of a page shared with snapshots
+uint8_t *Memory::unshare(uint32_t pageNumber, uint8_t *page) {
+    uint8_t *copy;
+    if (!freePages.empty()) {
+        copy = freePages.back();
+        freePages.pop_back();
+    } else {
+        copy = new uint8_t[PAGE_SIZE + sizeof(PageInfo)];
+    }
+    memcpy(copy, page, PAGE_SIZE + sizeof(PageInfo));
+    info(copy)->references = 1;
+    info(page)->references--;
+    directory[pageNumber >> TABLE_BITS][pageNumber & ((1u << TABLE_BITS) - 1)] = copy;
+
+    TlbEntry &t = readTlb[pageNumber & (TLB_ENTRIES - 1)];
+    if (t.tag == pageNumber)
+        t.page = copy;
+    return copy;
+}
+
+void Memory::release(uint8_t *page) {
+    if (--info(page)->references == 0)
+        delete[] page;
+}
+
+void Memory::markCode(uint32_t addr) {
+    uint32_t pageNumber = addr >> PAGE_BITS;
+    uint8_t *page = find(pageNumber);
+    if (page == NULL)
+        return; // all zero: nothing decodable to protect
+    PageInfo *pi = info(page);
+    uint32_t word = (addr & PAGE_MASK) >> 2;
+    uint32_t bit = 1u << (word & 31);
+    if ((pi->code[word >> 5] & bit) == 0) {
+        pi->code[word >> 5] |= bit;
+        pi->codeWords++;
+    }
+    TlbEntry &t = writeTlb[pageNumber & (TLB_ENTRIES - 1)];
+    if (t.tag == pageNumber)
+        t.tag = pageNumber | CODE_PAGE;
+}
+
+uint8_t Memory::read8_slow(uint32_t addr) {
+    uint32_t pageNumber = addr >> PAGE_BITS;
+    uint8_t *page = find(pageNumber);
+    TlbEntry &t = readTlb[pageNumber & (TLB_ENTRIES - 1)];
+    t.tag = pageNumber;
+    t.page = (page != NULL) ? page : zeroPage;
+    return t.page[addr & PAGE_MASK];
+}
+
+uint32_t Memory::read32_slow(uint32_t addr) {
+    return (uint32_t)read8(addr) |
+           ((uint32_t)read8(addr + 1) << 8) |
+           ((uint32_t)read8(addr + 2) << 16) |
+           ((uint32_t)read8(addr + 3) << 24);
+}
+
+/**
+ * Write through a CODE_PAGE write TLB entry that cannot change code: it
+ * touches only data words, or rewrites code with the bytes already there.
+ * The page is known to exist, so this needs neither the page table nor
+ * the code-mark bookkeeping. Returns false if the write needs write_slow.
+ */
+bool Memory::write_code_page(uint32_t addr, uint32_t value, unsigned size) {
+    uint32_t pageNumber = addr >> PAGE_BITS;
+    const TlbEntry &t = writeTlb[pageNumber & (TLB_ENTRIES - 1)];
+    uint32_t offset = addr & PAGE_MASK;
+    if (t.tag != (pageNumber | CODE_PAGE) || offset + size > PAGE_SIZE)
+        return false;
+    const PageInfo *pi = info(t.page);
+    for (uint32_t word = offset >> 2; word <= (offset + size - 1) >> 2; word++) {
+        if ((pi->code[word >> 5] & (1u << (word & 31))) == 0)
+            continue;
+        for (unsigned i = 0; i < size; i++) {
+            if (t.page[offset + i] != ((value >> (8 * i)) & 0xFF))
+                return false;
+        }
+        return true; // unchanged code; nothing to write
+    }
+    for (unsigned i = 0; i < size; i++)
+        t.page[offset + i] = (value >> (8 * i)) & 0xFF;
+    return true;
+}
+
+/**
+ * Writes that miss the write TLB: allocate the page, perform the write,
+ * and report it if it changed the contents of code words. Writes that
+ * cross a page boundary are split into bytes.
+ */
+void Memory::write_slow(uint32_t addr, uint32_t value, unsigned size) {
+    if (write_code_page(addr, value, size))
+        return;
+    uint32_t offset = addr & PAGE_MASK;
+    if (offset + size > PAGE_SIZE) {
+        for (unsigned i = 0; i < size; i++)
+            write_slow(addr + i, (value >> (8 * i)) & 0xFF, 1);
+        return;
+    }
+
+    uint32_t pageNumber = addr >> PAGE_BITS;
+    uint8_t *page = allocate(pageNumber);
+    if (page == NULL) {
+        dropped++;
+        return;
+    }
+    if (info(page)->references > 1)
+        page = unshare(pageNumber, page);
+    PageInfo *pi = info(page);
+    bool changed = false;
+    for (unsigned i = 0; i < size; i++) {
+        uint8_t byte = (value >> (8 * i)) & 0xFF;
+        changed |= page[offset + i] != byte;
+        page[offset + i] = byte;
+    }
+
+    TlbEntry &t = writeTlb[pageNumber & (TLB_ENTRIES - 1)];
+    t.tag = (pi->codeWords == 0) ? pageNumber : (pageNumber | CODE_PAGE);
+    t.page = page;
+    if (pi->codeWords == 0)
+        return;
+    // rewriting code with the bytes it already holds leaves decodes valid
+    if (!changed)
+        return;
+
+    // clear the code marks of every word the write touched
+    bool hit = false;
+    for (uint32_t word = offset >> 2; word <= (offset + size - 1) >> 2; word++) {
+        uint32_t bit = 1u << (word & 31);
+        if (pi->code[word >> 5] & bit) {
+            pi->code[word >> 5] &= ~bit;
+            pi->codeWords--;
+            hit = true;
+        }
+    }
+    if (hit) {
+        codeWriteCount++;
+        if (hook != NULL)
+            hook(hookContext, addr, size);
+    }
+}
+
+// Constructor - no pages
+MemorySnapshot::MemorySnapshot() {
+}
+
+MemorySnapshot::~MemorySnapshot() {
+    clear();
+}
+
+void MemorySnapshot::clear() {
+    for (size_t i = 0; i < entries.size(); i++)
+        Memory::release(entries[i].page);
+    entries.clear();
+}
+
+size_t MemorySnapshot::pages() const {
+    return entries.size();
+}
+
+uint32_t MemorySnapshot::pageNumber(size_t index) const {
+    return entries[index].pageNumber;
+}
+
+const uint8_t *MemorySnapshot::pageData(size_t index) const {
+    return entries[index].page;
+}
+
+const uint8_t *MemorySnapshot::findPage(uint32_t pageNumber) const {
+    size_t low = 0, high = entries.size();
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (entries[middle].pageNumber < pageNumber)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return (low < entries.size() && entries[low].pageNumber == pageNumber) ? entries[low].page : NULL;
+}
+
+bool MemorySnapshot::addPage(uint32_t pageNumber, const uint8_t *data) {
+    if (pageNumber > (0xFFFFFFFFu >> Memory::PAGE_BITS) ||
+        (!entries.empty() && pageNumber <= entries.back().pageNumber))
+        return false;
+    Entry e = { pageNumber, new uint8_t[Memory::PAGE_SIZE + sizeof(Memory::PageInfo)] };
+    memcpy(e.page, data, Memory::PAGE_SIZE);
+    memset(e.page + Memory::PAGE_SIZE, 0, sizeof(Memory::PageInfo));
+    Memory::info(e.page)->references = 1;
+    entries.push_back(e);
+    return true;
+}
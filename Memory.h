@@ -0,0 +1,217 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class MemorySnapshot;
+
+// Sparse, byte-addressable memory covering the full 32-bit address space.
+// Instructions and data share it. Pages are allocated on first write and
+// untouched memory reads as zero, so the footprint follows the pages a
+// program actually writes. A two-level page table maps page numbers to
+// pages; small direct-mapped TLBs in front of it keep recently used pages
+// one compare away, so the common access is a tag check plus an index.
+//
+// Words fetched as instructions can be marked as code. Pages holding code
+// enter the write TLB with a tag the inline check never matches, so every
+// write to them takes the slow path. There, writes to data words sharing
+// the page go straight through the entry, while writes that land on code
+// words are reported through a hook (the CPU uses it to drop stale decoded
+// and translated instructions).
+//
+// Pages are reference counted so snapshots can share them: taking a
+// snapshot only bumps counts and empties the write TLB, and the first
+// write to a shared page copies it (copy-on-write).
+class Memory {
+public:
+    static const unsigned PAGE_BITS = 12;
+    static const uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+    static const uint32_t PAGE_MASK = PAGE_SIZE - 1;
+    static const unsigned TLB_ENTRIES = 16;
+
+    // Called after a write of size bytes at addr changed a code word
+    typedef void (*CodeWriteHook)(void *context, uint32_t addr, unsigned size);
+
+    // Constructor
+    Memory();
+    ~Memory();
+
+    // Drops every page and code mark; all of memory reads as zero again
+    void clear();
+    // Exchanges contents with other, along with the limit they were filled
+    // under. Hooks stay with each object.
+    void swap(Memory &other);
+    // Copies size bytes to addr, e.g. a program image
+    void load(uint32_t addr, const uint8_t *data, size_t size);
+
+    // Makes snapshot share every page (replacing what it held); no page is
+    // copied until this memory or a restored one writes it
+    void snapshot(MemorySnapshot &snapshot);
+    // Replaces all contents with snapshot's pages, shared copy-on-write
+    void restore(const MemorySnapshot &snapshot);
+    // Numbers of the pages written since snapshot was taken from this
+    // memory (allocated or copied since), in increasing order
+    void changedPages(const MemorySnapshot &snapshot, std::vector<uint32_t> &pages) const;
+    // PAGE_SIZE bytes of a page; the shared zero page if it is unallocated
+    const uint8_t *pageData(uint32_t pageNumber) const;
+    // Numbers of all allocated pages, in increasing order
+    void residentPages(std::vector<uint32_t> &pages) const;
+
+    // Caps resident memory at bytes, rounded up to whole pages (0 = no cap).
+    // A write that needs a new page beyond the cap is dropped and counted.
+    void setLimit(uint64_t bytes);
+    uint64_t residentBytes() const;
+    uint64_t droppedWrites() const;
+
+    void setCodeWriteHook(CodeWriteHook hook, void *context);
+    // Marks the aligned word containing addr as code
+    void markCode(uint32_t addr);
+    // Writes that changed code words so far
+    uint64_t codeWrites() const;
+
+    // Little-endian accesses; multi-byte accesses may cross pages and wrap
+    // around the top of the address space
+    uint8_t read8(uint32_t addr) {
+        const TlbEntry &t = readTlb[(addr >> PAGE_BITS) & (TLB_ENTRIES - 1)];
+        if (t.tag == (addr >> PAGE_BITS))
+            return t.page[addr & PAGE_MASK];
+        return read8_slow(addr);
+    }
+
+    uint32_t read32(uint32_t addr) {
+        const TlbEntry &t = readTlb[(addr >> PAGE_BITS) & (TLB_ENTRIES - 1)];
+        uint32_t offset = addr & PAGE_MASK;
+        if (t.tag == (addr >> PAGE_BITS) && offset <= PAGE_SIZE - 4) {
+            const uint8_t *p = t.page + offset;
+            return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                   ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        }
+        return read32_slow(addr);
+    }
+
+    void write8(uint32_t addr, uint8_t value) {
+        const TlbEntry &t = writeTlb[(addr >> PAGE_BITS) & (TLB_ENTRIES - 1)];
+        if (t.tag == (addr >> PAGE_BITS)) {
+            t.page[addr & PAGE_MASK] = value;
+            return;
+        }
+        write_slow(addr, value, 1);
+    }
+
+    void write16(uint32_t addr, uint32_t value) {
+        const TlbEntry &t = writeTlb[(addr >> PAGE_BITS) & (TLB_ENTRIES - 1)];
+        uint32_t offset = addr & PAGE_MASK;
+        if (t.tag == (addr >> PAGE_BITS) && offset <= PAGE_SIZE - 2) {
+            uint8_t *p = t.page + offset;
+            p[0] = value & 0xFF;
+            p[1] = (value >> 8) & 0xFF;
+            return;
+        }
+        write_slow(addr, value, 2);
+    }
+
+    void write32(uint32_t addr, uint32_t value) {
+        const TlbEntry &t = writeTlb[(addr >> PAGE_BITS) & (TLB_ENTRIES - 1)];
+        uint32_t offset = addr & PAGE_MASK;
+        if (t.tag == (addr >> PAGE_BITS) && offset <= PAGE_SIZE - 4) {
+            uint8_t *p = t.page + offset;
+            p[0] = value & 0xFF;
+            p[1] = (value >> 8) & 0xFF;
+            p[2] = (value >> 16) & 0xFF;
+            p[3] = (value >> 24) & 0xFF;
+            return;
+        }
+        write_slow(addr, value, 4);
+    }
+
+private:
+    // the JIT inlines the TLB lookup
+    friend class JitEngine;
+    friend class MemorySnapshot;
+
+    static const unsigned TABLE_BITS = 10;  // page-table levels: 10 + 10 bits
+    static const uint32_t NO_PAGE = 0xFFFFFFFFu;
+    static const uint32_t CODE_PAGE = 0x80000000u;  // write TLB tag flag
+
+    struct TlbEntry {
+        uint32_t tag;  // page number (| CODE_PAGE for code), NO_PAGE if empty
+        uint8_t *page;
+    };
+
+    // Per-page bookkeeping stored right after the page's data
+    struct PageInfo {
+        uint32_t references;                   // owning memories and snapshots
+        uint32_t codeWords;                    // bits set in code
+        uint32_t code[PAGE_SIZE / 4 / 32];     // one bit per word
+    };
+
+    TlbEntry readTlb[TLB_ENTRIES];
+    TlbEntry writeTlb[TLB_ENTRIES];
+    // directory[page >> 10][page & 1023] -> page data, NULL if unallocated
+    uint8_t **directory[1u << TABLE_BITS];
+
+    std::vector<uint8_t *> freePages;
+    std::vector<uint8_t **> freeTables;
+    size_t pageCount;
+    size_t pageLimit;
+    uint64_t dropped;
+    uint64_t codeWriteCount;
+
+    CodeWriteHook hook;
+    void *hookContext;
+
+    Memory(const Memory &);
+    Memory &operator=(const Memory &);
+
+    static PageInfo *info(uint8_t *page) { return (PageInfo *)(page + PAGE_SIZE); }
+    uint8_t *find(uint32_t pageNumber) const;
+    uint8_t **new_table();
+    uint8_t *allocate(uint32_t pageNumber);
+    uint8_t *unshare(uint32_t pageNumber, uint8_t *page);
+    // Drops a reference held outside any Memory, deleting the page on the last
+    static void release(uint8_t *page);
+    void flush_tlbs();
+    bool write_code_page(uint32_t addr, uint32_t value, unsigned size);
+
+    uint8_t read8_slow(uint32_t addr);
+    uint32_t read32_slow(uint32_t addr);
+    void write_slow(uint32_t addr, uint32_t value, unsigned size);
+};
+
+// The pages of a Memory at one point in time (see Memory::snapshot).
+// Pages stay shared with every Memory the snapshot was taken from or
+// restored into until one of them writes the page. Reference counts are
+// not atomic: a snapshot and the memories sharing its pages must be used
+// from one thread at a time.
+class MemorySnapshot {
+public:
+    MemorySnapshot();
+    ~MemorySnapshot();
+
+    // Drops every page
+    void clear();
+    size_t pages() const;
+    uint32_t pageNumber(size_t index) const;
+    const uint8_t *pageData(size_t index) const; // PAGE_SIZE bytes
+    // Data of the page numbered pageNumber, NULL if the snapshot has none
+    const uint8_t *findPage(uint32_t pageNumber) const;
+    // Appends a page holding a copy of data (PAGE_SIZE bytes); page numbers
+    // must be added in increasing order
+    bool addPage(uint32_t pageNumber, const uint8_t *data);
+
+private:
+    friend class Memory;
+
+    struct Entry {
+        uint32_t pageNumber;
+        uint8_t *page;
+    };
+    std::vector<Entry> entries; // by increasing page number
+
+    MemorySnapshot(const MemorySnapshot &);
+    MemorySnapshot &operator=(const MemorySnapshot &);
+};
+
+#endif // MEMORY_H
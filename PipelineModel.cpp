@@ -0,0 +1,184 @@
+#include "PipelineModel.h"
+#include "BranchPredictor.h"
+
+#include <cstring>
+
+const char *forwarding_name(ForwardingMode mode) {
+    switch (mode) {
+        case FORWARD_NONE: return "none";
+        case FORWARD_EX: return "ex";
+        case FORWARD_MEM: return "mem";
+        default: return "full";
+    }
+}
+
+bool parse_forwarding(const char *name, ForwardingMode &mode) {
+    static const ForwardingMode modes[] = { FORWARD_NONE, FORWARD_EX, FORWARD_MEM, FORWARD_FULL };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        if (strcmp(name, forwarding_name(modes[i])) == 0) {
+            mode = modes[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Constructor - empty pipeline
+PipelineModel::PipelineModel(ForwardingMode forwarding, BranchPredictor *predictor)
+    : mode(forwarding), predictor(predictor)
+{
+    reset();
+}
+
+void PipelineModel::reset() {
+    memset(&last, 0, sizeof(last));
+    started = false;
+    redirectFetch = 0;
+    // every register starts out in the register file
+    memset(producers, 0, sizeof(producers));
+    memset(&counters, 0, sizeof(counters));
+}
+
+PipelineStats PipelineModel::stats() const {
+    return counters;
+}
+
+double PipelineModel::cpi() const {
+    return counters.instructions ? (double)counters.cycles / counters.instructions : 0.0;
+}
+
+ForwardingMode PipelineModel::forwarding() const {
+    return mode;
+}
+
+BranchPredictor *PipelineModel::branchPredictor() const {
+    return predictor;
+}
+
+/**
+ * First cycle at or after execute in which a consumer of p's result can be
+ * in EX. Each forwarding path only holds the result for one cycle, so with
+ * EX/MEM forwarding alone a consumer that misses it waits for the register
+ * file (written in WB and read by ID in the same cycle).
+ */
+uint64_t PipelineModel::operand_ready(const Producer &p, uint64_t execute) const {
+    if (execute <= p.execute + 1 && !p.load && (mode == FORWARD_EX || mode == FORWARD_FULL))
+        return p.execute + 1;
+    if (execute <= p.memory + 1 && (mode == FORWARD_MEM || mode == FORWARD_FULL))
+        return p.memory + 1;
+    return (execute > p.writeback) ? execute : p.writeback + 1;
+}
+
+// Tallies which latch an operand came from for an instruction in EX at execute
+void PipelineModel::count_forward(const Producer &p, uint64_t execute) {
+    if (p.writeback < execute)
+        return; // already in the register file when ID read it
+    if (p.execute + 1 == execute)
+        counters.forwardedExMem++;
+    else if (p.memory + 1 == execute)
+        counters.forwardedMemWb++;
+}
+
+/**
+ * Places one instruction in the pipeline behind the previous one. Only the
+ * youngest instruction's stage cycles and each register's latest producer
+ * are needed: stalls propagate through the "previous instruction has left
+ * this stage" constraints, so older instructions can no longer matter.
+ */
+void PipelineModel::retire(const CPU &cpu, unsigned long pc) {
+    const DecodedInstruction &d = *cpu.decoded;
+
+    bool readsRs1 = false, readsRs2 = false;
+    switch (d.opcode) {
+        case RTYPE:
+        case SW:
+        case BNE:
+            readsRs2 = true;
+            readsRs1 = true;
+            break;
+        case ITYPE:
+        case LW:
+        case JALR:
+            readsRs1 = true;
+            break;
+        default:
+            break; // LUI and unknown opcodes read no registers
+    }
+
+    StageCycles s;
+    if (started) {
+        // IF is free once the previous instruction moved to ID
+        s.fetch = last.decode;
+        if (s.fetch < redirectFetch)
+            s.fetch = redirectFetch;
+        s.decode = s.fetch + 1;
+        if (s.decode < last.execute)
+            s.decode = last.execute;
+    } else {
+        s.fetch = 0;
+        s.decode = 1;
+        started = true;
+    }
+
+    // EX waits for the previous instruction to move on and for operands
+    uint64_t earliest = s.decode + 1;
+    if (earliest < last.execute + 1)
+        earliest = last.execute + 1;
+    s.execute = earliest;
+    const Producer *binding = NULL;
+    const Producer *sources[2] = {
+        (readsRs1 && d.rs1_idx != 0) ? &producers[d.rs1_idx] : NULL,
+        (readsRs2 && d.rs2_idx != 0) ? &producers[d.rs2_idx] : NULL,
+    };
+    // delaying for one operand can make the other miss its path
+    for (bool moved = true; moved; ) {
+        moved = false;
+        for (int i = 0; i < 2; i++) {
+            if (sources[i] == NULL)
+                continue;
+            uint64_t ready = operand_ready(*sources[i], s.execute);
+            if (ready != s.execute) {
+                s.execute = ready;
+                binding = sources[i];
+                moved = true;
+            }
+        }
+    }
+    if (binding != NULL) {
+        if (binding->load)
+            counters.loadUseStalls += s.execute - earliest;
+        else
+            counters.dataStalls += s.execute - earliest;
+    }
+    if (readsRs1 && d.rs1_idx != 0)
+        count_forward(producers[d.rs1_idx], s.execute);
+    if (readsRs2 && d.rs2_idx != 0 && d.rs2_idx != d.rs1_idx)
+        count_forward(producers[d.rs2_idx], s.execute);
+
+    s.memory = s.execute + 1;
+    s.writeback = s.memory + 1;
+
+    if (d.control.RegWrite && d.rd_idx != 0) {
+        Producer &p = producers[d.rd_idx];
+        p.execute = s.execute;
+        p.memory = s.memory;
+        p.writeback = s.writeback;
+        p.load = d.control.MemRead;
+    }
+
+    // fetch went on at pc + 4 or the predicted PC; a wrong path is discovered in EX
+    bool redirect;
+    if (predictor != NULL)
+        redirect = predictor->retire(cpu, pc);
+    else
+        redirect = (d.opcode == BNE || d.opcode == JALR) && cpu.PC != pc + 4;
+    if (redirect) {
+        redirectFetch = s.execute + 1;
+        counters.flushes++;
+        counters.flushCycles += BRANCH_PENALTY;
+    }
+
+    last = s;
+    counters.instructions++;
+    counters.cycles = s.writeback + 1;
+}
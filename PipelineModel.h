@@ -0,0 +1,91 @@
+#ifndef PIPELINE_MODEL_H
+#define PIPELINE_MODEL_H
+
+#include <cstdint>
+
+#include "CPU.h"
+
+class BranchPredictor;
+
+// Forwarding paths into the EX stage
+enum ForwardingMode {
+    FORWARD_NONE, // operands only through the register file
+    FORWARD_EX,   // EX/MEM -> EX: an ALU result feeds the next instruction
+    FORWARD_MEM,  // MEM/WB -> EX: results (including loads) one cycle later
+    FORWARD_FULL  // both paths
+};
+
+const char *forwarding_name(ForwardingMode mode);
+// Parses "none", "ex", "mem" or "full"
+bool parse_forwarding(const char *name, ForwardingMode &mode);
+
+struct PipelineStats {
+    uint64_t instructions;
+    uint64_t cycles;         // until the last instruction leaves WB
+    uint64_t loadUseStalls;  // bubbles waiting for a load result
+    uint64_t dataStalls;     // bubbles waiting for any other result
+    uint64_t flushes;        // bne / jalr redirects (mispredictions)
+    uint64_t flushCycles;    // fetch slots squashed by them
+    uint64_t forwardedExMem; // operands taken from the EX/MEM latch
+    uint64_t forwardedMemWb; // operands taken from the MEM/WB latch
+};
+
+// Timing model of a classic in-order IF/ID/EX/MEM/WB pipeline.
+// It does not execute anything: the stage engine runs each instruction to
+// completion as before and then hands it to retire(), which works out the
+// cycle it would have occupied each stage. An instruction enters a stage
+// once the latch in front of it has been passed on by the previous
+// instruction and, for EX, once its source operands can reach it through
+// the register file (written in the first half of WB, read in the second
+// half of ID) or an enabled forwarding path. Branches and jumps are
+// resolved in EX. Fetch assumes fall-through unless a BranchPredictor is
+// attached, and a wrong guess squashes the two instructions behind it.
+class PipelineModel {
+public:
+    // Fetch slots lost to a redirect resolved in EX (IF and ID squashed)
+    static const unsigned BRANCH_PENALTY = 2;
+
+    // predictor (may be NULL) decides which bne / jalr redirect fetch;
+    // retire() trains it
+    explicit PipelineModel(ForwardingMode forwarding = FORWARD_FULL,
+                           BranchPredictor *predictor = NULL);
+
+    // Forgets all in-flight instructions and counters
+    void reset();
+
+    // Accounts for the instruction the CPU just executed at pc; cpu's PC
+    // is already the next one
+    void retire(const CPU &cpu, unsigned long pc);
+
+    PipelineStats stats() const;
+    // stats().cycles, cheap enough to read after every instruction
+    uint64_t cycles() const { return counters.cycles; }
+    double cpi() const;
+    ForwardingMode forwarding() const;
+    BranchPredictor *branchPredictor() const;
+
+private:
+    // Cycles an instruction spends entering each stage
+    struct StageCycles {
+        uint64_t fetch, decode, execute, memory, writeback;
+    };
+
+    // Latest in-flight writer of a register
+    struct Producer {
+        uint64_t execute, memory, writeback;
+        bool load; // result exists only after MEM
+    };
+
+    ForwardingMode mode;
+    BranchPredictor *predictor;
+    StageCycles last;       // youngest instruction so far
+    bool started;
+    uint64_t redirectFetch; // first fetch cycle after the latest flush
+    Producer producers[32];
+    PipelineStats counters;
+
+    uint64_t operand_ready(const Producer &p, uint64_t execute) const;
+    void count_forward(const Producer &p, uint64_t execute);
+};
+
+#endif // PIPELINE_MODEL_H
@@ -0,0 +1,198 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+
+const unsigned Profiler::MAX_DEPTH;
+const uint32_t Profiler::NO_NODE;
+
+// Constructor - the root node is the function at entry
+Profiler::Profiler(unsigned long pcLimit, unsigned long entry, const PipelineModel *timing)
+    : timing(timing), slots((size_t)(pcLimit >> 2) + 1), instructions(0), current(0),
+      truncated(0), lastSlot(0), lastNode(0), seenCycles(timing != NULL ? timing->cycles() : 0),
+      pending(NO_JUMP), pendingReturn(0)
+{
+    lastSlot = slots;
+    instructionsByPC.assign(slots + 1, 0);
+    cyclesByPC.assign(slots + 1, 0);
+    words.assign(slots, 0);
+    Node root = { (uint32_t)entry, NO_NODE, NO_NODE, NO_NODE, 0, 0 };
+    nodes.push_back(root);
+    stack.reserve(MAX_DEPTH);
+}
+
+void Profiler::finish() {
+    if (timing != NULL)
+        charge_cycles();
+    pending = NO_JUMP;
+}
+
+// Classifies a jalr by its link registers, as the return address stack does
+void Profiler::note_jump(const DecodedInstruction &d, unsigned long pc) {
+    bool linkRd = d.rd_idx == 1 || d.rd_idx == 5;
+    bool linkRs1 = d.rs1_idx == 1 || d.rs1_idx == 5;
+    if (linkRs1 && !(linkRd && d.rd_idx == d.rs1_idx))
+        pending = linkRd ? RETURN_AND_CALL : RETURN;
+    else if (linkRd)
+        pending = CALL;
+    pendingReturn = (uint32_t)(pc + 4);
+}
+
+// The child of parent for function, added on first use
+uint32_t Profiler::child(uint32_t parent, uint32_t function) {
+    for (uint32_t c = nodes[parent].firstChild; c != NO_NODE; c = nodes[c].nextSibling) {
+        if (nodes[c].function == function)
+            return c;
+    }
+    Node node = { function, parent, NO_NODE, nodes[parent].firstChild, 0, 0 };
+    nodes.push_back(node);
+    uint32_t index = (uint32_t)(nodes.size() - 1);
+    nodes[parent].firstChild = index;
+    return index;
+}
+
+void Profiler::transfer(unsigned long target) {
+    Jump jump = pending;
+    pending = NO_JUMP;
+    if (jump == RETURN || jump == RETURN_AND_CALL) {
+        // unwind to the frame that returns here; a return nobody called
+        // (or a longjmp-like jump to an unknown address) changes nothing
+        size_t depth = stack.size();
+        while (depth > 0 && stack[depth - 1].returnAddress != (uint32_t)target)
+            depth--;
+        if (depth > 0) {
+            stack.resize(depth - 1);
+            current = stack.empty() ? 0 : stack.back().node;
+        }
+    }
+    if (jump == CALL || jump == RETURN_AND_CALL) {
+        if (stack.size() >= MAX_DEPTH) {
+            truncated++;
+            return;
+        }
+        current = child(current, (uint32_t)target);
+        Frame frame = { current, pendingReturn };
+        stack.push_back(frame);
+    }
+}
+
+uint64_t Profiler::weight(const Node &node) const {
+    return timing != NULL ? node.cycles : node.instructions;
+}
+
+static std::string address(uint32_t value) {
+    char text[16];
+    snprintf(text, sizeof(text), "0x%08x", value);
+    return text;
+}
+
+static std::string percent(uint64_t part, uint64_t whole) {
+    char text[16];
+    snprintf(text, sizeof(text), "%6.2f%%", whole ? 100.0 * part / whole : 0.0);
+    return text;
+}
+
+/**
+ * PCs that ran, hottest first (by cycles with a timing model), then each
+ * function's self and total counts. Totals count recursive calls once:
+ * a node only adds its subtree if no caller above it is the same function.
+ */
+void Profiler::write_flat(std::ostream &out, CPU &disassembler) const {
+    uint64_t cycles = 0;
+    for (size_t i = 0; i <= slots; i++)
+        cycles += cyclesByPC[i];
+    bool timed = timing != NULL;
+
+    out << "# flat profile: " << instructions << " instructions";
+    if (timed)
+        out << ", " << cycles << " cycles";
+    out << "\n#         pc  instructions        %";
+    if (timed)
+        out << "        cycles        %";
+    out << "  instruction\n";
+
+    std::vector<size_t> order;
+    for (size_t i = 0; i <= slots; i++) {
+        if (instructionsByPC[i] != 0)
+            order.push_back(i);
+    }
+    const std::vector<uint64_t> &key = timed ? cyclesByPC : instructionsByPC;
+    std::stable_sort(order.begin(), order.end(),
+                     [&key](size_t a, size_t b) { return key[a] > key[b]; });
+    for (size_t k = 0; k < order.size(); k++) {
+        size_t i = order[k];
+        char counts[64];
+        snprintf(counts, sizeof(counts), "%14llu", (unsigned long long)instructionsByPC[i]);
+        out << "  " << (i < slots ? address((uint32_t)(i << 2)) : std::string("elsewhere "))
+            << counts << " " << percent(instructionsByPC[i], instructions);
+        if (timed) {
+            snprintf(counts, sizeof(counts), "%14llu", (unsigned long long)cyclesByPC[i]);
+            out << counts << " " << percent(cyclesByPC[i], cycles);
+        }
+        if (i < slots)
+            out << "  " << disassembler.disassemble(words[i]);
+        out << "\n";
+    }
+
+    // self and total per function
+    std::map<uint32_t, std::pair<uint64_t, uint64_t> > functions;
+    std::vector<uint64_t> subtree(nodes.size(), 0);
+    for (size_t n = nodes.size(); n-- > 0;)  // children always follow their parent
+    {
+        subtree[n] += weight(nodes[n]);
+        if (nodes[n].parent != NO_NODE)
+            subtree[nodes[n].parent] += subtree[n];
+    }
+    for (size_t n = 0; n < nodes.size(); n++) {
+        std::pair<uint64_t, uint64_t> &f = functions[nodes[n].function];
+        f.first += weight(nodes[n]);
+        bool outermost = true;
+        for (uint32_t p = nodes[n].parent; p != NO_NODE && outermost; p = nodes[p].parent)
+            outermost = nodes[p].function != nodes[n].function;
+        if (outermost)
+            f.second += subtree[n];
+    }
+    std::vector<std::pair<uint64_t, uint32_t> > byTotal;
+    for (std::map<uint32_t, std::pair<uint64_t, uint64_t> >::const_iterator it = functions.begin();
+         it != functions.end(); ++it)
+        byTotal.push_back(std::make_pair(it->second.second, it->first));
+    std::stable_sort(byTotal.begin(), byTotal.end(),
+                     [](const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b) {
+                         return a.first > b.first;
+                     });
+    uint64_t all = timed ? cycles : instructions;
+    out << "\n# functions by total " << (timed ? "cycles" : "instructions")
+        << " (entry address; recursion counted once)\n"
+        << "#   function          self        %         total        %\n";
+    for (size_t k = 0; k < byTotal.size(); k++) {
+        const std::pair<uint64_t, uint64_t> &f = functions[byTotal[k].second];
+        char counts[64];
+        out << "  " << address(byTotal[k].second);
+        snprintf(counts, sizeof(counts), "%14llu", (unsigned long long)f.first);
+        out << counts << " " << percent(f.first, all);
+        snprintf(counts, sizeof(counts), "%14llu", (unsigned long long)f.second);
+        out << counts << " " << percent(f.second, all) << "\n";
+    }
+    if (truncated != 0)
+        out << "# " << truncated << " calls deeper than " << MAX_DEPTH << " were charged to their caller\n";
+}
+
+void Profiler::write_folded(std::ostream &out) const {
+    std::vector<uint32_t> path;
+    for (size_t n = 0; n < nodes.size(); n++) {
+        uint64_t w = weight(nodes[n]);
+        if (w == 0)
+            continue;
+        path.clear();
+        for (uint32_t p = (uint32_t)n; p != NO_NODE; p = nodes[p].parent)
+            path.push_back(nodes[p].function);
+        for (size_t i = path.size(); i-- > 0;) {
+            out << address(path[i]);
+            if (i != 0)
+                out << ";";
+        }
+        out << " " << w << "\n";
+    }
+}
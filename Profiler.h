@@ -0,0 +1,115 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "CPU.h"
+#include "PipelineModel.h"
+
+// Profiling policy for the stage engine (see Instrumentation.h). Every
+// retired instruction is counted against its PC in an array sized to the
+// program, and against the current node of a calling-context tree; with a
+// timing model its cycles are charged the same way. Nothing is logged per
+// event, so the cost is a few increments per instruction.
+//
+// Only jalr moves through the tree, following the RISC-V link register
+// conventions (ra and t0 are link registers, as for the return address
+// stack): a jalr that writes a link register calls its target, entering
+// the child node for that function, and one that jumps through a link
+// register returns to the caller whose return address it jumps to. Other
+// jumps stay in the current function. Functions are named by their entry
+// address, the program's entry point being the root.
+class Profiler {
+public:
+    // Calls nest at most this deep; deeper calls are charged to the caller
+    static const unsigned MAX_DEPTH = 1024;
+
+    // timing may be NULL (instructions only)
+    Profiler(unsigned long pcLimit, unsigned long entry, const PipelineModel *timing);
+
+    void retire(const CPU &cpu, unsigned long pc, uint32_t instruction, uint64_t) {
+        if (pending != NO_JUMP)
+            transfer(pc);
+        if (timing != NULL)
+            charge_cycles();
+        size_t slot = (size_t)(pc >> 2);
+        if (slot < slots)
+            words[slot] = instruction;
+        else
+            slot = slots; // outside the program
+        instructionsByPC[slot]++;
+        nodes[current].instructions++;
+        instructions++;
+        lastSlot = slot;
+        lastNode = current;
+
+        const DecodedInstruction &d = *cpu.decoded;
+        if (d.opcode == JALR)
+            note_jump(d, pc);
+    }
+
+    // Charges the cycles of the last instruction; call after the run
+    void finish();
+
+    // Per-PC counts, hottest first, then per-function totals, as text
+    void write_flat(std::ostream &out, CPU &disassembler) const;
+    // One line per call stack: frames from the root separated by ';' and
+    // the stack's own cycles (instructions without a timing model)
+    void write_folded(std::ostream &out) const;
+
+private:
+    enum Jump { NO_JUMP, CALL, RETURN, RETURN_AND_CALL };
+
+    // Calling-context tree node: one function reached through one chain of calls
+    struct Node {
+        uint32_t function;
+        uint32_t parent;
+        uint32_t firstChild;
+        uint32_t nextSibling;
+        uint64_t instructions;
+        uint64_t cycles;
+    };
+
+    // An active call: its tree node and where it returns to
+    struct Frame {
+        uint32_t node;
+        uint32_t returnAddress;
+    };
+
+    static const uint32_t NO_NODE = 0xFFFFFFFFu;
+
+    const PipelineModel *timing;
+    size_t slots;
+    // per word of the program, plus one slot for PCs outside it
+    std::vector<uint64_t> instructionsByPC;
+    std::vector<uint64_t> cyclesByPC;
+    std::vector<uint32_t> words;
+    uint64_t instructions;
+
+    std::vector<Node> nodes;
+    std::vector<Frame> stack;
+    uint32_t current;
+    uint64_t truncated;   // calls past MAX_DEPTH
+
+    size_t lastSlot;
+    uint32_t lastNode;
+    uint64_t seenCycles;
+    Jump pending;
+    uint32_t pendingReturn;
+
+    void charge_cycles() {
+        uint64_t now = timing->cycles();
+        cyclesByPC[lastSlot] += now - seenCycles;
+        nodes[lastNode].cycles += now - seenCycles;
+        seenCycles = now;
+    }
+    void note_jump(const DecodedInstruction &d, unsigned long pc);
+    // Applies the pending call or return, now that its target is known
+    void transfer(unsigned long target);
+    uint32_t child(uint32_t parent, uint32_t function);
+    uint64_t weight(const Node &node) const;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,315 @@
+#include "Program.h"
+#include "CPU.h"
+
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+// Executable segments must end below this: the translating engines keep
+// one entry per instruction word from address 0 up to the pcLimit
+static const unsigned long MAX_CODE_END = 1ul << 20;
+
+static string hex_address(uint64_t address)
+{
+	stringstream s;
+	s << "0x" << hex << address;
+	return s.str();
+}
+
+bool parse_program_format(const char *name, ProgramFormat &format)
+{
+	static const char *const names[] = { "auto", "hex", "binary", "elf" };
+	for (int i = 0; i < 4; i++) {
+		if (strcmp(name, names[i]) == 0) {
+			format = (ProgramFormat)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *program_format_name(ProgramFormat format)
+{
+	switch (format) {
+		case FORMAT_AUTO: return "auto";
+		case FORMAT_HEX: return "hex";
+		case FORMAT_BINARY: return "binary";
+		case FORMAT_ELF: return "elf";
+	}
+	return "?";
+}
+
+// Constructor - nothing mapped
+MappedFile::MappedFile() : bytes(NULL), length(0) {}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+void MappedFile::close()
+{
+	if (bytes != NULL)
+		munmap((void *)bytes, length);
+	bytes = NULL;
+	length = 0;
+}
+
+bool MappedFile::open(const std::string &path, std::string &error)
+{
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		error = "cannot open " + path + (fd < 0 ? string(": ") + strerror(errno) : string());
+		if (fd >= 0)
+			::close(fd);
+		return false;
+	}
+	if (st.st_size > 0) {
+		void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			error = "cannot map " + path + ": " + strerror(errno);
+			::close(fd);
+			return false;
+		}
+		bytes = (const uint8_t *)p;
+		length = (size_t)st.st_size;
+	}
+	// the mapping outlives the descriptor
+	::close(fd);
+	return true;
+}
+
+static inline bool is_space(uint8_t c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline int hex_digit(uint8_t c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/**
+ * Hex text: whitespace-separated tokens, one byte each. Plain tokens of up
+ * to 8 hex digits are converted in place; anything else (0x prefixes,
+ * signs, junk) goes through the same stream extraction the original
+ * ifstream loop used, so every file loads exactly as it did before.
+ */
+static void parse_hex(const uint8_t *text, size_t length, Program &program)
+{
+	size_t p = 0;
+	int i = 0;
+	while (i < 4096) {
+		while (p < length && is_space(text[p]))
+			p++;
+		if (p == length)
+			break;
+		size_t start = p;
+		unsigned int x = 0;
+		bool plain = true;
+		for (; p < length && !is_space(text[p]); p++) {
+			int d = hex_digit(text[p]);
+			if (d < 0 || p - start >= 8)
+				plain = false;
+			else
+				x = (x << 4) | (unsigned)d;
+		}
+		if (!plain) {
+			stringstream token(string((const char *)text + start, p - start));
+			token >> hex >> x;
+		}
+		program.instMem[i] = static_cast<char>(x); // be careful about hex
+		i++;
+	}
+	program.size = i;
+}
+
+// Raw image: the whole file at address 0, starting at PC 0. All of it may
+// be code, so it is held to the same end as ELF executable segments.
+static bool load_binary(const uint8_t *data, size_t length, Program &program, string &error)
+{
+	uint64_t codeEnd = (uint64_t)length / 4 * 4;
+	if (codeEnd > MAX_CODE_END) {
+		error = program.path + ": code ends at " + hex_address(codeEnd) + ", above the " +
+		        hex_address(MAX_CODE_END) + " limit";
+		return false;
+	}
+	memcpy(program.instMem, data, length < 4096 ? length : 4096);
+	program.size = (int)length;
+	if (length > 0) {
+		ProgramSegment segment = { 0, data, (uint32_t)length, (uint32_t)length };
+		program.segments.push_back(segment);
+	}
+	return true;
+}
+
+static inline uint16_t le16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * RV32 ELF executable: every PT_LOAD segment at its virtual address and
+ * the entry point as the first PC. The pcLimit is the end of the highest
+ * executable segment.
+ */
+static bool load_elf(const uint8_t *data, size_t length, Program &program, string &error)
+{
+	const string &path = program.path;
+	// e_ident, then the ELF32 header fields used here
+	if (length < 52 || data[4] != 1 || data[5] != 1) {
+		error = path + ": not a 32-bit little-endian ELF file";
+		return false;
+	}
+	if (le16(data + 18) != 243) {  // EM_RISCV
+		error = path + ": not a RISC-V ELF file";
+		return false;
+	}
+	if (le16(data + 16) != 2) {    // ET_EXEC
+		error = path + ": not an ELF executable";
+		return false;
+	}
+	uint32_t entry = le32(data + 24);
+	uint32_t phoff = le32(data + 28);
+	uint16_t phentsize = le16(data + 42);
+	uint16_t phnum = le16(data + 44);
+	if (phnum == 0 || phentsize < 32 || phoff > length ||
+	    (uint64_t)phnum * phentsize > length - phoff) {
+		error = path + ": bad program header table";
+		return false;
+	}
+
+	uint64_t codeEnd = 0;
+	bool executable = false, entryMapped = false;
+	uint64_t loaded = 0;
+	for (unsigned i = 0; i < phnum; i++) {
+		const uint8_t *ph = data + phoff + (size_t)i * phentsize;
+		if (le32(ph) != 1)  // PT_LOAD
+			continue;
+		uint32_t offset = le32(ph + 4), address = le32(ph + 8);
+		uint32_t fileSize = le32(ph + 16), memorySize = le32(ph + 20), flags = le32(ph + 24);
+		if (offset > length || fileSize > length - offset || fileSize > memorySize ||
+		    (uint64_t)address + memorySize > 0x100000000ull) {
+			error = path + ": bad segment at " + hex_address(address);
+			return false;
+		}
+		ProgramSegment segment = { address, data + offset, fileSize, memorySize };
+		program.segments.push_back(segment);
+		loaded += fileSize;
+		if (flags & 1) {  // PF_X
+			executable = true;
+			// in 64 bits: a segment reaching 2^32 must not wrap to 0
+			uint64_t end = ((uint64_t)address + fileSize) / 4 * 4;
+			if (end > codeEnd)
+				codeEnd = end;
+			entryMapped = entryMapped || (entry >= address && entry < (uint64_t)address + fileSize);
+		}
+	}
+	if (!executable) {
+		error = path + ": no executable segment";
+		return false;
+	}
+	if (codeEnd > MAX_CODE_END) {
+		error = path + ": code ends at " + hex_address(codeEnd) + ", above the " +
+		        hex_address(MAX_CODE_END) + " limit";
+		return false;
+	}
+	if (!entryMapped) {
+		error = path + ": entry point " + hex_address(entry) + " is outside the executable segments";
+		return false;
+	}
+	program.entry = entry;
+	program.codeEnd = (unsigned long)codeEnd;
+	program.size = loaded < INT_MAX ? (int)loaded : INT_MAX;
+	return true;
+}
+
+// ELF by magic number, hex when the start of the file is text, binary otherwise
+static ProgramFormat detect_format(const uint8_t *data, size_t length)
+{
+	if (length >= 4 && memcmp(data, "\x7f" "ELF", 4) == 0)
+		return FORMAT_ELF;
+	size_t n = length < 512 ? length : 512;
+	for (size_t i = 0; i < n; i++) {
+		if (!is_space(data[i]) && (data[i] < 0x20 || data[i] >= 0x7F))
+			return FORMAT_BINARY;
+	}
+	return FORMAT_HEX;
+}
+
+bool load_program(const std::string &path, Program &program, ProgramFormat format,
+                  std::string &error)
+{
+	program.path = path;
+	program.size = 0;
+	program.segments.clear();
+	program.entry = 0;
+	program.codeEnd = 0;
+	memset(program.instMem, 0, sizeof(program.instMem));
+
+	// a fresh mapping: the previous one may still back a CPU being set up
+	shared_ptr<MappedFile> file(new MappedFile());
+	program.file.reset();
+	if (!file->open(path, error))
+		return false;
+	const uint8_t *data = file->data();
+	size_t length = file->size();
+
+	if (format == FORMAT_AUTO)
+		format = detect_format(data, length);
+	program.format = format;
+	switch (format) {
+		case FORMAT_ELF:
+			if (!load_elf(data, length, program, error)) {
+				program.segments.clear();
+				return false;
+			}
+			break;
+		case FORMAT_BINARY:
+			if (!load_binary(data, length, program, error))
+				return false;
+			break;
+		default:
+			// hex is copied out, so the mapping can go right away
+			parse_hex(data, length, program);
+			return true;
+	}
+	program.file = file;
+	return true;
+}
+
+bool load_program(const std::string &path, Program &program)
+{
+	string error;
+	return load_program(path, program, FORMAT_AUTO, error);
+}
+
+void reset_cpu(CPU &cpu, const Program &program)
+{
+	if (program.segments.empty()) {
+		cpu.reset(program.instMem);
+		return;
+	}
+	cpu.reset(NULL, 0);
+	for (size_t i = 0; i < program.segments.size(); i++) {
+		const ProgramSegment &s = program.segments[i];
+		cpu.loadMemory(s.address, s.data, s.fileSize);
+	}
+	cpu.setPC(program.entry);
+}
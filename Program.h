@@ -0,0 +1,87 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class CPU;
+
+// Instruction memory file formats
+enum ProgramFormat {
+	FORMAT_AUTO,   // decided from the contents (see load_program)
+	FORMAT_HEX,    // hex text, one byte per token: the original format
+	FORMAT_BINARY, // raw image loaded at address 0
+	FORMAT_ELF     // RV32 little-endian ELF executable
+};
+
+// Parses auto, hex, binary or elf
+bool parse_program_format(const char *name, ProgramFormat &format);
+const char *program_format_name(ProgramFormat format);
+
+// A whole file mapped read-only; empty files map nothing
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	// Maps path, replacing any earlier mapping
+	bool open(const std::string &path, std::string &error);
+	const uint8_t *data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	const uint8_t *bytes;
+	size_t length;
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+	void close();
+};
+
+// fileSize bytes of data loaded at address, zero up to memorySize (.bss)
+struct ProgramSegment {
+	uint32_t address;
+	const uint8_t *data; // points into the program's mapped file
+	uint32_t fileSize;
+	uint32_t memorySize;
+};
+
+// A program image as read from an instruction memory file
+struct Program {
+	std::string path;
+	ProgramFormat format;
+	char instMem[4096]; // memory at address 0, zero past the end (hex and binary)
+	int size;           // bytes read from the file (loaded bytes for ELF)
+
+	// Binary and ELF images are loaded from these segments, which point
+	// into the mapped file; hex programs have none and load instMem
+	std::vector<ProgramSegment> segments;
+	std::shared_ptr<MappedFile> file;
+	uint32_t entry;         // first PC
+	unsigned long codeEnd;  // end of the executable segments (ELF)
+
+	Program() : format(FORMAT_HEX), size(0), entry(0), codeEnd(0) {}
+
+	// Highest PC the run loop allows (maxPC * 4 in the original main loop)
+	unsigned long pcLimit() const {
+		return format == FORMAT_ELF ? codeEnd : (unsigned long)(size / 4) * 4;
+	}
+};
+
+// Reads an instruction memory file. The file is mapped rather than read;
+// FORMAT_AUTO picks ELF by its magic number, hex for text and binary for
+// anything else. Returns false with error set if the file cannot be
+// opened or is not a loadable program.
+bool load_program(const std::string &path, Program &program, ProgramFormat format,
+                  std::string &error);
+// Same, auto-detecting the format and dropping the error
+bool load_program(const std::string &path, Program &program);
+
+// Resets cpu to the start of program: its segments (or instMem) in an
+// otherwise empty memory and PC at the entry point
+void reset_cpu(CPU &cpu, const Program &program);
+
+#endif // PROGRAM_H
@@ -0,0 +1,264 @@
+#include "ResultCache.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+static const char MAGIC[8] = { 'R', 'V', 'C', 'A', 'C', 'H', 'E', 0 };
+static const uint32_t FORMAT_VERSION = 1;
+
+// One cache entry, in host byte order; checksum covers everything before it
+struct CacheEntry {
+    char magic[8];
+    uint32_t version;
+    uint32_t halted;
+    uint64_t keyHigh, keyLow;
+    int32_t a0, a1;
+    uint64_t instructions;
+    uint64_t stateHigh, stateLow;
+    uint64_t checksum;
+};
+
+static uint64_t rotl(uint64_t value, unsigned bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t fmix(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    return value ^ (value >> 33);
+}
+
+// Two 64-bit multiply-rotate lanes fed a word at a time, mixed together at
+// the end (the structure of MurmurHash3's 128-bit variant)
+class Hasher {
+public:
+    Hasher() : a(0x9e3779b97f4a7c15ULL), b(0x632be59bd9b4e019ULL), length(0) {}
+
+    void add(const void *data, size_t size) {
+        const uint8_t *p = (const uint8_t *)data;
+        length += size;
+        for (; size >= 8; p += 8, size -= 8) {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            mix(word);
+        }
+        if (size != 0) {
+            uint64_t word = 0;
+            memcpy(&word, p, size);
+            mix(word ^ ((uint64_t)size << 56));
+        }
+    }
+
+    template <typename T> void add_value(T value) { add(&value, sizeof(value)); }
+
+    ResultKey finish() const {
+        uint64_t h = a ^ length, l = b ^ length;
+        h += l;
+        l += h;
+        h = fmix(h);
+        l = fmix(l);
+        h += l;
+        l += h;
+        ResultKey key = { h, l };
+        return key;
+    }
+
+private:
+    uint64_t a, b, length;
+
+    void mix(uint64_t word) {
+        a ^= rotl(word * 0x87c37b91114253d5ULL, 31) * 0x4cf5ad432745937fULL;
+        a = rotl(a, 27) + b;
+        a = a * 5 + 0x52dce729;
+        b ^= rotl(word * 0x4cf5ad432745937fULL, 33) * 0x87c37b91114253d5ULL;
+        b = rotl(b, 31) + a;
+        b = b * 5 + 0x38495ab5;
+    }
+};
+
+static bool all_zero(const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+// PC, registers, the last load and every page that is not all zero (those
+// read the same whether or not they were ever allocated). Read in place: a
+// snapshot would share the pages and empty the write TLB.
+static void add_state(Hasher &hasher, unsigned long pc, const int32_t regs[32], int32_t memReadData,
+                      const Memory &memory) {
+    hasher.add_value((uint64_t)pc);
+    hasher.add(regs, 32 * sizeof(int32_t));
+    hasher.add_value(memReadData);
+    std::vector<uint32_t> pages;
+    memory.residentPages(pages);
+    for (size_t i = 0; i < pages.size(); i++) {
+        const uint8_t *data = memory.pageData(pages[i]);
+        if (all_zero(data, Memory::PAGE_SIZE))
+            continue;
+        hasher.add_value(pages[i]);
+        hasher.add(data, Memory::PAGE_SIZE);
+    }
+}
+
+// Hash of the running executable, so that any rebuild that changes the
+// code or how it was compiled stops matching older entries. Where the
+// executable cannot be read, the time this file was compiled stands in.
+static ResultKey hash_executable() {
+    Hasher hasher;
+#ifdef __APPLE__
+    char path[4096];
+    uint32_t size = sizeof(path);
+    FILE *file = _NSGetExecutablePath(path, &size) == 0 ? fopen(path, "rb") : NULL;
+#else
+    FILE *file = fopen("/proc/self/exe", "rb");
+#endif
+    if (file == NULL) {
+        static const char compiled[] = __DATE__ " " __TIME__;
+        hasher.add(compiled, sizeof(compiled));
+        return hasher.finish();
+    }
+    char buffer[16384];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) != 0)
+        hasher.add(buffer, count);
+    fclose(file);
+    return hasher.finish();
+}
+
+static const ResultKey &build_identity() {
+    static const ResultKey identity = hash_executable();
+    return identity;
+}
+
+std::string ResultKey::hex() const {
+    char text[33];
+    snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)high, (unsigned long long)low);
+    return text;
+}
+
+// Constructor - nothing is touched until open()
+ResultCache::ResultCache(const std::string &directory) : root(directory) {
+    while (root.size() > 1 && root[root.size() - 1] == '/')
+        root.erase(root.size() - 1);
+}
+
+bool ResultCache::open(std::string &error) {
+    if (mkdir(root.c_str(), 0777) != 0 && errno != EEXIST) {
+        error = "cannot create cache directory " + root + ": " + strerror(errno);
+        return false;
+    }
+    struct stat info;
+    if (stat(root.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        error = root + " is not a directory";
+        return false;
+    }
+    return true;
+}
+
+const std::string &ResultCache::directory() const {
+    return root;
+}
+
+ResultKey ResultCache::key(CPU &cpu, unsigned long pcLimit, const EngineOptions &options) {
+    Hasher hasher;
+    hasher.add(MAGIC, sizeof(MAGIC));
+    hasher.add_value(build_identity().high);
+    hasher.add_value(build_identity().low);
+    hasher.add_value((uint32_t)options.kind);
+    hasher.add_value(options.jitThreshold);
+    hasher.add_value(options.jitEnabled);
+    hasher.add_value(options.foldLoops);
+    hasher.add_value((uint64_t)pcLimit);
+    hasher.add_value(options.maxInstructions);
+    hasher.add_value(options.memoryLimit);
+    add_state(hasher, cpu.PC, cpu.regs, cpu.mem_read_data, cpu.memory);
+    return hasher.finish();
+}
+
+ResultKey ResultCache::digest(CPU &cpu) {
+    Hasher hasher;
+    add_state(hasher, cpu.PC, cpu.regs, cpu.mem_read_data, cpu.memory);
+    return hasher.finish();
+}
+
+// Entries are spread over 256 subdirectories by their first key byte
+std::string ResultCache::bucket(const ResultKey &key) const {
+    char name[4];
+    snprintf(name, sizeof(name), "/%02x", (unsigned)(key.high >> 56));
+    return root + name;
+}
+
+static uint64_t checksum(const CacheEntry &entry) {
+    Hasher hasher;
+    hasher.add(&entry, offsetof(CacheEntry, checksum));
+    return hasher.finish().low;
+}
+
+bool ResultCache::lookup(const ResultKey &key, CachedRun &run) const {
+    std::string path = bucket(key) + "/" + key.hex();
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    CacheEntry entry;
+    bool ok = fread(&entry, sizeof(entry), 1, file) == 1;
+    fclose(file);
+    if (!ok || memcmp(entry.magic, MAGIC, sizeof(MAGIC)) != 0 || entry.version != FORMAT_VERSION ||
+        entry.keyHigh != key.high || entry.keyLow != key.low || entry.checksum != checksum(entry))
+        return false;
+    run.a0 = entry.a0;
+    run.a1 = entry.a1;
+    run.halted = entry.halted != 0;
+    run.instructions = entry.instructions;
+    run.state.high = entry.stateHigh;
+    run.state.low = entry.stateLow;
+    return true;
+}
+
+bool ResultCache::store(const ResultKey &key, const CachedRun &run) const {
+    CacheEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.magic, MAGIC, sizeof(MAGIC));
+    entry.version = FORMAT_VERSION;
+    entry.halted = run.halted;
+    entry.keyHigh = key.high;
+    entry.keyLow = key.low;
+    entry.a0 = run.a0;
+    entry.a1 = run.a1;
+    entry.instructions = run.instructions;
+    entry.stateHigh = run.state.high;
+    entry.stateLow = run.state.low;
+    entry.checksum = checksum(entry);
+
+    std::string directory = bucket(key);
+    if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST)
+        return false;
+    // a unique name in the same directory, so the rename cannot cross filesystems
+    std::string temporary = directory + "/.tmp.XXXXXX";
+    int fd = mkstemp(&temporary[0]);
+    if (fd < 0)
+        return false;
+    // mkstemp makes the file private; entries are shared
+    bool ok = fchmod(fd, 0644) == 0 && write(fd, &entry, sizeof(entry)) == (ssize_t)sizeof(entry);
+    if (close(fd) != 0)
+        ok = false;
+    std::string path = directory + "/" + key.hex();
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include "CPU.h"
+#include "Engine.h"
+
+// 128-bit content hash (not cryptographic; collisions between honest
+// inputs are what it guards against)
+struct ResultKey {
+    uint64_t high, low;
+
+    std::string hex() const;
+    bool operator==(const ResultKey &other) const { return high == other.high && low == other.low; }
+};
+
+// What a cached run produced
+struct CachedRun {
+    int32_t a0, a1;
+    bool halted;
+    uint64_t instructions;
+    ResultKey state;   // digest of the final PC, registers, last load and memory
+};
+
+// On-disk cache of finished functional runs, addressed by content. The key
+// hashes everything a run's outcome depends on: the simulator build (a hash
+// of the running executable), the engine and its settings, the initial PC,
+// registers, last load and memory (so the program image and any loaded
+// snapshot), the PC limit, the instruction budget and the memory limit.
+// Engines should agree, but a result is only served to the engine that
+// computed it, so a bug in one cannot leak into runs of another.
+//
+// Entries live in DIR/xx/<key>, one small file each. A writer fills a
+// temporary file in the same directory and renames it into place, so
+// readers in other threads or processes see either no entry or a whole
+// one; writers racing on a key store identical contents and the last
+// rename wins. Every entry carries its key and a checksum, and one that
+// does not check out counts as a miss (and is replaced by the next store).
+class ResultCache {
+public:
+    // Constructor - nothing is touched until open()
+    explicit ResultCache(const std::string &directory);
+
+    // Creates the cache directory if it does not exist yet
+    bool open(std::string &error);
+    const std::string &directory() const;
+
+    // Key of a run starting from cpu's current state; cpu is not changed
+    static ResultKey key(CPU &cpu, unsigned long pcLimit, const EngineOptions &options);
+    // Digest of cpu's PC, registers, last load and memory
+    static ResultKey digest(CPU &cpu);
+
+    // Safe to call from any number of threads and processes at once
+    bool lookup(const ResultKey &key, CachedRun &run) const;
+    bool store(const ResultKey &key, const CachedRun &run) const;
+
+private:
+    std::string root;
+
+    std::string bucket(const ResultKey &key) const;
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,236 @@
+#include "Sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "PipelineModel.h"
+#include "CacheModel.h"
+#include "BranchPredictor.h"
+
+// Instruction count with an optional K/M/G suffix, ending at ':' or the end
+static bool parse_count(const char *&text, uint64_t &n) {
+    char *end;
+    n = strtoull(text, &end, 10);
+    if (end == text)
+        return false;
+    switch (*end) {
+        case 'K': case 'k': n *= 1000; end++; break;
+        case 'M': case 'm': n *= 1000000; end++; break;
+        case 'G': case 'g': n *= 1000000000; end++; break;
+    }
+    text = end;
+    return *text == ':' || *text == '\0';
+}
+
+bool parse_sample_config(const char *text, SampleConfig &config, std::string &error) {
+    uint64_t n[3];
+    const char *p = text;
+    for (int i = 0; i < 3; i++) {
+        if ((i > 0 && *p++ != ':') || !parse_count(p, n[i])) {
+            error = std::string("bad sample spec ") + text + ", expected N:W:M";
+            return false;
+        }
+    }
+    if (*p != '\0' || n[2] == 0) {
+        error = std::string("bad sample spec ") + text + ", expected N:W:M with M > 0";
+        return false;
+    }
+    config.fastForward = n[0];
+    config.warmup = n[1];
+    config.measure = n[2];
+    return true;
+}
+
+// Two-sided 95% Student t quantiles for 1..30 degrees of freedom
+static const double T95[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+// Metric slots, in report order
+enum { METRIC_CPI, METRIC_ICACHE, METRIC_DCACHE, METRIC_MISPREDICT, METRIC_COUNT };
+
+Sampler::Counters Sampler::read_counters(const EngineOptions &options) {
+    Counters c = Counters();
+    if (options.timing != NULL) {
+        PipelineStats s = options.timing->stats();
+        c.instructions = s.instructions;
+        c.cycles = s.cycles;
+    }
+    if (options.instructionCache != NULL) {
+        CacheStats s = options.instructionCache->stats();
+        c.icacheAccesses = s.hits + s.misses;
+        c.icacheMisses = s.misses;
+    }
+    if (options.dataCache != NULL) {
+        CacheStats s = options.dataCache->stats();
+        c.dcacheAccesses = s.hits + s.misses;
+        c.dcacheMisses = s.misses;
+    }
+    // the timing model trains its own predictor
+    BranchPredictor *predictor = options.predictor;
+    if (options.timing != NULL)
+        predictor = options.timing->branchPredictor();
+    if (predictor != NULL) {
+        PredictorStats s = predictor->stats();
+        c.branches = s.branches + s.jumps;
+        c.mispredicts = s.branchMisses + s.jumpMisses;
+    }
+    return c;
+}
+
+// Constructor - no samples yet
+Sampler::Sampler(const SampleConfig &config)
+    : config(config), instructions(0), detailed(0), cpiMeasured(false)
+{
+    static const char *const names[METRIC_COUNT] = { "CPI", "icache miss rate",
+                                                     "dcache miss rate", "mispredict rate" };
+    metrics.resize(METRIC_COUNT);
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        metrics[i].name = names[i];
+        metrics[i].percent = i != METRIC_CPI;
+    }
+}
+
+void Sampler::add_sample(size_t metric, uint64_t numerator, uint64_t denominator) {
+    if (denominator == 0)
+        return;
+    double value = (double)numerator / denominator;
+    metrics[metric].samples.push_back(metrics[metric].percent ? 100.0 * value : value);
+}
+
+// One sample of every metric the models count, from a measured window
+void Sampler::add_window(const Counters &before, const Counters &after) {
+    add_sample(METRIC_CPI, after.cycles - before.cycles, after.instructions - before.instructions);
+    add_sample(METRIC_ICACHE, after.icacheMisses - before.icacheMisses,
+               after.icacheAccesses - before.icacheAccesses);
+    add_sample(METRIC_DCACHE, after.dcacheMisses - before.dcacheMisses,
+               after.dcacheAccesses - before.dcacheAccesses);
+    add_sample(METRIC_MISPREDICT, after.mispredicts - before.mispredicts,
+               after.branches - before.branches);
+}
+
+/**
+ * Alternates fast-forward, warm-up and measured windows until the program
+ * halts. Only the windows go through the stage engine and the models; the
+ * fast engine picks up wherever the last window left the CPU. A final
+ * window cut short by the end of the program is measured only if no full
+ * window was.
+ */
+RunResult Sampler::run(CPU &cpu, unsigned long pcLimit, const EngineOptions &options) {
+    EngineSession fast(cpu, pcLimit, options);
+    EngineOptions models = options;
+    models.kind = ENGINE_STAGE;
+
+    RunResult result = { 0, false, 0, 0, 0 };
+    Counters partialBefore = Counters(), partialAfter = Counters();
+    bool partial = false;
+    uint64_t limit = options.maxInstructions;
+
+    while (!result.halted && result.instructions < limit) {
+        // fast-forward
+        uint64_t n = std::min(config.fastForward, limit - result.instructions);
+        if (n > 0) {
+            RunResult r = fast.run(n);
+            result.instructions += r.instructions;
+            result.halted = r.halted;
+            result.compiledBlocks = r.compiledBlocks;
+            result.codeFlushes = r.codeFlushes;
+            result.foldedInstructions = r.foldedInstructions;
+            if (result.halted || result.instructions >= limit)
+                break;
+        }
+
+        // warm up
+        n = std::min(config.warmup, limit - result.instructions);
+        if (n > 0) {
+            models.maxInstructions = n;
+            RunResult r = run_program(cpu, pcLimit, models);
+            result.instructions += r.instructions;
+            detailed += r.instructions;
+            result.halted = r.halted;
+            if (result.halted || result.instructions >= limit)
+                break;
+        }
+
+        // measure
+        Counters before = read_counters(options);
+        models.maxInstructions = std::min(config.measure, limit - result.instructions);
+        RunResult r = run_program(cpu, pcLimit, models);
+        result.instructions += r.instructions;
+        detailed += r.instructions;
+        result.halted = r.halted;
+        Counters after = read_counters(options);
+        if (r.instructions < config.measure) {
+            partial = r.instructions > 0;
+            partialBefore = before;
+            partialAfter = after;
+            break;
+        }
+        add_window(before, after);
+    }
+
+    bool measured = false;
+    for (size_t i = 0; i < metrics.size(); i++)
+        measured = measured || !metrics[i].samples.empty();
+    if (!measured && partial) {
+        add_window(partialBefore, partialAfter);
+    }
+    cpiMeasured = options.timing != NULL;
+    instructions = result.instructions;
+    return result;
+}
+
+/**
+ * Prints each metric as the mean over windows with a 95% confidence
+ * interval (Student t for up to 30 windows, normal beyond), then the
+ * cycle count the mean CPI extrapolates to.
+ */
+void Sampler::report(std::ostream &out) const {
+    size_t windows = 0;
+    for (size_t i = 0; i < metrics.size(); i++)
+        windows = std::max(windows, metrics[i].samples.size());
+    out << "sampling: " << windows << " windows of " << config.fastForward << " fast-forward, "
+        << config.warmup << " warm-up, " << config.measure << " measured; detailed "
+        << detailed << " of " << instructions << " instructions" << std::endl;
+
+    double cpi = 0, cpiError = 0;
+    for (size_t i = 0; i < metrics.size(); i++) {
+        const std::vector<double> &s = metrics[i].samples;
+        if (s.empty())
+            continue;
+        double mean = 0;
+        for (size_t j = 0; j < s.size(); j++)
+            mean += s[j];
+        mean /= s.size();
+        double error = 0;
+        if (s.size() > 1) {
+            double variance = 0;
+            for (size_t j = 0; j < s.size(); j++)
+                variance += (s[j] - mean) * (s[j] - mean);
+            variance /= s.size() - 1;
+            size_t df = s.size() - 1;
+            double t = df <= 30 ? T95[df - 1] : 1.96;
+            error = t * std::sqrt(variance / s.size());
+        }
+        const char *unit = metrics[i].percent ? "%" : "";
+        out << "  " << metrics[i].name << ": " << mean << unit;
+        if (s.size() > 1)
+            out << " +/- " << error << unit << " (95%, " << s.size() << " samples)";
+        else
+            out << " (1 sample, no interval)";
+        out << std::endl;
+        if (i == METRIC_CPI) {
+            cpi = mean;
+            cpiError = error;
+        }
+    }
+    if (cpiMeasured && !metrics[METRIC_CPI].samples.empty()) {
+        out << "  estimated cycles: " << (uint64_t)(cpi * instructions + 0.5);
+        if (cpiError > 0)
+            out << " +/- " << (uint64_t)(cpiError * instructions + 0.5);
+        out << std::endl;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Engine.h"
+
+// Lengths of the three phases of one sampling period, in instructions
+struct SampleConfig {
+    uint64_t fastForward; // functional only, on the fast engine
+    uint64_t warmup;      // models run but are not measured
+    uint64_t measure;     // models run and are measured
+};
+
+// Parses N:W:M (each with an optional K/M/G suffix); M must be > 0
+bool parse_sample_config(const char *text, SampleConfig &config, std::string &error);
+
+// Sampled simulation. Instead of feeding every instruction to the detailed
+// models (pipeline timing, caches, branch predictor), the run alternates
+// between fast-forwarding on a fast engine, warming the models up, and a
+// measured window. Each window yields one sample of CPI and of every miss
+// rate; the report extrapolates the sample means to the whole run with a
+// 95% confidence interval from the spread between windows. The fast engine
+// is kept for the whole run (see EngineSession), so switching costs no
+// retranslation.
+class Sampler {
+public:
+    explicit Sampler(const SampleConfig &config);
+
+    // Runs the program in cpu with the models in options (at least one)
+    // until it halts or options.maxInstructions have executed
+    RunResult run(CPU &cpu, unsigned long pcLimit, const EngineOptions &options);
+
+    // Prints the extrapolated results
+    void report(std::ostream &out) const;
+
+private:
+    // One sample per measured window
+    struct Metric {
+        const char *name;
+        bool percent;
+        std::vector<double> samples;
+    };
+
+    // Model counters at one point of the run
+    struct Counters {
+        uint64_t instructions, cycles;
+        uint64_t icacheAccesses, icacheMisses;
+        uint64_t dcacheAccesses, dcacheMisses;
+        uint64_t branches, mispredicts;
+    };
+
+    SampleConfig config;
+    uint64_t instructions;
+    uint64_t detailed;   // instructions run through the models
+    std::vector<Metric> metrics;
+    bool cpiMeasured;
+
+    static Counters read_counters(const EngineOptions &options);
+    void add_sample(size_t metric, uint64_t numerator, uint64_t denominator);
+    void add_window(const Counters &before, const Counters &after);
+};
+
+#endif // SAMPLER_H
@@ -0,0 +1,95 @@
+#include "Simulator.h"
+
+// The CPU starts out with empty instruction memory until load()
+static const char noProgram[4096] = { 0 };
+
+const char *simulator_status_name(SimulatorStatus status) {
+    switch (status) {
+        case SIM_RUNNING: return "running";
+        case SIM_ZERO_INSTRUCTION: return "zero-instruction";
+        case SIM_PAST_END: return "past-end";
+        default: return "no-program";
+    }
+}
+
+// Constructor - the engine exists from the start; load() points it at a program
+Simulator::Simulator(const EngineOptions &options)
+    : cpu(noProgram), session(cpu, 0, options), pcLimit(0), state(SIM_NO_PROGRAM), executed(0)
+{
+    cpu.setMemoryLimit(options.memoryLimit);
+}
+
+bool Simulator::load(const uint8_t *data, size_t size) {
+    if (size == 0)
+        return false;
+    // assign() keeps the capacity, so equal or smaller images do not allocate
+    image.assign(data, data + size);
+    pcLimit = (unsigned long)(size / 4) * 4;
+    state = SIM_RUNNING;
+    reset();
+    return true;
+}
+
+void Simulator::reset() {
+    if (state == SIM_NO_PROGRAM)
+        return;
+    cpu.reset(&image[0], image.size());
+    session.restart(pcLimit);
+    state = SIM_RUNNING;
+    executed = 0;
+}
+
+/**
+ * Continues the program on the engine. A halt is reported as the zero word
+ * that stopped it unless the PC had left [0, pcLimit].
+ */
+SimulatorStatus Simulator::run(uint64_t maxInstructions) {
+    if (state != SIM_RUNNING)
+        return state;
+    RunResult r = session.run(maxInstructions);
+    executed += r.instructions;
+    if (r.halted)
+        state = cpu.PC > pcLimit ? SIM_PAST_END : SIM_ZERO_INSTRUCTION;
+    return state;
+}
+
+SimulatorStatus Simulator::status() const {
+    return state;
+}
+
+uint64_t Simulator::instructions() const {
+    return executed;
+}
+
+uint32_t Simulator::pc() const {
+    return (uint32_t)cpu.PC;
+}
+
+void Simulator::setPC(uint32_t pc) {
+    cpu.PC = pc;
+}
+
+int32_t Simulator::reg(unsigned index) const {
+    return index < 32 ? cpu.regs[index] : 0;
+}
+
+void Simulator::setReg(unsigned index, int32_t value) {
+    if (index != 0 && index < 32)
+        cpu.regs[index] = value;
+}
+
+uint8_t Simulator::read8(uint32_t addr) {
+    return cpu.memory.read8(addr);
+}
+
+uint32_t Simulator::read32(uint32_t addr) {
+    return cpu.memory.read32(addr);
+}
+
+void Simulator::write8(uint32_t addr, uint8_t value) {
+    cpu.memory.write8(addr, value);
+}
+
+void Simulator::write32(uint32_t addr, uint32_t value) {
+    cpu.memory.write32(addr, value);
+}
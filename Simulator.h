@@ -0,0 +1,78 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "CPU.h"
+#include "Engine.h"
+
+// Where a simulation stands
+enum SimulatorStatus {
+    SIM_NO_PROGRAM,       // nothing loaded yet
+    SIM_RUNNING,          // can run: just reset, or run() used up its budget
+    SIM_ZERO_INSTRUCTION, // halted: fetched an all-zero instruction word
+    SIM_PAST_END          // halted: PC went past the end of the program
+};
+
+const char *simulator_status_name(SimulatorStatus status);
+
+// Embeddable simulator: one CPU and one engine, reused across programs and
+// runs. After the first few runs have grown its buffers to the largest
+// program seen, load(), reset() and run() do not allocate on the stage,
+// threaded and block engines (the JIT allocates whenever it compiles).
+//
+//   Simulator sim(options);
+//   sim.load(image, size);
+//   for (...) {
+//       sim.reset();
+//       sim.setReg(10, input);
+//       if (sim.run(1000000) == SIM_ZERO_INSTRUCTION)
+//           use(sim.reg(10));
+//   }
+class Simulator {
+public:
+    // options.kind picks the engine and options.memoryLimit caps guest
+    // memory; models, instrumentation and maxInstructions are ignored
+    explicit Simulator(const EngineOptions &options = EngineOptions());
+
+    // Copies image (loaded at address 0 on every reset) and resets. The
+    // program ends at the last whole word of the image. False if empty.
+    bool load(const uint8_t *image, size_t size);
+    // Back to the start of the loaded program: PC 0, registers zero,
+    // memory holding only the image
+    void reset();
+    // Runs up to maxInstructions more instructions unless halted
+    SimulatorStatus run(uint64_t maxInstructions);
+
+    SimulatorStatus status() const;
+    // Instructions executed since the last reset
+    uint64_t instructions() const;
+
+    uint32_t pc() const;
+    void setPC(uint32_t pc);
+    // x0 reads as zero and ignores writes
+    int32_t reg(unsigned index) const;
+    void setReg(unsigned index, int32_t value);
+
+    // Guest memory, little endian; writes over code are picked up by the
+    // engines like any self-modifying store
+    uint8_t read8(uint32_t addr);
+    uint32_t read32(uint32_t addr);
+    void write8(uint32_t addr, uint8_t value);
+    void write32(uint32_t addr, uint32_t value);
+
+private:
+    CPU cpu;
+    EngineSession session;
+    std::vector<uint8_t> image;
+    unsigned long pcLimit;
+    SimulatorStatus state;
+    uint64_t executed;
+
+    Simulator(const Simulator &);
+    Simulator &operator=(const Simulator &);
+};
+
+#endif // SIMULATOR_H
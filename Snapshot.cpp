@@ -0,0 +1,95 @@
+#include "Snapshot.h"
+
+#include <cstdio>
+#include <cstring>
+
+static const char MAGIC[6] = { 'R', 'V', 'S', 'N', 'A', 'P' };
+static const uint16_t VERSION = 2;
+
+struct SnapshotHeader {
+    char magic[6];
+    uint16_t version;
+    uint32_t pages;
+    int32_t memReadData;
+    uint64_t pc;
+    int32_t regs[32];
+};
+
+static bool all_zero(const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+bool save_snapshot(const CPUSnapshot &snapshot, const char *path, std::string &error) {
+    const MemorySnapshot &memory = snapshot.memory;
+    SnapshotHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.pages = 0;
+    header.memReadData = snapshot.mem_read_data;
+    for (size_t i = 0; i < memory.pages(); i++)
+        header.pages += !all_zero(memory.pageData(i), Memory::PAGE_SIZE);
+    header.pc = snapshot.PC;
+    memcpy(header.regs, snapshot.regs, sizeof(header.regs));
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        error = std::string("cannot create snapshot ") + path;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; ok && i < memory.pages(); i++) {
+        const uint8_t *data = memory.pageData(i);
+        if (all_zero(data, Memory::PAGE_SIZE))
+            continue;
+        uint32_t pageNumber = memory.pageNumber(i);
+        ok = fwrite(&pageNumber, sizeof(pageNumber), 1, file) == 1 &&
+             fwrite(data, Memory::PAGE_SIZE, 1, file) == 1;
+    }
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok)
+        error = std::string("cannot write snapshot ") + path;
+    return ok;
+}
+
+bool load_snapshot(const char *path, CPUSnapshot &snapshot, std::string &error) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        error = std::string("cannot open snapshot ") + path;
+        return false;
+    }
+    SnapshotHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+        fclose(file);
+        error = std::string(path) + " is not a snapshot file";
+        return false;
+    }
+    snapshot.PC = (unsigned long)header.pc;
+    memcpy(snapshot.regs, header.regs, sizeof(snapshot.regs));
+    snapshot.regs[0] = 0;
+    snapshot.mem_read_data = header.memReadData;
+
+    snapshot.memory.clear();
+    uint8_t data[Memory::PAGE_SIZE];
+    for (uint32_t i = 0; i < header.pages; i++) {
+        uint32_t pageNumber;
+        if (fread(&pageNumber, sizeof(pageNumber), 1, file) != 1 ||
+            fread(data, sizeof(data), 1, file) != 1) {
+            fclose(file);
+            error = std::string(path) + ": truncated snapshot";
+            return false;
+        }
+        if (!snapshot.memory.addPage(pageNumber, data)) {
+            fclose(file);
+            error = std::string(path) + ": bad page number";
+            return false;
+        }
+    }
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,20 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+
+#include "CPU.h"
+
+// Snapshot files, so a run can resume in another process:
+//
+//   header: "RVSNAP" version(2) pages(4) mem_read_data(4) PC(8) regs(32 x 4)
+//   page:   pageNumber(4) data(PAGE_SIZE)
+//
+// in host byte order. All-zero pages are left out since untouched memory
+// reads as zero anyway. A snapshot only makes sense with the program it
+// was taken from, which still supplies the PC limit.
+
+bool save_snapshot(const CPUSnapshot &snapshot, const char *path, std::string &error);
+bool load_snapshot(const char *path, CPUSnapshot &snapshot, std::string &error);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,235 @@
+#include "ThreadedEngine.h"
+
+// Constructor - translates the program right away
+ThreadedEngine::ThreadedEngine(CPU &cpu, unsigned long pcLimit)
+    : cpu(cpu), pcLimit(pcLimit), translatedVersion(0), isHalted(false)
+{
+    translate();
+}
+
+bool ThreadedEngine::halted() const {
+    return isHalted;
+}
+
+void ThreadedEngine::restart(unsigned long pcLimit) {
+    this->pcLimit = pcLimit;
+    isHalted = false;
+    translate();
+}
+
+// Builds one Op per aligned PC in [0, pcLimit]
+void ThreadedEngine::translate() {
+    unsigned long words = (pcLimit >> 2) + 1;
+    ops.resize(words);
+    for (unsigned long i = 0; i < words; i++) {
+        ops[i] = Translator::translate(cpu, i << 2);
+    }
+    translatedVersion = cpu.codeVersion;
+}
+
+#if defined(__GNUC__)
+#define HANDLER(name) L_##name:
+#define DISPATCH() goto *labels[op->kind]
+#else
+#define HANDLER(name) case name:
+#define DISPATCH() goto dispatch
+#endif
+
+// Straight-line successor: PC+4 is always aligned and covered by ops
+#define NEXT_SEQ() \
+    do { \
+        pc += 4; \
+        if (++executed == max_instructions || pc > pcLimit) goto out; \
+        op = &ops[pc >> 2]; \
+        DISPATCH(); \
+    } while (0)
+
+// Computed successor: may be misaligned, which only the CPU stages handle
+#define NEXT_JUMP() \
+    do { \
+        if (++executed == max_instructions || pc > pcLimit) goto out; \
+        if (pc & 3) goto slow; \
+        op = &ops[pc >> 2]; \
+        DISPATCH(); \
+    } while (0)
+
+// After a store: continue unless it overwrote translated code
+#define NEXT_STORE() \
+    do { \
+        if (cpu.codeVersion != translatedVersion) { \
+            pc += 4; \
+            goto retranslate; \
+        } \
+        NEXT_SEQ(); \
+    } while (0)
+
+#define ALU_RR(name, expr) \
+    HANDLER(name) { \
+        int32_t a = r[op->rs1], b = r[op->rs2]; \
+        r[op->rd] = (expr); \
+        NEXT_SEQ(); \
+    }
+
+#define ALU_RI(name, expr) \
+    HANDLER(name) { \
+        int32_t a = r[op->rs1], b = op->imm; \
+        r[op->rd] = (expr); \
+        NEXT_SEQ(); \
+    }
+
+/**
+ * Executes translated handlers until a halt condition or the instruction
+ * budget is reached. The halt conditions are exactly those of the stage loop
+ * in cpusim.cpp: a zero instruction word, or PC > pcLimit after an
+ * instruction completes.
+ */
+uint64_t ThreadedEngine::run(uint64_t max_instructions) {
+    if (isHalted || max_instructions == 0)
+        return 0;
+    if (translatedVersion != cpu.codeVersion)
+        translate();
+
+    int32_t *r = cpu.regs;
+    Memory &mem = cpu.memory;
+    int32_t mrd = cpu.mem_read_data; // last load result (kept by stale loads)
+    unsigned long pc = cpu.PC;
+    uint64_t executed = 0;
+    const TranslatedOp *op;
+
+#if defined(__GNUC__)
+    static void *const labels[OP_COUNT] = {
+        &&L_OP_HALT, &&L_OP_GENERIC, &&L_OP_NOP,
+        &&L_OP_ADD, &&L_OP_SUB, &&L_OP_AND, &&L_OP_OR, &&L_OP_SLTU, &&L_OP_SRA,
+        &&L_OP_ADDI, &&L_OP_SUBI, &&L_OP_ANDI, &&L_OP_ORI, &&L_OP_SLTIU, &&L_OP_SRAI,
+        &&L_OP_LUI,
+        &&L_OP_LB, &&L_OP_LBU, &&L_OP_LW,
+        &&L_OP_SH, &&L_OP_SW,
+        &&L_OP_BNE,
+        &&L_OP_JALR,
+    };
+#endif
+
+    if (pc > pcLimit || (pc & 3))
+        goto slow;
+    op = &ops[pc >> 2];
+
+#if defined(__GNUC__)
+    DISPATCH();
+#else
+dispatch:
+    switch (op->kind) {
+#endif
+
+    HANDLER(OP_HALT)
+        if (mem.read32((uint32_t)pc) == 0) {
+            isHalted = true;
+            goto out;
+        }
+        // a store filled the zero word since it was translated
+        translate();
+        op = &ops[pc >> 2];
+        DISPATCH();
+
+    HANDLER(OP_GENERIC)
+        goto slow;
+
+    HANDLER(OP_NOP)
+        NEXT_SEQ();
+
+    ALU_RR(OP_ADD, (int32_t)((uint32_t)a + (uint32_t)b))
+    ALU_RR(OP_SUB, (int32_t)((uint32_t)a - (uint32_t)b))
+    ALU_RR(OP_AND, a & b)
+    ALU_RR(OP_OR, a | b)
+    ALU_RR(OP_SLTU, ((uint32_t)a < (uint32_t)b) ? 1 : 0)
+    ALU_RR(OP_SRA, a >> (b & 0x1F))
+
+    ALU_RI(OP_ADDI, (int32_t)((uint32_t)a + (uint32_t)b))
+    ALU_RI(OP_SUBI, (int32_t)((uint32_t)a - (uint32_t)b))
+    ALU_RI(OP_ANDI, a & b)
+    ALU_RI(OP_ORI, a | b)
+    ALU_RI(OP_SLTIU, ((uint32_t)a < (uint32_t)b) ? 1 : 0)
+    ALU_RI(OP_SRAI, a >> (b & 0x1F))
+
+    HANDLER(OP_LUI)
+        r[op->rd] = op->imm;
+        NEXT_SEQ();
+
+    HANDLER(OP_LB)
+        mrd = (int8_t)mem.read8(op_address(r, *op));
+        r[op->rd] = mrd;
+        r[0] = 0;
+        NEXT_SEQ();
+
+    HANDLER(OP_LBU)
+        mrd = mem.read8(op_address(r, *op));
+        r[op->rd] = mrd;
+        r[0] = 0;
+        NEXT_SEQ();
+
+    HANDLER(OP_LW)
+        mrd = (int32_t)mem.read32(op_address(r, *op));
+        r[op->rd] = mrd;
+        r[0] = 0;
+        NEXT_SEQ();
+
+    HANDLER(OP_SH)
+        mem.write16(op_address(r, *op), r[op->rs2]);
+        NEXT_STORE();
+
+    HANDLER(OP_SW)
+        mem.write32(op_address(r, *op), r[op->rs2]);
+        NEXT_STORE();
+
+    HANDLER(OP_BNE)
+        if (r[op->rs1] != r[op->rs2])
+            pc = pc_from_mux((uint32_t)pc + (uint32_t)op->imm);
+        else
+            pc = pc_from_mux((uint32_t)pc + 4);
+        NEXT_JUMP();
+
+    HANDLER(OP_JALR) {
+        uint32_t target = ((uint32_t)r[op->rs1] + (uint32_t)op->imm) & ~1u;
+        if (op->rd != 0)
+            r[op->rd] = (int32_t)(pc + 4);
+        pc = pc_from_mux(target);
+        NEXT_JUMP();
+    }
+
+#if !defined(__GNUC__)
+    }
+#endif
+
+slow:
+    // One instruction through the regular CPU stages
+    {
+        cpu.PC = pc;
+        cpu.mem_read_data = mrd;
+        uint32_t instruction = cpu.fetch();
+        if (instruction == 0) {
+            isHalted = true;
+            goto out;
+        }
+        cpu.decode(instruction);
+        cpu.execute();
+        cpu.mem();
+        cpu.wb();
+        cpu.updatePC();
+        pc = cpu.PC;
+        mrd = cpu.mem_read_data;
+        if (cpu.codeVersion != translatedVersion)
+            goto retranslate;
+        NEXT_JUMP();
+    }
+
+retranslate:
+    // the last instruction wrote over translated code
+    translate();
+    NEXT_JUMP();
+
+out:
+    if (pc > pcLimit)
+        isHalted = true;
+    cpu.PC = pc;
+    cpu.mem_read_data = mrd;
+    return executed;
+}
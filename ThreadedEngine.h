@@ -0,0 +1,45 @@
+#ifndef THREADED_ENGINE_H
+#define THREADED_ENGINE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "CPU.h"
+#include "Translator.h"
+
+// Threaded-code execution engine.
+// Translates every instruction word in [0, pcLimit] into a specialized handler once
+// (see Translator.h), then runs the program by jumping from handler to handler
+// (computed goto where the compiler supports it). Handlers read and write the CPU's state
+// directly; anything without a specialized handler is executed through the
+// regular fetch/decode/execute/mem/wb/updatePC stages. A store over
+// translated code retranslates the program before the next instruction.
+class ThreadedEngine {
+public:
+    // pcLimit is the stage loop's exit bound: execution stops once PC > pcLimit
+    ThreadedEngine(CPU &cpu, unsigned long pcLimit);
+
+    // Runs until the program halts or max_instructions have executed.
+    // Returns the number of instructions executed.
+    uint64_t run(uint64_t max_instructions);
+
+    // True once the program fetched a zero word or left [0, pcLimit]
+    bool halted() const;
+
+    // Forgets the halt and starts over at the CPU's PC with a new exit
+    // bound, e.g. after CPU::reset loaded another program. Reuses the
+    // engine's buffers, so it does not allocate unless pcLimit grew.
+    void restart(unsigned long pcLimit);
+
+private:
+    CPU &cpu;
+    unsigned long pcLimit;
+    unsigned long translatedVersion;
+    bool isHalted;
+    // indexed by PC >> 2, covering every aligned PC <= pcLimit
+    std::vector<TranslatedOp> ops;
+
+    void translate();
+};
+
+#endif // THREADED_ENGINE_H
@@ -0,0 +1,270 @@
+#include "TimeTravel.h"
+
+#include <algorithm>
+
+// Constructor - history starts at cpu's current state
+TimeTravel::TimeTravel(CPU &cpu, unsigned long pcLimit, const HistoryConfig &config)
+    : cpu(cpu), pcLimit(pcLimit), config(config), checkpointInterval(std::max<uint64_t>(config.checkpointInterval, 1)),
+      instructions(0), stopped(false), head(0), count(0), replayCount(0), watchedRegisters(0)
+{
+    this->config.depth = std::max<size_t>(config.depth, 1);
+    this->config.checkpoints = std::max(config.checkpoints, 2u);
+    ring.resize(this->config.depth);
+    hit.position = 0;
+    hit.newValue = 0;
+    checkpointList.push_back(std::unique_ptr<Checkpoint>(new Checkpoint()));
+    checkpointList.back()->position = 0;
+    cpu.snapshot(checkpointList.back()->state);
+}
+
+uint64_t TimeTravel::position() const {
+    return instructions;
+}
+
+bool TimeTravel::halted() const {
+    return stopped;
+}
+
+/**
+ * One pass through the stages, as the stage engine makes it, with the
+ * undo record filled in between execute and mem: by then the register
+ * and store address are known and nothing has been written yet.
+ */
+bool TimeTravel::step() {
+    if (stopped)
+        return false;
+    unsigned long pc = cpu.PC;
+    uint32_t instruction = cpu.fetch();
+    if (instruction == 0) {
+        stopped = true;
+        return false;
+    }
+    cpu.decode(instruction);
+    cpu.execute();
+
+    const DecodedInstruction &d = *cpu.decoded;
+    UndoRecord &r = ring[head];
+    r.pc = (uint32_t)pc;
+    r.rd = d.control.RegWrite ? d.rd_idx : 0;
+    r.oldValue = cpu.regs[r.rd];
+    r.storeBytes = 0;
+    r.address = 0;
+    r.oldMemory = 0;
+    r.oldLoad = cpu.mem_read_data;
+    // mem() stores only for sh and sw
+    if (d.control.MemWrite && (d.funct3 == 0b001 || d.funct3 == 0b010)) {
+        r.address = (uint32_t)cpu.alu_result;
+        r.storeBytes = d.funct3 == 0b001 ? 2 : 4;
+        for (unsigned i = 0; i < r.storeBytes; i++)
+            r.oldMemory |= (uint32_t)cpu.memory.read8(r.address + i) << (8 * i);
+    }
+
+    cpu.mem();
+    cpu.wb();
+    cpu.updatePC();
+
+    if (++head == config.depth)
+        head = 0;
+    if (count < config.depth)
+        count++;
+    instructions++;
+    if (cpu.PC > pcLimit)
+        stopped = true;
+    // replays after a rewind stay behind the newest checkpoint
+    if (instructions >= checkpointList.back()->position + checkpointInterval)
+        checkpoint();
+    return true;
+}
+
+/**
+ * Adds a checkpoint at the current position. Past the limit, every other
+ * checkpoint after the first is dropped (the newest stays) and the
+ * interval doubles to match the spacing left.
+ */
+void TimeTravel::checkpoint() {
+    checkpointList.push_back(std::unique_ptr<Checkpoint>(new Checkpoint()));
+    checkpointList.back()->position = instructions;
+    cpu.snapshot(checkpointList.back()->state);
+    if (checkpointList.size() <= config.checkpoints)
+        return;
+    size_t kept = 1;
+    for (size_t i = 1; i < checkpointList.size(); i++) {
+        if (i % 2 == 0 || i == checkpointList.size() - 1)
+            checkpointList[kept++] = std::move(checkpointList[i]);
+    }
+    checkpointList.resize(kept);
+    checkpointInterval *= 2;
+}
+
+// Pops the newest undo record and puts back what its instruction overwrote
+void TimeTravel::undo() {
+    head = (head == 0 ? config.depth : head) - 1;
+    count--;
+    const UndoRecord &r = ring[head];
+    for (unsigned i = 0; i < r.storeBytes; i++) {
+        uint8_t old = (uint8_t)(r.oldMemory >> (8 * i));
+        // a store the memory limit dropped changed nothing
+        if (cpu.memory.read8(r.address + i) != old)
+            cpu.writeInstructionMemory(r.address + i, old);
+    }
+    cpu.regs[r.rd] = r.oldValue;
+    cpu.mem_read_data = r.oldLoad;
+    cpu.PC = r.pc;
+    instructions--;
+    stopped = false;
+}
+
+/**
+ * Restores the last checkpoint at or before from and steps forward to
+ * target, refilling the ring on the way.
+ */
+void TimeTravel::rewind(uint64_t target, uint64_t from) {
+    size_t i = checkpointList.size() - 1;
+    while (checkpointList[i]->position > from)
+        i--;
+    cpu.restore(checkpointList[i]->state);
+    instructions = checkpointList[i]->position;
+    stopped = false;
+    count = 0;
+    replayCount += target - instructions;
+    while (instructions < target && step()) {
+    }
+}
+
+bool TimeTravel::step_back() {
+    if (instructions == 0)
+        return false;
+    if (count == 0)
+        rewind(instructions, instructions - 1);
+    undo();
+    return true;
+}
+
+bool TimeTravel::seek(uint64_t target) {
+    if (target >= instructions) {
+        while (instructions < target && step()) {
+        }
+        return instructions == target;
+    }
+    if (instructions - target > count) {
+        rewind(target, target);
+        return true;
+    }
+    while (instructions > target)
+        undo();
+    return true;
+}
+
+bool TimeTravel::at_breakpoint() const {
+    return !breakpoints.empty() &&
+           std::find(breakpoints.begin(), breakpoints.end(), (uint32_t)cpu.PC) != breakpoints.end();
+}
+
+bool TimeTravel::watched(const UndoRecord &r) const {
+    if (r.rd != 0 && (watchedRegisters >> r.rd & 1))
+        return true;
+    for (size_t i = 0; i < watchedWords.size() && r.storeBytes != 0; i++) {
+        uint64_t start = watchedWords[i];
+        if (r.address < start + 4 && start < (uint64_t)r.address + r.storeBytes)
+            return true;
+    }
+    return false;
+}
+
+TimeTravel::Stop TimeTravel::run(uint64_t limit) {
+    bool watching = watchedRegisters != 0 || !watchedWords.empty();
+    while (instructions < limit) {
+        if (!step())
+            return STOP_HALTED;
+        if (watching) {
+            const UndoRecord &r = ring[(head == 0 ? config.depth : head) - 1];
+            if (watched(r)) {
+                hit.position = instructions - 1;
+                hit.record = r;
+                hit.newValue = cpu.regs[r.rd];
+                return STOP_WATCH;
+            }
+        }
+        if (at_breakpoint())
+            return STOP_BREAKPOINT;
+    }
+    return stopped ? STOP_HALTED : STOP_LIMIT;
+}
+
+TimeTravel::Stop TimeTravel::run_back() {
+    while (instructions > 0) {
+        if (count == 0)
+            rewind(instructions, instructions - 1);
+        UndoRecord r = ring[(head == 0 ? config.depth : head) - 1];
+        int32_t newValue = cpu.regs[r.rd];
+        undo();
+        if (watched(r)) {
+            hit.position = instructions;
+            hit.record = r;
+            hit.newValue = newValue;
+            return STOP_WATCH;
+        }
+        if (at_breakpoint())
+            return STOP_BREAKPOINT;
+    }
+    return STOP_START;
+}
+
+int32_t TimeTravel::reg(unsigned index) const {
+    return cpu.regs[index & 31];
+}
+
+unsigned long TimeTravel::pc() const {
+    return cpu.PC;
+}
+
+uint32_t TimeTravel::read32(uint32_t address) const {
+    return cpu.memory.read32(address);
+}
+
+const TimeTravel::WatchHit &TimeTravel::watch_hit() const {
+    return hit;
+}
+
+void TimeTravel::add_breakpoint(uint32_t pc) {
+    if (std::find(breakpoints.begin(), breakpoints.end(), pc) == breakpoints.end())
+        breakpoints.push_back(pc);
+}
+
+bool TimeTravel::remove_breakpoint(uint32_t pc) {
+    std::vector<uint32_t>::iterator it = std::find(breakpoints.begin(), breakpoints.end(), pc);
+    if (it == breakpoints.end())
+        return false;
+    breakpoints.erase(it);
+    return true;
+}
+
+void TimeTravel::watch_register(unsigned index) {
+    if (index != 0 && index < 32)
+        watchedRegisters |= 1u << index;
+}
+
+void TimeTravel::watch_memory(uint32_t address) {
+    watchedWords.push_back(address);
+}
+
+void TimeTravel::clear_watches() {
+    watchedRegisters = 0;
+    watchedWords.clear();
+}
+
+size_t TimeTravel::records() const {
+    return count;
+}
+
+uint64_t TimeTravel::oldest() const {
+    return instructions - count;
+}
+
+size_t TimeTravel::checkpoints() const {
+    return checkpointList.size();
+}
+
+uint64_t TimeTravel::replayed() const {
+    return replayCount;
+}
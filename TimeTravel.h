@@ -0,0 +1,133 @@
+#ifndef TIME_TRAVEL_H
+#define TIME_TRAVEL_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "CPU.h"
+
+// Sizes of the history a TimeTravel keeps
+struct HistoryConfig {
+    size_t depth;                 // undo records in the ring
+    uint64_t checkpointInterval;  // instructions between checkpoints
+    unsigned checkpoints;         // checkpoints kept (at least 2)
+
+    HistoryConfig() : depth(1u << 20), checkpointInterval(1u << 16), checkpoints(64) {}
+};
+
+// What the instruction an undo record belongs to overwrote
+struct UndoRecord {
+    uint32_t pc;
+    uint8_t rd;          // register written, 0 if none
+    uint8_t storeBytes;  // bytes stored (sh/sw), 0 if none
+    int32_t oldValue;    // rd before the write
+    uint32_t address;    // first byte stored
+    uint32_t oldMemory;  // the stored bytes before the store, little endian
+    int32_t oldLoad;     // the last load's value, which loads of widths mem()
+                         // does not perform write back instead
+};
+
+// Time-travel debugging on the stage engine. Every instruction stepped
+// forward pushes one undo record: just the register wb() overwrites and
+// the bytes mem() overwrites, taken between execute and mem (plus the last
+// load's value, which the engines carry as state too). The records
+// live in a ring of fixed depth, so stepping back within the last depth
+// instructions pops records and costs nothing else.
+//
+// Further back, checkpoints take over: a copy-on-write CPU snapshot every
+// checkpointInterval instructions (see CPU::snapshot). To reach an older
+// position the CPU restores the nearest checkpoint before it and steps
+// forward, which refills the ring. When the checkpoints run out the older
+// half is thinned to every other one and the interval doubles, so the
+// whole run stays reachable at a replay cost that grows with its length
+// rather than from the start. The checkpoint at instruction 0 is never
+// dropped.
+//
+// Breakpoints stop at a PC; watches stop at the instruction that writes a
+// register or any byte of a memory word, in either direction.
+class TimeTravel {
+public:
+    enum Stop { STOP_LIMIT, STOP_HALTED, STOP_START, STOP_BREAKPOINT, STOP_WATCH };
+
+    // The write that ended a run at a watch
+    struct WatchHit {
+        uint64_t position;  // index of the writing instruction
+        UndoRecord record;
+        int32_t newValue;   // register watches: the value written
+    };
+
+    // Constructor - history starts at cpu's current state
+    TimeTravel(CPU &cpu, unsigned long pcLimit, const HistoryConfig &config);
+
+    // Instructions executed to reach the current state
+    uint64_t position() const;
+    bool halted() const;
+
+    // One instruction forward; false if the program has halted
+    bool step();
+    // One instruction back; false at instruction 0
+    bool step_back();
+    // Goes to any position from 0 to the halt, forward by running
+    bool seek(uint64_t target);
+
+    // Steps forward until the program halts, hits a breakpoint or watch,
+    // or reaches position limit
+    Stop run(uint64_t limit);
+    // Steps back until instruction 0 or a breakpoint or watch
+    Stop run_back();
+    const WatchHit &watch_hit() const;
+
+    // The state at the current position, for display
+    int32_t reg(unsigned index) const;
+    unsigned long pc() const;
+    uint32_t read32(uint32_t address) const;
+
+    void add_breakpoint(uint32_t pc);
+    bool remove_breakpoint(uint32_t pc);
+    void watch_register(unsigned index);
+    // Watches the 4 bytes at address
+    void watch_memory(uint32_t address);
+    void clear_watches();
+
+    // Undo records held, oldest position they reach back to, checkpoints
+    size_t records() const;
+    uint64_t oldest() const;
+    size_t checkpoints() const;
+    uint64_t replayed() const;
+
+private:
+    struct Checkpoint {
+        uint64_t position;
+        CPUSnapshot state;
+    };
+
+    CPU &cpu;
+    unsigned long pcLimit;
+    HistoryConfig config;
+    uint64_t checkpointInterval;
+    uint64_t instructions;
+    bool stopped;   // halted at the current position
+
+    std::vector<UndoRecord> ring;
+    size_t head;    // next slot to fill
+    size_t count;
+    std::vector<std::unique_ptr<Checkpoint> > checkpointList;
+    uint64_t replayCount;
+
+    std::vector<uint32_t> breakpoints;
+    uint32_t watchedRegisters;  // bit per register
+    std::vector<uint32_t> watchedWords;
+    WatchHit hit;
+
+    void checkpoint();
+    void undo();
+    void rewind(uint64_t target, uint64_t from);
+    bool at_breakpoint() const;
+    bool watched(const UndoRecord &record) const;
+
+    TimeTravel(const TimeTravel &);
+    TimeTravel &operator=(const TimeTravel &);
+};
+
+#endif // TIME_TRAVEL_H
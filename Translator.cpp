@@ -0,0 +1,85 @@
+#include "Translator.h"
+
+/**
+ * Picks the operation kind for the instruction at pc.
+ * The choice follows the control signals and ALU operation the CPU would
+ * derive for the same bits, so each kind only has to perform the work
+ * those signals select.
+ */
+TranslatedOp Translator::translate(CPU &cpu, unsigned long pc) {
+    TranslatedOp op;
+    op.kind = OP_HALT;
+    op.rd = op.rs1 = op.rs2 = 0;
+    op.imm = 0;
+
+    // same bounds as CPU::fetch
+    if ((uint64_t)pc > 0xFFFFFFFFu)
+        return op;
+
+    uint32_t instruction = cpu.memory.read32((uint32_t)pc);
+    // zero words are not marked as code (their page may not even exist), so
+    // engines read an OP_HALT's word again before halting on it
+    if (instruction == 0)
+        return op;
+    // stores over this word now bump cpu.codeVersion
+    cpu.memory.markCode((uint32_t)pc);
+
+    DecodedInstruction d;
+    cpu.decode_fields(instruction, d);
+    op.rd = d.rd_idx;
+    op.rs1 = d.rs1_idx;
+    op.rs2 = d.rs2_idx;
+    op.imm = d.immediate;
+
+    switch (d.opcode) {
+        case RTYPE:
+        case ITYPE: {
+            if (d.rd_idx == 0) {
+                op.kind = OP_NOP;
+                break;
+            }
+            // register and immediate forms are laid out in the same order
+            int base = d.control.ALUSrc ? OP_ADDI : OP_ADD;
+            switch (d.alu_op) {
+                case 0b0000: op.kind = base + (OP_AND - OP_ADD); break;
+                case 0b0001: op.kind = base + (OP_OR - OP_ADD); break;
+                case 0b0010: op.kind = base; break;
+                case 0b0011: op.kind = base + (OP_SLTU - OP_ADD); break;
+                case 0b0110: op.kind = base + (OP_SUB - OP_ADD); break;
+                case 0b0111: op.kind = base + (OP_SRA - OP_ADD); break;
+                default: op.kind = OP_GENERIC; break;
+            }
+            break;
+        }
+        case LUI:
+            op.kind = (d.rd_idx == 0) ? OP_NOP : OP_LUI;
+            break;
+        case LW:
+            // loads update mem_read_data even when rd is x0
+            switch (d.funct3) {
+                case 0b000: op.kind = OP_LB; break;
+                case 0b100: op.kind = OP_LBU; break;
+                case 0b010: op.kind = OP_LW; break;
+                default: op.kind = OP_GENERIC; break;
+            }
+            break;
+        case SW:
+            switch (d.funct3) {
+                case 0b001: op.kind = OP_SH; break;
+                case 0b010: op.kind = OP_SW; break;
+                default: op.kind = OP_NOP; break; // CPU::mem ignores other widths
+            }
+            break;
+        case BNE:
+            op.kind = OP_BNE;
+            break;
+        case JALR:
+            op.kind = OP_JALR;
+            break;
+        default:
+            // unknown opcodes raise no control signals
+            op.kind = OP_NOP;
+            break;
+    }
+    return op;
+}
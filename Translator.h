@@ -0,0 +1,49 @@
+#ifndef TRANSLATOR_H
+#define TRANSLATOR_H
+
+#include <cstdint>
+
+#include "CPU.h"
+
+// Operation kinds for pre-translated instructions, shared by the fast
+// execution engines. Each kind performs exactly the work the CPU stages do
+// for the control signals and ALU operation of the original instruction.
+enum OpKind {
+    OP_HALT,     // zero instruction word: stop
+    OP_GENERIC,  // no specialized kind: run the CPU stages
+    OP_NOP,      // no architectural effect
+    OP_ADD, OP_SUB, OP_AND, OP_OR, OP_SLTU, OP_SRA,        // rd = rs1 op rs2
+    OP_ADDI, OP_SUBI, OP_ANDI, OP_ORI, OP_SLTIU, OP_SRAI,  // rd = rs1 op imm
+    OP_LUI,
+    OP_LB, OP_LBU, OP_LW,
+    OP_SH, OP_SW,
+    OP_BNE,
+    OP_JALR,
+    OP_COUNT
+};
+
+// One translated instruction
+struct TranslatedOp {
+    uint8_t kind;
+    uint8_t rd, rs1, rs2;
+    int32_t imm;
+};
+
+class Translator {
+public:
+    // Translates the instruction word the CPU would fetch at pc
+    static TranslatedOp translate(CPU &cpu, unsigned long pc);
+};
+
+// Next-PC values travel through the int32_t PC muxes in CPU::updatePC,
+// so every target is truncated to 32 bits and sign-extended back.
+static inline unsigned long pc_from_mux(uint32_t target) {
+    return (unsigned long)(long)(int32_t)target;
+}
+
+// Effective data address of a load/store, as computed by CPU::mem
+static inline uint32_t op_address(const int32_t *r, const TranslatedOp &op) {
+    return (uint32_t)r[op.rs1] + (uint32_t)op.imm;
+}
+
+#endif // TRANSLATOR_H
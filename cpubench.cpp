@@ -0,0 +1,483 @@
+#include "CPU.h"
+#include "Program.h"
+#include "Engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+
+// Bundled programs benchmarked by default (looked up in --dir)
+static const char *const BUNDLED[] = {
+	"25instMem-r.txt", "25instMem-swr.txt", "25instMem-jswr.txt", "25instMem-test.txt",
+	"25r.txt", "25swr.txt", "25jswr.txt", "25test.txt"
+};
+
+// Instruction encoders for the synthetic kernels
+static uint32_t r_type(unsigned funct3, unsigned funct7, unsigned rd, unsigned rs1, unsigned rs2)
+{
+	return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | 0x33;
+}
+
+static uint32_t i_type(unsigned opcode, unsigned funct3, unsigned rd, unsigned rs1, int imm)
+{
+	return ((uint32_t)(imm & 0xFFF) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static uint32_t sw(unsigned rs1, unsigned rs2, int imm)
+{
+	return ((uint32_t)((imm >> 5) & 0x7F) << 25) | (rs2 << 20) | (rs1 << 15) | (2 << 12) |
+		   ((imm & 0x1F) << 7) | 0x23;
+}
+
+static uint32_t bne(unsigned rs1, unsigned rs2, int offset)
+{
+	uint32_t imm = (uint32_t)offset & 0x1FFF;
+	return (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3F) << 25) | (rs2 << 20) | (rs1 << 15) |
+		   (1 << 12) | (((imm >> 1) & 0xF) << 8) | (((imm >> 11) & 1) << 7) | 0x63;
+}
+
+static uint32_t lui(unsigned rd, uint32_t upper)
+{
+	return (upper << 12) | (rd << 7) | 0x37;
+}
+
+static uint32_t add(unsigned rd, unsigned rs1, unsigned rs2) { return r_type(0, 0, rd, rs1, rs2); }
+static uint32_t sub(unsigned rd, unsigned rs1, unsigned rs2) { return r_type(0, 0x20, rd, rs1, rs2); }
+static uint32_t addi(unsigned rd, unsigned rs1, int imm) { return i_type(0x13, 0, rd, rs1, imm); }
+
+// Builds a program image from instruction words
+static void assemble(const char *name, const vector<uint32_t> &words, Program &program)
+{
+	program.path = name;
+	memset(program.instMem, 0, sizeof(program.instMem));
+	for (size_t i = 0; i < words.size(); i++)
+		for (int b = 0; b < 4; b++)
+			program.instMem[4 * i + b] = (char)(words[i] >> (8 * b));
+	program.size = (int)(words.size() * 4);
+}
+
+/**
+ * Long-running loop kernels that count x31 down from 0x7FFFF000, so they
+ * never halt within a benchmark budget: alu-loop is dependent register
+ * arithmetic, mem-loop walks 64 KB of data a cache line at a time, and
+ * call-loop calls a small function through jalr.
+ */
+static void synthetic_kernels(vector<Program> &programs)
+{
+	Program p;
+	vector<uint32_t> w;
+
+	w.push_back(lui(31, 0x7FFFF));
+	w.push_back(addi(5, 0, 3));
+	w.push_back(add(10, 10, 31));           // loop:
+	w.push_back(sub(11, 11, 10));
+	w.push_back(r_type(7, 0, 12, 10, 11));  // and
+	w.push_back(r_type(5, 0x20, 13, 12, 5)); // sra
+	w.push_back(sub(14, 13, 10));
+	w.push_back(i_type(0x13, 3, 15, 14, 100)); // sltiu
+	w.push_back(add(10, 10, 15));
+	w.push_back(addi(31, 31, -1));
+	w.push_back(bne(31, 0, -32));
+	w.push_back(0);
+	assemble("alu-loop", w, p);
+	programs.push_back(p);
+
+	w.clear();
+	w.push_back(lui(8, 0x10));              // data at 0x10000
+	w.push_back(lui(12, 0x10));
+	w.push_back(addi(12, 12, -64));         // offset mask 0xFFC0
+	w.push_back(lui(31, 0x7FFFF));
+	w.push_back(addi(9, 0, 0));
+	w.push_back(add(6, 8, 9));              // loop:
+	w.push_back(i_type(0x03, 2, 7, 6, 0));  // lw
+	w.push_back(add(7, 7, 31));
+	w.push_back(sw(6, 7, 0));
+	w.push_back(addi(9, 9, 64));
+	w.push_back(r_type(7, 0, 9, 9, 12));    // and
+	w.push_back(add(10, 10, 7));
+	w.push_back(addi(31, 31, -1));
+	w.push_back(bne(31, 0, -32));
+	w.push_back(0);
+	assemble("mem-loop", w, p);
+	programs.push_back(p);
+
+	w.clear();
+	w.push_back(lui(31, 0x7FFFF));
+	w.push_back(addi(5, 0, 24));
+	w.push_back(i_type(0x67, 0, 1, 5, 0));  // loop: jalr ra, 0(t0)
+	w.push_back(addi(31, 31, -1));
+	w.push_back(bne(31, 0, -8));
+	w.push_back(0);
+	w.push_back(add(10, 10, 31));           // function at 24
+	w.push_back(addi(11, 11, 1));
+	w.push_back(i_type(0x67, 0, 0, 1, 0));  // jalr x0, 0(ra)
+	assemble("call-loop", w, p);
+	programs.push_back(p);
+}
+
+// Benchmark settings from the command line
+struct BenchOptions {
+	uint64_t budget;   // instructions per measured run
+	unsigned repeat;   // minimum measured runs
+	double minSeconds; // keep repeating until this much was measured
+	unsigned maxRuns;
+};
+
+// One program on one engine
+struct BenchResult {
+	uint64_t instructions; // per measured sample
+	uint64_t perRun;       // per start of the program (instructions if it never halts)
+	bool halts;            // restarted within the budget: compare runNs, not nsPerInstruction
+	unsigned runs;
+	double medianNs, minNs, maxNs; // per instruction, reset excluded
+	double runNs, resetNs; // per program start: reset and run, and the reset alone
+	long peakRssKB;
+	int32_t a0, a1;        // after the last run, to spot engines disagreeing
+};
+
+// One sample: the budget in whole program runs
+struct BudgetRun {
+	uint64_t instructions;
+	unsigned starts;       // program runs begun
+	bool halted;
+	double resetSeconds;   // CPU reset and engine restart
+	double runSeconds;     // executing instructions
+};
+
+/**
+ * Executes at least budget instructions of program. A program that halts
+ * first is reset and run again from the start, whole runs only, so a0/a1
+ * always come from a complete run. The reset (CPU and engine, as the
+ * Simulator API does it) is timed apart from execution: for programs that
+ * run a few dozen instructions it costs more than the run itself.
+ */
+static BudgetRun run_budget(CPU &cpu, EngineSession &session, const Program &program, uint64_t budget)
+{
+	BudgetRun b;
+	b.instructions = 0;
+	b.starts = 0;
+	b.halted = false;
+	b.resetSeconds = 0;
+	b.runSeconds = 0;
+	chrono::steady_clock::time_point last = chrono::steady_clock::now();
+	while (b.instructions < budget) {
+		reset_cpu(cpu, program);
+		session.restart(program.pcLimit());
+		chrono::steady_clock::time_point reset = chrono::steady_clock::now();
+		RunResult r = session.run(budget);
+		chrono::steady_clock::time_point ran = chrono::steady_clock::now();
+		b.resetSeconds += chrono::duration<double>(reset - last).count();
+		b.runSeconds += chrono::duration<double>(ran - reset).count();
+		last = ran;
+		b.starts++;
+		b.halted |= r.halted;
+		if (r.instructions == 0)
+			break; // halts immediately; nothing to measure
+		b.instructions += r.instructions;
+	}
+	return b;
+}
+
+static double median(vector<double> &samples)
+{
+	sort(samples.begin(), samples.end());
+	return samples[samples.size() / 2];
+}
+
+static BenchResult measure(const Program &program, EngineKind engine, const BenchOptions &bench)
+{
+	EngineOptions options;
+	options.kind = engine;
+	CPU cpu(program.instMem);
+	reset_cpu(cpu, program);
+	EngineSession session(cpu, program.pcLimit(), options);
+
+	// one unmeasured run warms host caches and the allocator
+	run_budget(cpu, session, program, bench.budget);
+
+	vector<double> samples, runs, resets;
+	double total = 0;
+	BenchResult result;
+	result.instructions = 0;
+	result.perRun = 0;
+	result.halts = false;
+	while (samples.size() < bench.maxRuns &&
+		   (samples.size() < bench.repeat || total < bench.minSeconds)) {
+		BudgetRun b = run_budget(cpu, session, program, bench.budget);
+		total += b.resetSeconds + b.runSeconds;
+		result.instructions = b.instructions;
+		result.perRun = b.instructions / b.starts;
+		result.halts = b.halted;
+		samples.push_back(b.instructions ? b.runSeconds * 1e9 / b.instructions : 0);
+		runs.push_back((b.resetSeconds + b.runSeconds) * 1e9 / b.starts);
+		resets.push_back(b.resetSeconds * 1e9 / b.starts);
+	}
+	result.runs = (unsigned)samples.size();
+	result.medianNs = median(samples);
+	result.minNs = samples.front();
+	result.maxNs = samples.back();
+	result.runNs = median(runs);
+	result.resetNs = median(resets);
+	result.a0 = cpu.getA0();
+	result.a1 = cpu.getA1();
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	result.peakRssKB = usage.ru_maxrss / 1024; // bytes on macOS
+#else
+	result.peakRssKB = usage.ru_maxrss;
+#endif
+	return result;
+}
+
+// Escapes a string for a JSON value
+static string json_string(const string &s)
+{
+	string out = "\"";
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s[i] == '"' || s[i] == '\\')
+			out += '\\';
+		out += s[i];
+	}
+	return out + "\"";
+}
+
+static string format_result(const string &program, EngineKind engine, const BenchResult &r)
+{
+	ostringstream line;
+	line << "{\"program\":" << json_string(program)
+		 << ",\"engine\":\"" << engine_name(engine) << "\""
+		 << ",\"instructions\":" << r.instructions
+		 << ",\"runs\":" << r.runs
+		 << ",\"ns_per_instruction\":" << r.medianNs
+		 << ",\"min_ns_per_instruction\":" << r.minNs
+		 << ",\"max_ns_per_instruction\":" << r.maxNs
+		 << ",\"instructions_per_second\":" << (r.medianNs > 0 ? 1e9 / r.medianNs : 0)
+		 << ",\"halts\":" << (r.halts ? "true" : "false")
+		 << ",\"instructions_per_run\":" << r.perRun
+		 << ",\"ns_per_run\":" << r.runNs
+		 << ",\"reset_ns_per_run\":" << r.resetNs
+		 << ",\"peak_rss_kb\":" << r.peakRssKB
+		 << ",\"a0\":" << r.a0 << ",\"a1\":" << r.a1 << "}";
+	return line.str();
+}
+
+/**
+ * Measures in a child process so each line's peak RSS belongs to that
+ * program and engine alone. The child prints its line through a pipe;
+ * returns false if it failed.
+ */
+static bool measure_isolated(const Program &program, EngineKind engine, const BenchOptions &bench,
+							 string &line)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+	cout.flush();
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		string text = format_result(program.path, engine, measure(program, engine, bench));
+		size_t at = 0;
+		while (at < text.size()) {
+			ssize_t n = write(fds[1], text.data() + at, text.size() - at);
+			if (n <= 0)
+				_exit(1);
+			at += n;
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	line.clear();
+	char buffer[512];
+	ssize_t n;
+	while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+		line.append(buffer, n);
+	close(fds[0]);
+	int status;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 && !line.empty();
+}
+
+// Value of "key": in a result line written by format_result
+static string json_field(const string &line, const string &key)
+{
+	string pattern = "\"" + key + "\":";
+	size_t at = line.find(pattern);
+	if (at == string::npos)
+		return "";
+	at += pattern.size();
+	if (line[at] == '"') {
+		size_t end = line.find('"', at + 1);
+		return end == string::npos ? "" : line.substr(at + 1, end - at - 1);
+	}
+	size_t end = line.find_first_of(",}", at);
+	return line.substr(at, end == string::npos ? string::npos : end - at);
+}
+
+// The figure a result line is compared on: whole runs for programs that
+// halt, since their reset outweighs their instructions
+static const char *compared_field(const string &line)
+{
+	return json_field(line, "halts") == "true" ? "ns_per_run" : "ns_per_instruction";
+}
+
+// compared_field() per "program engine" from an earlier cpubench output
+static bool load_baseline(const char *path, map<string, double> &baseline)
+{
+	ifstream in(path);
+	if (!in)
+		return false;
+	string line;
+	while (getline(in, line)) {
+		string program = json_field(line, "program"), engine = json_field(line, "engine");
+		string ns = json_field(line, compared_field(line));
+		if (!program.empty() && !engine.empty() && !ns.empty())
+			baseline[program + " " + engine] = strtod(ns.c_str(), NULL);
+	}
+	return true;
+}
+
+// Splits a comma-separated engine list
+static bool parse_engines(const char *text, vector<EngineKind> &engines)
+{
+	engines.clear();
+	string list(text);
+	size_t at = 0;
+	while (at <= list.size()) {
+		size_t end = list.find(',', at);
+		if (end == string::npos)
+			end = list.size();
+		EngineKind kind;
+		if (!parse_engine(list.substr(at, end - at).c_str(), kind))
+			return false;
+		engines.push_back(kind);
+		at = end + 1;
+	}
+	return !engines.empty();
+}
+
+// Benchmarks simulator throughput: every program on every engine, one
+// JSON object per line on stdout (progress and regressions on stderr)
+int main(int argc, char* argv[])
+{
+	// command line: cpubench [--budget=N] [--repeat=N] [--min-time=SECONDS]
+	//                        [--engines=LIST] [--dir=DIR] [--no-synthetic]
+	//                        [--baseline=FILE [--tolerance=PERCENT]] [programs...]
+	BenchOptions bench;
+	bench.budget = 1000000;
+	bench.repeat = 5;
+	bench.minSeconds = 0.2;
+	bench.maxRuns = 100;
+	vector<EngineKind> engines;
+	parse_engines("stage,threaded,block,jit", engines);
+	string dir = ".";
+	bool synthetic = true;
+	const char *baselineFile = NULL;
+	double tolerance = 10;
+	vector<string> paths;
+	for (int a = 1; a < argc; a++) {
+		if (strncmp(argv[a], "--budget=", 9) == 0) {
+			bench.budget = strtoull(argv[a] + 9, NULL, 10);
+		} else if (strncmp(argv[a], "--repeat=", 9) == 0) {
+			bench.repeat = strtoul(argv[a] + 9, NULL, 10);
+		} else if (strncmp(argv[a], "--min-time=", 11) == 0) {
+			bench.minSeconds = strtod(argv[a] + 11, NULL);
+		} else if (strncmp(argv[a], "--engines=", 10) == 0) {
+			if (!parse_engines(argv[a] + 10, engines)) {
+				cerr << "bad engine list " << argv[a] + 10 << endl;
+				return -1;
+			}
+		} else if (strncmp(argv[a], "--dir=", 6) == 0) {
+			dir = argv[a] + 6;
+		} else if (strcmp(argv[a], "--no-synthetic") == 0) {
+			synthetic = false;
+		} else if (strncmp(argv[a], "--baseline=", 11) == 0) {
+			baselineFile = argv[a] + 11;
+		} else if (strncmp(argv[a], "--tolerance=", 12) == 0) {
+			tolerance = strtod(argv[a] + 12, NULL);
+		} else if (argv[a][0] == '-') {
+			cerr << "unknown option " << argv[a] << endl;
+			return -1;
+		} else {
+			paths.push_back(argv[a]);
+		}
+	}
+	if (bench.budget == 0 || bench.repeat == 0) {
+		cerr << "--budget and --repeat must be positive" << endl;
+		return -1;
+	}
+	bench.maxRuns = max(bench.maxRuns, bench.repeat);
+
+	vector<Program> programs;
+	if (paths.empty()) {
+		for (size_t i = 0; i < sizeof(BUNDLED) / sizeof(BUNDLED[0]); i++)
+			paths.push_back(dir + "/" + BUNDLED[i]);
+	}
+	for (size_t i = 0; i < paths.size(); i++) {
+		Program program;
+		if (!load_program(paths[i], program)) {
+			cerr << "cannot open " << paths[i] << endl;
+			return -1;
+		}
+		// report bundled programs by file name
+		size_t slash = program.path.rfind('/');
+		if (slash != string::npos)
+			program.path = program.path.substr(slash + 1);
+		programs.push_back(program);
+	}
+	if (synthetic)
+		synthetic_kernels(programs);
+
+	map<string, double> baseline;
+	if (baselineFile != NULL && !load_baseline(baselineFile, baseline)) {
+		cerr << "cannot read baseline " << baselineFile << endl;
+		return -1;
+	}
+
+	unsigned failures = 0, regressions = 0;
+	for (size_t p = 0; p < programs.size(); p++) {
+		for (size_t e = 0; e < engines.size(); e++) {
+			string line;
+			if (!measure_isolated(programs[p], engines[e], bench, line)) {
+				cerr << programs[p].path << " " << engine_name(engines[e]) << ": benchmark failed" << endl;
+				failures++;
+				continue;
+			}
+			cout << line << endl;
+			string key = programs[p].path + " " + engine_name(engines[e]);
+			map<string, double>::const_iterator old = baseline.find(key);
+			if (old != baseline.end() && old->second > 0) {
+				const char *field = compared_field(line);
+				double now = strtod(json_field(line, field).c_str(), NULL);
+				double change = 100.0 * (now - old->second) / old->second;
+				if (change > tolerance) {
+					cerr << key << ": " << now << (strcmp(field, "ns_per_run") == 0 ? " ns/run, " : " ns/instruction, ") << change
+						 << "% slower than baseline " << old->second << endl;
+					regressions++;
+				}
+			}
+		}
+	}
+	if (baselineFile != NULL)
+		cerr << "regressions: " << regressions << " (tolerance " << tolerance << "%)" << endl;
+	return failures == 0 && regressions == 0 ? 0 : 1;
+}
@@ -1,4 +1,21 @@
 #include "CPU.h"
+#include "Program.h"
+#include "Engine.h"
+#include "BatchRunner.h"
+#include "LockstepEngine.h"
+#include "PipelineModel.h"
+#include "CacheModel.h"
+#include "BranchPredictor.h"
+#include "Instrumentation.h"
+#include "BinaryTrace.h"
+#include "Snapshot.h"
+#include "Sampler.h"
+#include "HartGroup.h"
+#include "CoSimulator.h"
+#include "Profiler.h"
+#include "ResultCache.h"
+#include "TimeTravel.h"
+#include "ControlFlowGraph.h"
 
 #include <iostream>
 #include <bitset>
@@ -7,85 +24,763 @@
 #include <string>
 #include<fstream>
 #include <sstream>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <unistd.h>
 using namespace std;
 
 
-int main(int argc, char* argv[])
+// Parses a byte count with an optional K, M or G suffix
+static bool parse_size(const char *text, uint64_t &bytes)
 {
+	char *end;
+	bytes = strtoull(text, &end, 10);
+	if (end == text)
+		return false;
+	switch (*end) {
+		case 'K': case 'k': bytes <<= 10; end++; break;
+		case 'M': case 'm': bytes <<= 20; end++; break;
+		case 'G': case 'g': bytes <<= 30; end++; break;
+	}
+	return *end == '\0';
+}
 
+// Prints one cache's counters and its worst-missing instructions to stderr
+static void report_cache(const char *name, const CacheModel &cache)
+{
+	const CacheConfig &c = cache.configuration();
+	CacheStats s = cache.stats();
+	uint64_t accesses = s.hits + s.misses;
+	cerr << name << ": " << c.sizeBytes / 1024.0 << " KB " << c.ways << "-way "
+		 << c.lineBytes << " B lines " << replacement_name(c.replacement)
+		 << (c.writeBack ? " write-back" : " write-through") << endl;
+	cerr << "  reads: " << s.reads << "  writes: " << s.writes
+		 << "  hits: " << s.hits << "  misses: " << s.misses
+		 << "  miss rate: " << (accesses ? 100.0 * s.misses / accesses : 0) << "%"
+		 << "  evictions: " << s.evictions;
+	if (c.writeBack)
+		cerr << "  writebacks: " << s.writebacks;
+	else
+		cerr << "  memory writes: " << s.memoryWrites;
+	cerr << endl;
+	vector<pair<uint32_t, uint64_t> > top = cache.topMisses(5);
+	if (!top.empty()) {
+		cerr << "  misses by pc:";
+		for (size_t i = 0; i < top.size(); i++)
+			cerr << " 0x" << hex << top[i].first << dec << " " << top[i].second;
+		cerr << endl;
+	}
+}
 
-	// instruction memo
-	char instMem[4096] = {0};
+// Prints prediction accuracy and the most mispredicted branches to stderr
+static void report_predictor(const BranchPredictor &predictor)
+{
+	const PredictorConfig &c = predictor.configuration();
+	PredictorStats s = predictor.stats();
+	uint64_t total = s.branches + s.jumps, misses = s.branchMisses + s.jumpMisses;
+	cerr << "predictor: " << predictor_name(c.kind);
+	if (c.kind != PREDICT_NOT_TAKEN)
+		cerr << " (" << (1u << c.tableBits) << " counters)";
+	cerr << "  btb: " << c.btbEntries << "  ras: " << c.rasDepth << endl;
+	cerr << "  bne: " << s.branches << " (" << s.branchMisses << " mispredicted)"
+		 << "  jalr: " << s.jumps << " (" << s.jumpMisses << " mispredicted, "
+		 << s.returns << " returns, " << s.returnMisses << " wrong)"
+		 << "  accuracy: " << (total ? 100.0 * (total - misses) / total : 100) << "%" << endl;
+	vector<pair<uint32_t, BranchSite> > worst = predictor.worstSites(5);
+	if (!worst.empty() && worst[0].second.mispredicted != 0) {
+		cerr << "  mispredicted by pc:";
+		for (size_t i = 0; i < worst.size() && worst[i].second.mispredicted != 0; i++)
+			cerr << " 0x" << hex << worst[i].first << dec << " " << worst[i].second.mispredicted
+				 << "/" << worst[i].second.executed;
+		cerr << endl;
+	}
+}
 
+// The debugger's view of the current position: the next instruction
+static void show_position(CPU &cpu, const TimeTravel &history)
+{
+	uint32_t word = history.read32((uint32_t)history.pc());
+	cout << "[" << history.position() << "] pc 0x" << hex << history.pc() << ": ";
+	if (history.halted() || word == 0)
+		cout << "halted" << dec << endl;
+	else
+		cout << "0x" << word << dec << "  " << cpu.disassemble(word) << endl;
+}
 
-	if (argc < 2) {
-		//cout << "No file name entered. Exiting...";
-		return -1;
+static void show_stop(CPU &cpu, const TimeTravel &history, TimeTravel::Stop stop)
+{
+	switch (stop) {
+		case TimeTravel::STOP_LIMIT: cout << "stopped at --max-instructions" << endl; break;
+		case TimeTravel::STOP_HALTED: cout << "program halted" << endl; break;
+		case TimeTravel::STOP_START: cout << "start of the run" << endl; break;
+		case TimeTravel::STOP_BREAKPOINT: cout << "breakpoint" << endl; break;
+		case TimeTravel::STOP_WATCH: {
+			const TimeTravel::WatchHit &hit = history.watch_hit();
+			const UndoRecord &r = hit.record;
+			uint32_t word = history.read32(r.pc);
+			cout << "watch: [" << hit.position << "] pc 0x" << hex << r.pc << dec
+				 << "  " << cpu.disassemble(word) << ":";
+			if (r.rd != 0)
+				cout << " x" << (int)r.rd << " " << r.oldValue << " -> " << hit.newValue;
+			if (r.storeBytes != 0)
+				cout << " stored " << (int)r.storeBytes << " bytes at 0x" << hex << r.address
+					 << " over 0x" << r.oldMemory << dec;
+			cout << endl;
+			break;
+		}
 	}
+	show_position(cpu, history);
+}
 
-	ifstream infile(argv[1]); //open the file
-	if (!(infile.is_open() && infile.good())) {
-		// cout<<"error opening file\n";
-		return 0; 
+// Parses a register as xN
+static bool parse_register(const string &text, unsigned &index)
+{
+	char *end;
+	if (text.size() < 2 || text[0] != 'x')
+		return false;
+	index = strtoul(text.c_str() + 1, &end, 10);
+	return *end == '\0' && index < 32;
+}
+
+// Interactive time-travel debugger: commands from stdin, output to stdout
+// (see Time-Travel Debugging in the README)
+static void run_debugger(CPU &cpu, TimeTravel &history, uint64_t maxInstructions)
+{
+	bool prompt = isatty(0);
+	show_position(cpu, history);
+	string line;
+	for (;;) {
+		if (prompt)
+			cout << "(tt) " << flush;
+		if (!getline(cin, line))
+			break;
+		istringstream words(line);
+		string command, argument;
+		if (!(words >> command))
+			continue;
+		words >> argument;
+		uint64_t count = argument.empty() ? 1 : strtoull(argument.c_str(), NULL, 0);
+		uint32_t address = (uint32_t)strtoul(argument.c_str(), NULL, 0);
+		if (command == "s" || command == "step") {
+			for (uint64_t i = 0; i < count && history.position() < maxInstructions && history.step(); i++) {
+			}
+			show_position(cpu, history);
+		} else if (command == "rs" || command == "reverse-step") {
+			for (uint64_t i = 0; i < count && history.step_back(); i++) {
+			}
+			show_position(cpu, history);
+		} else if (command == "c" || command == "continue") {
+			show_stop(cpu, history, history.run(maxInstructions));
+		} else if (command == "rc" || command == "reverse-continue") {
+			show_stop(cpu, history, history.run_back());
+		} else if (command == "goto") {
+			if (!history.seek(min(count, maxInstructions)))
+				cout << "program halted before instruction " << count << endl;
+			show_position(cpu, history);
+		} else if ((command == "b" || command == "break") && !argument.empty()) {
+			history.add_breakpoint(address);
+		} else if ((command == "d" || command == "delete") && !argument.empty()) {
+			if (!history.remove_breakpoint(address))
+				cout << "no breakpoint at " << argument << endl;
+		} else if ((command == "w" || command == "watch") && !argument.empty()) {
+			unsigned index;
+			if (parse_register(argument, index))
+				history.watch_register(index);
+			else
+				history.watch_memory(address);
+		} else if (command == "unwatch") {
+			history.clear_watches();
+		} else if (command == "r" || command == "regs") {
+			for (unsigned i = 0; i < 32; i++)
+				cout << "x" << i << "=" << history.reg(i) << ((i % 8 == 7) ? "\n" : " ");
+		} else if (command == "x" && !argument.empty()) {
+			string countText;
+			uint64_t n = 1;
+			if (words >> countText)
+				n = strtoull(countText.c_str(), NULL, 0);
+			for (uint64_t i = 0; i < n; i++) {
+				uint32_t a = address + 4 * (uint32_t)i;
+				cout << "0x" << hex << a << ": 0x" << history.read32(a) << dec << endl;
+			}
+		} else if (command == "i" || command == "info") {
+			cout << "instruction " << history.position() << "  undo records: " << history.records()
+				 << " (back to " << history.oldest() << ")  checkpoints: " << history.checkpoints()
+				 << "  replayed: " << history.replayed() << endl;
+			show_position(cpu, history);
+		} else if (command == "q" || command == "quit") {
+			break;
+		} else {
+			cout << "commands: s|step [N], rs|reverse-step [N], c|continue, rc|reverse-continue,"
+				 << " goto N, b|break ADDR, d|delete ADDR, w|watch xN|ADDR, unwatch,"
+				 << " r|regs, x ADDR [N], i|info, q|quit" << endl;
+		}
 	}
+}
 
-	string line; 
-	int i = 0;
-	while (infile >> line && i < 4096) {
-			
-			stringstream line2(line);
-			unsigned int x; 
-			line2 >> hex >> x;
-			instMem[i] = static_cast<char>(x); // be careful about hex
-			i++;
+int main(int argc, char* argv[])
+{
 
+	// command line: cpusim [--engine=stage|threaded|block|jit] [--jit-threshold=N]
+	//                      [--no-jit] [--no-fold-loops] [--max-instructions=N] [--mem-limit=BYTES]
+	//                      [--timing [--forwarding=none|ex|mem|full]]
+	//                      [--icache=SPEC] [--dcache=SPEC]
+	//                      [--predictor=KIND[:BITS] [--btb=N] [--ras=N]]
+	//                      [--trace | --trace-file=FILE [--trace-packed] | --counters=FILE |
+	//                       --profile=FILE [--profile-folded=FILE]]
+	//                      [--sample=N:W:M]
+	//                      [--load-snapshot=FILE] [--save-snapshot=FILE]
+	//                      [--format=auto|hex|binary|elf] [--cosim[=N]] [--cache=DIR]
+	//                      [--cfg=FILE] [--stats] <file>
+	//               cpusim --batch=<manifest|directory> [--jobs=N] [options]
+	//               cpusim --lanes=<inputs> [--max-instructions=N] [--mem-limit=BYTES] [--stats] <file>
+	//               cpusim --debugger [--history=N] [--checkpoint-interval=N] [--load-snapshot=FILE] <file>
+	//               cpusim --harts=N [--quantum=N] [--jobs=N] [--engine=...] [--stats] <file>
+	const char *filename = NULL;
+	const char *batch = NULL;
+	const char *lanes = NULL;
+	unsigned jobs = 0;
+	EngineOptions options;
+	bool stats = false;
+	bool timing = false;
+	ForwardingMode forwarding = FORWARD_FULL;
+	bool icache = false, dcache = false;
+	CacheConfig icacheConfig, dcacheConfig;
+	bool predict = false;
+	PredictorConfig predictorConfig;
+	const char *countersFile = NULL;
+	const char *traceFile = NULL;
+	const char *profileFile = NULL;
+	const char *foldedFile = NULL;
+	bool tracePacked = false;
+	const char *loadSnapshot = NULL;
+	const char *saveSnapshot = NULL;
+	bool sample = false;
+	SampleConfig sampleConfig;
+	ProgramFormat format = FORMAT_AUTO;
+	unsigned harts = 0;
+	uint64_t quantum = 10000;
+	uint64_t cosim = 0;
+	const char *cacheDirectory = NULL;
+	bool debugger = false;
+	HistoryConfig history;
+	const char *cfgFile = NULL;
+	for (int a = 1; a < argc; a++) {
+		if (strncmp(argv[a], "--engine=", 9) == 0) {
+			if (!parse_engine(argv[a] + 9, options.kind)) {
+				cerr << "unknown engine " << argv[a] + 9 << endl;
+				return -1;
+			}
+		} else if (strncmp(argv[a], "--jit-threshold=", 16) == 0) {
+			options.jitThreshold = strtoul(argv[a] + 16, NULL, 10);
+		} else if (strcmp(argv[a], "--no-jit") == 0) {
+			options.jitEnabled = false;
+		} else if (strcmp(argv[a], "--no-fold-loops") == 0) {
+			options.foldLoops = false;
+		} else if (strncmp(argv[a], "--max-instructions=", 19) == 0) {
+			options.maxInstructions = strtoull(argv[a] + 19, NULL, 10);
+		} else if (strncmp(argv[a], "--mem-limit=", 12) == 0) {
+			if (!parse_size(argv[a] + 12, options.memoryLimit)) {
+				cerr << "bad memory limit " << argv[a] + 12 << endl;
+				return -1;
+			}
+		} else if (strncmp(argv[a], "--batch=", 8) == 0) {
+			batch = argv[a] + 8;
+		} else if (strncmp(argv[a], "--lanes=", 8) == 0) {
+			lanes = argv[a] + 8;
+		} else if (strncmp(argv[a], "--harts=", 8) == 0) {
+			harts = strtoul(argv[a] + 8, NULL, 10);
+			if (harts == 0) {
+				cerr << "--harts needs at least one hart" << endl;
+				return -1;
+			}
+		} else if (strncmp(argv[a], "--quantum=", 10) == 0) {
+			quantum = strtoull(argv[a] + 10, NULL, 10);
+			if (quantum == 0) {
+				cerr << "--quantum must be at least 1" << endl;
+				return -1;
+			}
+		} else if (strcmp(argv[a], "--cosim") == 0) {
+			cosim = 1000;
+		} else if (strncmp(argv[a], "--cosim=", 8) == 0) {
+			cosim = strtoull(argv[a] + 8, NULL, 10);
+			if (cosim == 0) {
+				cerr << "--cosim needs an interval of at least 1" << endl;
+				return -1;
+			}
+		} else if (strncmp(argv[a], "--cache=", 8) == 0) {
+			cacheDirectory = argv[a] + 8;
+		} else if (strncmp(argv[a], "--cfg=", 6) == 0) {
+			cfgFile = argv[a] + 6;
+		} else if (strcmp(argv[a], "--debugger") == 0) {
+			debugger = true;
+		} else if (strncmp(argv[a], "--history=", 10) == 0) {
+			uint64_t depth;
+			if (!parse_size(argv[a] + 10, depth) || depth == 0) {
+				cerr << "bad history depth " << argv[a] + 10 << endl;
+				return -1;
+			}
+			history.depth = (size_t)depth;
+		} else if (strncmp(argv[a], "--checkpoint-interval=", 22) == 0) {
+			if (!parse_size(argv[a] + 22, history.checkpointInterval) || history.checkpointInterval == 0) {
+				cerr << "bad checkpoint interval " << argv[a] + 22 << endl;
+				return -1;
+			}
+		} else if (strncmp(argv[a], "--jobs=", 7) == 0) {
+			jobs = strtoul(argv[a] + 7, NULL, 10);
+		} else if (strcmp(argv[a], "--timing") == 0) {
+			timing = true;
+		} else if (strncmp(argv[a], "--forwarding=", 13) == 0) {
+			if (!parse_forwarding(argv[a] + 13, forwarding)) {
+				cerr << "unknown forwarding mode " << argv[a] + 13 << endl;
+				return -1;
+			}
+		} else if (strncmp(argv[a], "--icache=", 9) == 0 || strncmp(argv[a], "--dcache=", 9) == 0) {
+			bool instruction = argv[a][2] == 'i';
+			string error;
+			if (!parse_cache_config(argv[a] + 9, instruction ? icacheConfig : dcacheConfig, error)) {
+				cerr << "bad cache " << argv[a] + 9 << ": " << error << endl;
+				return -1;
+			}
+			(instruction ? icache : dcache) = true;
+		} else if (strncmp(argv[a], "--predictor=", 12) == 0) {
+			string error;
+			if (!parse_predictor(argv[a] + 12, predictorConfig, error)) {
+				cerr << error << endl;
+				return -1;
+			}
+			predict = true;
+		} else if (strncmp(argv[a], "--btb=", 6) == 0) {
+			predictorConfig.btbEntries = strtoul(argv[a] + 6, NULL, 10);
+			if (predictorConfig.btbEntries & (predictorConfig.btbEntries - 1)) {
+				cerr << "BTB entries must be a power of two" << endl;
+				return -1;
+			}
+		} else if (strncmp(argv[a], "--ras=", 6) == 0) {
+			predictorConfig.rasDepth = strtoul(argv[a] + 6, NULL, 10);
+		} else if (strcmp(argv[a], "--trace") == 0) {
+			options.debug = true;
+		} else if (strncmp(argv[a], "--trace-file=", 13) == 0) {
+			traceFile = argv[a] + 13;
+		} else if (strcmp(argv[a], "--trace-packed") == 0) {
+			tracePacked = true;
+		} else if (strncmp(argv[a], "--counters=", 11) == 0) {
+			countersFile = argv[a] + 11;
+		} else if (strncmp(argv[a], "--profile=", 10) == 0) {
+			profileFile = argv[a] + 10;
+		} else if (strncmp(argv[a], "--profile-folded=", 17) == 0) {
+			foldedFile = argv[a] + 17;
+		} else if (strncmp(argv[a], "--sample=", 9) == 0) {
+			string error;
+			if (!parse_sample_config(argv[a] + 9, sampleConfig, error)) {
+				cerr << error << endl;
+				return -1;
+			}
+			sample = true;
+		} else if (strncmp(argv[a], "--load-snapshot=", 16) == 0) {
+			loadSnapshot = argv[a] + 16;
+		} else if (strncmp(argv[a], "--save-snapshot=", 16) == 0) {
+			saveSnapshot = argv[a] + 16;
+		} else if (strncmp(argv[a], "--format=", 9) == 0) {
+			if (!parse_program_format(argv[a] + 9, format)) {
+				cerr << "unknown program format " << argv[a] + 9 << endl;
+				return -1;
+			}
+		} else if (strcmp(argv[a], "--stats") == 0) {
+			stats = true;
+		} else if (argv[a][0] == '-') {
+			cerr << "unknown option " << argv[a] << endl;
+			return -1;
+		} else {
+			filename = argv[a];
 		}
+	}
 
-	int maxPC= i/4; // max number of instructions
-	// cout<< "maxPC: " << maxPC << endl;
+	if (cfgFile != NULL && batch != NULL) {
+		cerr << "--cfg analyzes a single program" << endl;
+		return -1;
+	}
+	if (timing && (batch != NULL || lanes != NULL)) {
+		cerr << "--timing models a single program run" << endl;
+		return -1;
+	}
+	bool profiling = profileFile != NULL || foldedFile != NULL;
+	bool instrumented = options.debug || countersFile != NULL || traceFile != NULL || profiling;
+	if ((icache || dcache || predict || instrumented) && (batch != NULL || lanes != NULL)) {
+		cerr << "--icache, --dcache, --predictor, --trace, --trace-file, --counters and --profile"
+			 << " observe a single program run" << endl;
+		return -1;
+	}
+	if ((loadSnapshot != NULL || saveSnapshot != NULL) && (batch != NULL || lanes != NULL)) {
+		cerr << "--load-snapshot and --save-snapshot apply to a single program run" << endl;
+		return -1;
+	}
+	if (format != FORMAT_AUTO && batch != NULL) {
+		cerr << "--format applies to a single program; batch inputs are auto-detected" << endl;
+		return -1;
+	}
+	if (sample && !(timing || icache || dcache || predict)) {
+		cerr << "--sample needs --timing, --icache, --dcache or --predictor" << endl;
+		return -1;
+	}
+	if (sample && (instrumented || batch != NULL || lanes != NULL)) {
+		cerr << "--sample cannot be combined with --trace, --trace-file, --counters,"
+			 << " --profile, --batch or --lanes" << endl;
+		return -1;
+	}
+	if (harts != 0 && (timing || icache || dcache || predict || instrumented || sample ||
+					   loadSnapshot != NULL || saveSnapshot != NULL || batch != NULL || lanes != NULL)) {
+		cerr << "--harts runs functional engines only; models, tracing, snapshots,"
+			 << " --sample, --batch and --lanes do not apply" << endl;
+		return -1;
+	}
+	if (cosim != 0 && (timing || icache || dcache || predict || instrumented || sample ||
+					   loadSnapshot != NULL || saveSnapshot != NULL || lanes != NULL || harts != 0)) {
+		cerr << "--cosim checks functional engines only; models, tracing, snapshots,"
+			 << " --sample, --lanes and --harts do not apply" << endl;
+		return -1;
+	}
+	if (cacheDirectory != NULL && (timing || icache || dcache || predict || instrumented || sample ||
+								   saveSnapshot != NULL || lanes != NULL || harts != 0 || cosim != 0)) {
+		cerr << "--cache records functional results only; models, tracing, --sample,"
+			 << " --save-snapshot, --lanes, --harts and --cosim need a real run" << endl;
+		return -1;
+	}
+	if (debugger && (timing || icache || dcache || predict || instrumented || sample || batch != NULL ||
+					 lanes != NULL || harts != 0 || cosim != 0 || cacheDirectory != NULL)) {
+		cerr << "--debugger steps one program on its own; models, tracing, --sample, --batch,"
+			 << " --lanes, --harts, --cosim and --cache do not apply" << endl;
+		return -1;
+	}
+	if ((int)options.debug + (countersFile != NULL) + (traceFile != NULL) + profiling > 1) {
+		cerr << "--trace, --trace-file, --counters and --profile cannot be combined" << endl;
+		return -1;
+	}
 
+	ResultCache resultCache(cacheDirectory != NULL ? cacheDirectory : "");
+	if (cacheDirectory != NULL) {
+		string error;
+		if (!resultCache.open(error)) {
+			cerr << error << endl;
+			return -1;
+		}
+	}
 
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
 
-	CPU myCPU(instMem);  // call the approriate constructor here to initialize the processor...  
-	
+	if (batch != NULL) {
+		vector<string> paths;
+		if (!collect_batch_inputs(batch, paths)) {
+			cerr << "cannot read batch " << batch << endl;
+			return -1;
+		}
+		BatchRunner runner(options, jobs);
+		runner.setCoSimulation(cosim);
+		runner.setResultCache(cacheDirectory != NULL ? &resultCache : NULL);
+		size_t failures = runner.run(paths, cout);
+		if (stats) {
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			cerr << "batch: " << paths.size() << " programs  jobs: " << runner.jobs()
+				 << "  seconds: " << seconds << endl;
+		}
+		return failures == 0 ? 0 : 1;
+	}
 
-	int cycle = 0;
-	bool debug = false;
+	if (filename == NULL) {
+		//cout << "No file name entered. Exiting...";
+		return -1;
+	}
 
-	while (true) // main loop. Each iteration is equal to one clock cycle.  
-	{
-		
-		//fetch
-		uint32_t instruction = myCPU.fetch();
+	// instruction memo
+	Program program;
+	string loadError;
+	if (!load_program(filename, program, format, loadError)) {
+		// cout<<"error opening file\n";
+		cerr << loadError << endl;
+		return 0; 
+	}
 
-		if(instruction == 0){
-			break;
+	// static analysis of the image, whatever runs it below
+	if (cfgFile != NULL) {
+		chrono::steady_clock::time_point analysisStart = chrono::steady_clock::now();
+		ControlFlowGraph graph(program);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - analysisStart).count();
+		ofstream out(cfgFile);
+		string name = cfgFile;
+		if (name.size() >= 4 && (name.compare(name.size() - 4, 4, ".dot") == 0 ||
+								 name.compare(name.size() - 3, 3, ".gv") == 0)) {
+			CPU disassembler(program.instMem);
+			graph.write_dot(out, disassembler);
+		} else {
+			graph.write_json(out);
+		}
+		if (!out) {
+			cerr << "cannot write control-flow graph to " << cfgFile << endl;
 		}
-		
-		// decode
-		myCPU.decode(instruction);
+		if (stats) {
+			cerr << "cfg: " << graph.instructions().size() << " instructions  " << graph.blocks().size()
+				 << " blocks  " << graph.loops().size() << " loops";
+			vector<uint32_t> hot = graph.hot_loops();
+			if (!hot.empty()) {
+				const ControlFlowGraph::Loop &loop = graph.loops()[hot[0]];
+				cerr << "  hottest at 0x" << hex << graph.blocks()[loop.header].start << dec
+					 << " (depth " << loop.depth << ")";
+			}
+			cerr << "  seconds: " << seconds << endl;
+		}
+	}
 
-		// execute
-		myCPU.execute();
-        
-		// Mem
-		myCPU.mem();
+	if (lanes != NULL) {
+		vector<LaneInput> inputs;
+		string error;
+		if (!load_lane_inputs(lanes, inputs, error)) {
+			cerr << error << endl;
+			return -1;
+		}
+		if (program.format == FORMAT_ELF || program.size > 4096) {
+			cerr << "--lanes runs hex or binary images of up to 4 KB" << endl;
+			return -1;
+		}
+		LockstepEngine engine(program.instMem, program.pcLimit(), inputs, options.memoryLimit);
+		engine.run(options.maxInstructions);
+		uint64_t total = 0;
+		for (size_t lane = 0; lane < engine.lanes(); lane++) {
+			total += engine.instructions(lane);
+			// a0 = x10, a1 = x11
+			cout << "(" << engine.reg(lane, 10) << "," << engine.reg(lane, 11) << ")" << "\n";
+		}
+		cout.flush();
+		if (stats) {
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			cerr << "lockstep: " << engine.lanes() << " lanes  instructions: " << total
+				 << "  seconds: " << seconds
+				 << "  MIPS: " << (seconds > 0 ? total / seconds / 1e6 : 0) << endl;
+		}
+		return 0;
+	}
 
-		// Write Back
-        myCPU.wb();
+	if (harts != 0) {
+		HartGroup group(program, harts, quantum, options, jobs);
+		group.run();
+		uint64_t total = 0;
+		for (unsigned h = 0; h < group.harts(); h++) {
+			total += group.instructions(h);
+			cout << "(" << group.hart(h).getA0() << "," << group.hart(h).getA1() << ")" << "\n";
+		}
+		cout.flush();
+		if (stats) {
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			cerr << "harts: " << group.harts() << "  jobs: " << group.jobs()
+				 << "  quanta: " << group.quanta() << "  merged bytes: " << group.mergedBytes()
+				 << "  instructions: " << total << "  seconds: " << seconds
+				 << "  MIPS: " << (seconds > 0 ? total / seconds / 1e6 : 0) << endl;
+		}
+		return 0;
+	}
 
-		// Debugging purposes
-		if(debug){
-			myCPU.print_debug_state(instruction, cycle);
+	if (cosim != 0) {
+		CoSimulator checker(program, options, cosim);
+		bool matched = checker.run();
+		// a0 = x10, a1 = x11 of the reference
+		cout << "(" << checker.reference().getA0() << "," << checker.reference().getA1() << ")" << endl;
+		if (!matched || stats)
+			checker.report(cerr);
+		if (stats) {
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			cerr << "seconds: " << seconds << endl;
 		}
+		return matched ? 0 : 1;
+	}
 
-		myCPU.updatePC(); // Update PC
+	CPU myCPU(program.instMem);  // call the approriate constructor here to initialize the processor...  
+	if (!program.segments.empty())
+		reset_cpu(myCPU, program);
+	myCPU.setMemoryLimit(options.memoryLimit);
+	if (loadSnapshot != NULL) {
+		// continue where a previous run left off
+		CPUSnapshot snapshot;
+		string error;
+		if (!load_snapshot(loadSnapshot, snapshot, error)) {
+			cerr << error << endl;
+			return -1;
+		}
+		myCPU.restore(snapshot);
+	}
+
+	if (debugger) {
+		TimeTravel travel(myCPU, program.pcLimit(), history);
+		run_debugger(myCPU, travel, options.maxInstructions);
+		if (stats) {
+			cerr << "history: " << travel.records() << " undo records back to instruction "
+				 << travel.oldest() << "  checkpoints: " << travel.checkpoints()
+				 << "  replayed: " << travel.replayed() << " instructions" << endl;
+		}
+		if (saveSnapshot != NULL) {
+			CPUSnapshot snapshot;
+			myCPU.snapshot(snapshot);
+			string error;
+			if (!save_snapshot(snapshot, saveSnapshot, error)) {
+				cerr << error << endl;
+			}
+		}
+		// the state the session ended at
+		cout << "(" << myCPU.getA0() << "," << myCPU.getA1() << ")" << endl;
+		return 0;
+	}
 
+	// a run whose result is cached is not simulated again
+	ResultKey cacheKey;
+	if (cacheDirectory != NULL) {
+		cacheKey = ResultCache::key(myCPU, program.pcLimit(), options);
+		CachedRun hit;
+		if (resultCache.lookup(cacheKey, hit)) {
+			cout << "(" << hit.a0 << "," << hit.a1 << ")" << endl;
+			if (stats) {
+				double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+				cerr << "cache: hit  key: " << cacheKey.hex() << "  instructions: " << hit.instructions
+					 << (hit.halted ? "" : " (limit)") << "  state: " << hit.state.hex()
+					 << "  seconds: " << seconds << endl;
+			}
+			return 0;
+		}
+	}
 
-		cycle++;
+	unique_ptr<ExecutionCounters> counters;
+	if (countersFile != NULL) {
+		counters.reset(new ExecutionCounters(program.pcLimit()));
+		options.counters = counters.get();
+	}
+	TraceWriter traceWriter;
+	if (traceFile != NULL) {
+		string error;
+		if (!traceWriter.open(traceFile, tracePacked, error)) {
+			cerr << error << endl;
+			return -1;
+		}
+		options.traceWriter = &traceWriter;
+	}
+	BranchPredictor predictor(predictorConfig);
+	PipelineModel pipeline(forwarding, predict ? &predictor : NULL);
+	if (timing) {
+		options.timing = &pipeline;
+	} else if (predict) {
+		options.predictor = &predictor;
+	}
+	CacheModel instructionCache(icacheConfig), dataCache(dcacheConfig);
+	if (icache) {
+		options.instructionCache = &instructionCache;
+	}
+	if (dcache) {
+		options.dataCache = &dataCache;
+	}
+	// functions are named by entry address; the root is where the run starts
+	unique_ptr<Profiler> profiler;
+	if (profiling) {
+		profiler.reset(new Profiler(program.pcLimit(), myCPU.readPC(), timing ? &pipeline : NULL));
+		options.profiler = profiler.get();
+	}
+	Sampler sampler(sampleConfig);
+	RunResult result = sample ? sampler.run(myCPU, program.pcLimit(), options)
+							  : run_program(myCPU, program.pcLimit(), options);
+	if (traceFile != NULL && !traceWriter.close()) {
+		cerr << "cannot write trace to " << traceFile << endl;
+	}
+	if (cacheDirectory != NULL) {
+		CachedRun run = { myCPU.getA0(), myCPU.getA1(), result.halted, result.instructions,
+						  ResultCache::digest(myCPU) };
+		if (!resultCache.store(cacheKey, run)) {
+			cerr << "cannot write cache entry to " << cacheDirectory << endl;
+		} else if (stats) {
+			cerr << "cache: stored  key: " << cacheKey.hex() << "  state: " << run.state.hex() << endl;
+		}
+	}
+	if (saveSnapshot != NULL) {
+		CPUSnapshot snapshot;
+		myCPU.snapshot(snapshot);
+		string error;
+		if (!save_snapshot(snapshot, saveSnapshot, error)) {
+			cerr << error << endl;
+		}
+	}
 
-		if (myCPU.readPC() > maxPC * 4)
-			break;
+	// Throughput report goes to stderr so stdout stays "(a0,a1)"
+	if (stats) {
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		// observed runs always go through the stage engine (sampled ones only
+		// between windows)
+		bool observed = !sample && (timing || icache || dcache || predict || instrumented);
+		EngineKind ran = observed ? ENGINE_STAGE : options.kind;
+		cerr << "engine: " << engine_name(ran)
+			 << "  instructions: " << result.instructions
+			 << "  seconds: " << seconds
+			 << "  MIPS: " << (seconds > 0 ? result.instructions / seconds / 1e6 : 0) << endl;
+		if (ran == ENGINE_JIT) {
+			cerr << "jit: " << result.compiledBlocks << " blocks compiled";
+			if (result.codeFlushes != 0) {
+				cerr << "  " << result.codeFlushes << " code buffer flushes";
+			}
+			cerr << endl;
+		}
+		if (ran == ENGINE_BLOCK && result.foldedInstructions != 0) {
+			cerr << "loops: " << result.foldedInstructions << " instructions skipped" << endl;
+		}
+		if (traceFile != NULL) {
+			cerr << "trace: " << traceWriter.records() << " records  "
+				 << traceWriter.bytesWritten() << " bytes" << endl;
+		}
+		cerr << "memory: " << myCPU.residentMemory() / 1024 << " KB resident";
+		if (myCPU.droppedWrites() != 0) {
+			cerr << "  " << myCPU.droppedWrites() << " stores dropped (--mem-limit)";
+		}
+		cerr << endl;
+	}
+	if (sample) {
+		// the models below only saw the warm-up and measured windows
+		sampler.report(cerr);
+	} else if (timing) {
+		PipelineStats t = pipeline.stats();
+		cerr << "pipeline: cycles: " << t.cycles
+			 << "  instructions: " << t.instructions
+			 << "  CPI: " << pipeline.cpi()
+			 << "  forwarding: " << forwarding_name(forwarding) << endl;
+		cerr << "stalls: load-use " << t.loadUseStalls
+			 << "  data " << t.dataStalls
+			 << "  flush " << t.flushCycles << " (" << t.flushes << " redirects)"
+			 << "  forwarded: EX/MEM " << t.forwardedExMem
+			 << "  MEM/WB " << t.forwardedMemWb << endl;
+	}
+	if (predict) {
+		report_predictor(predictor);
+	}
+	if (countersFile != NULL) {
+		ofstream out(countersFile);
+		counters->write_json(out);
+		if (!out) {
+			cerr << "cannot write counters to " << countersFile << endl;
+		}
+	}
+	if (profiling) {
+		profiler->finish();
+		if (profileFile != NULL) {
+			ofstream out(profileFile);
+			profiler->write_flat(out, myCPU);
+			if (!out) {
+				cerr << "cannot write profile to " << profileFile << endl;
+			}
+		}
+		if (foldedFile != NULL) {
+			ofstream out(foldedFile);
+			profiler->write_folded(out);
+			if (!out) {
+				cerr << "cannot write profile to " << foldedFile << endl;
+			}
+		}
+	}
+	if (icache) {
+		report_cache("icache", instructionCache);
+	}
+	if (dcache) {
+		report_cache("dcache", dataCache);
 	}
 
 	int a0 = myCPU.getA0();
@@ -96,4 +791,4 @@ int main(int argc, char* argv[])
 	
 	return 0;
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,177 @@
+// Checks the table-driven Controller against the original switch-based
+// control logic, kept below as it was before the decode tables: every
+// opcode for generate_signals, and every opcode, funct3, funct7 and ALUOp
+// for aluController and aluOperation.
+//
+// usage: build/controller_test      (built and run by make check)
+
+#include <cstdio>
+
+#include "Controller.h"
+
+namespace original {
+
+/**
+ * Generates control signals based *only on the opcode.
+ * This function is direct implementation of the control logic table.
+ */
+ControlSignals generate_signals(uint8_t opcode) {
+
+    ControlSignals signals;
+
+    // Initialize all signals to false and 0
+    signals.RegWrite = false;
+    signals.MemRead = false;
+    signals.MemWrite = false;
+    signals.Branch = false;
+    signals.ALUSrc = false;
+    signals.MemtoReg = false;
+    signals.ALUOp = 0;
+    signals.LUISel = false;
+    signals.JALRSel = false;
+    signals.PCSrc = 0;
+
+    // Mapping according to the controls table
+    switch (opcode) {
+        case RTYPE:
+			signals.RegWrite = true;
+			signals.ALUOp = 0b10;
+			signals.PCSrc = 0; // PC+4
+			break; // R-type
+        case ITYPE:
+			signals.RegWrite = true;
+			signals.ALUSrc = true;
+			signals.PCSrc = 0; // PC+4
+			break; // I-type
+        case LUI:
+			signals.RegWrite = true;
+			signals.ALUSrc = true;
+			signals.LUISel = true; // LUI selector - Use immediate instead of ALU result
+			signals.PCSrc = 0; // PC+4
+			break; // LUI
+        case LW:
+			signals.RegWrite = true;
+			signals.MemRead = true;
+			signals.ALUSrc = true;
+			signals.MemtoReg = true;
+			signals.PCSrc = 0; // PC+4
+			break; // Load
+        case SW:
+			signals.MemWrite = true;
+			signals.ALUSrc = true;
+            signals.MemtoReg = true;
+			signals.PCSrc = 0; // PC+4
+			break; // Store
+        case BNE:
+			signals.Branch = true;
+			signals.ALUOp = 0b01;
+            signals.MemtoReg = true;
+			signals.PCSrc = 1; // PC + immediate (if branch taken)
+			break; // BNE
+        case JALR:
+			signals.RegWrite = true;
+			signals.ALUSrc = true;
+			signals.JALRSel = true; // Write PC+4 to register
+			signals.PCSrc = 2;
+			break; // JALR
+        default:
+            break;
+    }
+
+    return signals;
+}
+
+/**
+ * the ALU Controller.
+ * Takes the 2-bit ALUOp, funct3, funct7 and opcode to generate the 4-bit ALU operation signal.
+ */
+uint8_t aluController(uint8_t opcode, uint8_t funct3, uint8_t funct7, uint8_t alu_op) {
+    if (alu_op == 0b00)
+        return 0b0010; // ADD (for Load/Store/ADDI)
+    if (alu_op == 0b01)
+        return 0b0110; // SUB (for BNE)
+
+    // For R-type instructions (ALUOp = 10), decode funct3/funct7
+    if (alu_op == 0b10) {
+        if (funct3 == 0b000 && funct7 == 0b0000000)
+            return 0b0010; // ADD
+        if (funct3 == 0b000 && funct7 == 0b0100000)
+            return 0b0110; // SUB
+        if (funct3 == 0b101 && funct7 == 0b0100000)
+            return 0b0111; // SRA
+        if (funct3 == 0b111 && funct7 == 0b0000000)
+            return 0b0000; // AND
+    }
+
+    // For I-type ALU instructions (opcode 0010011), decode funct3
+    if(opcode == 0b0010011) {
+        if (funct3 == 0b110)
+            return 0b0001; // ORI
+        if (funct3 == 0b011)
+            return 0b0011; // SLTIU
+        if (funct3 == 0b000)
+            return 0b0010; // ADDI
+    }
+
+    return 0b0010; // Default : ADD
+}
+
+} // namespace original
+
+static unsigned long checks = 0, failures = 0;
+
+static void expect(bool ok, const char *what, unsigned opcode, int funct3, int funct7, int aluOp,
+                   unsigned got, unsigned expected) {
+    checks++;
+    if (ok)
+        return;
+    if (failures++ < 20) {
+        printf("FAIL %s: opcode 0x%02x", what, opcode);
+        if (funct3 >= 0)
+            printf(" funct3 %d funct7 0x%02x", funct3, funct7);
+        if (aluOp >= 0)
+            printf(" ALUOp %d", aluOp);
+        printf(": 0x%x, originally 0x%x\n", got, expected);
+    }
+}
+
+// Signals packed one per bit (ALUOp and PCSrc two bits each), for printing
+static unsigned pack(const ControlSignals &s) {
+    return s.RegWrite | s.MemRead << 1 | s.MemWrite << 2 | s.Branch << 3 | s.ALUSrc << 4 |
+           s.MemtoReg << 5 | (s.ALUOp & 3) << 6 | s.LUISel << 8 | s.JALRSel << 9 | (s.PCSrc & 3) << 10;
+}
+
+int main() {
+    Controller controller;
+    // decode() passes the low 7 bits of the instruction as the opcode
+    for (unsigned opcode = 0; opcode < 128; opcode++) {
+        ControlSignals signals = controller.generate_signals((uint8_t)opcode);
+        ControlSignals reference = original::generate_signals((uint8_t)opcode);
+        // compared field by field, so a signal out of its range shows too
+        bool same = signals.RegWrite == reference.RegWrite && signals.MemRead == reference.MemRead &&
+                    signals.MemWrite == reference.MemWrite && signals.Branch == reference.Branch &&
+                    signals.ALUSrc == reference.ALUSrc && signals.MemtoReg == reference.MemtoReg &&
+                    signals.ALUOp == reference.ALUOp && signals.LUISel == reference.LUISel &&
+                    signals.JALRSel == reference.JALRSel && signals.PCSrc == reference.PCSrc;
+        expect(same, "generate_signals", opcode, -1, -1, -1, pack(signals), pack(reference));
+
+        for (unsigned funct3 = 0; funct3 < 8; funct3++) {
+            for (unsigned funct7 = 0; funct7 < 128; funct7++) {
+                for (unsigned aluOp = 0; aluOp < 4; aluOp++) {
+                    uint8_t got = controller.aluController((uint8_t)opcode, (uint8_t)funct3, (uint8_t)funct7,
+                                                           (uint8_t)aluOp);
+                    uint8_t expected = original::aluController((uint8_t)opcode, (uint8_t)funct3,
+                                                               (uint8_t)funct7, (uint8_t)aluOp);
+                    expect(got == expected, "aluController", opcode, funct3, funct7, aluOp, got, expected);
+                }
+                // the decoder's one-lookup path, with the opcode's own ALUOp
+                uint8_t got = controller.aluOperation((uint8_t)opcode, (uint8_t)funct3, (uint8_t)funct7);
+                uint8_t expected = original::aluController((uint8_t)opcode, (uint8_t)funct3, (uint8_t)funct7,
+                                                           reference.ALUOp);
+                expect(got == expected, "aluOperation", opcode, funct3, funct7, -1, got, expected);
+            }
+        }
+    }
+    printf("%lu checks, %lu failed\n", checks, failures);
+    return failures == 0 ? 0 : 1;
+}
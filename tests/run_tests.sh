@@ -0,0 +1,323 @@
+#!/bin/bash
+# Differential regression checks: every engine configuration must finish a
+# program with the same (a0,a1), PC, instruction count, registers and memory
+# as the stage engine.
+#
+# usage: tests/run_tests.sh [path/to/cpusim]      (default ./cpusim)
+#
+# Both runs save their final state with --save-snapshot. A snapshot holds
+# every resident page, so equal snapshot files mean equal memory. Each
+# configuration then runs again under --cosim, which names the first
+# diverging instruction when there is one. A program with a listing next to
+# it ("# a0 = N" / "# a1 = N" lines) must also give the listed result.
+
+cd "$(dirname "$0")/.." || exit 2
+CPUSIM=${1:-./cpusim}
+if [ ! -x "$CPUSIM" ]; then
+    echo "$CPUSIM: not found; build cpusim first (see README.md)" >&2
+    exit 2
+fi
+
+# tracedump is looked for next to cpusim
+TRACEDUMP=$(dirname "$CPUSIM")/tracedump
+
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+checks=0
+failures=0
+
+fail() {
+    echo "FAIL $*"
+    failures=$((failures + 1))
+}
+
+# expect PROGRAM LISTING [OPTIONS]: the stage engine gives the listing's result
+expect() {
+    local program=$1 listing=$2 options=$3
+    local a0 a1 result
+    a0=$(sed -n 's/^# a0 = //p' "$listing")
+    a1=$(sed -n 's/^# a1 = //p' "$listing")
+    [ -n "$a0" ] && [ -n "$a1" ] || return 0
+    checks=$((checks + 1))
+    result=$("$CPUSIM" --engine=stage $options "$program")
+    [ "$result" = "($a0,$a1)" ] || fail "$program: stage gave $result, $listing lists ($a0,$a1)"
+}
+
+# check PROGRAM CONFIGURATION [OPTIONS]: CONFIGURATION ends like the stage
+# engine; OPTIONS are given to both
+check() {
+    local program=$1 configuration=$2 options=$3
+    local reference result label="$configuration${options:+ $options}"
+    checks=$((checks + 1))
+    reference=$("$CPUSIM" --engine=stage $options --save-snapshot="$SCRATCH/reference" "$program")
+    result=$("$CPUSIM" $configuration $options --save-snapshot="$SCRATCH/result" "$program")
+    if [ "$result" != "$reference" ]; then
+        fail "$program [$label]: $result, stage gave $reference"
+    elif ! cmp -s "$SCRATCH/reference" "$SCRATCH/result"; then
+        fail "$program [$label]: final state differs from the stage engine"
+    elif ! "$CPUSIM" --cosim $configuration $options "$program" > /dev/null 2> "$SCRATCH/cosim"; then
+        fail "$program [$label]: $(head -1 "$SCRATCH/cosim")"
+    fi
+}
+
+# folded PROGRAM [OPTIONS]: the block engine skips iterations of a counted
+# loop, so the check against the stage engine covered the skipping
+folded() {
+    local program=$1 options=$2
+    checks=$((checks + 1))
+    if ! "$CPUSIM" --engine=block --stats $options "$program" 2>&1 > /dev/null |
+            grep -q '^loops: [1-9][0-9]* instructions skipped'; then
+        fail "$program [--engine=block${options:+ $options}]: no loop iterations skipped"
+    fi
+}
+
+# lanes PROGRAM INPUTS [OPTIONS]: a --lanes run gives every lane the result
+# after its "# (a0,a1)" comment, and the "# instructions: N" total
+lanes() {
+    local program=$1 inputs=$2 options=$3
+    local instructions label="--lanes=$inputs${options:+ $options}"
+    checks=$((checks + 1))
+    "$CPUSIM" --lanes="$inputs" --stats $options "$program" > "$SCRATCH/lanes" 2> "$SCRATCH/stats"
+    sed -n 's/^[^#].*# *\((.*)\)$/\1/p' "$inputs" > "$SCRATCH/expected"
+    instructions=$(sed -n 's/^# instructions: //p' "$inputs")
+    if ! diff "$SCRATCH/expected" "$SCRATCH/lanes" > "$SCRATCH/diff"; then
+        fail "$program [$label]: lanes differ (expected <, got >)"
+        cat "$SCRATCH/diff"
+    elif ! grep -q " instructions: $instructions " "$SCRATCH/stats"; then
+        fail "$program [$label]: $(grep -o 'instructions: [0-9]*' "$SCRATCH/stats"), expected $instructions"
+    fi
+}
+
+# resume PROGRAM N CONFIGURATION [OPTIONS]: CONFIGURATION stopped after N
+# instructions with --save-snapshot and continued with --load-snapshot ends
+# like an uninterrupted stage run
+resume() {
+    local program=$1 n=$2 configuration=$3 options=$4
+    local reference result label="$configuration --max-instructions=$n${options:+ $options}"
+    checks=$((checks + 1))
+    reference=$("$CPUSIM" --engine=stage $options --save-snapshot="$SCRATCH/reference" "$program")
+    "$CPUSIM" $configuration $options --max-instructions=$n --save-snapshot="$SCRATCH/prefix" "$program" > /dev/null
+    result=$("$CPUSIM" $configuration $options --load-snapshot="$SCRATCH/prefix" --save-snapshot="$SCRATCH/result" "$program")
+    if [ "$result" != "$reference" ]; then
+        fail "$program [$label, resumed]: $result, stage gave $reference"
+    elif ! cmp -s "$SCRATCH/reference" "$SCRATCH/result"; then
+        fail "$program [$label, resumed]: final state differs from the stage engine"
+    fi
+}
+
+# trace PROGRAM [OPTIONS]: --trace-file, plain and packed, reads back
+# through tracedump as the --trace text without its decode and execute
+# sections
+trace() {
+    local program=$1 options=$2 packed
+    for packed in "" "--trace-packed"; do
+        checks=$((checks + 1))
+        "$CPUSIM" --trace $options "$program" | sed '$d' |
+            awk '/^--- (DECODE|EXECUTE) ---$/ { skip = 1; next } /^---|^$/ { skip = 0 } !skip' > "$SCRATCH/text"
+        "$CPUSIM" --trace-file="$SCRATCH/trace" $packed $options "$program" > /dev/null
+        "$TRACEDUMP" "$SCRATCH/trace" > "$SCRATCH/dump"
+        if ! cmp -s "$SCRATCH/text" "$SCRATCH/dump"; then
+            fail "$program [--trace-file${packed:+ $packed}${options:+ $options}]: tracedump differs from --trace"
+            diff "$SCRATCH/text" "$SCRATCH/dump" | head -10
+        fi
+    done
+}
+
+# rejected PROGRAM MESSAGE: loading PROGRAM fails with MESSAGE and runs nothing
+rejected() {
+    local program=$1 message=$2 result
+    checks=$((checks + 1))
+    result=$("$CPUSIM" "$program" 2> "$SCRATCH/error")
+    if [ -n "$result" ]; then
+        fail "$program: ran and gave $result, expected \"$message\""
+    elif ! grep -qF "$message" "$SCRATCH/error"; then
+        fail "$program: $(head -1 "$SCRATCH/error"), expected \"$message\""
+    fi
+}
+
+# cfg PROGRAM EXPECTED: --cfg writes exactly EXPECTED, in its format (.dot
+# or .json) and without running the program
+cfg() {
+    local program=$1 expected=$2 result output
+    output=$SCRATCH/cfg.${expected##*.}
+    checks=$((checks + 1))
+    result=$("$CPUSIM" --cfg="$output" --max-instructions=0 "$program")
+    if [ "$result" != "(0,0)" ]; then
+        fail "$program [--cfg]: ran and gave $result"
+    elif ! diff "$expected" "$output" > "$SCRATCH/diff"; then
+        fail "$program [--cfg]: differs from $expected (expected <, got >)"
+        head -10 "$SCRATCH/diff"
+    fi
+}
+
+# cached PROGRAM: with --cache, a first run stores its result and a repeat
+# is a hit with the same output, key and final-state digest. A fast engine
+# must get a key of its own but store the same digest as the stage engine.
+cached() {
+    local program=$1 reference configuration stored key stage
+    reference=$("$CPUSIM" --engine=stage "$program")
+    for configuration in "--engine=stage" "${CONFIGURATIONS[@]}"; do
+        checks=$((checks + 1))
+        rm -rf "$SCRATCH/cache"
+        "$CPUSIM" --cache="$SCRATCH/cache" --stats $configuration "$program" > "$SCRATCH/first" 2> "$SCRATCH/stats"
+        stored=$(sed -n 's/^cache: stored  key: \([0-9a-f]*\)  state: \([0-9a-f]*\)$/\1 \2/p' "$SCRATCH/stats")
+        "$CPUSIM" --cache="$SCRATCH/cache" --stats $configuration "$program" > "$SCRATCH/second" 2> "$SCRATCH/stats"
+        key=$(sed -n 's/^cache: hit  key: \([0-9a-f]*\)  .*state: \([0-9a-f]*\)  .*/\1 \2/p' "$SCRATCH/stats")
+        if [ "$(cat "$SCRATCH/first")" != "$reference" ] || [ "$(cat "$SCRATCH/second")" != "$reference" ]; then
+            fail "$program [--cache $configuration]: $(cat "$SCRATCH/first") then $(cat "$SCRATCH/second"), stage gave $reference"
+        elif [ -z "$stored" ] || [ "$key" != "$stored" ]; then
+            fail "$program [--cache $configuration]: stored \"$stored\", then hit \"$key\""
+        elif [ "$configuration" = "--engine=stage" ]; then
+            stage=$stored
+        elif [ "${stored% *}" = "${stage% *}" ] || [ "${stored#* }" != "${stage#* }" ]; then
+            fail "$program [--cache $configuration]: key and state \"$stored\", stage engine \"$stage\""
+        fi
+    done
+}
+
+# transcript FILE: FILE holds "$ cpusim ARGS [< INPUT]" lines, each
+# followed by what that run prints, stderr first, then stdout. Comment
+# lines may come before the first run. Times (seconds, MIPS, wall_us) are
+# left out of the comparison.
+transcript() {
+    local file=$1 runs i command input
+    local -a args
+    rm -f "$SCRATCH"/command.* "$SCRATCH"/expected.*
+    runs=$(awk -v dir="$SCRATCH" '
+        /^\$ / { n++; print substr($0, 3) > (dir "/command." n); printf "" > (dir "/expected." n); next }
+        n { print > (dir "/expected." n) }
+        END { print n + 0 }' "$file")
+    for ((i = 1; i <= runs; i++)); do
+        checks=$((checks + 1))
+        command=$(cat "$SCRATCH/command.$i")
+        input=/dev/null
+        case $command in *" < "*) input=${command##* < } ;; esac
+        read -ra args <<< "${command% < *}"
+        "$CPUSIM" "${args[@]:1}" < "$input" > "$SCRATCH/stdout" 2> "$SCRATCH/stderr"
+        cat "$SCRATCH/stderr" "$SCRATCH/stdout" |
+            sed -E 's/  (seconds|MIPS): [^ ]+//g; s/ wall_us=[0-9]+//' > "$SCRATCH/output"
+        if ! diff "$SCRATCH/expected.$i" "$SCRATCH/output" > "$SCRATCH/diff"; then
+            fail "$file: \$ $command (expected <, got >)"
+            head -10 "$SCRATCH/diff"
+        fi
+    done
+}
+
+# regressions: the regression programs, tests/instMem-X.txt (hex),
+# tests/X.bin (raw binary) and tests/X.elf, one "PROGRAM X" line each.
+# Each is listed in tests/X.txt. Programs with X.lanes inputs only run in
+# lockstep, and bad-X programs must fail to load.
+regressions() {
+    local program name
+    for program in tests/instMem-*.txt tests/*.bin tests/*.elf; do
+        name=${program#tests/}
+        name=${name#instMem-}
+        name=${name%.*}
+        case $name in bad-*) continue ;; esac
+        [ -e "tests/$name.lanes" ] || echo "$program $name"
+    done
+}
+
+CONFIGURATIONS=(
+    "--engine=threaded"
+    "--engine=block"
+    "--engine=block --no-fold-loops"
+    "--engine=jit"
+    "--engine=jit --jit-threshold=0"
+)
+
+# the bundled programs, with their listings (25instMem-X.txt and 25X.txt)
+for program in 25instMem-*.txt; do
+    expect "$program" "25${program#25instMem-}"
+    for configuration in "${CONFIGURATIONS[@]}"; do
+        check "$program" "$configuration"
+    done
+done
+
+# regression programs (see regressions above). A "# options:" line in the
+# listing gives options for every run, "# folded" requires
+# the block engine to skip loop iterations, and "# resume: N" stops every
+# configuration after N instructions and continues from a snapshot.
+while read -r program name; do
+    options=$(sed -n 's/^# options: //p' "tests/$name.txt")
+    expect "$program" "tests/$name.txt" "$options"
+    for configuration in "${CONFIGURATIONS[@]}"; do
+        check "$program" "$configuration" "$options"
+    done
+    grep -q '^# folded$' "tests/$name.txt" && folded "$program" "$options"
+    n=$(sed -n 's/^# resume: //p' "tests/$name.txt")
+    if [ -n "$n" ]; then
+        for configuration in "--engine=stage" "${CONFIGURATIONS[@]}"; do
+            resume "$program" "$n" "$configuration" "$options"
+        done
+    fi
+done < <(regressions)
+
+# loaders: code must end at or below 1 MB, for raw binaries as for ELF
+# segments, and a segment ending at 2^32 must not wrap around to 0
+head -c $((1024 * 1024)) /dev/zero > "$SCRATCH/limit.bin"
+printf '# a0 = 0\n# a1 = 0\n' > "$SCRATCH/limit.txt"
+expect "$SCRATCH/limit.bin" "$SCRATCH/limit.txt"
+head -c $((1024 * 1024 + 4)) /dev/zero > "$SCRATCH/over.bin"
+rejected "$SCRATCH/over.bin" "code ends at 0x100004, above the 0x100000 limit"
+rejected tests/bad-wrap-segment.elf "code ends at 0x100000000, above the 0x100000 limit"
+
+# control-flow graphs: tests/X.cfg.json and tests/X.cfg.dot hold the
+# blocks, loops and dominators --cfg finds in the regression program X.
+# tests/instMem-nested-loop-call.txt nests two loops and calls a halfword
+# address.
+for expected in tests/*.cfg.json tests/*.cfg.dot; do
+    name=${expected#tests/}
+    cfg "tests/instMem-${name%.cfg.*}.txt" "$expected"
+done
+
+# the JIT's code buffer: 65536 stores (sw x7 -4 x5) run twice need more
+# than its 4 MB, so it fills up during each pass. The 258 blocks of each
+# pass must all be compiled, which takes flushing the buffer and compiling
+# again.
+body=$(printf '\x23\xae\x72\xfe')
+for i in $(seq 16); do body=$body$body; done
+{
+    printf '\x93\x83\x13\x00'                   # addi x7 x7 1
+    printf '%s' "$body"
+    printf '\x93\x04\x20\x00\x63\x96\x93\x00'   # addi x9 x0 2; bne x7 x9 12
+    printf '\x13\x85\x03\x00\x00\x00\x00\x00'   # addi x10 x7 0; .word 0x0
+    printf '\x67\x00\x00\x00'                   # jalr x0 0 x0
+} > "$SCRATCH/jit-buffer.bin"
+printf '# a0 = 2\n# a1 = 0\n' > "$SCRATCH/jit-buffer.txt"
+expect "$SCRATCH/jit-buffer.bin" "$SCRATCH/jit-buffer.txt"
+check "$SCRATCH/jit-buffer.bin" "--engine=jit --jit-threshold=0"
+checks=$((checks + 1))
+if ! "$CPUSIM" --engine=jit --jit-threshold=0 --stats "$SCRATCH/jit-buffer.bin" 2>&1 > /dev/null |
+        grep -q '^jit: 516 blocks compiled  [1-9][0-9]* code buffer flushes$'; then
+    fail "$SCRATCH/jit-buffer.bin [--engine=jit --jit-threshold=0]: not every block compiled after the buffer filled"
+fi
+
+# traces of every program; tests/instMem-trace-loop.txt fills several
+# trace blocks and wraps the writer's ring
+if [ -x "$TRACEDUMP" ]; then
+    for program in 25instMem-*.txt; do
+        trace "$program"
+    done
+    while read -r program name; do
+        trace "$program" "$(sed -n 's/^# options: //p' "tests/$name.txt")"
+    done < <(regressions)
+else
+    echo "$TRACEDUMP: not found; trace checks skipped" >&2
+fi
+
+# lanes that diverge at a bne, store over code or a zero word (and leave
+# the lockstep, keeping the memory limit), or run out of instructions
+lanes tests/instMem-lockstep.txt tests/lockstep.lanes "--max-instructions=1000 --mem-limit=4K"
+
+# the result cache, on a counted loop the block engine skips
+cached tests/instMem-count-up.txt
+
+# the models and modes whose reports are checked line by line, one
+# tests/X.expected transcript each
+for file in tests/*.expected; do
+    transcript "$file"
+done
+
+echo "$checks checks, $failures failed"
+[ $failures -eq 0 ]
@@ -0,0 +1,145 @@
+// Checks the Simulator library API as an embedder links it (libcpusim.a):
+// results on every engine across resets, run budgets, the halt reasons,
+// the register and memory accessors, and that steady-state load(), reset()
+// and run() make no heap allocations on the stage, threaded and block
+// engines.
+//
+// usage: build/simulator_test      (built and run by make check)
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "Simulator.h"
+
+// Every heap allocation in the process goes through these
+static unsigned long allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size != 0 ? size : 1);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+static unsigned checks = 0, failures = 0;
+
+static void check(bool ok, const char *engine, const char *what, long got, long expected) {
+    checks++;
+    if (!ok) {
+        printf("FAIL %s: %s is %ld, expected %ld\n", engine, what, got, expected);
+        failures++;
+    }
+}
+
+static void expect(const char *engine, const char *what, long got, long expected) {
+    check(got == expected, engine, what, got, expected);
+}
+
+// Sums x10 down to 1 into x11, keeping the running sum in a word at 0x10000,
+// and loads it back into x10:
+//     0:  lui  x5 0x10
+//     4:  addi x11 x0 0
+//     8:  add  x11 x11 x10     <loop>
+//     c:  sw   x11 0 x5
+//    10:  addi x10 x10 -1
+//    14:  bne  x10 x0 -12 <loop>
+//    18:  lw   x10 0 x5
+//    1c:  .word 0x0
+static const uint32_t SUM[] = {
+    0x000102b7, 0x00000593, 0x00a585b3, 0x00b2a023,
+    0xfff50513, 0xfe051ae3, 0x0002a503, 0x00000000
+};
+
+static const uint32_t SUM_LOOP_INSTRUCTIONS = 4;
+
+static void load_words(Simulator &sim, const uint32_t *words, size_t count) {
+    uint8_t image[64];
+    for (size_t i = 0; i < count; i++) {
+        for (unsigned b = 0; b < 4; b++)
+            image[4 * i + b] = (uint8_t)(words[i] >> (8 * b));
+    }
+    sim.load(image, 4 * count);
+}
+
+// One reset and run of SUM with x10 = n; checks the result
+static void run_sum(Simulator &sim, const char *engine, int32_t n) {
+    sim.reset();
+    sim.setReg(10, n);
+    expect(engine, "status after run", sim.run(1000000), SIM_ZERO_INSTRUCTION);
+    expect(engine, "a0", sim.reg(10), n * (n + 1) / 2);
+    expect(engine, "a1", sim.reg(11), n * (n + 1) / 2);
+    expect(engine, "word at 0x10000", sim.read32(0x10000), n * (n + 1) / 2);
+    expect(engine, "instructions", (long)sim.instructions(), 3 + SUM_LOOP_INSTRUCTIONS * n);
+}
+
+static void test_engine(EngineKind kind, const char *engine, bool allocationFree) {
+    EngineOptions options;
+    options.kind = kind;
+    Simulator sim(options);
+    expect(engine, "status before load", sim.status(), SIM_NO_PROGRAM);
+    load_words(sim, SUM, sizeof(SUM) / sizeof(SUM[0]));
+
+    // budgets: a run that stops early continues where it left off
+    sim.setReg(10, 10);
+    expect(engine, "status after 5 instructions", sim.run(5), SIM_RUNNING);
+    expect(engine, "instructions after run(5)", (long)sim.instructions(), 5);
+    expect(engine, "status after the rest", sim.run(1000000), SIM_ZERO_INSTRUCTION);
+    expect(engine, "a0 after two runs", sim.reg(10), 55);
+    expect(engine, "run after halting", sim.run(10), SIM_ZERO_INSTRUCTION);
+
+    // accessors: x0 stays zero, stores over code are picked up
+    sim.reset();
+    sim.setReg(0, 7);
+    expect(engine, "x0", sim.reg(0), 0);
+    sim.setReg(10, 3);
+    sim.write32(0x04, 0x06400593); // addi x11 x0 100
+    expect(engine, "status with patched code", sim.run(1000000), SIM_ZERO_INSTRUCTION);
+    expect(engine, "a1 with patched code", sim.reg(11), 106);
+    sim.reset();
+    expect(engine, "byte at 0x04 after reset", sim.read8(0x04), 0x93);
+    sim.setPC(0x40);
+    expect(engine, "status past the end", sim.run(10), SIM_PAST_END);
+
+    // warm up, then steady state must not allocate
+    for (int n = 1; n <= 20; n++)
+        run_sum(sim, engine, n);
+    unsigned long before = allocations;
+    for (int n = 1; n <= 100; n++)
+        run_sum(sim, engine, n % 20 + 1);
+    load_words(sim, SUM, sizeof(SUM) / sizeof(SUM[0]));
+    run_sum(sim, engine, 20);
+    if (allocationFree)
+        expect(engine, "allocations in 101 load/reset/run cycles", (long)(allocations - before), 0);
+}
+
+int main() {
+    test_engine(ENGINE_STAGE, "stage", true);
+    test_engine(ENGINE_THREADED, "threaded", true);
+    test_engine(ENGINE_BLOCK, "block", true);
+    // the JIT allocates when it compiles blocks
+    test_engine(ENGINE_JIT, "jit", false);
+    printf("%u checks, %u failed\n", checks, failures);
+    return failures == 0 ? 0 : 1;
+}
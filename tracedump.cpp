@@ -0,0 +1,72 @@
+#include "CPU.h"
+#include "BinaryTrace.h"
+
+#include <iostream>
+#include <cstring>
+#include <string>
+using namespace std;
+
+// Prints a binary trace written by cpusim --trace-file in the same text
+// form --trace prints while running (the decode and execute details are
+// not recorded, so those sections are left out)
+int main(int argc, char* argv[])
+{
+	// command line: tracedump [--limit=N] <trace>
+	const char *filename = NULL;
+	uint64_t limit = UINT64_MAX;
+	for (int a = 1; a < argc; a++) {
+		if (strncmp(argv[a], "--limit=", 8) == 0) {
+			limit = strtoull(argv[a] + 8, NULL, 10);
+		} else if (argv[a][0] == '-') {
+			cerr << "unknown option " << argv[a] << endl;
+			return -1;
+		} else {
+			filename = argv[a];
+		}
+	}
+	if (filename == NULL) {
+		cerr << "usage: tracedump [--limit=N] <trace>" << endl;
+		return -1;
+	}
+
+	TraceReader reader;
+	string error;
+	if (!reader.open(filename, error)) {
+		cerr << error << endl;
+		return 1;
+	}
+
+	// only used to disassemble instruction words
+	static const char noProgram[4096] = { 0 };
+	CPU disassembler(noProgram);
+
+	TraceEntry e;
+	uint64_t count = 0;
+	while (count < limit && reader.next(e)) {
+		count++;
+		cout << "================== CYCLE " << e.cycle << " ==================" << "\n";
+		cout << "PC: 0x" << hex << e.pc << dec << "\n";
+		char word[9];
+		snprintf(word, sizeof(word), "%08x", e.instruction);
+		cout << "Instruction: 0x" << word << "  [" << disassembler.disassemble(e.instruction) << "]" << "\n";
+		if (e.flags & TRACE_MEM_READ) {
+			cout << "--- MEMORY ---" << "\n";
+			cout << "Reading from address " << (int32_t)e.address << ", Value: " << (int32_t)e.memValue << "\n";
+		}
+		if (e.flags & TRACE_MEM_WRITE) {
+			cout << "--- MEMORY ---" << "\n";
+			cout << "Writing " << (int32_t)e.memValue << " to address " << (int32_t)e.address << "\n";
+		}
+		if (e.flags & TRACE_REG_WRITE) {
+			cout << "--- WRITE BACK ---" << "\n";
+			cout << "Writing " << (int32_t)e.wbData << " to register x" << (int)e.rd << "\n";
+		}
+		cout << "\n";
+	}
+	cout.flush();
+	if (!reader.error().empty()) {
+		cerr << filename << ": " << reader.error() << endl;
+		return 1;
+	}
+	return 0;
+}